@@ -17,6 +17,10 @@
 #include "rv/intrinsics.h"
 #include "llvm/ADT/SmallVector.h"
 
+#include <map>
+#include <string>
+#include <tuple>
+
 namespace rv {
 
 class ListResolver;
@@ -25,6 +29,34 @@ class PlatformInfo {
   void registerDeclareSIMDFunction(llvm::Function & F);
   void addIntrinsicMappings();
 
+  // resolver chain query (argument shapes in serialized form)
+  struct ResolverQuery {
+    std::string funcName;
+    llvm::FunctionType * scaFuncTy;
+    std::string argShapes;
+    int vectorWidth;
+    bool hasPredicate;
+    int scaFuncState; // \p funcName in the module: 0 (absent), 1 (declared), 2 (defined)
+
+    bool operator<(const ResolverQuery & o) const {
+      return std::tie(funcName, scaFuncTy, argShapes, vectorWidth, hasPredicate, scaFuncState) <
+             std::tie(o.funcName, o.scaFuncTy, o.argShapes, o.vectorWidth, o.hasPredicate, o.scaFuncState);
+    }
+  };
+  ResolverQuery makeQuery(llvm::StringRef funcName, llvm::FunctionType & scaFuncTy,
+                          const VectorShapeVec & argShapes, int vectorWidth, bool hasPredicate) const;
+
+  // position of the first resolver service that answers a query (-1 if none does).
+  // Dropped whenever the mappings or the resolver chain change. Queries are keyed by the state of the
+  // scalar function in the module, so a function that is defined later is not stuck with an old "not found".
+  mutable std::map<ResolverQuery, int> resolverCache;
+  unsigned resolverCacheEpoch; // bumped on every invalidation
+  void invalidateResolverCache() { resolverCache.clear(); ++resolverCacheEpoch; }
+  // remember \p serviceIdx unless the cache was invalidated since \p queryEpoch
+  void cacheResolverQuery(const ResolverQuery & query, int serviceIdx, unsigned queryEpoch) const {
+    if (queryEpoch == resolverCacheEpoch) resolverCache[query] = serviceIdx;
+  }
+
 public:
   PlatformInfo(llvm::Module &mod, llvm::TargetTransformInfo *TTI,
                llvm::TargetLibraryInfo *TLI);
@@ -36,6 +68,11 @@ public:
   llvm::TargetTransformInfo *getTTI();
   llvm::TargetLibraryInfo *getTLI();
 
+  // "target-cpu" and "target-features" of \p F, the function the TTI belongs to
+  // (identifies the target of generated code across functions and compilations)
+  void setTargetAttributes(const llvm::Function & F);
+  const std::string & getTargetAttributes() const { return targetAttributes; }
+
   // insert a new function resolver into the resolver chain
   void addResolverService(std::unique_ptr<ResolverService>&& newResolver, bool givePrecedence);
 
@@ -46,6 +83,13 @@ public:
               int vectorWidth,
               bool hasPredicate) const;
 
+  // whether \p getResolver would succeed (cheaper than requesting the resolver).
+  bool hasResolver(llvm::StringRef funcName,
+                   llvm::FunctionType & scaFuncTy,
+                   const VectorShapeVec & argShapes,
+                   int vectorWidth,
+                   bool hasPredicate) const;
+
   llvm::Module &getModule() const { return mod; }
   llvm::LLVMContext &getContext() const { return mod.getContext(); }
 
@@ -80,6 +124,7 @@ private:
   llvm::Module &mod;
   llvm::TargetTransformInfo *mTTI;
   llvm::TargetLibraryInfo *mTLI;
+  std::string targetAttributes;
   std::vector<std::unique_ptr<ResolverService>> resolverServices;
   ListResolver * listResolver;
 };
@@ -10,8 +10,12 @@
 #define RV_BRANCH_ESTIMATE_H
 
 #include "rv/PlatformInfo.h"
+#include "rv/analysis/costModel.h"
 #include <llvm/ADT/SmallSet.h>
 
+#include <map>
+#include <memory>
+
 namespace llvm {
 class LoopInfo;
 class DominatorTree;
@@ -21,6 +25,7 @@ class BranchProbabilityInfo;
 namespace rv {
 class MaskExpander;
 class VectorizationInfo;
+struct Config;
 
 class BranchEstimate {
   VectorizationInfo & vecInfo;
@@ -29,16 +34,17 @@ class BranchEstimate {
   llvm::DominatorTree & domTree;
   llvm::LoopInfo & loopInfo;
   llvm::BranchProbabilityInfo * pbInfo;
+  std::unique_ptr<CostModel> costModel; // only available with TTI
+
+  // lane ratios of the region blocks (computed once on first use)
+  std::map<llvm::BasicBlock*, double> dispersion;
+  bool hasDispersion;
+
+  const std::map<llvm::BasicBlock*, double> & getDispersion();
 
 public:
-  BranchEstimate(VectorizationInfo & _vecInfo, PlatformInfo & _platInfo, MaskExpander & _maskEx, llvm::DominatorTree & _domTree, llvm::LoopInfo & _loopInfo, llvm::BranchProbabilityInfo * _pbInfo)
-  :vecInfo(_vecInfo)
-  ,platInfo(_platInfo)
-  ,maskEx(_maskEx)
-  ,domTree(_domTree)
-  ,loopInfo(_loopInfo)
-  ,pbInfo(_pbInfo)
-  {}
+  BranchEstimate(Config & config, VectorizationInfo & _vecInfo, PlatformInfo & _platInfo, MaskExpander & _maskEx, llvm::DominatorTree & _domTree, llvm::LoopInfo & _loopInfo, llvm::BranchProbabilityInfo * _pbInfo);
+  ~BranchEstimate();
 
   bool CheckLegality (llvm::BranchInst & branch, bool & onTrueLegal, bool & onFalseLegal);
 
@@ -62,6 +68,22 @@ public:
                            llvm::SmallSet<llvm::BasicBlock*, 32> & seenBlocks);
 
   size_t getBlockScore(llvm::BasicBlock & entry);
+
+  // vector cost of the dominance region of @entry (cost model units, falls back to the region score without TTI)
+  double getDomRegionCost(llvm::BasicBlock & entry);
+
+  // probability that no lane enters @block (from the mask profile if available,
+  // otw lanes are assumed to branch independently with the dispersed block ratio,
+  // or all together if @coherent)
+  double getAllFalseProb(llvm::BasicBlock & block, const std::map<llvm::BasicBlock*, double> & dispMap, bool coherent = false) const;
+
+  // cost of testing a mask for all-false and branching on the result
+  double getSkipOverhead() const;
+
+  // expected savings per execution of @branch if the dominance region of successor @succIdx is skipped whenever no lane enters it
+  // (<= 0 if that does not pay off). The all-false probability of the successor is returned in @oAllFalseProb.
+  // @coherent: the lanes of @branch mostly agree (eg affine conditions).
+  double getSkipGain(llvm::BranchInst & branch, unsigned succIdx, double & oAllFalseProb, bool coherent = false);
 };
 
 int GetNumPredecessors(llvm::BasicBlock & block);
@@ -0,0 +1,49 @@
+//===- rv/analysis/MaskProfile.h - measured lane activity of region blocks --*- C++ -*-===//
+//
+// Part of the RV Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef RV_ANALYSIS_MASKPROFILE_H
+#define RV_ANALYSIS_MASKPROFILE_H
+
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace rv {
+
+// Active-lane histograms of region blocks, as dumped by the mask profiling runtime (runtime/maskProfile.c).
+// Entries are keyed by the name of the scalar function, the region id and the block id
+// (see VectorizationInfo::assignProfileIds).
+class MaskProfile {
+  using Key = std::tuple<std::string, unsigned, unsigned>;
+  // histogram[k] = number of executions with k active lanes
+  std::map<Key, std::vector<uint64_t>> histograms;
+
+public:
+  // read a profile file (entries of repeated runs are accumulated)
+  bool load(llvm::StringRef filePath);
+
+  // the profile named by RV_MASK_PROFILE_USE (loaded once per process, nullptr if unset or unreadable)
+  static const MaskProfile * get();
+
+  // the histogram of block @blockId in region @regionId of @funcName (nullptr if not profiled)
+  const std::vector<uint64_t> * getHistogram(llvm::StringRef funcName, unsigned regionId, unsigned blockId) const;
+
+  // number of executions of the block (with any number of active lanes)
+  uint64_t getExecutionCount(llvm::StringRef funcName, unsigned regionId, unsigned blockId) const;
+  // number of executions of the block with at least one active lane
+  uint64_t getActiveCount(llvm::StringRef funcName, unsigned regionId, unsigned blockId) const;
+};
+
+} // namespace rv
+
+#endif // RV_ANALYSIS_MASKPROFILE_H
@@ -0,0 +1,64 @@
+//===- rv/analysis/MemoryAccessAnalysis.h - address groups of memory accesses --*- C++ -*-===//
+//
+// Part of the RV Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef RV_ANALYSIS_MEMORYACCESSANALYSIS_H
+#define RV_ANALYSIS_MEMORYACCESSANALYSIS_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/PassManager.h>
+
+#include <vector>
+
+namespace rv {
+
+// Groups the loads and stores of a function by their address.
+// The addresses of all accesses in a group have constant byte offsets to each other
+// (eg the fields of a struct or neighbouring array elements in the same iteration).
+class MemoryAccessAnalysis {
+  struct AccessInfo {
+    unsigned groupIdx;
+    int64_t offset; // byte offset from the lowest address in the group
+  };
+  llvm::DenseMap<const llvm::Instruction *, AccessInfo> accessInfos;
+  std::vector<std::vector<const llvm::Instruction *>> groupAccesses;
+
+public:
+  MemoryAccessAnalysis(const llvm::Function & F, llvm::ScalarEvolution & SE);
+
+  size_t getNumGroups() const { return groupAccesses.size(); }
+
+  // the group of \p inst and its byte offset from the lowest address in the group (false if \p inst is not a load/store of the function)
+  bool getAccessGroup(const llvm::Instruction & inst, unsigned & oGroupIdx, int64_t & oOffset) const;
+
+  // all loads and stores of group \p groupIdx (in block order)
+  const std::vector<const llvm::Instruction *> & getGroupAccesses(unsigned groupIdx) const { return groupAccesses[groupIdx]; }
+
+  // whether the addresses of \p A and \p B have a constant distance (oDelta = addr(A) - addr(B))
+  bool getConstantDistance(const llvm::Instruction & A, const llvm::Instruction & B, int64_t & oDelta) const;
+
+  void print(llvm::raw_ostream & out) const;
+  void dump() const;
+};
+
+// Provides the MemoryAccessAnalysis of a function (cached until its function changes).
+class MemoryAccessAnalysisPass : public llvm::AnalysisInfoMixin<MemoryAccessAnalysisPass> {
+  friend llvm::AnalysisInfoMixin<MemoryAccessAnalysisPass>;
+  static llvm::AnalysisKey Key;
+
+public:
+  using Result = MemoryAccessAnalysis;
+
+  static llvm::StringRef name() { return "rv-memory-access"; }
+  Result run(llvm::Function & F, llvm::FunctionAnalysisManager & FAM);
+};
+
+} // namespace rv
+
+#endif // RV_ANALYSIS_MEMORYACCESSANALYSIS_H
@@ -12,11 +12,14 @@
 #include <cstddef>
 
 namespace llvm {
+  struct Align;
   class Instruction;
   class Type;
   class BasicBlock;
   class TargetTransformInfo;
   class Function;
+  class Value;
+  class raw_ostream;
 }
 
 namespace rv {
@@ -27,6 +30,48 @@ class VectorizationInfo;
 class Region;
 
 struct VectorMapping;
+class VectorShape;
+
+// estimated execution cost of a region at a given vector width
+struct RegionCost {
+  size_t vectorWidth;
+  double scalarCost; // cost of @vectorWidth scalar iterations of the region
+  double vectorCost; // cost of a single vector iteration of the region
+
+  // expensive operations in the vector code
+  size_t numGathers;
+  size_t numScatters;
+  size_t numInterleaved; // non-unit constant stride accesses (interleaved groups or gathers/scatters)
+  size_t numMaskedAccesses; // contiguous accesses under a varying predicate
+  size_t numCascadedCalls;
+  size_t numBlends; // selects for phis in divergent join blocks
+
+  RegionCost(size_t _vectorWidth = 1)
+  : vectorWidth(_vectorWidth)
+  , scalarCost(0.0)
+  , vectorCost(0.0)
+  , numGathers(0)
+  , numScatters(0)
+  , numInterleaved(0)
+  , numMaskedAccesses(0)
+  , numCascadedCalls(0)
+  , numBlends(0)
+  {}
+
+  // expected speedup of the vector code over the scalar code (> 1.0 is good)
+  double getSpeedup() const { return vectorCost > 0.0 ? scalarCost / vectorCost : 1.0; }
+  bool isProfitable() const { return vectorWidth > 1 && vectorCost < scalarCost; }
+
+  void print(llvm::raw_ostream & out) const;
+  void dump() const;
+};
+
+// lowerings of varying (gather/scatter) memory accesses
+enum class VaryingLowering {
+  Intrinsic, // llvm.masked.gather/scatter (scalarized by the backend if not legal)
+  Blend,     // branch-free lane accesses, inactive lanes access a dummy slot
+  Cascade    // one conditional block per lane (out-of-line helper)
+};
 
 class CostModel {
   PlatformInfo & platInfo;
@@ -35,14 +80,26 @@ class CostModel {
 
   bool needsReplication(const llvm::Instruction & inst) const;
 
+  // the shape of @val (@vecInfo may be null, in which case all in-region values are assumed to be varying)
+  VectorShape getShape(const llvm::Value & val, const VectorizationInfo * vecInfo) const;
+  // whether @block will execute under a varying predicate
+  bool hasVaryingPredicate(const llvm::BasicBlock & block, const VectorizationInfo * vecInfo) const;
+
+  // cost of scalarizing @inst into @width scalar copies
+  double getReplicationCost(const llvm::Instruction & inst, size_t width) const;
+  // cost of a vector load/store at @width (counts gathers/scatters, etc in @cost)
+  double getMemoryCost(const llvm::Instruction & inst, size_t width, const VectorizationInfo * vecInfo, RegionCost & cost) const;
+  // cost of a vector call at @width
+  double getCallCost(const llvm::Instruction & inst, size_t width, const VectorizationInfo * vecInfo, RegionCost & cost) const;
+
 public:
   CostModel(PlatformInfo & _platInfo, Config & _config);
 
   // whether this is an vectorizable LLVM intrinsic
   bool IsVectorizableFunction(llvm::Function & Callee) const;
 
-  // pick a width for @inst
-  size_t pickWidthForInstruction(const llvm::Instruction & inst, size_t maxWidth) const;
+  // pick a width for @inst (@mayBePredicated: @inst may execute under a non-trivial mask)
+  size_t pickWidthForInstruction(const llvm::Instruction & inst, size_t maxWidth, bool mayBePredicated = true) const;
 
   // pick a width for @type
   size_t pickWidthForType(const llvm::Type & type, size_t maxWidth) const;
@@ -51,8 +108,25 @@ public:
   size_t pickWidthForMapping(const VectorMapping & mapping) const;
 
   // pick a vector width for a single block/the region
-  size_t pickWidthForBlock(const llvm::BasicBlock & block, size_t maxWidth) const;
+  size_t pickWidthForBlock(const llvm::BasicBlock & block, size_t maxWidth, bool mayBePredicated = true) const;
   size_t pickWidthForRegion(const Region & region, size_t maxWidth) const;
+
+  // TTI cost of a single scalar execution of @inst
+  double getScalarCost(const llvm::Instruction & inst) const;
+
+  // TTI cost of the vectorized @inst at @width (accounts expensive operations in @cost)
+  double getVectorCost(const llvm::Instruction & inst, size_t width, const VectorizationInfo * vecInfo, RegionCost & cost) const;
+
+  // cheapest lowering for a varying load/store of @width x @accessTy (its cost is returned in @oCost, if not null)
+  VaryingLowering pickVaryingLowering(llvm::Type & accessTy, unsigned addrSpace, llvm::Align alignment, size_t width,
+                                      bool isStore, bool needsMask, double * oCost = nullptr) const;
+
+  // estimate the scalar and vector cost of the region at @width
+  RegionCost estimateRegionCost(const Region & region, size_t width, const VectorizationInfo * vecInfo) const;
+
+  // pick the most profitable width <= @maxWidth for @region (returns 1 if vectorization does not pay off)
+  // the estimate for the picked width is returned in @oCost (if not null)
+  size_t pickProfitableWidth(const Region & region, size_t maxWidth, const VectorizationInfo * vecInfo, RegionCost * oCost = nullptr) const;
 };
 
 }
@@ -58,6 +58,9 @@ namespace rv {
     // minimum dependence distance between two loop iterations
     Optional<iter_t> minDepDist;
 
+    // treatment of the remainder iterations (rv::Config::EpilogueMode)
+    Optional<int> epilogueMode;
+
     llvm::raw_ostream& print(llvm::raw_ostream & out) const;
     void dump() const;
   };
@@ -11,6 +11,8 @@
 
 #include <llvm/Support/raw_ostream.h>
 
+#include <string>
+
 namespace llvm {
   class Function;
 }
@@ -42,6 +44,9 @@ struct Config {
   bool useScatterGatherIntrinsics;
   bool enableMaskedMove;
   bool useSafeDivisors; // blend-in safe divisors to eliminate spurious arithmetic exceptions
+  bool useMaskedMath; // call masked math functions in divergent code (inactive lanes do not raise spurious FP exceptions)
+  bool useInterleavedAccesses; // combine strided accesses to the members of a record into wide loads/stores + shuffles
+  bool enableMaskProfiling; // count the active lanes of every region block at runtime (see runtime/maskProfile.c)
 
 // optimization flags
   bool enableSplitAllocas;
@@ -51,6 +56,7 @@ struct Config {
   bool enableHeuristicBOSCC;
   bool enableCoherentIF;
   bool enableOptimizedBlends;
+  bool enableCostModel; // pick vector widths by comparing TTI cost estimates (reject unprofitable regions)
 
 // greedy inter-procedural vectorizatoin
   bool enableGreedyIPV;
@@ -69,9 +75,28 @@ struct Config {
   bool useNEON;
   bool useADVSIMD;
 
+  // widest enabled SIMD ISA (ve, avx512, avx2, avx, sse, advsimd, neon or none)
+  std::string getTargetISA() const;
+
+  // comma-separated ISAs that the loop vectorizer runs for ("all" for any target)
+  std::string loopVecTargets;
+  bool isLoopVecTarget() const;
+
 // code gen options
   bool useAVL; // generate AVL loops
 
+  // emit additional loop versions at half the width (down to this width) for
+  // loops with short trip counts (0 = single vector loop version)
+  int minVersionWidth;
+
+  // how to execute the remaining iterations of a vectorized loop
+  enum EpilogueMode {
+    EM_Scalar = 0, // scalar remainder loop
+    EM_HalfWidth = 1, // vector loop at half the width (followed by the scalar loop)
+    EM_Masked = 2, // single tail-predicated vector iteration
+  };
+  EpilogueMode epilogueMode;
+
   void print(llvm::raw_ostream&) const;
 
   // create default configuration (RV_ARCH env var)
@@ -82,6 +107,7 @@ struct Config {
 };
 
 std::string to_string(Config::VAMethod vam);
+std::string to_string(Config::EpilogueMode em);
 
 }
 
@@ -10,6 +10,7 @@
 
 
 #include "llvm/Pass.h"
+#include "llvm/ADT/SmallPtrSet.h"
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "rv/transform/remTransform.h"
@@ -19,7 +20,14 @@
 #include "llvm/IR/PassManager.h"
 #include "rv/transform/remTransform.h"
 #include "rv/rv.h"
+#include "rv/analysis/costModel.h"
+#include "rv/region/Region.h"
+#include "rv/vectorizationInfo.h"
 #include "rv/legacy/passes.h"
+#include "rv/passes/ModuleContext.h"
+
+#include <map>
+#include <vector>
 
 namespace llvm {
   class OptimizationRemarkEmitter;
@@ -38,9 +46,13 @@ namespace rv {
 
 class LoopVectorizer {
 public:
+  // \p FAM is the analysis manager of the enclosing pass manager (or the
+  // private one of \p ModuleCtx). \p ModuleCtx provides the PlatformInfo.
   LoopVectorizer(llvm::Function &F, llvm::TargetTransformInfo &TTI,
                  llvm::TargetLibraryInfo &TLI,
-                 llvm::OptimizationRemarkEmitter &ORE);
+                 llvm::OptimizationRemarkEmitter &ORE,
+                 llvm::FunctionAnalysisManager &FAM,
+                 ModuleContext &ModuleCtx);
 
   bool run();
 
@@ -59,8 +71,11 @@ private:
   // cost estimation
   struct LoopScore {
     LoopScore(bool HasSIMDAnnotation = false)
-        : Score(0), HasSIMDAnnotation(HasSIMDAnnotation) {}
-    unsigned Score;
+        : Score(0), Speedup(1.0), HasEstimate(false),
+          HasSIMDAnnotation(HasSIMDAnnotation) {}
+    unsigned Score; // expected speedup in percent (0 if not estimated)
+    double Speedup; // expected speedup (only valid if HasEstimate)
+    bool HasEstimate; // the cost model produced a speedup estimate
     bool HasSIMDAnnotation;
   };
 
@@ -70,6 +85,9 @@ private:
     , VectorWidth(0)
     , DepDist(0)
     , TripAlign(0)
+    , Epilogue(Config::EM_Scalar)
+    , Cost()
+    , Variant("main")
     {}
 
     llvm::BasicBlock *Header;
@@ -77,17 +95,52 @@ private:
 
     iter_t DepDist; // minimal dependence distance between loop iterations
     iter_t TripAlign; // multiple of loop trip count
+
+    Config::EpilogueMode Epilogue; // execution of the remainder iterations
+
+    RegionCost Cost; // cost model estimate (vectorWidth <= 1 if not estimated)
+    const char *Variant; // role of this loop copy (main, version, epilogue)
   };
 
   /// \return true if legal (in that case LJ&LS get populated)
   bool scoreLoop(LoopJob& LJ, LoopScore& LS, llvm::Loop & L);
 
+  // speedup of the vectorized loop of \p LJ over the scalar loop \p L at the
+  // expected trip count (includes the remainder iterations)
+  double getExpectedSpeedup(llvm::Loop &L, const LoopJob &LJ);
+
+  struct ScoredLoop {
+    LoopJob LJ;
+    LoopScore LS;
+    bool Legal;
+    double Weight; // frequency-weighted scalar cost of the loop
+  };
+
+  // loops picked for vectorization in a loop nest
+  struct NestChoice {
+    NestChoice() : Saved(0.0), Estimated(true), HasSIMDAnnotation(false) {}
+    double Saved; // expected fraction of the nest's execution time saved
+    bool Estimated; // all picked loops have a cost estimate
+    bool HasSIMDAnnotation; // some picked loop has a SIMD annotation
+    std::vector<llvm::Loop *> Loops;
+  };
+
+  // pick the disjoint loops in the nest of \p L that save the most time
+  // (relative to \p NestWeight, the weight of the outermost loop)
+  NestChoice selectNestLoops(llvm::Loop &L, double NestWeight,
+                             std::map<llvm::Loop *, ScoredLoop> &Scores);
+
+  // record why \p L stays scalar in the vectorization report (RV_REPORT_JSON)
+  void reportRejection(llvm::Loop &L, const llvm::DebugLoc &DL,
+                       llvm::StringRef Reason,
+                       const RegionCost *Cost = nullptr);
+
   // Step 1: Decide which loops to vectorize.
   // Step 2: Prepare all loops for vectorization.
   // Step 3: Vectorize the regions.
   bool collectLoopJobs(llvm::LoopInfo & LI);
   std::vector<LoopJob> LoopsToPrepare;
-  bool prepareLoopVectorization(); // TODO mark this function as un-vectorizable (or prepare a holdout copy)
+  bool prepareLoopVectorization(bool &Changed);
 
   struct LoopVectorizerJob {
     LoopJob LJ;
@@ -95,24 +148,45 @@ private:
     llvm::Value *EntryAVL; // loop entry AVL (FIXME)
   };
   std::vector<LoopVectorizerJob> LoopsToVectorize;
+
+  // prepare the loop of \p LJ and its versions/epilogue (jobs go to
+  // \p Prepared). On failure, \p FailReason is set. \p Modified tells
+  // whether the function was left half-transformed (rolled back by
+  // prepareLoopVectorization).
+  bool prepareLoop(LoopJob &LJ, std::vector<LoopVectorizerJob> &Prepared,
+                   std::string &FailReason, bool &Modified);
   bool vectorizeLoopRegions();
   bool vectorizeLoop(LoopVectorizerJob& LVJob);
 
-  llvm::FunctionAnalysisManager FAM; // private pass infrastructure
+  llvm::FunctionAnalysisManager &FAM;
+  ModuleContext &ModuleCtx;
   std::unique_ptr<VectorizerInterface> vectorizer;
 
   bool canVectorizeLoop(llvm::Loop &L);
   bool hasVectorizableLoopStructure(llvm::Loop &L, bool EmitRemarks);
 
+  // speculatively run the VectorizationAnalysis on the unmodified loop \p L
+  // (at \p VectorWidth) to inform the cost model. This does not alter the IR.
+  std::unique_ptr<VectorizationInfo>
+  analyzeLoopShapes(llvm::Loop &L, Region &LoopRegion, unsigned VectorWidth);
+
   // convert L into a vectorizable loop
   // this will create a new scalar loop that can be vectorized directly with RV
-  PreparedLoop transformToVectorizableLoop(llvm::Loop &L, int VectorWidth, int tripAlign, ValueSet & uniformOverrides);
+  PreparedLoop transformToVectorizableLoop(llvm::Loop &L, int VectorWidth, int tripAlign, ValueSet & uniformOverrides, bool UseTailPredication);
 
   bool canAdjustTripCount(llvm::Loop &L, int VectorWidth, int TripCount);
 
   // return the trip count of L if it is constant. Otw, returns -1
   int getTripCount(llvm::Loop &L);
 
+  // widths of the additional loop versions (in descending order) that run
+  // before the scalar remainder loop (includes the half-width epilogue)
+  std::vector<unsigned> getVersionWidths(const LoopJob &LJ) const;
+
+  // whether the remainder iterations of \p LJ execute in a tail-predicated
+  // vector loop
+  bool hasMaskedEpilogue(const LoopJob &LJ) const;
+
   // the trip count of the loop is always a multiple of this value
   // returns 1 for loop w/o known alignment
   int getTripAlignment(llvm::Loop & L);
@@ -134,10 +208,15 @@ public:
   static char ID;
   LoopVectorizerLegacyPass() : llvm::FunctionPass(ID) {}
 
+  bool doInitialization(llvm::Module &M) override;
+  bool doFinalization(llvm::Module &M) override;
   bool runOnFunction(llvm::Function &F) override;
 
   /// Register all analyses and transformation required.
   void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
+
+private:
+  std::unique_ptr<ModuleContext> ModuleCtx; // from doInitialization to doFinalization
 };
 
 struct LoopVectorizerWrapperPass
@@ -148,6 +227,14 @@ public:
   static llvm::StringRef name() { return "rv::LoopVectorizer"; }
   llvm::PreservedAnalyses run(llvm::Function &F,
                               llvm::FunctionAnalysisManager &FAM);
+
+private:
+  // the cached ModuleContextAnalysis if the pipeline requires it, otherwise
+  // a context that this pass keeps for one sweep over the module
+  ModuleContext &getModuleContext(llvm::Function &F,
+                                  llvm::FunctionAnalysisManager &FAM);
+  std::unique_ptr<ModuleContext> SweepCtx;
+  llvm::SmallPtrSet<const llvm::Function *, 16> SweepFuncs;
 };
 
 } // namespace rv
@@ -0,0 +1,118 @@
+//===- rv/passes/ModuleContext.h - per-module state of RV's passes --*- C++ -*-===//
+//
+// Part of the RV Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+
+#ifndef RV_PASSES_MODULECONTEXT_H
+#define RV_PASSES_MODULECONTEXT_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/ValueHandle.h"
+
+#include "rv/PlatformInfo.h"
+#include "rv/config.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class LLVMContext;
+  class Module;
+  class TargetLibraryInfo;
+  class TargetTransformInfo;
+}
+
+namespace rv {
+
+// State that RV's function passes share across the functions of a module.
+// There is one PlatformInfo (and resolver chain) per function configuration
+// (target ISA and RV options decide the resolvers) instead of one per
+// function. The SLEEF modules stay parsed as long as the context lives.
+class ModuleContext {
+public:
+  ModuleContext(llvm::Module &M);
+  ModuleContext(ModuleContext &&Other);
+  ModuleContext(const ModuleContext &) = delete;
+  ModuleContext &operator=(const ModuleContext &) = delete;
+  ~ModuleContext();
+
+  llvm::Module &getModule() const { return *M; }
+
+  // Never invalidated: function passes read it through the outer analysis
+  // proxy, which only hands out results that cannot be invalidated. The
+  // context rebuilds its PlatformInfos itself when functions are added or
+  // deleted; pipelines drop its state explicitly with reset()
+  // (invalidate<rv-module-context>).
+  bool invalidate(llvm::Module &, const llvm::PreservedAnalyses &,
+                  llvm::ModuleAnalysisManager::Invalidator &);
+
+  // drop all PlatformInfos and the private analysis manager
+  void reset();
+
+  // the PlatformInfo for functions configured as \p RVConfig (its resolver
+  // chain is set up on first use). Its TTI/TLI are set to \p TTI and \p TLI.
+  // All PlatformInfos are rebuilt once a function of the module was deleted
+  // (eg by the inliner in a CGSCC pipeline), they may refer to it.
+  PlatformInfo &getPlatformInfo(const Config &RVConfig,
+                                llvm::TargetTransformInfo &TTI,
+                                llvm::TargetLibraryInfo &TLI);
+
+  // analysis manager for pass managers that do not provide one (legacy PM).
+  // Users have to clear the results of a function when they are done with it.
+  llvm::FunctionAnalysisManager &getPrivateFAM();
+
+private:
+  // flags the context as stale when its function is deleted
+  class FunctionWatch final : public llvm::CallbackVH {
+    std::shared_ptr<bool> Stale;
+    void deleted() override {
+      *Stale = true;
+      llvm::CallbackVH::deleted();
+    }
+
+  public:
+    FunctionWatch(llvm::Function &F, std::shared_ptr<bool> Stale)
+        : llvm::CallbackVH(&F), Stale(std::move(Stale)) {}
+  };
+  void watchFunctions();
+
+  llvm::Module *M;
+  llvm::LLVMContext *Ctx; // null once moved from
+  std::map<std::string, std::unique_ptr<PlatformInfo>> PlatInfos;
+  std::unique_ptr<llvm::FunctionAnalysisManager> PrivateFAM;
+  std::shared_ptr<bool> Stale; // a watched function was deleted
+  std::vector<FunctionWatch> Watches;
+};
+
+// Provides the ModuleContext to function passes through the
+// ModuleAnalysisManagerFunctionProxy. Pipelines should require it right
+// before RV's function passes (require<rv-module-context>).
+class ModuleContextAnalysis
+    : public llvm::AnalysisInfoMixin<ModuleContextAnalysis> {
+  friend llvm::AnalysisInfoMixin<ModuleContextAnalysis>;
+  static llvm::AnalysisKey Key;
+
+public:
+  using Result = ModuleContext;
+
+  static llvm::StringRef name() { return "rv-module-context"; }
+  Result run(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
+};
+
+// Resets the cached ModuleContext (invalidate<rv-module-context>).
+class ModuleContextResetPass
+    : public llvm::PassInfoMixin<ModuleContextResetPass> {
+public:
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM);
+};
+
+} // namespace rv
+
+#endif // RV_PASSES_MODULECONTEXT_H
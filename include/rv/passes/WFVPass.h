@@ -13,6 +13,7 @@
 #include "llvm/Pass.h"
 
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "rv/transform/remTransform.h"
@@ -22,6 +23,8 @@
 #include "rv/legacy/passes.h"
 
 #include <limits>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace llvm {
@@ -46,6 +49,8 @@ class WFV {
   llvm::FunctionAnalysisManager FAM;
 
   bool enableDiagOutput; // WFV_DIAG
+  llvm::raw_ostream *diagOut; // WFV_DIAG output stream
+  unsigned numThreads; // RV_WFV_THREADS
 
   std::vector<VectorMapping> wfvJobs;
 
@@ -59,6 +64,38 @@ class WFV {
   void vectorizeFunction(VectorizerInterface &vectorizer,
                          VectorMapping &wfvJob);
 
+  /// generate the jobs [\p Begin, \p End) of wfvJobs in \p M.
+  /// All jobs are registered as mappings for recursive vectorization.
+  void vectorizeJobs(llvm::Module &M, size_t Begin, size_t End);
+
+  /// whether the jobs of \p M can be distributed over staging modules.
+  bool canStageJobs(llvm::Module &M) const;
+
+  /// result of a staging worker.
+  struct StagedSlice {
+    llvm::SmallVector<char, 0> code; // bitcode of the new SIMD variants
+    std::string reports;             // buffered Report() output
+    std::string diags;               // buffered WFV_DIAG output
+    std::string records;             // buffered RV_REPORT_JSON records
+    std::vector<std::string> sharedHelpers; // helpers made linkonce_odr for linking
+    bool ok = false;
+  };
+
+  /// vectorize the jobs concurrently in per-thread staging modules and link
+  /// the results back into \p M in job order.
+  /// Returns false and leaves \p M unchanged if staging failed.
+  bool runStaged(llvm::Module &M);
+
+  /// link the staged code of \p Slices into a fresh module in the context of
+  /// \p M. Returns nullptr if any slice could not be read back or linked.
+  std::unique_ptr<llvm::Module>
+  linkStagedSlices(llvm::Module &M, std::vector<StagedSlice> &Slices) const;
+
+  /// worker: vectorize jobs [\p Begin, \p End) of the serialized module \p
+  /// ModBuffer in a private context and serialize the new code to \p Slice.
+  static bool stageJobs(llvm::StringRef ModBuffer, size_t Begin, size_t End,
+                        bool DiagOutput, StagedSlice &Slice);
+
 public:
   WFV();
   bool run(llvm::Module &);
@@ -72,6 +72,9 @@ public:
   virtual ~ResolverService();
   virtual std::unique_ptr<FunctionResolver> resolve(llvm::StringRef funcName, llvm::FunctionType & scaFuncTy, const VectorShapeVec & argShapes, int vectorWidth, bool hasPredicate, llvm::Module & destModule) = 0;
 
+  // whether \p resolve would succeed. Services may answer this without creating a resolver.
+  virtual bool isAvailable(llvm::StringRef funcName, llvm::FunctionType & scaFuncTy, const VectorShapeVec & argShapes, int vectorWidth, bool hasPredicate, llvm::Module & destModule);
+
   void dump() const;
   virtual void print(llvm::raw_ostream & out) const;
 };
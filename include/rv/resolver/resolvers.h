@@ -16,6 +16,11 @@ namespace rv {
   // Use the SLEEF library to implement math functions.
   void addSleefResolver(const Config & config, PlatformInfo & platInfo);
 
+  // Keep the parsed SLEEF modules of \p Ctx alive between SLEEF resolvers.
+  // Every retain must be matched by a release before \p Ctx is destroyed.
+  void retainSleefModules(llvm::LLVMContext & Ctx);
+  void releaseSleefModules(llvm::LLVMContext & Ctx);
+
   // Vectorize functions that are declares with "pragma omp declare simd".
   void addOpenMPResolver(const Config & config, PlatformInfo & platInfo);
 
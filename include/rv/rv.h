@@ -29,6 +29,7 @@ namespace llvm {
 namespace rv {
 
 class VectorizationInfo;
+struct VectorizationReport;
 
 /*
  * The new vectorizer interface.
@@ -88,9 +89,14 @@ public:
 
     const Config & getConfig() const { return config; }
 
+    // record phase times and widening statistics in @_report (may be null)
+    void setReport(VectorizationReport * _report) { report = _report; }
+    VectorizationReport * getReport() const { return report; }
+
 private:
     Config config;
     PlatformInfo & platInfo;
+    VectorizationReport * report;
 };
 
 
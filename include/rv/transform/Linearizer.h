@@ -40,6 +40,7 @@ namespace llvm {
   class LoopInfo;
   class Loop;
   class BasicBlock;
+  class PostDominatorTree;
 }
 
 namespace rv {
@@ -339,6 +340,7 @@ namespace rv {
     MaskExpander & maskEx;
     llvm::DominatorTree & dt;
     llvm::LoopInfo & li;
+    llvm::PostDominatorTree * pdt; // updated in one batch after linearization (if available)
     llvm::Function & func;
     llvm::LLVMContext & context;
 
@@ -374,6 +376,13 @@ namespace rv {
     // simplify the cfg again
     void cleanup();
 
+    // add an update of kind @kind for every CFG edge leaving a region block
+    void recordRegionEdges(std::vector<llvm::DominatorTree::UpdateType> & cfgUpdates, llvm::DominatorTree::UpdateKind kind) const;
+
+    // settle the idoms of the region blocks and the region exits on the linearized CFG
+    // (visits the region only, the dom tree outside of it is unaffected)
+    void repairRegionDomTree();
+
     // verify that
     // a) all divergent branches have been folded
     // b) the function, domTree and loop tree are consistent
@@ -398,6 +407,9 @@ namespace rv {
     Linearizer(Config _config, VectorizationInfo & _vecInfo, MaskExpander & _maskEx, llvm::FunctionAnalysisManager &FAM);
 
     void run();
+
+    // analyses that ::run keeps up to date (dom tree, post dom tree and loop info)
+    llvm::PreservedAnalyses getPreservedAnalyses() const;
   };
 
 
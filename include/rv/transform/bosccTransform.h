@@ -28,10 +28,13 @@ namespace llvm {
 
 namespace rv {
 
+struct Config;
 class MaskExpander;
 class VectorizationInfo;
+struct VectorizationReport;
 
 class BOSCCTransform {
+  Config & config;
   VectorizationInfo & vecInfo;
   PlatformInfo & platInfo;
   MaskExpander & maskEx;
@@ -39,9 +42,11 @@ class BOSCCTransform {
   llvm::PostDominatorTree & postDomTree;
   llvm::LoopInfo & loopInfo;
   llvm::BranchProbabilityInfo * pbInfo;
+  VectorizationReport * report;
 
 public:
-  BOSCCTransform(VectorizationInfo & _vecInfo, PlatformInfo & _platInfo, MaskExpander & _maskEx, llvm::FunctionAnalysisManager &FAM);
+  // decisions are recorded in @_report (may be null)
+  BOSCCTransform(Config & _config, VectorizationInfo & _vecInfo, PlatformInfo & _platInfo, MaskExpander & _maskEx, llvm::FunctionAnalysisManager &FAM, VectorizationReport * _report = nullptr);
 
   bool run();
 };
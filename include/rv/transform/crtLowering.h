@@ -18,6 +18,9 @@ namespace rv {
   // link the compiler-rt code for the specified complex arithmetic function @funcName with @funcTy into @insertInto
   llvm::Function *
   requestScalarImplementation(const llvm::StringRef & funcName, llvm::FunctionType & funcTy, llvm::Module &insertInto);
+
+  // drop the compiler-rt module parsed into @ctx (has to happen before @ctx is destroyed)
+  void releaseScalarImplementations(llvm::LLVMContext & ctx);
 }
 
 
@@ -16,6 +16,8 @@
 #include "rv/analysis/reductionAnalysis.h"
 #include "rv/Mask.h"
 
+#include <functional>
+
 namespace rv {
 
 struct Config;
@@ -24,9 +26,17 @@ struct Config;
 llvm::Instruction& CreateReductInst(llvm::IRBuilder<> & builder, RedKind redKind, llvm::Value & firstArg, llvm::Value & secondArg);
 
 // reduce the vector @vectorVal to a scalar value (using redKind)
-llvm::Value & CreateVectorReduce(Config & config, llvm::IRBuilder<> & builder, RedKind redKind, llvm::Value & vectorVal, llvm::Value * initVal);
+// @ordered reductions combine @initVal and then the lanes strictly in lane order (no reassociation)
+llvm::Value & CreateVectorReduce(Config & config, llvm::IRBuilder<> & builder, RedKind redKind, llvm::Value & vectorVal, llvm::Value * initVal, bool ordered = false);
 llvm::Value & CreateMaskedVectorReduce(Config & config, llvm::IRBuilder<> & builder, Mask vecMask, RedKind redKind, llvm::Value & vectorVal, llvm::Value * initVal);
 
+// log-depth (Hillis-Steele) prefix scan of @vectorVal over shuffles: lane i combines lanes 0..i with @combineFunc
+// exclusive scans combine lanes 0..i-1 (lane 0 is @identity)
+llvm::Value & CreateVectorScan(llvm::IRBuilder<> & builder, llvm::Value & vectorVal, llvm::Constant & identity, bool exclusive,
+                               std::function<llvm::Value*(llvm::IRBuilder<>&, llvm::Value*, llvm::Value*)> combineFunc);
+// prefix scan with the operator of @redKind
+llvm::Value & CreateVectorScan(llvm::IRBuilder<> & builder, RedKind redKind, llvm::Value & vectorVal, bool exclusive);
+
 // if laneOffset is >= 0 create an extract from that offset, if laneOffset < 0 add the vector width first
 // will return @vecVal if it is not a vector (uniform value)
 llvm::Value & CreateExtract(llvm::IRBuilder<> & builder, llvm::Value & vecVal, int laneOffset);
@@ -12,6 +12,7 @@
 
 #include "llvm/Analysis/BranchProbabilityInfo.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/PassManager.h"
 
 #include <set>
 
@@ -67,6 +68,9 @@ public:
 
   // Check whether ::createVectorizableLoop will succeed on \p L.
   bool analyzeLoopStructure(llvm::Loop &L);
+
+  // analyses that ::createVectorizableLoop keeps up to date
+  llvm::PreservedAnalyses getPreservedAnalyses() const;
 };
 
 }
@@ -63,6 +63,10 @@ class VectorizationInfo {
   // fixed shapes (will be preserved through VA)
   std::set<const llvm::Value *> pinned;
 
+  // mask profile keys (see assignProfileIds)
+  unsigned ProfileRegionId;
+  std::map<const llvm::BasicBlock *, unsigned> ProfileBlockIds;
+
   // internal helper
   Mask& requestMask(const llvm::BasicBlock & block);
 
@@ -84,6 +88,15 @@ public:
   void setEntryAVL(llvm::Value * NewAVL) { EntryAVL = NewAVL; }
   llvm::Value* getEntryAVL() const { return EntryAVL; }
 
+  // Number the region for mask profiling (RV_MASK_PROFILE, RV_MASK_PROFILE_USE).
+  // Block names do not survive release builds, so region blocks are keyed by
+  // their ordinal in function layout order, taken before CIF/BOSCC and the
+  // linearizer change the CFG. Regions get consecutive ids per function.
+  void assignProfileIds();
+  unsigned getProfileRegionId() const { return ProfileRegionId; }
+  // false for blocks that were created after assignProfileIds
+  bool getProfileBlockId(const llvm::BasicBlock &block, unsigned &oBlockId) const;
+
   // disjoin path divergence
   bool isJoinDivergent(const llvm::BasicBlock &JoinBlock) const {
     return JoinDivergentBlocks.count(&JoinBlock);
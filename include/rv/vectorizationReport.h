@@ -0,0 +1,133 @@
+//===- rv/vectorizationReport.h - machine-readable vectorization report --*- C++ -*-===//
+//
+// Part of the RV Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+
+#ifndef RV_VECTORIZATIONREPORT_H
+#define RV_VECTORIZATIONREPORT_H
+
+#include "rv/analysis/costModel.h"
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rv {
+
+// widening statistics of a single region (collected by the NatBuilder)
+struct NatStatistics {
+  // memory
+  unsigned numMaskedGather = 0, numMaskedScatter = 0, numGather = 0, numScatter = 0;
+  unsigned numInterMaskedLoads = 0, numInterMaskedStores = 0, numInterLoads = 0, numInterStores = 0;
+  unsigned numContMaskedLoads = 0, numContMaskedStores = 0, numContLoads = 0, numContStores = 0;
+  unsigned numUniMaskedLoads = 0, numUniMaskedStores = 0, numUniLoads = 0, numUniStores = 0;
+  unsigned numUniAllocas = 0, numSlowAllocas = 0;
+
+  // address computation
+  unsigned numVecGEPs = 0, numScalGEPs = 0, numInterGEPs = 0, numVecBCs = 0, numScalBCs = 0;
+
+  // calls
+  unsigned numVecCalls = 0, numSemiCalls = 0, numFallCalls = 0, numCascadeCalls = 0, numRVIntrinsics = 0;
+
+  // everything else
+  unsigned numScalarized = 0, numVectorized = 0, numFallbacked = 0, numLazy = 0;
+
+  // mask kinds (constant/uniform/varying)
+  unsigned numConstLoadMasks = 0, numUniLoadMasks = 0, numVarLoadMasks = 0;
+  unsigned numConstStoreMasks = 0, numUniStoreMasks = 0, numVarStoreMasks = 0;
+};
+
+// BOSCC/CIF decision at a divergent branch
+struct SkipBranchDecision {
+  std::string transform; // "boscc" or "cif"
+  std::string block;     // block of the divergent branch
+  std::string successor; // successor region the inserted branch skips
+  double allFalseProb;   // estimated probability that no lane enters the successor
+  double gain;           // expected savings per vector iteration (cost model units)
+  bool inserted;
+};
+
+// Structured record of one vectorization job (a loop or a SIMD function variant).
+// Records are appended as JSON lines to the file named by RV_REPORT_JSON.
+struct VectorizationReport {
+  std::string kind;     // "loop" or "function"
+  std::string function; // scalar function containing the region
+  std::string region;   // loop header or vector function name
+  std::string location; // "file:line" (if known)
+  std::string variant;  // role of this loop copy (main, version, epilogue)
+
+  unsigned vectorWidth; // 0 if the region was rejected
+  std::string rejection; // why the region stayed scalar
+
+  bool hasCost;
+  RegionCost cost;
+
+  bool hasStatistics;
+  NatStatistics stats;
+
+  // considered BOSCC/CIF branches
+  std::vector<SkipBranchDecision> skipBranches;
+
+  // seconds per vectorizer phase (in pipeline order)
+  std::vector<std::pair<std::string, double>> phaseTimes;
+
+  VectorizationReport(std::string _kind, std::string _function, std::string _region);
+
+  void setCost(const RegionCost & _cost) { cost = _cost; hasCost = true; }
+  void setStatistics(const NatStatistics & _stats) { stats = _stats; hasStatistics = true; }
+  void addPhaseTime(const std::string & phase, double seconds);
+  void addSkipBranch(const SkipBranchDecision & decision) { skipBranches.push_back(decision); }
+
+  // whether RV_REPORT_JSON is set
+  static bool isEnabled();
+
+  // append this record to the RV_REPORT_JSON file (no-op otherwise)
+  // records of a thread with a VectorizationReportBuffer go to the buffer instead
+  void emit() const;
+
+  // append the JSON lines @records to the RV_REPORT_JSON file
+  static void appendRecords(const std::string & records);
+};
+
+// buffers the records emitted by the constructing thread while alive
+// (worker threads must not write to the shared RV_REPORT_JSON stream)
+class VectorizationReportBuffer {
+  std::string records;
+  std::string * prevRecords;
+
+public:
+  VectorizationReportBuffer();
+  ~VectorizationReportBuffer();
+
+  // the JSON lines buffered so far
+  std::string & str() { return records; }
+};
+
+// adds its lifetime to the phase @phase of @report (if any)
+class ReportPhaseTimer {
+  VectorizationReport * report;
+  std::string phase;
+  std::chrono::steady_clock::time_point start;
+
+public:
+  ReportPhaseTimer(VectorizationReport * _report, std::string _phase)
+  : report(_report)
+  , phase(std::move(_phase))
+  , start(std::chrono::steady_clock::now())
+  {}
+
+  ~ReportPhaseTimer() {
+    if (!report) return;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    report->addPhaseTime(phase, elapsed.count());
+  }
+};
+
+} // namespace rv
+
+#endif // RV_VECTORIZATIONREPORT_H
@@ -0,0 +1,68 @@
+//===- runtime/maskProfile.c - mask coherence profiling runtime --*- C -*-===//
+//
+// Part of the RV Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Link this into programs compiled with RV_MASK_PROFILE set. At exit, one line
+// per vectorized region block is appended to $RV_MASK_PROFILE_FILE
+// (default: rv-mask-profile.txt):
+//
+//   <function> TAB <region> TAB <block> TAB <vector width> TAB <n_0> <n_1> .. <n_width>
+//
+// where n_k is the number of executions of the block with k active lanes.
+// Regions and blocks are numbered by the compiler (block names do not survive
+// release builds).
+// Pass the file to the next compile with RV_MASK_PROFILE_USE.
+//
+//===----------------------------------------------------------------------===//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// counter table of one vectorized region (emitted by NatBuilder::instrumentMaskProfile)
+struct rv_mask_profile {
+  const char * function;
+  uint32_t region;
+  const uint32_t * blocks; // block ids
+  uint64_t * counters; // (width + 1) counters per block
+  uint32_t numBlocks;
+  uint32_t width;
+  struct rv_mask_profile * next;
+};
+
+static struct rv_mask_profile * registeredProfiles = NULL;
+
+static void
+rv_mask_profile_dump(void) {
+  const char * filePath = getenv("RV_MASK_PROFILE_FILE");
+  if (!filePath || !*filePath) filePath = "rv-mask-profile.txt";
+
+  FILE * out = fopen(filePath, "a");
+  if (!out) {
+    fprintf(stderr, "rv: could not open the mask profile %s\n", filePath);
+    return;
+  }
+
+  for (const struct rv_mask_profile * prof = registeredProfiles; prof; prof = prof->next) {
+    for (uint32_t b = 0; b < prof->numBlocks; ++b) {
+      const uint64_t * hist = prof->counters + b * (prof->width + 1);
+      fprintf(out, "%s\t%u\t%u\t%u\t", prof->function, prof->region, prof->blocks[b], prof->width);
+      for (uint32_t numActive = 0; numActive <= prof->width; ++numActive) {
+        fprintf(out, numActive ? " %llu" : "%llu", (unsigned long long) hist[numActive]);
+      }
+      fputc('\n', out);
+    }
+  }
+  fclose(out);
+}
+
+void
+rv_mask_profile_register(struct rv_mask_profile * prof) {
+  if (!registeredProfiles) atexit(rv_mask_profile_dump);
+  prof->next = registeredProfiles;
+  registeredProfiles = prof;
+}
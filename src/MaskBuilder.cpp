@@ -2,6 +2,7 @@
 
 #include "rv/intrinsics.h"
 #include "utils/rvTools.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/PatternMatch.h"
 #include <cassert>
@@ -185,15 +186,18 @@ llvm::Value *MaskBuilder::CreateSelect(llvm::IRBuilder<> &Builder,
 // Fold the ActiveVectorLength of M into its predicate.
 Mask VectorMaskBuilder::FoldAVL(llvm::IRBuilder<> &Builder, Mask M,
                                 llvm::Twine Name) {
-  auto Mod = Builder.GetInsertBlock()->getModule();
-  auto *VectorWidthVal = Builder.getInt32(VectorWidth);
-  auto *PredTy = FixedVectorType::get(Builder.getInt1Ty(), VectorWidth);
-  // Vector impl.
-  auto ActiveLaneFunc = Intrinsic::getDeclaration(
-      Mod, Intrinsic::get_active_lane_mask, {PredTy, Builder.getInt32Ty()});
-
-  auto ConvertedPred = Builder.CreateCall(
-      ActiveLaneFunc, {M.getAVL(), VectorWidthVal}, "avl_to_pred");
+  if (!M.getAVL())
+    return M;
+
+  // Lane i is active iff i < AVL.
+  auto *AVL = M.getAVL();
+  auto *AVLTy = AVL->getType();
+  SmallVector<Constant *, 16> LaneIds;
+  for (unsigned i = 0; i < VectorWidth; ++i)
+    LaneIds.push_back(ConstantInt::get(AVLTy, i));
+  auto *SplatAVL = Builder.CreateVectorSplat(VectorWidth, AVL);
+  auto *ConvertedPred = &AddMaskOp<>(*Builder.CreateICmpULT(
+      ConstantVector::get(LaneIds), SplatAVL, Name + ".avl_pred"));
 
   Mask FoldedPred;
   FoldedPred.setPred(ConvertedPred);
@@ -72,7 +72,10 @@ PlatformInfo::registerDeclareSIMDFunction(Function & F) {
 }
 
 void
-PlatformInfo::addMapping(VectorMapping&& mapping) { listResolver->addMapping(std::move(mapping)); }
+PlatformInfo::addMapping(VectorMapping&& mapping) {
+  invalidateResolverCache();
+  listResolver->addMapping(std::move(mapping));
+}
 
 void
 PlatformInfo::addIntrinsicMappings() {
@@ -95,7 +98,9 @@ PlatformInfo::addIntrinsicMappings() {
 
 PlatformInfo::PlatformInfo(Module &_mod, TargetTransformInfo *TTI,
                            TargetLibraryInfo *TLI)
-: mod(_mod)
+: resolverCache()
+, resolverCacheEpoch(0)
+, mod(_mod)
 , mTTI(TTI)
 , mTLI(TLI)
 , resolverServices()
@@ -123,12 +128,32 @@ TargetTransformInfo *PlatformInfo::getTTI() { return mTTI; }
 
 TargetLibraryInfo *PlatformInfo::getTLI() { return mTLI; }
 
+void PlatformInfo::setTargetAttributes(const Function &F) {
+  targetAttributes =
+      (F.getFnAttribute("target-cpu").getValueAsString() + ";" +
+       F.getFnAttribute("target-features").getValueAsString())
+          .str();
+}
+
 void
 PlatformInfo::addResolverService(std::unique_ptr<ResolverService>&& newResolver, bool givePrecedence) {
+  invalidateResolverCache();
   auto itInsert = givePrecedence ? resolverServices.begin() : resolverServices.end();
   resolverServices.insert(itInsert, std::move(newResolver));
 }
 
+PlatformInfo::ResolverQuery
+PlatformInfo::makeQuery(StringRef funcName, FunctionType & scaFuncTy, const VectorShapeVec & argShapes, int vectorWidth, bool hasPredicate) const {
+  std::string shapeText;
+  for (const auto & argShape : argShapes) {
+    shapeText += argShape.isDefined() ? argShape.serialize() : "?";
+    shapeText += ",";
+  }
+  const auto * scaFunc = mod.getFunction(funcName);
+  int scaFuncState = !scaFunc ? 0 : (scaFunc->isDeclaration() ? 1 : 2);
+  return ResolverQuery{funcName.str(), &scaFuncTy, shapeText, vectorWidth, hasPredicate, scaFuncState};
+}
+
 std::unique_ptr<FunctionResolver>
 PlatformInfo::getResolver(StringRef funcName,
                           FunctionType & scaFuncTy,
@@ -145,13 +170,51 @@ PlatformInfo::getResolver(StringRef funcName,
     errs() << "\n";
   }
 
-  for (const auto & resolver : resolverServices) {
-    std::unique_ptr<FunctionResolver> funcResolver = resolver->resolve(funcName, scaFuncTy, argShapes, vectorWidth, hasPredicate, mod);
+  auto query = makeQuery(funcName, scaFuncTy, argShapes, vectorWidth, hasPredicate);
+  auto itCached = resolverCache.find(query);
+  if (itCached != resolverCache.end()) {
+    int serviceIdx = itCached->second;
+    if (serviceIdx < 0) return nullptr;
+    auto funcResolver = resolverServices[serviceIdx]->resolve(funcName, scaFuncTy, argShapes, vectorWidth, hasPredicate, mod);
     if (funcResolver) return funcResolver;
+    // stale entry -> walk the chain again
+    resolverCache.erase(itCached);
   }
+
+  // resolving may register new mappings (eg recursive vectorization), which outdates the answer
+  unsigned queryEpoch = resolverCacheEpoch;
+  for (size_t i = 0; i < resolverServices.size(); ++i) {
+    std::unique_ptr<FunctionResolver> funcResolver = resolverServices[i]->resolve(funcName, scaFuncTy, argShapes, vectorWidth, hasPredicate, mod);
+    if (funcResolver) {
+      cacheResolverQuery(query, i, queryEpoch);
+      return funcResolver;
+    }
+  }
+  cacheResolverQuery(query, -1, queryEpoch);
   return nullptr;
 }
 
+bool
+PlatformInfo::hasResolver(StringRef funcName,
+                          FunctionType & scaFuncTy,
+                          const VectorShapeVec & argShapes,
+                          int vectorWidth,
+                          bool hasPredicate) const {
+  auto query = makeQuery(funcName, scaFuncTy, argShapes, vectorWidth, hasPredicate);
+  auto itCached = resolverCache.find(query);
+  if (itCached != resolverCache.end()) return itCached->second >= 0;
+
+  unsigned queryEpoch = resolverCacheEpoch;
+  for (size_t i = 0; i < resolverServices.size(); ++i) {
+    if (resolverServices[i]->isAvailable(funcName, scaFuncTy, argShapes, vectorWidth, hasPredicate, mod)) {
+      cacheResolverQuery(query, i, queryEpoch);
+      return true;
+    }
+  }
+  cacheResolverQuery(query, -1, queryEpoch);
+  return false;
+}
+
 llvm::Function &
 PlatformInfo::requestRVIntrinsicFunc(RVIntrinsic rvIntrin) {
   auto * func = mod.getFunction(GetIntrinsicName(rvIntrin));
@@ -202,10 +265,16 @@ PlatformInfo::dump() const {
 
 
 bool
-PlatformInfo::forgetMapping(const VectorMapping & mapping) { return listResolver->forgetMapping(mapping); }
+PlatformInfo::forgetMapping(const VectorMapping & mapping) {
+  invalidateResolverCache();
+  return listResolver->forgetMapping(mapping);
+}
 
 void
-PlatformInfo::forgetAllMappingsFor(const Function & scaFunc) { listResolver->forgetAllMappingsFor(scaFunc); }
+PlatformInfo::forgetAllMappingsFor(const Function & scaFunc) {
+  invalidateResolverCache();
+  listResolver->forgetAllMappingsFor(scaFunc);
+}
 
 void
 PlatformInfo::print(llvm::raw_ostream & out) const {
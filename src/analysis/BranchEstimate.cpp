@@ -8,6 +8,7 @@
 
 #include "rv/analysis/BranchEstimate.h"
 
+#include <cmath>
 #include <vector>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Function.h>
@@ -20,6 +21,7 @@
 #include <llvm/IR/Dominators.h>
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Analysis/BranchProbabilityInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
 #include <llvm/Support/Format.h>
 
 #include <llvm/ADT/SmallSet.h>
@@ -28,6 +30,8 @@
 
 #include "rv/vectorizationInfo.h"
 #include "rv/PlatformInfo.h"
+#include "rv/config.h"
+#include "rv/analysis/MaskProfile.h"
 #include "rv/shape/vectorShape.h"
 #include "rv/transform/maskExpander.h"
 
@@ -44,6 +48,19 @@ using namespace llvm;
 
 namespace rv {
 
+BranchEstimate::BranchEstimate(Config & config, VectorizationInfo & _vecInfo, PlatformInfo & _platInfo, MaskExpander & _maskEx, DominatorTree & _domTree, LoopInfo & _loopInfo, BranchProbabilityInfo * _pbInfo)
+: vecInfo(_vecInfo)
+, platInfo(_platInfo)
+, maskEx(_maskEx)
+, domTree(_domTree)
+, loopInfo(_loopInfo)
+, pbInfo(_pbInfo)
+, costModel(_platInfo.getTTI() ? std::make_unique<CostModel>(_platInfo, config) : nullptr)
+, hasDispersion(false)
+{}
+
+BranchEstimate::~BranchEstimate() {}
+
 size_t
 BranchEstimate::getBlockScore(BasicBlock & entry) {
   size_t score = 0;
@@ -245,6 +262,82 @@ BranchEstimate::analyze(BranchInst &branch, double &trueRatio, double &falseRati
   return true;
 }
 
+double
+BranchEstimate::getDomRegionCost(BasicBlock & entry) {
+  if (!costModel) return getDomRegionScore(entry);
+
+  SmallVector<BasicBlock *, 32> domBlocks;
+  domTree.getDescendants(&entry, domBlocks);
+
+  RegionCost dummyCost(vecInfo.getVectorWidth());
+  double cost = 0.0;
+  for (auto * block : domBlocks) {
+    if (!vecInfo.inRegion(*block)) continue;
+    for (auto & inst : *block) {
+      cost += costModel->getVectorCost(inst, vecInfo.getVectorWidth(), &vecInfo, dummyCost);
+    }
+  }
+  return cost;
+}
+
+const std::map<BasicBlock*,double> &
+BranchEstimate::getDispersion() {
+  // blocks that are added later on have no ratio (-> nothing to gain)
+  if (!hasDispersion) {
+    computeDispersion(dispersion);
+    hasDispersion = true;
+  }
+  return dispersion;
+}
+
+double
+BranchEstimate::getAllFalseProb(BasicBlock & block, const std::map<BasicBlock*,double> & dispMap, bool coherent) const {
+  // measured lane activity (RV_MASK_PROFILE_USE) relative to the executions of the region entry
+  const auto * profile = MaskProfile::get();
+  unsigned entryId, blockId;
+  if (profile && vecInfo.getProfileBlockId(vecInfo.getEntry(), entryId) && vecInfo.getProfileBlockId(block, blockId)) {
+    StringRef funcName = vecInfo.getScalarFunction().getName();
+    unsigned regionId = vecInfo.getProfileRegionId();
+    uint64_t entryCount = profile->getExecutionCount(funcName, regionId, entryId);
+    if (entryCount > 0 && profile->getHistogram(funcName, regionId, blockId)) {
+      double activeRatio = profile->getActiveCount(funcName, regionId, blockId) / (double) entryCount;
+      return 1.0 - std::min<double>(activeRatio, 1.0);
+    }
+  }
+
+  auto itRatio = dispMap.find(&block);
+  if (itRatio == dispMap.end()) return 0.0;
+  double laneRatio = std::min<double>(std::max<double>(itRatio->second, 0.0), 1.0);
+  if (coherent) return 1.0 - laneRatio;
+  return std::pow(1.0 - laneRatio, (double) vecInfo.getVectorWidth());
+}
+
+double
+BranchEstimate::getSkipOverhead() const {
+  auto * TTI = platInfo.getTTI();
+  if (!TTI) return 2.0;
+
+  auto kind = TargetTransformInfo::TCK_RecipThroughput;
+  auto * maskTy = FixedVectorType::get(Type::getInt1Ty(platInfo.getContext()), vecInfo.getVectorWidth());
+  InstructionCost testCost = TTI->getArithmeticReductionCost(Instruction::Or, maskTy, None, kind)
+                           + TTI->getCFInstrCost(Instruction::Br, kind);
+  if (!testCost.isValid()) return 2.0;
+  return std::max<double>(1.0, (double) *testCost.getValue());
+}
+
+double
+BranchEstimate::getSkipGain(BranchInst & branch, unsigned succIdx, double & oAllFalseProb, bool coherent) {
+  auto & skipBlock = *branch.getSuccessor(succIdx);
+  oAllFalseProb = getAllFalseProb(skipBlock, getDispersion(), coherent);
+
+  // linearized code executes the region in every vector iteration, the test is paid for in every iteration as well
+  double skipCost = getDomRegionCost(skipBlock);
+  double gain = oAllFalseProb * skipCost - getSkipOverhead();
+
+  IF_DEBUG_BRANCH { errs() << "skip " << skipBlock.getName() << ": allFalse " << oAllFalseProb << ", region cost " << skipCost << ", gain " << gain << "\n"; }
+  return gain;
+}
+
 // Return nullptr if there are multiple exit blocks
 BasicBlock *
 BranchEstimate::getExitBlock(BasicBlock * entry)
@@ -0,0 +1,99 @@
+//===- src/analysis/MaskProfile.cpp - measured lane activity of region blocks --*- C++ -*-===//
+//
+// Part of the RV Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "rv/analysis/MaskProfile.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "report.h"
+
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+
+using namespace llvm;
+
+namespace rv {
+
+bool
+MaskProfile::load(StringRef filePath) {
+  auto bufferOrErr = MemoryBuffer::getFile(filePath);
+  if (!bufferOrErr) return false;
+
+  SmallVector<StringRef, 64> lines;
+  (*bufferOrErr)->getBuffer().split(lines, '\n', -1, false);
+
+  for (StringRef line : lines) {
+    // <function> TAB <region> TAB <block> TAB <width> TAB <n_0> .. <n_width>
+    SmallVector<StringRef, 5> fields;
+    line.split(fields, '\t');
+    if (fields.size() != 5) continue;
+
+    unsigned regionId, blockId, width;
+    if (fields[1].getAsInteger(10, regionId)) continue;
+    if (fields[2].getAsInteger(10, blockId)) continue;
+    if (fields[3].getAsInteger(10, width)) continue;
+
+    SmallVector<StringRef, 17> countTexts;
+    fields[4].split(countTexts, ' ', -1, false);
+    if (countTexts.size() != width + 1) continue;
+
+    auto & hist = histograms[Key{fields[0].str(), regionId, blockId}];
+    if (!hist.empty() && hist.size() != countTexts.size()) continue; // profiled at a different width
+    hist.resize(countTexts.size(), 0);
+    for (size_t i = 0; i < countTexts.size(); ++i) {
+      uint64_t count;
+      if (!countTexts[i].getAsInteger(10, count)) hist[i] += count;
+    }
+  }
+  return true;
+}
+
+const MaskProfile *
+MaskProfile::get() {
+  static std::once_flag loadFlag;
+  static std::unique_ptr<MaskProfile> profile;
+
+  std::call_once(loadFlag, []() {
+    const char * filePath = getenv("RV_MASK_PROFILE_USE");
+    if (!filePath || !*filePath) return;
+
+    profile = std::make_unique<MaskProfile>();
+    if (!profile->load(filePath)) {
+      Error() << "could not read the mask profile " << filePath << "\n";
+      profile.reset();
+    }
+  });
+  return profile.get();
+}
+
+const std::vector<uint64_t> *
+MaskProfile::getHistogram(StringRef funcName, unsigned regionId, unsigned blockId) const {
+  auto itHist = histograms.find(Key{funcName.str(), regionId, blockId});
+  if (itHist == histograms.end()) return nullptr;
+  return &itHist->second;
+}
+
+uint64_t
+MaskProfile::getExecutionCount(StringRef funcName, unsigned regionId, unsigned blockId) const {
+  const auto * hist = getHistogram(funcName, regionId, blockId);
+  if (!hist) return 0;
+  uint64_t numExecs = 0;
+  for (auto count : *hist) numExecs += count;
+  return numExecs;
+}
+
+uint64_t
+MaskProfile::getActiveCount(StringRef funcName, unsigned regionId, unsigned blockId) const {
+  const auto * hist = getHistogram(funcName, regionId, blockId);
+  if (!hist || hist->empty()) return 0;
+  return getExecutionCount(funcName, regionId, blockId) - (*hist)[0];
+}
+
+} // namespace rv
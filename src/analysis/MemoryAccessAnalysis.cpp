@@ -0,0 +1,86 @@
+//===- src/analysis/MemoryAccessAnalysis.cpp - address groups of memory accesses --*- C++ -*-===//
+//
+// Part of the RV Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "rv/analysis/MemoryAccessAnalysis.h"
+
+#include "native/MemoryAccessGrouper.h"
+
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+namespace rv {
+
+MemoryAccessAnalysis::MemoryAccessAnalysis(const Function & F, ScalarEvolution & SE)
+: accessInfos()
+, groupAccesses()
+{
+  MemoryAccessGrouper grouper(SE, 0);
+  std::vector<std::pair<const Instruction *, const SCEV *>> accesses;
+  for (const auto & block : F) {
+    for (const auto & inst : block) {
+      const Value * ptr = getLoadStorePointerOperand(&inst);
+      if (!ptr) continue;
+      accesses.emplace_back(&inst, grouper.add(const_cast<Value *>(ptr)));
+    }
+  }
+
+  // group offsets are final once all accesses are added
+  for (const auto & access : accesses) {
+    AccessInfo info;
+    if (!grouper.getGroupOffset(access.second, info.groupIdx, info.offset)) continue;
+    accessInfos[access.first] = info;
+    if (info.groupIdx >= groupAccesses.size()) groupAccesses.resize(info.groupIdx + 1);
+    groupAccesses[info.groupIdx].push_back(access.first);
+  }
+}
+
+bool
+MemoryAccessAnalysis::getAccessGroup(const Instruction & inst, unsigned & oGroupIdx, int64_t & oOffset) const {
+  auto itInfo = accessInfos.find(&inst);
+  if (itInfo == accessInfos.end()) return false;
+  oGroupIdx = itInfo->second.groupIdx;
+  oOffset = itInfo->second.offset;
+  return true;
+}
+
+bool
+MemoryAccessAnalysis::getConstantDistance(const Instruction & A, const Instruction & B, int64_t & oDelta) const {
+  unsigned groupA, groupB;
+  int64_t offsetA, offsetB;
+  if (!getAccessGroup(A, groupA, offsetA) || !getAccessGroup(B, groupB, offsetB)) return false;
+  if (groupA != groupB) return false;
+  oDelta = offsetA - offsetB;
+  return true;
+}
+
+void
+MemoryAccessAnalysis::print(raw_ostream & out) const {
+  out << "MemoryAccessAnalysis {\n";
+  for (size_t groupIdx = 0; groupIdx < groupAccesses.size(); ++groupIdx) {
+    if (groupAccesses[groupIdx].empty()) continue;
+    out << "group " << groupIdx << ":\n";
+    for (const auto * inst : groupAccesses[groupIdx]) {
+      out << "\t" << accessInfos.lookup(inst).offset << " : " << *inst << "\n";
+    }
+  }
+  out << "}\n";
+}
+
+void
+MemoryAccessAnalysis::dump() const { print(errs()); }
+
+AnalysisKey MemoryAccessAnalysisPass::Key;
+
+MemoryAccessAnalysis
+MemoryAccessAnalysisPass::run(Function & F, FunctionAnalysisManager & FAM) {
+  return MemoryAccessAnalysis(F, FAM.getResult<ScalarEvolutionAnalysis>(F));
+}
+
+} // namespace rv
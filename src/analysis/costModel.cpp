@@ -15,9 +15,13 @@
 #include "rv/config.h"
 
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Support/raw_ostream.h"
 
 #include "rv/utils.h"
 #include "rvConfig.h"
@@ -32,6 +36,34 @@ using namespace llvm;
 
 namespace rv {
 
+// all estimates are in terms of reciprocal throughput
+static const TargetTransformInfo::TargetCostKind CostKind = TargetTransformInfo::TCK_RecipThroughput;
+
+// convert a TTI cost to a plain number (@fallback if TTI does not know)
+static
+double
+ToCost(InstructionCost cost, double fallback) {
+  if (!cost.isValid()) return fallback;
+  return (double) *cost.getValue();
+}
+
+void
+RegionCost::print(raw_ostream & out) const {
+  out << "RegionCost { width " << vectorWidth
+      << ", scalar " << scalarCost
+      << ", vector " << vectorCost
+      << ", speedup " << getSpeedup()
+      << ", gathers " << numGathers
+      << ", scatters " << numScatters
+      << ", interleaved " << numInterleaved
+      << ", masked " << numMaskedAccesses
+      << ", cascaded calls " << numCascadedCalls
+      << ", blends " << numBlends << " }";
+}
+
+void
+RegionCost::dump() const { print(errs()); errs() << "\n"; }
+
 
 CostModel::CostModel(PlatformInfo & _platInfo, Config & _config)
 : platInfo(_platInfo)
@@ -105,7 +137,7 @@ CostModel::IsVectorizableFunction(Function & callee) const {
 
 
 size_t
-CostModel::pickWidthForInstruction(const Instruction & inst, size_t maxWidth) const {
+CostModel::pickWidthForInstruction(const Instruction & inst, size_t maxWidth, bool mayBePredicated) const {
   if (!needsReplication(inst)) return maxWidth; // remains scalar
 
 // check call mappings, critical sections
@@ -136,8 +168,7 @@ CostModel::pickWidthForInstruction(const Instruction & inst, size_t maxWidth) co
     for (; sampleWidth > 1; sampleWidth /= 2) {
 
       // if (platInfo.getMappingsForCall(matchVec, *callee, botArgVec, sampleWidth, needsPredication)) break; // FIXME deprecated
-      const bool needsPredicate = false; // FIXME
-      if (platInfo.getResolver(calleeName, *callee->getFunctionType(), topArgVec, sampleWidth, needsPredicate)) {
+      if (platInfo.hasResolver(calleeName, *callee->getFunctionType(), topArgVec, sampleWidth, mayBePredicated)) {
         break;
       }
     }
@@ -172,8 +203,8 @@ CostModel::pickWidthForType(const Type & type, size_t maxWidth) const {
 }
 
 size_t
-CostModel::pickWidthForBlock(const BasicBlock & block, size_t maxWidth) const {
-  for (const auto & inst : block) maxWidth = pickWidthForInstruction(inst, maxWidth);
+CostModel::pickWidthForBlock(const BasicBlock & block, size_t maxWidth, bool mayBePredicated) const {
+  for (const auto & inst : block) maxWidth = pickWidthForInstruction(inst, maxWidth, mayBePredicated);
   size_t numDataPhis = CountDataPhis(block);
 
   if (numDataPhis > 2*maxWidth) {
@@ -193,8 +224,9 @@ CostModel::pickWidthForRegion(const Region & region, size_t maxWidth) const {
 
   IF_DEBUG_CM { errs() << "cm: bounding vector width for region " << region.str() << ", initial max width " << width << "\n"; }
 
+  // no predicates are known yet, only the region entry is sure to run with all lanes
   region.for_blocks([&](const BasicBlock & block) {
-      width = pickWidthForBlock(block, width);
+      width = pickWidthForBlock(block, width, &block != &region.getRegionEntry());
       return width > 1;
   });
 
@@ -202,4 +234,318 @@ CostModel::pickWidthForRegion(const Region & region, size_t maxWidth) const {
 }
 
 
+// cost estimates
+
+VectorShape
+CostModel::getShape(const Value & val, const VectorizationInfo * vecInfo) const {
+  if (isa<Constant>(val) || isa<Argument>(val)) return VectorShape::uni();
+  if (vecInfo && vecInfo->hasKnownShape(val)) return vecInfo->getVectorShape(val);
+  return VectorShape::undef(); // unknown
+}
+
+bool
+CostModel::hasVaryingPredicate(const BasicBlock & block, const VectorizationInfo * vecInfo) const {
+  if (!vecInfo) return false;
+  bool isVarying = false;
+  return vecInfo->getVaryingPredicateFlag(block, isVarying) && isVarying;
+}
+
+double
+CostModel::getScalarCost(const Instruction & inst) const {
+  if (isa<DbgInfoIntrinsic>(inst)) return 0.0;
+  return ToCost(tti.getInstructionCost(&inst, CostKind), 1.0);
+}
+
+double
+CostModel::getReplicationCost(const Instruction & inst, size_t width) const {
+  double cost = width * getScalarCost(inst);
+
+  // extract all operand lanes
+  for (const auto & op : inst.operands()) {
+    auto * opTy = op->getType();
+    if (isa<Constant>(op) || !VectorType::isValidElementType(opTy)) continue;
+    auto * vecOpTy = FixedVectorType::get(opTy, width);
+    cost += width * ToCost(tti.getVectorInstrCost(Instruction::ExtractElement, vecOpTy), 1.0);
+  }
+
+  // re-assemble the result vector
+  auto * instTy = inst.getType();
+  if (!instTy->isVoidTy() && VectorType::isValidElementType(instTy)) {
+    auto * vecTy = FixedVectorType::get(instTy, width);
+    cost += width * ToCost(tti.getVectorInstrCost(Instruction::InsertElement, vecTy), 1.0);
+  }
+  return cost;
+}
+
+double
+CostModel::getMemoryCost(const Instruction & inst, size_t width, const VectorizationInfo * vecInfo, RegionCost & cost) const {
+  const auto * load = dyn_cast<LoadInst>(&inst);
+  const auto * store = dyn_cast<StoreInst>(&inst);
+  assert(load || store);
+
+  const Value * ptr = load ? load->getPointerOperand() : store->getPointerOperand();
+  Type * accessTy = load ? load->getType() : store->getValueOperand()->getType();
+  Align alignment = load ? load->getAlign() : store->getAlign();
+  unsigned addrSpace = ptr->getType()->getPointerAddressSpace();
+
+  // uniform access: a single scalar load/store (NatBuilder stores the last active lane)
+  VectorShape addrShape = getShape(*ptr, vecInfo);
+  if (addrShape.isUniform()) {
+    double uniCost = getScalarCost(inst);
+    if (store && !getShape(*store->getValueOperand(), vecInfo).isUniform()) {
+      auto * vecTy = FixedVectorType::get(accessTy, width);
+      uniCost += ToCost(tti.getVectorInstrCost(Instruction::ExtractElement, vecTy), 1.0);
+    }
+    return uniCost;
+  }
+
+  if (!VectorType::isValidElementType(accessTy)) return getReplicationCost(inst, width);
+
+  auto * vecTy = FixedVectorType::get(accessTy, width);
+  const auto & layout = inst.getModule()->getDataLayout();
+  int byteSize = static_cast<int>(layout.getTypeStoreSize(accessTy));
+  bool needsMask = hasVaryingPredicate(*inst.getParent(), vecInfo);
+  unsigned opcode = inst.getOpcode();
+
+  // contiguous access (unknown address shapes are optimistically considered contiguous)
+  if (!addrShape.isDefined() || addrShape.isStrided(byteSize)) {
+    if (needsMask) {
+      ++cost.numMaskedAccesses;
+      return ToCost(tti.getMaskedMemoryOpCost(opcode, vecTy, alignment, addrSpace, CostKind), getReplicationCost(inst, width));
+    }
+    return ToCost(tti.getMemoryOpCost(opcode, vecTy, alignment, addrSpace, CostKind, &inst), getReplicationCost(inst, width));
+  }
+
+  // constant non-unit strides over the members of a record: one wide access + shuffles for all members of the group
+  if (addrShape.hasStridedShape()) {
+    ++cost.numInterleaved;
+    int64_t factor = addrShape.getStride() % byteSize == 0 ? addrShape.getStride() / byteSize : 0;
+    bool isGroupFactor = factor == 2 || factor == 3 || factor == 4 || factor == 8;
+    if (config.useInterleavedAccesses && isGroupFactor && !config.useAVL && !config.enableVP) {
+      // assume fully populated records (the group cost is shared by all of its members)
+      auto * wideTy = FixedVectorType::get(accessTy, width * factor);
+      SmallVector<unsigned, 8> indices;
+      for (unsigned i = 0; i < factor; ++i) indices.push_back(i);
+      InstructionCost groupCost = tti.getInterleavedMemoryOpCost(opcode, wideTy, factor, indices, alignment, addrSpace, CostKind, needsMask);
+      if (groupCost.isValid()) {
+        if (needsMask) ++cost.numMaskedAccesses;
+        return ToCost(groupCost, 0.0) / factor;
+      }
+    }
+  }
+
+  // otw lowered to gathers/scatters
+  store ? ++cost.numScatters : ++cost.numGathers;
+
+  double varyingCost;
+  pickVaryingLowering(*accessTy, addrSpace, alignment, width, store, needsMask, &varyingCost);
+  return varyingCost;
+}
+
+VaryingLowering
+CostModel::pickVaryingLowering(Type & accessTy, unsigned addrSpace, Align alignment, size_t width,
+                               bool isStore, bool needsMask, double * oCost) const {
+  auto * vecTy = FixedVectorType::get(&accessTy, width);
+  auto * ptrTy = PointerType::get(&accessTy, addrSpace);
+  auto * vecPtrTy = FixedVectorType::get(ptrTy, width);
+  auto * maskTy = FixedVectorType::get(Type::getInt1Ty(accessTy.getContext()), width);
+  unsigned opcode = isStore ? Instruction::Store : Instruction::Load;
+
+  // native gathers/scatters (and unmasked ones, which the backend scalarizes without branches)
+  bool isLegal = isStore ? tti.isLegalMaskedScatter(vecTy, alignment) : tti.isLegalMaskedGather(vecTy, alignment);
+  if (config.useScatterGatherIntrinsics && (isLegal || !needsMask)) {
+    if (oCost) *oCost = ToCost(tti.getGatherScatterOpCost(opcode, vecTy, nullptr, needsMask, alignment, CostKind), width * 4.0);
+    return VaryingLowering::Intrinsic;
+  }
+
+  // a single lane: extract the pointer (and value), access memory, insert the result
+  double laneCost = ToCost(tti.getVectorInstrCost(Instruction::ExtractElement, vecPtrTy), 1.0)
+                  + ToCost(tti.getMemoryOpCost(opcode, &accessTy, alignment, addrSpace, CostKind), 1.0)
+                  + ToCost(tti.getVectorInstrCost(isStore ? Instruction::ExtractElement : Instruction::InsertElement, vecTy), 1.0);
+  double maskLaneCost = needsMask ? ToCost(tti.getVectorInstrCost(Instruction::ExtractElement, maskTy), 1.0) : 0.0;
+
+  // blends execute every lane and redirect inactive lanes with a select
+  double selectCost = needsMask ? ToCost(tti.getCmpSelInstrCost(Instruction::Select, ptrTy, Type::getInt1Ty(accessTy.getContext()), CmpInst::BAD_ICMP_PREDICATE, CostKind), 1.0) : 0.0;
+  double blendCost = width * (laneCost + maskLaneCost + selectCost);
+
+  // cascades skip inactive lanes but branch on every lane
+  // (random masks: half the lanes are active and every other branch is mispredicted)
+  const double MispredictCost = 16.0;
+  double cascadeCost = width * (maskLaneCost + 0.5 * (laneCost + MispredictCost));
+
+  // the dummy slot of blends is an alloca and has to live in the same address space
+  bool canBlend = addrSpace == platInfo.getDataLayout().getAllocaAddrSpace();
+  if (canBlend && (!needsMask || blendCost <= cascadeCost)) {
+    if (oCost) *oCost = blendCost;
+    return VaryingLowering::Blend;
+  }
+
+  // masked intrinsics on targets without native support are expanded into an in-line cascade
+  if (oCost) *oCost = cascadeCost;
+  return config.useScatterGatherIntrinsics ? VaryingLowering::Intrinsic : VaryingLowering::Cascade;
+}
+
+double
+CostModel::getCallCost(const Instruction & inst, size_t width, const VectorizationInfo * vecInfo, RegionCost & cost) const {
+  const auto & call = cast<CallInst>(inst);
+  double scaCost = getScalarCost(inst);
+
+  auto * callee = call.getCalledFunction();
+  if (callee) {
+    // critical sections and trivial intrinsics are not replicated
+    if (IsCriticalSection(*callee) || IsVectorizableFunction(*callee)) return scaCost;
+
+    // assume that recursive vectorization will succeed
+    if (!callee->isDeclaration() && config.enableGreedyIPV) return scaCost;
+
+    // vectorizable LLVM intrinsics
+    Intrinsic::ID id = callee->getIntrinsicID();
+    auto * retTy = call.getType();
+    if (id != Intrinsic::not_intrinsic && VectorType::isValidElementType(retTy)) {
+      SmallVector<Type*, 4> vecArgTys;
+      for (const auto & arg : call.args()) {
+        vecArgTys.push_back(FixedVectorType::get(arg->getType(), width));
+      }
+      IntrinsicCostAttributes costAttrs(id, FixedVectorType::get(retTy, width), vecArgTys);
+      InstructionCost vecCost = tti.getIntrinsicInstrCost(costAttrs, CostKind);
+      if (vecCost.isValid()) return ToCost(vecCost, scaCost);
+    }
+
+    // vector implementations provided by the resolver chain (SLEEF, etc)
+    VectorShapeVec argShapes;
+    for (const auto & arg : call.args()) {
+      VectorShape argShape = getShape(*arg, vecInfo);
+      argShapes.push_back(argShape.isDefined() ? argShape : VectorShape::varying());
+    }
+    const bool needsPredicate = hasVaryingPredicate(*inst.getParent(), vecInfo);
+    auto resolver = platInfo.getResolver(callee->getName(), *callee->getFunctionType(), argShapes, width, needsPredicate);
+    if (resolver) {
+      return scaCost * resolver->requestCostEstimate().cost;
+    }
+  }
+
+  // fallback to replication (cascaded if this call has side effects under a varying predicate)
+  double replCost = getReplicationCost(inst, width);
+  if (hasVaryingPredicate(*inst.getParent(), vecInfo) && call.mayHaveSideEffects()) {
+    ++cost.numCascadedCalls;
+    replCost += width * ToCost(tti.getCFInstrCost(Instruction::Br, CostKind), 1.0);
+  }
+  return replCost;
+}
+
+double
+CostModel::getVectorCost(const Instruction & inst, size_t width, const VectorizationInfo * vecInfo, RegionCost & cost) const {
+  if (isa<DbgInfoIntrinsic>(inst)) return 0.0;
+
+  if (isa<LoadInst>(inst) || isa<StoreInst>(inst)) {
+    return getMemoryCost(inst, width, vecInfo, cost);
+  }
+
+  // uniform instructions remain scalar
+  VectorShape shape = getShape(inst, vecInfo);
+  if (shape.isUniform()) return getScalarCost(inst);
+
+  if (isa<CallInst>(inst)) {
+    return getCallCost(inst, width, vecInfo, cost);
+  }
+
+  auto * instTy = inst.getType();
+  auto * boolTy = Type::getInt1Ty(inst.getContext());
+
+  // phis in divergent join blocks turn into blends
+  if (auto * phi = dyn_cast<PHINode>(&inst)) {
+    if (!vecInfo || !vecInfo->isJoinDivergent(*phi->getParent())) return 0.0;
+    if (!VectorType::isValidElementType(instTy)) return getReplicationCost(inst, width);
+    size_t numBlends = phi->getNumIncomingValues() - 1;
+    cost.numBlends += numBlends;
+    auto * vecTy = FixedVectorType::get(instTy, width);
+    auto * maskTy = FixedVectorType::get(boolTy, width);
+    return numBlends * ToCost(tti.getCmpSelInstrCost(Instruction::Select, vecTy, maskTy, CmpInst::BAD_ICMP_PREDICATE, CostKind), 1.0);
+  }
+
+  // branches are folded or remain uniform
+  if (inst.isTerminator()) return getScalarCost(inst);
+
+  // NatBuilder scalarizes the index computation of strided pointers
+  if (isa<GetElementPtrInst>(inst) && (!shape.isDefined() || shape.hasStridedShape()) && config.scalarizeIndexComputation) {
+    return getScalarCost(inst);
+  }
+
+  if (instTy->isVoidTy() || !VectorType::isValidElementType(instTy)) {
+    return getReplicationCost(inst, width);
+  }
+  auto * vecTy = FixedVectorType::get(instTy, width);
+
+  InstructionCost vecCost = InstructionCost::getInvalid();
+  if (isa<BinaryOperator>(inst) || isa<UnaryOperator>(inst)) {
+    vecCost = tti.getArithmeticInstrCost(inst.getOpcode(), vecTy, CostKind);
+
+  } else if (auto * cast = dyn_cast<CastInst>(&inst)) {
+    auto * srcTy = cast->getSrcTy();
+    if (VectorType::isValidElementType(srcTy)) {
+      vecCost = tti.getCastInstrCost(inst.getOpcode(), vecTy, FixedVectorType::get(srcTy, width), TargetTransformInfo::CastContextHint::None, CostKind);
+    }
+
+  } else if (auto * cmp = dyn_cast<CmpInst>(&inst)) {
+    auto * opTy = cmp->getOperand(0)->getType();
+    if (VectorType::isValidElementType(opTy)) {
+      vecCost = tti.getCmpSelInstrCost(inst.getOpcode(), FixedVectorType::get(opTy, width), vecTy, cmp->getPredicate(), CostKind);
+    }
+
+  } else if (auto * sel = dyn_cast<SelectInst>(&inst)) {
+    Type * condTy = getShape(*sel->getCondition(), vecInfo).isUniform() ? (Type*) boolTy : FixedVectorType::get(boolTy, width);
+    vecCost = tti.getCmpSelInstrCost(Instruction::Select, vecTy, condTy, CmpInst::BAD_ICMP_PREDICATE, CostKind);
+
+  } else if (auto * gep = dyn_cast<GetElementPtrInst>(&inst)) {
+    // vector of pointers: one vector add (and scaling) per index
+    const auto & layout = inst.getModule()->getDataLayout();
+    auto * idxTy = FixedVectorType::get(layout.getIndexType(gep->getPointerOperandType()), width);
+    vecCost = tti.getArithmeticInstrCost(Instruction::Add, idxTy, CostKind);
+    vecCost *= (InstructionCost::CostType) gep->getNumIndices();
+  }
+
+  return ToCost(vecCost, getReplicationCost(inst, width));
+}
+
+RegionCost
+CostModel::estimateRegionCost(const Region & region, size_t width, const VectorizationInfo * vecInfo) const {
+  RegionCost cost(width);
+
+  region.for_blocks([&](const BasicBlock & block) {
+    for (const auto & inst : block) {
+      cost.scalarCost += width * getScalarCost(inst);
+      cost.vectorCost += getVectorCost(inst, width, vecInfo, cost);
+    }
+    return true;
+  });
+
+  IF_DEBUG_CM { errs() << "cm: "; cost.print(errs()); errs() << "\n"; }
+  return cost;
+}
+
+size_t
+CostModel::pickProfitableWidth(const Region & region, size_t maxWidth, const VectorizationInfo * vecInfo, RegionCost * oCost) const {
+  RegionCost bestCost(1);
+  bool foundProfitable = false;
+
+  for (size_t width = maxWidth; width > 1; width /= 2) {
+    RegionCost cost = estimateRegionCost(region, width, vecInfo);
+    if (!foundProfitable && width == maxWidth) bestCost = cost; // report the widest estimate if nothing pays off
+    if (!cost.isProfitable()) continue;
+
+    // prefer the widest width with the best speedup
+    if (!foundProfitable || cost.getSpeedup() > bestCost.getSpeedup()) {
+      bestCost = cost;
+      foundProfitable = true;
+    }
+  }
+
+  IF_DEBUG_CM {
+    errs() << "cm: picked width " << (foundProfitable ? bestCost.vectorWidth : 1) << " for region " << region.str() << "\n";
+  }
+
+  if (oCost) *oCost = bestCost;
+  return foundProfitable ? bestCost.vectorWidth : 1;
+}
+
 }
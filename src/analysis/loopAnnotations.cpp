@@ -24,6 +24,7 @@ LoopMD::print(raw_ostream & out) const {
   if (vectorizeEnable.isSet()) out << "vectorizeEnable = " << vectorizeEnable.get() << ", ";
   if (minDepDist.isSet()) out << "minDepDist = " << DepDistToString(minDepDist.get()) << ", ";
   if (explicitVectorWidth.isSet()) out << "explicitVectorWidth = " << explicitVectorWidth.get() << ", ";
+  if (epilogueMode.isSet()) out << "epilogueMode = " << epilogueMode.get() << ", ";
   out << "}";
   return out;
 }
@@ -67,6 +68,13 @@ OptimisticJoin(LoopMD && A, LoopMD && B) {
     md.explicitVectorWidth = std::min<iter_t>(A.explicitVectorWidth.safeGet(ParallelDistance), B.explicitVectorWidth.safeGet(ParallelDistance));
   }
 
+  // the more specific (RV) epilogue annotation takes precedence
+  if (B.epilogueMode.isSet()) {
+    md.epilogueMode = B.epilogueMode.get();
+  } else if (A.epilogueMode.isSet()) {
+    md.epilogueMode = A.epilogueMode.get();
+  }
+
   return md;
 }
 
@@ -116,6 +124,10 @@ GetLoopAnnotation(llvm::Loop & L) {
     } else if (text.equals("llvm.loop.vectorize.width")) {
       llvmAnnot.explicitVectorWidth = cast<ConstantInt>(Cst->getValue())->getSExtValue();
 
+    } else if (text.equals("llvm.loop.vectorize.predicate.enable")) {
+      // tail folding requested -> single masked epilogue iteration (mode 2)
+      if (!Cst->getValue()->isNullValue()) llvmAnnot.epilogueMode = 2;
+
     } else if (text.equals("rv.loop.vectorize.enable")) {
       const bool vectorizeEnable = !Cst->getValue()->isNullValue();
       rvAnnot.vectorizeEnable = vectorizeEnable;
@@ -129,6 +141,10 @@ GetLoopAnnotation(llvm::Loop & L) {
 
     } else if (text.equals("rv.loop.mindepdist")) {
       rvAnnot.minDepDist = cast<ConstantInt>(Cst->getValue())->getSExtValue();
+
+    } else if (text.equals("rv.loop.vectorize.epilogue")) {
+      // 0 = scalar, 1 = half width, 2 = masked
+      rvAnnot.epilogueMode = cast<ConstantInt>(Cst->getValue())->getSExtValue();
     }
   }
 
@@ -43,18 +43,22 @@ Config::Config()
 
 // backend defaults
 , scalarizeIndexComputation(true)
-, useScatterGatherIntrinsics(true)
+, useScatterGatherIntrinsics(!CheckFlag("RV_DISABLE_GATHERSCATTER"))
 , enableMaskedMove(true)
 , useSafeDivisors(true)
+, useMaskedMath(!CheckFlag("RV_DISABLE_MASKEDMATH"))
+, useInterleavedAccesses(!CheckFlag("RV_DISABLE_INTERLEAVED"))
+, enableMaskProfiling(CheckFlag("RV_MASK_PROFILE"))
 
 // optimization defaults
 , enableSplitAllocas(!CheckFlag("RV_DISABLE_SPLITALLOCAS"))
 , enableStructOpt(!CheckFlag("RV_DISABLE_STRUCTOPT"))
 , enableSROV(!CheckFlag("RV_DISABLE_SROV"))
 , enableIRPolish(CheckFlag("RV_ENABLE_POLISH"))
-, enableHeuristicBOSCC(CheckFlag("RV_EXP_BOSCC"))
-, enableCoherentIF(CheckFlag("RV_EXP_CIF"))
+, enableHeuristicBOSCC(!CheckFlag("RV_DISABLE_BOSCC"))
+, enableCoherentIF(!CheckFlag("RV_DISABLE_CIF"))
 , enableOptimizedBlends(!CheckFlag("RV_NO_BLENDOPT"))
+, enableCostModel(!CheckFlag("RV_DISABLE_COSTMODEL"))
 
 // enable greedy inter-procedural vectorization
 , enableGreedyIPV(CheckFlag("RV_IPV"))
@@ -73,16 +77,44 @@ Config::Config()
 , useAVX512(false)
 , useNEON(false)
 , useADVSIMD(false)
+, loopVecTargets("ve,sse,avx,avx2,avx512")
 
 // codegen flags
 , useAVL(CheckFlag("RV_FORCE_AVL")) 
+, minVersionWidth(0)
+, epilogueMode(EM_Scalar)
 {
+  // profile the plain linearized code (skipped blocks would not record their all-false executions)
+  if (enableMaskProfiling) {
+    enableHeuristicBOSCC = false;
+    enableCoherentIF = false;
+  }
+
   const char *ULP = getenv("RV_ACCURACY");
   if (ULP) {
     int CustomBound = atoi(ULP);
     if (CustomBound > 0) maxULPErrorBound = CustomBound;
     else Report() << "ERROR: Expected an > 0 integer for RV_ACCURACY\n";
   }
+
+  const char *VersionWidth = getenv("RV_MIN_VERSION_WIDTH");
+  if (VersionWidth) {
+    int CustomWidth = atoi(VersionWidth);
+    if (CustomWidth >= 0) minVersionWidth = CustomWidth;
+    else Report() << "ERROR: Expected an >= 0 integer for RV_MIN_VERSION_WIDTH\n";
+  }
+
+  const char *Targets = getenv("RV_LOOPVEC_TARGETS");
+  if (Targets) loopVecTargets = Targets;
+
+  const char *Epilogue = getenv("RV_EPILOGUE");
+  if (Epilogue) {
+    std::string EpilogueText = Epilogue;
+    if (EpilogueText == "scalar") epilogueMode = EM_Scalar;
+    else if (EpilogueText == "half") epilogueMode = EM_HalfWidth;
+    else if (EpilogueText == "masked") epilogueMode = EM_Masked;
+    else Report() << "ERROR: Expected one of scalar, half, masked for RV_EPILOGUE\n";
+  }
 }
 
 Config
@@ -181,6 +213,29 @@ Config::createForFunction(Function & F) {
   return config;
 }
 
+std::string
+Config::getTargetISA() const {
+  if (useVE) return "ve";
+  if (useAVX512) return "avx512";
+  if (useAVX2) return "avx2";
+  if (useAVX) return "avx";
+  if (useSSE) return "sse";
+  if (useADVSIMD) return "advsimd";
+  if (useNEON) return "neon";
+  return "none";
+}
+
+bool
+Config::isLoopVecTarget() const {
+  std::string isa = getTargetISA();
+  bool found = false;
+  for_elems(loopVecTargets, [&](StringRef elem) {
+    found = elem.trim() == "all" || elem.trim() == isa;
+    return !found;
+  });
+  return found;
+}
+
 std::string
 to_string(Config::VAMethod vam) {
   switch(vam) {
@@ -193,6 +248,17 @@ to_string(Config::VAMethod vam) {
   }
 }
 
+std::string
+to_string(Config::EpilogueMode em) {
+  switch(em) {
+    case Config::EM_Scalar: return "scalar";
+    case Config::EM_HalfWidth: return "half";
+    case Config::EM_Masked: return "masked";
+    default:
+        abort(); // invalid epilogue mode
+  }
+}
+
 static void
 printVAFlags(const Config & config, llvm::raw_ostream & out) {
     out << "VA:   " << to_string(config.vaMethod) << ", foldAllBranches = " << config.foldAllBranches;
@@ -201,7 +267,10 @@ printVAFlags(const Config & config, llvm::raw_ostream & out) {
 static void
 printNativeFlags(const Config & config, llvm::raw_ostream & out) {
    out << "nat:  useScatterGather = " << config.useScatterGatherIntrinsics
-       << ", useSafeDiv = " << config.useSafeDivisors;
+       << ", useSafeDiv = " << config.useSafeDivisors
+       << ", useMaskedMath = " << config.useMaskedMath
+       << ", useInterleaved = " << config.useInterleavedAccesses
+       << ", maskProfiling = " << config.enableMaskProfiling;
 }
 
 static void
@@ -212,15 +281,18 @@ printOptFlags(const Config & config, llvm::raw_ostream & out) {
         << ", enableHeuristicBOSCC = " << config.enableHeuristicBOSCC
         << ", enableCoherentIF = " << config.enableCoherentIF
         << ", enableOptimizedBlends = " << config.enableOptimizedBlends
+        << ", enableCostModel = " << config.enableCostModel
         << ", enableIRPolish = " << config.enableIRPolish
         << ", greedyIPV = " << config.enableGreedyIPV
         << ", maxULPErrorBound = " << ulp_to_string(config.maxULPErrorBound)
-        << ", useAVL = " << config.useAVL << "\n";
+        << ", useAVL = " << config.useAVL
+        << ", minVersionWidth = " << config.minVersionWidth
+        << ", epilogue = " << to_string(config.epilogueMode) << "\n";
 }
 
 static void
 printFeatureFlags(const Config & config, llvm::raw_ostream & out) {
-  out << "arch: useSSE = " << config.useSSE << ", useAVX = " << config.useAVX << ", useAVX2 = " << config.useAVX2 << ", useAVX512 = " << config.useAVX512 << ", useNEON = " << config.useNEON << ", useADVSIMD = " << config.useADVSIMD << ", useVE = " << config.useVE << "\n";
+  out << "arch: useSSE = " << config.useSSE << ", useAVX = " << config.useAVX << ", useAVX2 = " << config.useAVX2 << ", useAVX512 = " << config.useAVX512 << ", useNEON = " << config.useNEON << ", useADVSIMD = " << config.useADVSIMD << ", useVE = " << config.useVE << ", loopVecTargets = " << config.loopVecTargets << "\n";
 }
 
 
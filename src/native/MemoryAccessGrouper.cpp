@@ -40,10 +40,12 @@ MemoryGroup::print(raw_ostream & out) const {
 
 MemoryGroup::MemoryGroup(const SCEV *scev) :
   topIdx(1),
+  lowOffset(0),
   elements(1, scev) {}
 
 MemoryGroup::MemoryGroup() :
   topIdx(0),
+  lowOffset(0),
   elements() {}
 
 void MemoryGroup::insert(const SCEV *scev, int offset) {
@@ -53,7 +55,7 @@ void MemoryGroup::insert(const SCEV *scev, int offset) {
 
   } else if (offset >= 0) {
     // resize if necessary
-    if(offset >= static_cast<int>(topIdx))
+    if(offset >= static_cast<int>(elements.size()))
       elements.resize(std::max<unsigned>((unsigned) (elements.size() * 2), (unsigned) offset + 1), nullptr);
 
     elements[offset] = scev;
@@ -72,6 +74,7 @@ void MemoryGroup::insert(const SCEV *scev, int offset) {
 
     elements[0] = scev;
     topIdx = topIdx + shiftValue;
+    lowOffset += offset;
   }
 }
 
@@ -84,19 +87,36 @@ MemoryAccessGrouper::MemoryAccessGrouper(ScalarEvolution &SE, unsigned laneByteS
   laneByteSize(laneByteSize)
 {}
 
+MemoryAccessGrouper::BucketKey
+MemoryAccessGrouper::getBucketKey(const SCEV *addrSCEV) {
+  const SCEV *stepSCEV = nullptr;
+  if (const auto *addRec = dyn_cast<SCEVAddRecExpr>(addrSCEV)) {
+    if (addRec->isAffine()) stepSCEV = addRec->getStepRecurrence(SE);
+  }
+  const SCEV *baseSCEV = addrSCEV->getType()->isPointerTy() ? SE.getPointerBase(addrSCEV) : nullptr;
+  return BucketKey(baseSCEV, stepSCEV);
+}
+
 const SCEV *MemoryAccessGrouper::add(Value *addrVal) {
   const SCEV *addrSCEV = SE.getSCEV(addrVal);
   assert(addrSCEV && "can't compute SCEV");
 
-  // try to find existing group with constant offset to addrSCEV
-  for (MemoryGroup &group : memoryGroups) {
-    int64_t offset = 0;
-    IF_DEBUG_MG errs() << "DIFFING " << *addrSCEV << " and " << *group[0] <<"\n";
-    if (!getConstantDiff(addrSCEV, group[0], offset)) {
+  // already grouped
+  if (scevGroups.count(addrSCEV)) return addrSCEV;
+
+  // try to find existing group with constant offset to addrSCEV (only in the bucket of its base pointer)
+  auto &bucket = buckets[getBucketKey(addrSCEV)];
+  for (unsigned groupIdx : bucket) {
+    MemoryGroup &group = memoryGroups[groupIdx];
+    int64_t anchorOffset = 0;
+    IF_DEBUG_MG errs() << "DIFFING " << *addrSCEV << " and " << *groupAnchors[groupIdx] <<"\n";
+    if (!getConstantDiff(addrSCEV, groupAnchors[groupIdx], anchorOffset)) {
       IF_DEBUG_MG errs() << "\tnon const!\n";
       continue;
     }
 
+    // offset relative to the lowest element
+    int64_t offset = anchorOffset - group.getLowOffset();
     IF_DEBUG_MG errs() << "\tresult: " << offset << "\n";
 
     if (std::abs(offset) >= groupLimit) continue;
@@ -104,15 +124,29 @@ const SCEV *MemoryAccessGrouper::add(Value *addrVal) {
     IF_DEBUG_MG errs() << "== " << offset << "\n";
 
     group.insert(addrSCEV, offset);
+    scevGroups[addrSCEV] = std::make_pair(groupIdx, anchorOffset);
     return addrSCEV;
   }
 
   // new group
+  unsigned groupIdx = memoryGroups.size();
   MemoryGroup freshGroup(addrSCEV);
   memoryGroups.push_back(freshGroup);
+  groupAnchors.push_back(addrSCEV);
+  bucket.push_back(groupIdx);
+  scevGroups[addrSCEV] = std::make_pair(groupIdx, 0);
   return addrSCEV;
 }
 
+bool
+MemoryAccessGrouper::getGroupOffset(const SCEV *scev, unsigned &oGroupIdx, int64_t &oOffset) const {
+  auto itGroup = scevGroups.find(scev);
+  if (itGroup == scevGroups.end()) return false;
+  oGroupIdx = itGroup->second.first;
+  oOffset = itGroup->second.second - memoryGroups[oGroupIdx].getLowOffset();
+  return true;
+}
+
 static int64_t
 GetConstValue(const SCEV & cScev) {
   return cast<const SCEVConstant>(cScev).getAPInt().getSExtValue();
@@ -239,8 +273,16 @@ MemoryAccessGrouper::getConstantDiff(const llvm::SCEV * A, const llvm::SCEV * B,
       return true;
     }
 
+  // same recurrence with a constant offset in the start value ({C + X,+,S} and {X,+,S})
+    case scAddRecExpr: {
+      auto * aRec = cast<SCEVAddRecExpr>(A);
+      auto * bRec = cast<SCEVAddRecExpr>(B);
+      if (aRec->getLoop() != bRec->getLoop() || !aRec->isAffine() || !bRec->isAffine()) return false;
+      if (!equals(aRec->getStepRecurrence(SE), bRec->getStepRecurrence(SE))) return false;
+      return getConstantDiff(aRec->getStart(), bRec->getStart(), oDelta);
+    }
+
     case scUDivExpr:
-    case scAddRecExpr:
     case scUMaxExpr:
     case scSMaxExpr:
     case scUnknown:
@@ -259,12 +301,10 @@ MemoryAccessGrouper::getConstantDiff(const llvm::SCEV * A, const llvm::SCEV * B,
 const MemoryGroup & MemoryAccessGrouper::getMemoryGroup(const SCEV *scev) {
   static MemoryGroup emptyGroup;
 
-  for (MemoryGroup &group : memoryGroups) {
-    auto findIt = std::find(group.begin(), group.end(), scev);
-    if (findIt != group.end())
-      return group;
-  }
-  return emptyGroup;
+  auto itGroup = scevGroups.find(scev);
+  if (itGroup == scevGroups.end())
+    return emptyGroup;
+  return memoryGroups[itGroup->second.first];
 }
 
 // MemoryAccessGrouper_END
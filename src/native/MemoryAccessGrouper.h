@@ -12,10 +12,13 @@
 
 #include <llvm/Analysis/ScalarEvolution.h>
 #include <llvm/Analysis/MemoryDependenceAnalysis.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
 
 namespace rv {
   class MemoryGroup {
     unsigned topIdx;
+    int64_t lowOffset; // offset of elements[0] relative to the first element inserted into the group
     std::vector<const llvm::SCEV *> elements;
 
   public:
@@ -25,6 +28,7 @@ namespace rv {
     void insert(const llvm::SCEV *scev, int offset);
     const llvm::SCEV *operator[](int i) const { return elements[i]; }
     unsigned size() const { return topIdx; }
+    int64_t getLowOffset() const { return lowOffset; }
     std::vector<const llvm::SCEV *>::iterator begin() { return elements.begin(); }
     std::vector<const llvm::SCEV *>::iterator end() { return elements.end(); }
 
@@ -37,6 +41,15 @@ namespace rv {
     unsigned laneByteSize;
     bool getConstantOffset(const llvm::SCEV *a, const llvm::SCEV *b, int &offset);
 
+    // addresses can only have a constant offset if they share the same base pointer and stride
+    using BucketKey = std::pair<const llvm::SCEV *, const llvm::SCEV *>;
+    BucketKey getBucketKey(const llvm::SCEV *addrSCEV);
+    llvm::DenseMap<BucketKey, llvm::SmallVector<unsigned, 4>> buckets; // group indices
+    std::vector<const llvm::SCEV *> groupAnchors; // first element inserted into each group
+
+    // group index and offset relative to the group anchor
+    llvm::DenseMap<const llvm::SCEV *, std::pair<unsigned, int64_t>> scevGroups;
+
   public:
     std::vector<MemoryGroup> memoryGroups;
 
@@ -49,6 +62,9 @@ namespace rv {
     MemoryAccessGrouper(llvm::ScalarEvolution &SE, unsigned laneByteSize);
     const llvm::SCEV *add(llvm::Value *addrVal);
     const MemoryGroup & getMemoryGroup(const llvm::SCEV *scev);
+
+    // index of the group of \p scev and its byte offset from the lowest address in the group (false if not added)
+    bool getGroupOffset(const llvm::SCEV *scev, unsigned &oGroupIdx, int64_t &oOffset) const;
   };
 
   class InstructionGroup {
@@ -14,9 +14,10 @@
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Metadata.h>
 #include "llvm/IR/IntrinsicsX86.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
 #include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 #include <report.h>
-#include <fstream>
 
 
 #include "NatBuilder.h"
@@ -25,6 +26,8 @@
 #include "utils/rvTools.h"
 #include "rv/transform/redTools.h"
 #include "rv/analysis/reductionAnalysis.h"
+#include "rv/analysis/MemoryAccessAnalysis.h"
+#include "rv/analysis/costModel.h"
 #include "rv/region/Region.h"
 #include "rv/rvDebug.h"
 #include "rv/intrinsics.h"
@@ -80,24 +83,6 @@ CreateScalarBroadcast(IRBuilder<> & builder, Value & scaValue, int elemCount) {
 
 namespace rv {
 
-unsigned numMaskedGather, numMaskedScatter, numGather, numScatter,
-    numInterMaskedLoads, numInterMaskedStores, numInterLoads, numInterStores,
-    numContMaskedLoads, numContMaskedStores, numContLoads, numContStores, numUniMaskedLoads, numUniMaskedStores,
-    numUniLoads, numUniStores, numUniAllocas, numSlowAllocas;
-
-unsigned numVecGEPs, numScalGEPs, numInterGEPs, numVecBCs, numScalBCs;
-unsigned numVecCalls, numSemiCalls, numFallCalls, numCascadeCalls, numRVIntrinsics;
-unsigned numScalarized, numVectorized, numFallbacked, numLazy;
-
-unsigned numConstLoadMasks, numUniLoadMasks, numVarLoadMasks;
-unsigned numConstStoreMasks, numUniStoreMasks, numVarStoreMasks;
-
-bool DumpStatistics(std::string &file) {
-  char * envVal = getenv("NAT_STAT_DUMP");
-  if (!envVal) return false;
-  else return !(file = envVal).empty();
-}
-
 Value*
 NatBuilder::getSplat(Constant* Elt) {
   return ConstantVector::getSplat(ElementCount::getFixed(vectorWidth()), Elt);
@@ -113,88 +98,38 @@ NatBuilder::getIndexTy(Value * val) const {
 void NatBuilder::printStatistics() {
   // memory statistics
   Report() << "nat memory:\n"
-           << "\tuni allocas: " << numUniAllocas << "\n"
-           << "\tslow allocas: " << numSlowAllocas << "\n"
-           << "\tscatter/gather: " << numScatter << "/" << numGather << ", masked " << numMaskedScatter << "/" << numMaskedGather << "\n"
-           << "\tinter load/store: " << numInterLoads << "/" << numInterStores << ", masked " << numInterMaskedLoads << "/" << numInterMaskedStores << "\n"
-           << "\tcons load/store: " << numContLoads << "/" << numContStores << ", masked " <<  numContMaskedLoads << "/" << numContMaskedStores << "\n"
-           << "\tuni load/store: " << numUniLoads << "/" << numUniStores << ", masked " << numUniMaskedLoads << "/" << numUniMaskedStores << "\n"
-           << "\tstore masks (c/u/v): " << numConstStoreMasks << "/" << numUniStoreMasks << "/" << numVarStoreMasks << "\n"
-           << "\tload  masks (c/u/v): " << numConstLoadMasks << "/" << numUniLoadMasks << "/" << numVarLoadMasks << "\n";
+           << "\tuni allocas: " << stats.numUniAllocas << "\n"
+           << "\tslow allocas: " << stats.numSlowAllocas << "\n"
+           << "\tscatter/gather: " << stats.numScatter << "/" << stats.numGather << ", masked " << stats.numMaskedScatter << "/" << stats.numMaskedGather << "\n"
+           << "\tinter load/store: " << stats.numInterLoads << "/" << stats.numInterStores << ", masked " << stats.numInterMaskedLoads << "/" << stats.numInterMaskedStores << "\n"
+           << "\tcons load/store: " << stats.numContLoads << "/" << stats.numContStores << ", masked " <<  stats.numContMaskedLoads << "/" << stats.numContMaskedStores << "\n"
+           << "\tuni load/store: " << stats.numUniLoads << "/" << stats.numUniStores << ", masked " << stats.numUniMaskedLoads << "/" << stats.numUniMaskedStores << "\n"
+           << "\tstore masks (c/u/v): " << stats.numConstStoreMasks << "/" << stats.numUniStoreMasks << "/" << stats.numVarStoreMasks << "\n"
+           << "\tload  masks (c/u/v): " << stats.numConstLoadMasks << "/" << stats.numUniLoadMasks << "/" << stats.numVarLoadMasks << "\n";
 
 #if 0
   // lazy statistics
   Report() << "GEPs/BCs\n";
-  Report() << "GEPs: " << numVecGEPs << "/" << numScalGEPs << "/" << numInterGEPs << " vec/scal/inter\n";
-  Report() << "BCs: " << numVecBCs << "/" << numScalBCs << " vec/scal\n";
+  Report() << "GEPs: " << stats.numVecGEPs << "/" << stats.numScalGEPs << "/" << stats.numInterGEPs << " vec/scal/inter\n";
+  Report() << "BCs: " << stats.numVecBCs << "/" << stats.numScalBCs << " vec/scal\n";
   Report() << "\n";
 #endif
 
   // call statistics
   Report() << "nat calls:\n"
-           << "\tVectorized: " << numVecCalls << "/" << numSemiCalls << " fully/semi\n"
-           << "\tReplicated: " << numFallCalls << "/" << numCascadeCalls << " replicated/cascaded\n"
-           << "\tRV Intrinsics: " << numRVIntrinsics << " intrinsics\n";
+           << "\tVectorized: " << stats.numVecCalls << "/" << stats.numSemiCalls << " fully/semi\n"
+           << "\tReplicated: " << stats.numFallCalls << "/" << stats.numCascadeCalls << " replicated/cascaded\n"
+           << "\tRV Intrinsics: " << stats.numRVIntrinsics << " intrinsics\n";
 
 #if 0
   // general statistics
   Report() << "Everything else\n";
-  Report() << "Scalarized: " << numScalarized << " instructions\n";
-  Report() << "Vectorized: " << numVectorized << " instructions\n";
-  Report() << "Replicated: " << numFallbacked << " instructions\n";
-  Report() << "Lazy Instructions: " << numLazy << " instructions\n";
+  Report() << "Scalarized: " << stats.numScalarized << " instructions\n";
+  Report() << "Vectorized: " << stats.numVectorized << " instructions\n";
+  Report() << "Replicated: " << stats.numFallbacked << " instructions\n";
+  Report() << "Lazy Instructions: " << stats.numLazy << " instructions\n";
   Report() << "\n";
 #endif
-
-  std::string fileName;
-  if (!DumpStatistics(fileName))
-    return;
-
-  std::ofstream file;
-  file.open(fileName, std::fstream::app);
-
-  // header
-  file << "Feature,Frequency\n";
-
-  // memory statistics
-  file << (config.useScatterGatherIntrinsics ? "masked-scatter," : "masked-casc-store,") << numMaskedScatter << "\n";
-  file << (config.useScatterGatherIntrinsics ? "masked-gather," : "masked-casc-load,") << numMaskedGather << "\n";
-  file << (config.useScatterGatherIntrinsics ? "scatter," : "cascade-store,") << numScatter << "\n";
-  file << (config.useScatterGatherIntrinsics ? "gather," : "cascade-load,")  << numGather << "\n";
-  file << "interleaved-masked-load," << numInterMaskedLoads << "\n";
-  file << "interleaved-masked-store," << numInterMaskedStores << "\n";
-  file << "interleaved-load," << numInterLoads << "\n";
-  file << "interleaved-store," << numInterStores << "\n";
-  file << "contiguous-masked-load," << numContMaskedLoads << "\n";
-  file << "contiguous-masked-store," << numContMaskedStores << "\n";
-  file << "contiguous-load," << numContLoads << "\n";
-  file << "contiguous-store," << numContStores << "\n";
-  file << "uniform-masked-load," << numUniMaskedLoads << "\n";
-  file << "uniform-masked-store," << numUniMaskedStores << "\n";
-  file << "uniform-load," << numUniLoads << "\n";
-  file << "uniform-store," << numUniStores << "\n";
-
-  // lazy statistics
-  file << "vector-GEP," << numVecGEPs << "\n";
-  file << "scalar-GEP," << numScalGEPs << "\n";
-  file << "interleaved-GEP," << numInterGEPs << "\n";
-  file << "vector-BC," << numVecBCs << "\n";
-  file << "scalar-BC," << numScalBCs << "\n";
-
-  // call statistics
-  file << "vec-call," << numVecCalls << "\n";
-  file << "semi-vec-call," << numSemiCalls << "\n";
-  file << "replicated-call," << numFallCalls << "\n";
-  file << "cascaded-call," << numCascadeCalls << "\n";
-  file << "rv-intrinsic," << numRVIntrinsics << "\n";
-
-  // general statistics
-  file << "scalarized," << numScalarized << "\n";
-  file << "vectorized," << numVectorized << "\n";
-  file << "replicated," << numFallbacked << "\n";
-  file << "lazy-instr," << numLazy << "\n";
-
-  file.close();
 }
 
 VectorShape NatBuilder::getVectorShape(const Value &val) const {
@@ -209,17 +144,21 @@ NatBuilder::NatBuilder(Config _config, PlatformInfo &_platInfo, VectorizationInf
     platInfo(_platInfo),
     vecInfo(_vecInfo),
     dominatorTree(FAM.getResult<DominatorTreeAnalysis>(vecInfo.getScalarFunction())),
+    postDomTree(FAM.getCachedResult<PostDominatorTreeAnalysis>(vecInfo.getScalarFunction())),
+    loopInfo(FAM.getCachedResult<LoopAnalysis>(vecInfo.getScalarFunction())),
     memDepRes(FAM.getResult<MemoryDependenceAnalysis>(vecInfo.getScalarFunction())),
     SE(FAM.getResult<ScalarEvolutionAnalysis>(vecInfo.getScalarFunction())),
+    FAM(FAM),
     reda(_reda),
     undeadMasks(vecInfo, FAM),
+    costModel(_platInfo.getTTI() ? std::make_unique<CostModel>(_platInfo, config) : nullptr),
     layout(_vecInfo.getScalarFunction().getParent()),
     i1Ty(IntegerType::get(_vecInfo.getMapping().vectorFn->getContext(), 1)),
     i32Ty(IntegerType::get(_vecInfo.getMapping().vectorFn->getContext(), 32)),
     vecMaskArg(nullptr),
+    stats(),
     keepScalar(),
-    cascadeLoadMap(),
-    cascadeStoreMap(),
+    dummySlotMap(),
     vectorValueMap(),
     scalarValueMap(),
     basicBlockMap(),
@@ -237,6 +176,12 @@ void NatBuilder::vectorize(bool embedRegion, ValueToValueMapTy * vecInstMap) {
     reda.dump();
   }
 
+  // blocks of the host function (the vector loop is embedded in it)
+  SmallPtrSet<const BasicBlock *, 32> hostBlocks;
+  if (embedRegion && vecInfo.getRegion().isVectorLoop()) {
+    for (auto &BB : *vecFunc) hostBlocks.insert(&BB);
+  }
+
   // map arguments first
 
   if (!vecInfo.getRegion().isVectorLoop()) {
@@ -273,6 +218,13 @@ void NatBuilder::vectorize(bool embedRegion, ValueToValueMapTy * vecInstMap) {
   if (config.scalarizeIndexComputation)
     visitMemInstructions();
 
+  // compute sin/cos pairs with a single fused call
+  combineFusedMathCalls();
+
+  // combine strided accesses to the same records into wide loads/stores
+  if (config.useInterleavedAccesses)
+    visitInterleavedGroups();
+
   // create all BasicBlocks first and map them
   for (auto &block : *func) {
     if (!vecInfo.inRegion(block)) continue;
@@ -306,6 +258,9 @@ void NatBuilder::vectorize(bool embedRegion, ValueToValueMapTy * vecInstMap) {
   // revisit PHINodes now and add the mapped incoming values
   if (!phiVector.empty()) addValuesToPHINodes();
 
+  // lane activity counters
+  if (config.enableMaskProfiling) instrumentMaskProfile();
+
   // report statistics
   printStatistics();
 
@@ -332,26 +287,44 @@ void NatBuilder::vectorize(bool embedRegion, ValueToValueMapTy * vecInstMap) {
 
   if (!embedRegion) return;
 
+  // CFG changes for the dom tree update
+  std::vector<DominatorTree::UpdateType> cfgUpdates;
+
   // rewire branches outside the region to go to the region instead
   std::vector<BasicBlock *> oldBlocks;
+  std::vector<BasicBlock *> newBlocks;
   for (auto &BB : *vecFunc) {
     if (vecInfo.inRegion(BB)) {
       oldBlocks.push_back(&BB);
       continue; // keep old region
     }
+    if (!hostBlocks.count(&BB)) {
+      newBlocks.push_back(&BB);
+      continue; // vector code
+    }
     auto &termInst = *BB.getTerminator();
     for (unsigned i = 0; i < termInst.getNumOperands(); ++i) {
       auto *termOp = termInst.getOperand(i);
       auto *branchTarget = dyn_cast<BasicBlock>(termOp);
       if (!branchTarget) continue;
       if (vecInfo.inRegion(*branchTarget)) {
-        termInst.setOperand(i, getVectorBlock(*branchTarget, false));
+        auto *vecTarget = getVectorBlock(*branchTarget, false);
+        termInst.setOperand(i, vecTarget);
+        cfgUpdates.push_back({DominatorTree::Delete, &BB, branchTarget});
+        cfgUpdates.push_back({DominatorTree::Insert, &BB, vecTarget});
       }
     }
   }
 
+  for (auto *newBB : newBlocks) {
+    for (auto *succBB : successors(newBB))
+      cfgUpdates.push_back({DominatorTree::Insert, newBB, succBB});
+  }
+
   // remove old region
   for (auto *oldBB : oldBlocks) {
+    for (auto *succBB : successors(oldBB))
+      cfgUpdates.push_back({DominatorTree::Delete, oldBB, succBB});
     new UnreachableInst(oldBB->getContext(), oldBB);
     while (oldBB->size() > 1) {
       auto I = oldBB->begin();
@@ -364,6 +337,10 @@ void NatBuilder::vectorize(bool embedRegion, ValueToValueMapTy * vecInstMap) {
     // oldBB->eraseFromParent();
   }
 
+  // the analyses of the scalar function only describe the host of a vector loop
+  if (vecInfo.getRegion().isVectorLoop())
+    updateHostAnalyses(oldBlocks, newBlocks, cfgUpdates);
+
   IF_DEBUG_NAT {
     errs() << "-- Vectorized IR: --\n";
     for (auto *oldBB : oldBlocks) {
@@ -373,6 +350,70 @@ void NatBuilder::vectorize(bool embedRegion, ValueToValueMapTy * vecInstMap) {
   }
 }
 
+void NatBuilder::updateHostAnalyses(const std::vector<BasicBlock *> &oldBlocks,
+                                    const std::vector<BasicBlock *> &newBlocks,
+                                    ArrayRef<DominatorTree::UpdateType> cfgUpdates) {
+  // only the edges of the loop region changed
+  DomTreeUpdater DTU(&dominatorTree, postDomTree, DomTreeUpdater::UpdateStrategy::Eager);
+  DTU.applyUpdatesPermissive(cfgUpdates);
+
+  if (!loopInfo) return;
+
+  // vector blocks belong to the loop of their scalar block
+  DenseMap<const BasicBlock *, Loop *> blockLoops;
+  for (auto *oldBB : oldBlocks) {
+    auto *loop = loopInfo->getLoopFor(oldBB);
+    for (auto *vecBB : getMappedBlocks(oldBB))
+      blockLoops[vecBB] = loop;
+  }
+
+  // guard and cascade blocks belong to the loop of the block they were emitted into
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto *newBB : newBlocks) {
+      if (blockLoops.count(newBB)) continue;
+      for (auto *predBB : predecessors(newBB)) {
+        auto itPred = blockLoops.find(predBB);
+        if (itPred == blockLoops.end()) continue;
+        blockLoops[newBB] = itPred->second;
+        changed = true;
+        break;
+      }
+    }
+  }
+
+  // register the vector blocks with their loops
+  for (auto *newBB : newBlocks) {
+    auto itLoop = blockLoops.find(newBB);
+    if (itLoop == blockLoops.end() || !itLoop->second) continue;
+    itLoop->second->addBasicBlockToLoop(newBB, *loopInfo);
+  }
+
+  // the vector loops take over the headers and drop the scalar blocks
+  for (auto *oldBB : oldBlocks) {
+    if (!loopInfo->isLoopHeader(oldBB)) continue;
+    loopInfo->getLoopFor(oldBB)->moveToHeader(getVectorBlock(*oldBB, false));
+  }
+  for (auto *oldBB : oldBlocks) loopInfo->removeBlock(oldBB);
+
+  IF_DEBUG_NAT {
+    dominatorTree.verify();
+    loopInfo->verify(dominatorTree);
+  }
+}
+
+PreservedAnalyses NatBuilder::getPreservedAnalyses() const {
+  // whole-function vectorization creates the body of the vector function
+  if (!vecInfo.getRegion().isVectorLoop()) return PreservedAnalyses::none();
+
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  PA.preserve<PostDominatorTreeAnalysis>();
+  PA.preserve<LoopAnalysis>();
+  return PA;
+}
+
 void NatBuilder::vectorize(BasicBlock *const bb, BasicBlock *vecBlock) {
   assert(vecBlock && "no block to insert vector code");
   IF_DEBUG_NAT { errs() << ":: Vectorizing block: " << bb->getName().str() << "\n"; }
@@ -407,13 +448,13 @@ void NatBuilder::vectorize(BasicBlock *const bb, BasicBlock *vecBlock) {
       }
 
       if (load) {
-        numConstLoadMasks += memMaskConst;
-        numUniLoadMasks += memMaskUni;
-        numVarLoadMasks += memMaskDiv;
+        stats.numConstLoadMasks += memMaskConst;
+        stats.numUniLoadMasks += memMaskUni;
+        stats.numVarLoadMasks += memMaskDiv;
       } else if (store) {
-        numConstStoreMasks += memMaskConst;
-        numUniStoreMasks += memMaskUni;
-        numVarStoreMasks += memMaskDiv;
+        stats.numConstStoreMasks += memMaskConst;
+        stats.numUniStoreMasks += memMaskUni;
+        stats.numVarStoreMasks += memMaskDiv;
       }
     }
 
@@ -460,7 +501,7 @@ void NatBuilder::vectorize(BasicBlock *const bb, BasicBlock *vecBlock) {
     } else if (!canVectorize(inst) && shouldVectorize(inst)){
       replicateInstruction(inst);
     } else {
-      if (alloca) ++numUniAllocas;
+      if (alloca) ++stats.numUniAllocas;
       copyInstruction(inst);
     }
   }
@@ -545,7 +586,7 @@ NatBuilder::createAnyGuard(bool instNeedsGuard, BasicBlock & origBlock, bool pro
 }
 
 ValVec
-NatBuilder::scalarizeCascaded(BasicBlock & srcBlock, Instruction & inst, bool packResult, std::function<Value*(IRBuilder<>&,size_t)> genFunc) {
+NatBuilder::scalarizeCascaded(BasicBlock & srcBlock, Instruction & inst, bool packResult, std::function<Value*(IRBuilder<>&,size_t)> genFunc, Value * laneMask) {
    // packResult -> a single vector value
    // !packResult -> results of all replicated elements
    ValVec resultVec;
@@ -578,7 +619,8 @@ NatBuilder::scalarizeCascaded(BasicBlock & srcBlock, Instruction & inst, bool pa
      assert(builder.GetInsertBlock() == condBlock);
 
      // guard if
-     Value *LaneMask = requestLanePredicate(srcBlock, lane); // do not map this value if it's fresh to avoid dominance violations
+     Value *LaneMask = laneMask ? builder.CreateExtractElement(laneMask, lane, "lane_guard")
+                                : requestLanePredicate(srcBlock, lane); // do not map this value if it's fresh to avoid dominance violations
      builder.CreateCondBr(LaneMask, maskedBlock, nextBlock);
 
    // materialize the scalarized block
@@ -652,12 +694,6 @@ NatBuilder::requestVectorCallArgs(CallInst & scaCall, Function & vecFunc, int ma
 
     if (vecIdx == maskPos) {
       Mask vecMask = requestVectorMask(*scaCall.getParent());
-      if (getenv("RV_FOLD_AVL")) {
-        VectorMaskBuilder MBuilder(vectorWidth());
-        vecMask = MBuilder.FoldAVL(builder, vecMask);
-      } else {
-        Report() << "Ignoring AVL in call!\n";
-      }
       auto &VecMaskVal =
           vecMask.requestPredAsValue(vecFunc.getContext(), vectorWidth());
       vectorArgs.push_back(&VecMaskVal);
@@ -729,7 +765,7 @@ void NatBuilder::vectorizePHIInstruction(PHINode *const scalPhi) {
   }
   phiVector.push_back(scalPhi);
 
-  shape.isVarying() ? loopEnd == 1 ? ++numVectorized : ++numFallbacked : ++numScalarized;
+  shape.isVarying() ? loopEnd == 1 ? ++stats.numVectorized : ++stats.numFallbacked : ++stats.numScalarized;
 }
 
 /* expects that builder has valid insertion point set */
@@ -756,7 +792,7 @@ void NatBuilder::copyInstruction(Instruction *const inst, unsigned laneIdx) {
   builder.Insert(cpInst, inst->getName());
   mapScalarValue(inst, cpInst, laneIdx);
 
-  ++numScalarized; // statistics
+  ++stats.numScalarized; // statistics
 }
 
 static
@@ -777,7 +813,7 @@ void NatBuilder::vectorizeAlloca(AllocaInst *const allocaInst) {
   llvm::Align allocAlign = allocaInst->getAlign();
   auto * allocTy = allocaInst->getType()->getElementType();
 
-  ++numSlowAllocas;
+  ++stats.numSlowAllocas;
 
   auto name = allocaInst->getName();
   if (!allocaInst->isArrayAllocation()) {
@@ -807,6 +843,46 @@ void NatBuilder::vectorizeAlloca(AllocaInst *const allocaInst) {
   replicateInstruction(allocaInst);
 }
 
+// neutral element of the combining operation of \p atomicrmw (nullptr if it is not an integer reduction)
+static Constant*
+GetAtomicIdentity(const AtomicRMWInst & atomicrmw) {
+  auto * intTy = dyn_cast<IntegerType>(atomicrmw.getValOperand()->getType());
+  if (!intTy) return nullptr;
+
+  unsigned bits = intTy->getBitWidth();
+  switch (atomicrmw.getOperation()) {
+  case AtomicRMWInst::Add:
+  case AtomicRMWInst::Sub:
+  case AtomicRMWInst::Or:
+  case AtomicRMWInst::Xor:
+  case AtomicRMWInst::UMax: return ConstantInt::get(intTy, 0);
+  case AtomicRMWInst::And:
+  case AtomicRMWInst::UMin: return ConstantInt::get(intTy, APInt::getAllOnesValue(bits));
+  case AtomicRMWInst::Max:  return ConstantInt::get(intTy, APInt::getSignedMinValue(bits));
+  case AtomicRMWInst::Min:  return ConstantInt::get(intTy, APInt::getSignedMaxValue(bits));
+  default:
+    return nullptr;
+  }
+}
+
+// combine two updates of \p atomicrmw (subtractions are combined by adding up the subtrahends)
+static Value*
+CreateAtomicCombine(IRBuilder<> & builder, const AtomicRMWInst & atomicrmw, Value * lhs, Value * rhs) {
+  switch (atomicrmw.getOperation()) {
+  case AtomicRMWInst::Add:
+  case AtomicRMWInst::Sub:  return builder.CreateAdd(lhs, rhs);
+  case AtomicRMWInst::And:  return builder.CreateAnd(lhs, rhs);
+  case AtomicRMWInst::Or:   return builder.CreateOr(lhs, rhs);
+  case AtomicRMWInst::Xor:  return builder.CreateXor(lhs, rhs);
+  case AtomicRMWInst::Max:  return createMinMaxOp(builder, RecurKind::SMax, lhs, rhs);
+  case AtomicRMWInst::UMax: return createMinMaxOp(builder, RecurKind::UMax, lhs, rhs);
+  case AtomicRMWInst::Min:  return createMinMaxOp(builder, RecurKind::SMin, lhs, rhs);
+  case AtomicRMWInst::UMin: return createMinMaxOp(builder, RecurKind::UMin, lhs, rhs);
+  default:
+    llvm_unreachable("case missing");
+  }
+}
+
 void NatBuilder::vectorizeAtomicRMW(AtomicRMWInst *const atomicrmw) {
   VectorShape shape = getVectorShape(*atomicrmw);
   if (shape.isStrided() || shape.isContiguous()) {
@@ -836,7 +912,11 @@ void NatBuilder::vectorizeAtomicRMW(AtomicRMWInst *const atomicrmw) {
     VectorShape ptrShape = getVectorShape(*ptr);
 
     if (!ptrShape.isUniform()) {
-      replicateInstruction(atomicrmw);
+      if (GetAtomicIdentity(*atomicrmw)) {
+        vectorizeAtomicHistogram(*atomicrmw);
+      } else {
+        replicateInstruction(atomicrmw);
+      }
       return;
     }
     Value *predicate = vecInfo.getPredicate(*atomicrmw->getParent());
@@ -904,25 +984,14 @@ void NatBuilder::vectorizeAtomicRMW(AtomicRMWInst *const atomicrmw) {
       clonedInst->setOperand(1, finalVal);
       builder.Insert(clonedInst);
 
-      Value *itervector = UndefValue::get(vectorizedVal->getType());
-      Value *itervar = clonedInst;
-      itervector = builder.CreateInsertElement(itervector, itervar, (uint64_t) 0);
-      for (int i  = 1; i < vectorWidth(); i++) {
-        Value *update = builder.CreateExtractElement(vectorizedVal, (uint64_t) i - 1);
-        switch (atomicrmw->getOperation()) {
-        case AtomicRMWInst::Add:  itervar = builder.CreateAdd(itervar, update); break;
-        case AtomicRMWInst::Sub:  itervar = builder.CreateSub(itervar, update); break;
-        case AtomicRMWInst::And:  itervar = builder.CreateAnd(itervar, update); break;
-        case AtomicRMWInst::Or:   itervar = builder.CreateOr(itervar, update); break;
-        case AtomicRMWInst::Max:  itervar = createMinMaxOp(builder, RecurKind::SMax, itervar, update); break;
-        case AtomicRMWInst::UMax: itervar = createMinMaxOp(builder, RecurKind::UMax, itervar, update); break;
-        case AtomicRMWInst::Min:  itervar = createMinMaxOp(builder, RecurKind::SMin, itervar, update); break;
-        case AtomicRMWInst::UMin: itervar = createMinMaxOp(builder, RecurKind::UMin, itervar, update); break;
-        default:
-          llvm_unreachable("case missing");
-        }
-        itervector = builder.CreateInsertElement(itervector, itervar, (uint64_t) i);
-      }
+      // lane i fetches the old value combined with the values of all lanes before it
+      Value *prefixVal = &CreateVectorScan(builder, *vectorizedVal, *GetAtomicIdentity(*atomicrmw), true,
+          [atomicrmw](IRBuilder<> & builder, Value * lhs, Value * rhs) { return CreateAtomicCombine(builder, *atomicrmw, lhs, rhs); });
+      Value *oldVal = builder.CreateVectorSplat(vectorWidth(), clonedInst);
+      Value *itervector = atomicrmw->getOperation() == AtomicRMWInst::Sub
+                        ? builder.CreateSub(oldVal, prefixVal)
+                        : CreateAtomicCombine(builder, *atomicrmw, oldVal, prefixVal);
+      itervector->setName(atomicrmw->getName());
 
       mapVectorValue(atomicrmw, itervector);
       break;
@@ -936,6 +1005,205 @@ void NatBuilder::vectorizeAtomicRMW(AtomicRMWInst *const atomicrmw) {
   }
 }
 
+// shuffle mask that moves lane i to lane i + \p dist (lanes < \p dist are taken from the second operand)
+static SmallVector<int, 32>
+GetLaneShiftUpMask(int width, int dist) {
+  SmallVector<int, 32> shuffleMask;
+  for (int i = 0; i < width; ++i) {
+    shuffleMask.push_back(i < dist ? width + i : i - dist);
+  }
+  return shuffleMask;
+}
+
+// shuffle mask that moves lane i + \p dist to lane i (lanes >= width - \p dist are taken from the second operand)
+static SmallVector<int, 32>
+GetLaneShiftDownMask(int width, int dist) {
+  SmallVector<int, 32> shuffleMask;
+  for (int i = 0; i < width; ++i) {
+    shuffleMask.push_back(i + dist < width ? i + dist : width + i);
+  }
+  return shuffleMask;
+}
+
+// combine \p vals pairwise so the dependence depth is log2(#vals) instead of #vals
+static Value *
+CreateTreeCombine(IRBuilder<> & builder, std::vector<Value*> vals, std::function<Value*(IRBuilder<>&,Value*,Value*)> combineFunc) {
+  assert(!vals.empty());
+  while (vals.size() > 1) {
+    std::vector<Value*> nextVals;
+    for (size_t i = 0; i + 1 < vals.size(); i += 2) {
+      nextVals.push_back(combineFunc(builder, vals[i], vals[i + 1]));
+    }
+    if (vals.size() % 2) nextVals.push_back(vals.back());
+    vals = std::move(nextVals);
+  }
+  return vals[0];
+}
+
+// whether the target of \p F supports the subtarget feature \p feature (eg "+avx512cd")
+static bool
+HasTargetFeature(const Function & F, StringRef feature) {
+  if (!F.hasFnAttribute("target-features")) return false;
+  return F.getFnAttribute("target-features").getValueAsString().contains(feature);
+}
+
+std::vector<Value*>
+NatBuilder::createLaneConflicts(Value & vecAddr, Value & laneMask) {
+  int width = vectorWidth();
+  auto & ctx = builder.getContext();
+  auto * addrTy = cast<VectorType>(vecAddr.getType());
+  auto * intTy = addrTy->getElementType()->isPointerTy()
+               ? layout.getIntPtrType(ctx, addrTy->getElementType()->getPointerAddressSpace())
+               : cast<IntegerType>(addrTy->getElementType());
+  auto * vecIntTy = FixedVectorType::get(intTy, width);
+  Value * addrInts = addrTy->getElementType()->isPointerTy() ? builder.CreatePtrToInt(&vecAddr, vecIntTy, "conflict_addr") : &vecAddr;
+  auto * falseVec = Constant::getNullValue(laneMask.getType());
+
+  // AVX-512 CD: vpconflict yields the bit set of all earlier lanes with the same value
+  Value * conflictBits = nullptr;
+  unsigned elemBits = intTy->getBitWidth();
+  unsigned totalBits = elemBits * width;
+  const Function & scaFunc = vecInfo.getScalarFunction();
+  bool hasConflictInst = HasTargetFeature(scaFunc, "+avx512cd") &&
+                         (elemBits == 32 || elemBits == 64) &&
+                         (totalBits == 512 || ((totalBits == 128 || totalBits == 256) && HasTargetFeature(scaFunc, "+avx512vl")));
+  if (hasConflictInst) {
+    Intrinsic::ID conflictID;
+    if (elemBits == 32) {
+      conflictID = totalBits == 128 ? Intrinsic::x86_avx512_conflict_d_128
+                 : totalBits == 256 ? Intrinsic::x86_avx512_conflict_d_256 : Intrinsic::x86_avx512_conflict_d_512;
+    } else {
+      conflictID = totalBits == 128 ? Intrinsic::x86_avx512_conflict_q_128
+                 : totalBits == 256 ? Intrinsic::x86_avx512_conflict_q_256 : Intrinsic::x86_avx512_conflict_q_512;
+    }
+    auto * conflictDecl = Intrinsic::getDeclaration(builder.GetInsertBlock()->getModule(), conflictID);
+    conflictBits = builder.CreateCall(conflictDecl, {addrInts}, "conflict_bits");
+  }
+
+  std::vector<Value*> conflicts(width, nullptr);
+  for (int dist = 1; dist < width; ++dist) {
+    Value * sameAddr;
+    if (conflictBits) {
+      // lane i: test bit (i - dist)
+      std::vector<Constant*> laneBits;
+      for (int i = 0; i < width; ++i) {
+        laneBits.push_back(ConstantInt::get(intTy, i >= dist ? APInt::getOneBitSet(elemBits, i - dist) : APInt(elemBits, 0)));
+      }
+      Value * testBits = builder.CreateAnd(conflictBits, ConstantVector::get(laneBits));
+      sameAddr = builder.CreateICmpNE(testBits, Constant::getNullValue(vecIntTy), "conflict");
+    } else {
+      // compare with the address of lane i - dist (lanes < dist compare with themselves and are masked out below)
+      SmallVector<int, 32> shuffleMask;
+      for (int i = 0; i < width; ++i) shuffleMask.push_back(i < dist ? i : i - dist);
+      Value * earlierAddr = builder.CreateShuffleVector(addrInts, UndefValue::get(vecIntTy), shuffleMask, "earlier_addr");
+      sameAddr = builder.CreateICmpEQ(addrInts, earlierAddr, "conflict");
+    }
+
+    // both lanes are active (shifting in false also masks out lanes < dist)
+    Value * earlierMask = builder.CreateShuffleVector(&laneMask, falseVec, GetLaneShiftUpMask(width, dist), "earlier_mask");
+    conflicts[dist] = builder.CreateAnd(builder.CreateAnd(sameAddr, &laneMask), earlierMask, "conflict_active");
+  }
+  return conflicts;
+}
+
+void NatBuilder::vectorizeAtomicHistogram(AtomicRMWInst & atomicrmw) {
+  auto & scaBlock = *atomicrmw.getParent();
+  int width = vectorWidth();
+
+  Mask vecMask = Mask::getAllTrue();
+  Value * predicate = vecInfo.getPredicate(scaBlock);
+  bool needsMask = predicate && !vecInfo.getVectorShape(*predicate).isUniform();
+  if (needsMask) {
+    vecMask = requestVectorMask(scaBlock);
+    if (vecMask.getAVL()) {
+      replicateInstruction(&atomicrmw);
+      return;
+    }
+  }
+
+  Value * vecPtr = requestVectorValue(atomicrmw.getPointerOperand());
+  Value * vecVal = requestVectorValue(atomicrmw.getValOperand());
+  auto * boolVecTy = FixedVectorType::get(i1Ty, width);
+  Value * laneMask = vecMask.knownAllTrue() ? Constant::getAllOnesValue(boolVecTy) : vecMask.getPred();
+
+  Constant * identity = GetAtomicIdentity(atomicrmw);
+  Value * identityVec = ConstantVector::getSplat(ElementCount::getFixed(width), identity);
+  auto combineFunc = [&atomicrmw](IRBuilder<> & builder, Value * lhs, Value * rhs) { return CreateAtomicCombine(builder, atomicrmw, lhs, rhs); };
+
+  // conflicts[d]: lane i accesses the same address as the active lane i - d
+  std::vector<Value*> conflicts = createLaneConflicts(*vecPtr, *laneMask);
+
+  // the first active lane of every address issues the atomic
+  std::vector<Value*> earlierConflicts(conflicts.begin() + 1, conflicts.end());
+  auto orFunc = [](IRBuilder<> & builder, Value * lhs, Value * rhs) { return builder.CreateOr(lhs, rhs); };
+  Value * hasEarlier = width > 1 ? CreateTreeCombine(builder, earlierConflicts, orFunc) : Constant::getNullValue(boolVecTy);
+  Value * isLeader = builder.CreateAnd(laneMask, builder.CreateNot(hasEarlier), "atomic_leader");
+
+  // Lanes of the same address need not be adjacent, so a Hillis-Steele scan over fixed lane shifts
+  // would drop lanes whenever the partner lane of a step hits another address. Instead, the
+  // per-distance terms are independent and are combined as a balanced tree (log2(W) deep).
+
+  // pre-combine the values of all lanes with the same address in the leader lane
+  std::vector<Value*> laterVals = {vecVal};
+  for (int dist = 1; dist < width; ++dist) {
+    Value * laterConflict = builder.CreateShuffleVector(conflicts[dist], Constant::getNullValue(boolVecTy), GetLaneShiftDownMask(width, dist));
+    Value * laterVal = builder.CreateShuffleVector(vecVal, identityVec, GetLaneShiftDownMask(width, dist));
+    laterVals.push_back(builder.CreateSelect(laterConflict, laterVal, identityVec));
+  }
+  Value * totalVal = CreateTreeCombine(builder, laterVals, combineFunc);
+  totalVal->setName("atomic_combined");
+
+  // one atomic per address
+  auto atomicFunc = [&](IRBuilder<> & builder, size_t lane) -> Value* {
+    auto * laneAtomic = cast<AtomicRMWInst>(atomicrmw.clone());
+    laneAtomic->setOperand(0, builder.CreateExtractElement(vecPtr, lane));
+    laneAtomic->setOperand(1, builder.CreateExtractElement(totalVal, lane));
+    builder.Insert(laneAtomic, atomicrmw.getName());
+    return laneAtomic;
+  };
+  scalarizeCascaded(scaBlock, atomicrmw, true, atomicFunc, isLeader);
+  ++stats.numFallbacked;
+
+  if (atomicrmw.use_empty()) return;
+
+  // fetch results: the value of the leader combined with all earlier lanes of the same address
+  Value * leaderOld = getVectorValue(atomicrmw);
+  std::vector<Value*> earlierVals;
+  // (found leader, its old value) per distance, at most one distance hits the leader
+  std::vector<Value*> leaderFound;
+  std::vector<Value*> leaderVals;
+  for (int dist = 1; dist < width; ++dist) {
+    Value * earlierVal = builder.CreateShuffleVector(vecVal, identityVec, GetLaneShiftUpMask(width, dist));
+    earlierVals.push_back(builder.CreateSelect(conflicts[dist], earlierVal, identityVec));
+
+    Value * earlierLeader = builder.CreateShuffleVector(isLeader, Constant::getNullValue(boolVecTy), GetLaneShiftUpMask(width, dist));
+    leaderFound.push_back(builder.CreateAnd(conflicts[dist], earlierLeader));
+    leaderVals.push_back(builder.CreateShuffleVector(leaderOld, UndefValue::get(leaderOld->getType()), GetLaneShiftUpMask(width, dist)));
+  }
+  Value * prefixVal = earlierVals.empty() ? identityVec : CreateTreeCombine(builder, earlierVals, combineFunc);
+
+  // select the old value of the leader as a tree of (found, value) pairs
+  while (leaderFound.size() > 1) {
+    std::vector<Value*> nextFound, nextVals;
+    for (size_t i = 0; i + 1 < leaderFound.size(); i += 2) {
+      nextVals.push_back(builder.CreateSelect(leaderFound[i], leaderVals[i], leaderVals[i + 1]));
+      nextFound.push_back(builder.CreateOr(leaderFound[i], leaderFound[i + 1]));
+    }
+    if (leaderFound.size() % 2) {
+      nextFound.push_back(leaderFound.back());
+      nextVals.push_back(leaderVals.back());
+    }
+    leaderFound = std::move(nextFound);
+    leaderVals = std::move(nextVals);
+  }
+  Value * laneOld = leaderFound.empty() ? leaderOld : builder.CreateSelect(leaderFound[0], leaderVals[0], leaderOld);
+
+  Value * fetchVal = atomicrmw.getOperation() == AtomicRMWInst::Sub
+                   ? builder.CreateSub(laneOld, prefixVal)
+                   : combineFunc(builder, laneOld, prefixVal);
+  fetchVal->setName(atomicrmw.getName() + ".fetch");
+  mapVectorValue(&atomicrmw, fetchVal);
+}
 
 void NatBuilder::replicateInstruction(Instruction *const inst) {
   // fallback for vectorizing varying instructions:
@@ -964,7 +1232,7 @@ void NatBuilder::replicateInstruction(Instruction *const inst) {
     scalarize(*inst->getParent(), *inst, packResult, replFunc);
   }
 
-  ++numFallbacked;
+  ++stats.numFallbacked;
 }
 
 /* expects that builder has valid insertion point set */
@@ -979,7 +1247,7 @@ void NatBuilder::vectorizeInstruction(Instruction *const inst) {
     // use the Explicit Vector Length extension
     Mask blockMask;
     if (!hasTotalOperationTag(*inst)) {
-      blockMask = requestVectorMask(*inst->getParent());
+      blockMask = requestVectorMask(*inst->getParent(), true);
     }
 
     // configure predicate
@@ -1017,7 +1285,7 @@ void NatBuilder::vectorizeInstruction(Instruction *const inst) {
 
   mapVectorValue(inst, vecInst);
 
-  ++numVectorized;
+  ++stats.numVectorized;
 }
 
 void NatBuilder::vectorizeMaskReductionCall(CallInst *rvCall, RVIntrinsic MaskIntrin) {
@@ -1032,12 +1300,12 @@ void NatBuilder::vectorizeMaskReductionCall(CallInst *rvCall, RVIntrinsic MaskIn
   Value *reduction = createVectorMaskSummary(maskedMask, MaskIntrin, rvCall->getType());
   mapScalarValue(rvCall, reduction);
 
-  ++numRVIntrinsics;
+  ++stats.numRVIntrinsics;
 }
 
 void
 NatBuilder::vectorizeExtractCall(CallInst *rvCall) {
-  ++numRVIntrinsics;
+  ++stats.numRVIntrinsics;
 
   assert(rvCall->getNumArgOperands() == 2 && "expected 2 arguments for rv_extract(vec, laneId)");
 
@@ -1061,7 +1329,7 @@ NatBuilder::vectorizeExtractCall(CallInst *rvCall) {
 
 void
 NatBuilder::vectorizeInsertCall(CallInst *rvCall) {
-  ++numRVIntrinsics;
+  ++stats.numRVIntrinsics;
 
   assert(rvCall->getNumArgOperands() == 3 && "expected 3 arguments for rv_insert(vec, laneId, value)");
 
@@ -1086,7 +1354,7 @@ NatBuilder::vectorizeInsertCall(CallInst *rvCall) {
 
 void
 NatBuilder::vectorizeLoadCall(CallInst *rvCall) {
-  ++numRVIntrinsics;
+  ++stats.numRVIntrinsics;
 
   assert(rvCall->getNumArgOperands() == 2 && "expected 2 arguments for rv_load(vecPtr, laneId)");
 
@@ -1120,7 +1388,7 @@ NatBuilder::vectorizeLoadCall(CallInst *rvCall) {
 
 void
 NatBuilder::vectorizeStoreCall(CallInst *rvCall) {
-  ++numRVIntrinsics;
+  ++stats.numRVIntrinsics;
 
   assert(rvCall->getNumArgOperands() == 3 && "expected 3 arguments for rv_store(vecPtr, laneId, value)");
 
@@ -1148,7 +1416,7 @@ NatBuilder::vectorizeStoreCall(CallInst *rvCall) {
 
 void
 NatBuilder::vectorizeShuffleCall(CallInst *rvCall) {
-  ++numRVIntrinsics;
+  ++stats.numRVIntrinsics;
 
   assert(rvCall->getNumArgOperands() == 2 && "expected 2 arguments for rv_shuffle(vec, shift)");
 
@@ -1239,7 +1507,7 @@ NatBuilder::createVectorMaskSummary(Mask vecMask, RVIntrinsic mode, Type * index
 
 void
 NatBuilder::vectorizeBallotCall(CallInst *rvCall) {
-  ++numRVIntrinsics;
+  ++stats.numRVIntrinsics;
 
   auto vecWidth = vecInfo.getVectorWidth();
   assert((vecWidth == 4 || vecWidth == 8) && "rv_ballot only supports SSE and AVX instruction sets");
@@ -1255,34 +1523,24 @@ NatBuilder::vectorizeBallotCall(CallInst *rvCall) {
 
 void
 NatBuilder::vectorizeIndexCall(CallInst & rvCall) {
-  ++numRVIntrinsics;
+  ++stats.numRVIntrinsics;
 
-// avx512vl - expand based implementation
-  if (config.useAVX512) {
-    auto vecWidth = vecInfo.getVectorWidth();
-    assert(vecWidth == 4 || vecWidth == 8);
+  assert(rvCall.getNumArgOperands() == 1 && "expected 1 argument for rv_index(mask)");
 
-    Intrinsic::ID id = Intrinsic::x86_avx512_mask_expand;
+  Value *condArg = rvCall.getArgOperand(0);
+  auto vecWidth = vecInfo.getVectorWidth();
+  bool argUniform = hasUniformPredicate(*rvCall.getParent()) && vecInfo.getVectorShape(*condArg).isUniform();
 
-    assert(rvCall.getNumArgOperands() == 1 && "expected 1 argument for rv_index(mask)");
+  Mask vecMask = argUniform ? Mask::getAllTrue() : maskInactiveLanes(*condArg, *rvCall.getParent(), false);
 
-    Value *condArg = rvCall.getArgOperand(0);
+// avx512vl - expand based implementation
+  if (!argUniform && config.useAVX512 && !vecMask.getAVL() && (vecWidth == 4 || vecWidth == 8)) {
+    Intrinsic::ID id = Intrinsic::x86_avx512_mask_expand;
 
     auto * intLaneTy = IntegerType::getIntNTy(rvCall.getContext(), 512 / vecWidth);
-    bool argUniform = hasUniformPredicate(*rvCall.getParent()) && vecInfo.getVectorShape(*condArg).isUniform();
-
-// uniform arg
-    if (argUniform) {
-      mapScalarValue(&rvCall, createContiguousVector(vecWidth, intLaneTy, 0, 1));
-      return;
-    }
-
-    Mask vecMask = maskInactiveLanes(*condArg, *rvCall.getParent(), false);
     auto *maskVec = vecMask.getPred();
-    assert(!vecMask.getAVL() && "TODO implement for AVL");
     auto * contVec = createContiguousVector(vecWidth, intLaneTy, 0, 1);
 
-
     auto * fpLaneTy = Type::getDoubleTy(rvCall.getContext());
     auto * fpVecTy =  FixedVectorType::get(fpLaneTy, vecWidth);
     auto * intVecTy = FixedVectorType::get(intLaneTy, vecWidth);
@@ -1304,14 +1562,31 @@ NatBuilder::vectorizeIndexCall(CallInst & rvCall) {
     return;
   }
 
-// generic implementation
-  assert(config.useAVX512 && "TODO generic implementation (avx512vl only)");
-  abort(); // "TODO generic implementation (avx512vl only)"
+  auto * indexTy = cast<IntegerType>(rvCall.getType());
+
+// uniform arg
+  if (argUniform) {
+    mapScalarValue(&rvCall, createContiguousVector(vecWidth, indexTy, 0, 1));
+    return;
+  }
+
+// generic implementation: exclusive prefix sum over the active lanes
+  if (vecMask.getAVL()) {
+    VectorMaskBuilder MBuilder(vecWidth);
+    vecMask = MBuilder.FoldAVL(builder, vecMask);
+  }
+  auto * laneMask = &vecMask.requestPredAsValue(builder.getContext(), vectorWidth());
+  auto * indexVecTy = FixedVectorType::get(indexTy, vecWidth);
+  auto * activeCount = builder.CreateZExt(laneMask, indexVecTy);
+  auto & laneIndex = CreateVectorScan(builder, RedKind::Add, *activeCount, true);
+  auto * indexVec = builder.CreateSelect(laneMask, &laneIndex, Constant::getNullValue(indexVecTy), "rv_index");
+
+  mapVectorValue(&rvCall, indexVec);
 }
 
 void
 NatBuilder::vectorizePopCountCall(CallInst *rvCall) {
-  ++numRVIntrinsics;
+  ++stats.numRVIntrinsics;
 
   auto indexTy = rvCall->getType();
 
@@ -1337,7 +1612,7 @@ NatBuilder::vectorizePopCountCall(CallInst *rvCall) {
 
 void
 NatBuilder::vectorizeAlignCall(CallInst *rvCall) {
-  ++numRVIntrinsics;
+  ++stats.numRVIntrinsics;
 
   assert(rvCall->getNumArgOperands() == 2 && "expected 2 arguments for rv_align(ptr, alignment)");
 
@@ -1351,10 +1626,8 @@ NatBuilder::vectorizeAlignCall(CallInst *rvCall) {
 
 void
 NatBuilder::vectorizeCompactCall(CallInst *rvCall) {
-  ++numRVIntrinsics;
+  ++stats.numRVIntrinsics;
 
-  abort(); // TODO implement for VP
-#if 0
   assert(rvCall->getNumArgOperands() == 2 && "expected 2 arguments for rv_compact(vec, mask)");
 
   Value *vecArg  = rvCall->getArgOperand(0);
@@ -1362,58 +1635,71 @@ NatBuilder::vectorizeCompactCall(CallInst *rvCall) {
 
 // uniform arg
   if (getVectorShape(*vecArg).isUniform()) {
-    mapScalarValue(rvCall, vecArg);
+    mapScalarValue(rvCall, requestScalarValue(vecArg));
     return;
   }
 
 // non-uniform arg
-  auto * vecVal  = requestVectorValue(vecArg);
-  auto * maskVal = requestVectorValue(maskArg);
-
-  auto vecWidth = cast<VectorType>(maskVal->getType())->getVectorNumElements();
-  auto tableIndex = createVectorMaskSummary(*rvCall->getType(), vecMask, builder, RVIntrinsic::Ballot);
-  auto table = createCompactLookupTable(vecWidth);
-  auto indices = builder.CreateLoad(builder.CreateInBoundsGEP(table, { builder.getInt32(0), tableIndex }), "rv_compact_indices");
-  Value * compacted = UndefValue::get(vecVal->getType());
-  for (size_t i = 0; i < vecWidth; ++i) {
-    auto index = builder.CreateExtractElement(indices, builder.getInt32(i), "rv_compact_index");
-    auto elem = builder.CreateExtractElement(vecVal, index, "rv_compact_elem");
-    compacted = builder.CreateInsertElement(compacted, elem, builder.getInt32(i), "rv_compact");
+  Mask vecMask = maskInactiveLanes(*maskArg, *rvCall->getParent(), false);
+  if (vecMask.getAVL()) {
+    VectorMaskBuilder MBuilder(vectorWidth());
+    vecMask = MBuilder.FoldAVL(builder, vecMask);
   }
+  auto * vecVal  = requestVectorValue(vecArg);
+  auto * laneMask = &vecMask.requestPredAsValue(builder.getContext(), vectorWidth());
+
+  auto * compacted = createCompaction(*vecVal, *laneMask);
+  compacted->setName("rv_compact");
   mapVectorValue(rvCall, compacted);
-#endif
 }
 
-Constant*
-NatBuilder::createCompactLookupTable(unsigned vecWidth) {
-  assert(vecWidth <= 8);
-  auto module = vecInfo.getVectorFunction().getParent();
-  auto tableName = "rv_compact_lookup_table" + std::to_string(vecWidth);
-  auto global = module->getGlobalVariable(tableName);
-  if (global)
-    return global;
-
-  // for all possible mask values
-  auto elemTy = builder.getInt32Ty();
-  std::vector<Constant*> tableElems;
-  std::vector<Constant*> elemValues(vecWidth);
-  for (unsigned i = 0; i < (1u << vecWidth); ++i) {
-    for (unsigned j = 0; j < vecWidth; ++j)
-      elemValues[j] = ConstantInt::get(elemTy, j);
-    for (unsigned j = 0, k = 0; j < vecWidth; ++j) {
-      if (i & (1 << j)) {
-        elemValues[k] = ConstantInt::get(elemTy, j);
-        k++;
-      }
-    }
-    // generate a lookup table element
-    tableElems.push_back(ConstantVector::get(elemValues));
+Value*
+NatBuilder::createCompaction(Value & vecVal, Value & laneMask) {
+  int width = vectorWidth();
+  auto * vecTy = cast<FixedVectorType>(vecVal.getType());
+  auto * elemTy = vecTy->getElementType();
+  unsigned vecBits = layout.getTypeSizeInBits(vecTy);
+  unsigned elemBits = layout.getTypeSizeInBits(elemTy);
+
+// avx512: native vcompress (32/64 bit lanes, 128/256 bit vectors require avx512vl)
+  const Function & scaFunc = vecInfo.getScalarFunction();
+  bool hasCompressInst = config.useAVX512 && (elemBits == 32 || elemBits == 64) &&
+                         (vecBits == 512 || ((vecBits == 128 || vecBits == 256) && HasTargetFeature(scaFunc, "+avx512vl")));
+  if (hasCompressInst) {
+    // the intrinsic is defined on integer and fp vectors only
+    auto * nativeTy = elemTy->isPointerTy() ? FixedVectorType::get(builder.getIntNTy(elemBits), width) : vecTy;
+    Value * nativeVal = elemTy->isPointerTy() ? builder.CreatePtrToInt(&vecVal, nativeTy) : &vecVal;
+    auto * compressDecl = Intrinsic::getDeclaration(builder.GetInsertBlock()->getModule(), Intrinsic::x86_avx512_mask_compress, {nativeTy});
+    Value * compressed = builder.CreateCall(compressDecl, {nativeVal, UndefValue::get(nativeTy), &laneMask}, "compress");
+    return elemTy->isPointerTy() ? builder.CreateIntToPtr(compressed, vecTy) : compressed;
+  }
+
+// generic: every active lane moves down by the number of inactive lanes before it.
+  // the shift distances are applied bit by bit (log2(width) shuffle steps). Shift distances are non-decreasing in the lane
+  // index and the destinations are distinct, so active lanes never collide.
+  auto * intTy = builder.getInt32Ty();
+  auto * intVecTy = FixedVectorType::get(intTy, width);
+  auto * boolVecTy = FixedVectorType::get(i1Ty, width);
+  Value * inactiveCount = builder.CreateZExt(builder.CreateNot(&laneMask), intVecTy);
+  Value * shiftDist = &CreateVectorScan(builder, RedKind::Add, *inactiveCount, true);
+
+  Value * laneVal = &vecVal;
+  Value * laneValid = &laneMask;
+  Value * noLanes = Constant::getNullValue(boolVecTy);
+  for (int dist = 1; dist < width; dist *= 2) {
+    // lanes that move by dist in this step
+    Value * moveBit = builder.CreateAnd(shiftDist, ConstantVector::getSplat(ElementCount::getFixed(width), ConstantInt::get(intTy, dist)));
+    Value * moves = builder.CreateAnd(laneValid, builder.CreateICmpNE(moveBit, Constant::getNullValue(intVecTy)));
+
+    Value * movedValid = builder.CreateShuffleVector(moves, noLanes, GetLaneShiftDownMask(width, dist), "compact_moved");
+    Value * movedVal = builder.CreateShuffleVector(laneVal, UndefValue::get(vecTy), GetLaneShiftDownMask(width, dist));
+    Value * movedDist = builder.CreateShuffleVector(shiftDist, UndefValue::get(intVecTy), GetLaneShiftDownMask(width, dist));
+
+    laneVal = builder.CreateSelect(movedValid, movedVal, laneVal, "compact_step");
+    shiftDist = builder.CreateSelect(movedValid, movedDist, shiftDist);
+    laneValid = builder.CreateOr(movedValid, builder.CreateAnd(laneValid, builder.CreateNot(moves)));
   }
-  auto tableValue = ConstantArray::get(ArrayType::get(tableElems[0]->getType(), tableElems.size()), tableElems);
-  auto table = cast<GlobalVariable>(module->getOrInsertGlobal(tableName, tableValue->getType()));
-  table->setConstant(true);
-  table->setInitializer(tableValue);
-  return table;
+  return laneVal;
 }
 
 static
@@ -1439,8 +1725,95 @@ CopyTargetAttributes(Function & destFunc, Function & srcFunc) {
   }
 }
 
+// 1 for sin, 2 for cos (libm function or LLVM intrinsic), 0 otherwise
+static int
+GetSinCosKind(const CallInst & call) {
+  auto * callee = call.getCalledFunction();
+  if (!callee || call.arg_size() != 1) return 0;
+
+  switch (callee->getIntrinsicID()) {
+    case Intrinsic::sin: return 1;
+    case Intrinsic::cos: return 2;
+    case Intrinsic::not_intrinsic: break;
+    default: return 0;
+  }
+
+  StringRef name = callee->getName();
+  if (name == "sin" || name == "sinf") return 1;
+  if (name == "cos" || name == "cosf") return 2;
+  return 0;
+}
+
+void
+NatBuilder::combineFusedMathCalls() {
+  for (auto & block : vecInfo.getScalarFunction()) {
+    if (!vecInfo.inRegion(block)) continue;
+    bool hasCallPredicate = !hasUniformPredicate(block);
+
+    // unpaired sin/cos calls in this block by (operand, kind)
+    std::map<std::pair<Value*, int>, CallInst*> openCalls;
+    for (auto & inst : block) {
+      auto * call = dyn_cast<CallInst>(&inst);
+      if (!call) continue;
+      int kind = GetSinCosKind(*call);
+      if (!kind || !shouldVectorize(call)) continue;
+
+      Value * operand = call->getArgOperand(0);
+      auto itPartner = openCalls.find(std::make_pair(operand, 3 - kind));
+      if (itPartner == openCalls.end()) {
+        openCalls.emplace(std::make_pair(operand, kind), call);
+        continue;
+      }
+      CallInst * partner = itPartner->second;
+      openCalls.erase(itPartner);
+
+      // is there a fused implementation at this width?
+      Type * scaTy = call->getType();
+      if (!scaTy->isFloatTy() && !scaTy->isDoubleTy()) continue;
+      auto * fusedTy = FunctionType::get(StructType::get(scaTy, scaTy), {scaTy}, false);
+      std::string fusedName = scaTy->isFloatTy() ? "sincosf.fused" : "sincos.fused";
+      VectorShapeVec argShapes = {vecInfo.getVectorShape(*operand)};
+      if (!platInfo.hasResolver(fusedName, *fusedTy, argShapes, vectorWidth(), hasCallPredicate)) continue;
+
+      // {sin, cos}
+      fusedMathCalls[partner] = FusedMathCall{fusedName, fusedTy, (unsigned) (2 - kind), call};
+      fusedMathCalls[call] = FusedMathCall{fusedName, fusedTy, (unsigned) (kind - 1), partner};
+    }
+  }
+}
+
+bool
+NatBuilder::vectorizeFusedMathCall(CallInst & scalCall, const FusedMathCall & fused) {
+  // already computed with its partner
+  if (getVectorValue(scalCall)) return true;
+
+  auto & scaBlock = *scalCall.getParent();
+  bool hasCallPredicate = !hasUniformPredicate(scaBlock);
+  VectorShapeVec argShapes = {vecInfo.getVectorShape(*scalCall.getArgOperand(0))};
+  auto funcResolver = platInfo.getResolver(fused.fusedName, *fused.fusedTy, argShapes, vectorWidth(), hasCallPredicate);
+  if (!funcResolver) return false;
+
+  Function & simdFunc = funcResolver->requestVectorized();
+  CopyTargetAttributes(simdFunc, vecInfo.getScalarFunction());
+
+  // the fused function takes the same arguments as either call
+  std::vector<Value*> vectorArgs;
+  requestVectorCallArgs(scalCall, simdFunc, funcResolver->getMaskPos(), vectorArgs);
+  auto * fusedCall = builder.CreateCall(&simdFunc, vectorArgs, scalCall.getName() + ".fused");
+  fusedCall->setCallingConv(simdFunc.getCallingConv());
+
+  mapVectorValue(&scalCall, builder.CreateExtractValue(fusedCall, fused.resultIdx, scalCall.getName() + ".rv"));
+  mapVectorValue(fused.partner, builder.CreateExtractValue(fusedCall, 1 - fused.resultIdx, fused.partner->getName() + ".rv"));
+  ++stats.numVecCalls;
+  return true;
+}
+
 void
 NatBuilder::vectorizeCallInstruction(CallInst *const scalCall) {
+  // part of a fused multi-result math call
+  auto itFused = fusedMathCalls.find(scalCall);
+  if (itFused != fusedMathCalls.end() && vectorizeFusedMathCall(*scalCall, itFused->second)) return;
+
   auto & scaBlock = *scalCall->getParent();
   bool hasCallPredicate = !hasUniformPredicate(scaBlock);
 
@@ -1500,7 +1873,7 @@ NatBuilder::vectorizeCallInstruction(CallInst *const scalCall) {
 
     if (producesValue) { vecCall.setName(scalCall->getName() + ".mapped"); }
     mapVectorValue(scalCall, &vecCall);
-    ++numVecCalls;
+    ++stats.numVecCalls;
 
   } else {
 // Otw, try to semi-vectorize the call by replication a smaller vectorized version
@@ -1527,24 +1900,42 @@ NatBuilder::vectorizeCallInstruction(CallInst *const scalCall) {
       ShuffleBuilder extractor(vecWidth);
 
       // prepare the extract shuffler
-      for (unsigned i = 0; i < scalCall->getNumArgOperands(); ++i) {
+      const int numArgs = scalCall->getNumArgOperands();
+      for (int i = 0; i < numArgs; ++i) {
         Value *const arg = scalCall->getArgOperand(i);
         Value *mappedArg = requestVectorValue(arg);
         extractor.add(mappedArg);
       }
 
+      // masked variants take their part of the call predicate (last extractor slot)
+      const int maskPos = funcResolver->getMaskPos();
+      if (maskPos >= 0) {
+        Mask vecMask = requestVectorMask(*scalCall->getParent());
+        extractor.add(&vecMask.requestPredAsValue(builder.getContext(), vectorWidth()));
+      }
+
       // replicate vector call
       for (unsigned i = 0; i < replicationFactor; ++i) {
-        CallInst *call = cast<CallInst>(scalCall->clone());
-        call->setCalledFunction(&simdFunc);
-        call->mutateType(simdFunc.getReturnType());
-
-        // insert arguments into call
-        for (unsigned j = 0; j < scalCall->getNumArgOperands(); ++j) {
-          Value *vecArg = extractor.extractVector(builder, j, i * vecWidth);
-          call->setArgOperand(j, vecArg);
+        std::vector<Value*> partArgs;
+        auto itParam = simdFunc.arg_begin();
+        for (int vecIdx = 0, scaIdx = 0; vecIdx < (int) simdFunc.arg_size(); ++vecIdx, ++itParam) {
+          if (vecIdx == maskPos) {
+            partArgs.push_back(extractor.extractVector(builder, numArgs, i * vecWidth));
+            continue;
+          }
+
+          // uniform parameters stay scalar
+          Value *scaArg = scalCall->getArgOperand(scaIdx);
+          if (itParam->getType() == scaArg->getType()) {
+            partArgs.push_back(requestScalarValue(scaArg));
+          } else {
+            partArgs.push_back(extractor.extractVector(builder, scaIdx, i * vecWidth));
+          }
+          ++scaIdx;
         }
-        builder.Insert(call);
+
+        auto *call = builder.CreateCall(&simdFunc, partArgs);
+        call->setCallingConv(simdFunc.getCallingConv());
         appender.add(call);
       }
 
@@ -1552,7 +1943,7 @@ NatBuilder::vectorizeCallInstruction(CallInst *const scalCall) {
       Value *append = appender.append(builder);
       mapVectorValue(scalCall, append);
 
-      ++numSemiCalls;
+      ++stats.numSemiCalls;
       return;
     }
 
@@ -1581,7 +1972,7 @@ NatBuilder::vectorizeCallInstruction(CallInst *const scalCall) {
     }
 
     // if we need cascading, we need the vectorized predicate and the cascading blocks
-    needCascade ? ++numCascadeCalls : ++numFallCalls;
+    needCascade ? ++stats.numCascadeCalls : ++stats.numFallCalls;
   }
 }
 
@@ -1603,7 +1994,7 @@ void NatBuilder::copyCallInstruction(CallInst *const scalCall, unsigned laneIdx)
                                    scalCall->getName());
   mapScalarValue(scalCall, call, laneIdx);
 
-  ++numScalarized;
+  ++stats.numScalarized;
 }
 
 
@@ -1657,6 +2048,8 @@ void NatBuilder::vectorizeMemoryInstruction(Instruction *const inst) {
     return replicateInstruction(inst);
   }
 
+  if (vectorizeInterleavedGroup(*inst)) return;
+
   LoadInst *load = dyn_cast<LoadInst>(inst);
   StoreInst *store = dyn_cast<StoreInst>(inst);
 
@@ -1688,9 +2081,10 @@ void NatBuilder::vectorizeMemoryInstruction(Instruction *const inst) {
     needsMask = false;
   }
 
+  // VP loads/stores consume the AVL directly, all other lowerings see it folded into the predicate
   Mask vecMask;
   if (needsMask) {
-    vecMask = requestVectorMask(*inst->getParent());
+    vecMask = requestVectorMask(*inst->getParent(), config.enableVP);
   } else {
     vecMask = Mask::getAllTrue();
   }
@@ -1727,7 +2121,7 @@ void NatBuilder::vectorizeMemoryInstruction(Instruction *const inst) {
       Value *vecBasePtr = requestScalarValue(accessedPtr);
       vecMem = createContiguousLoad(vecBasePtr, Align(alignment), vecMask, UndefValue::get(vecType));
 
-      addrShape.isUniform() ? ++numUniLoads : needsMask ? ++numContMaskedLoads : ++numContLoads;
+      addrShape.isUniform() ? ++stats.numUniLoads : needsMask ? ++stats.numContMaskedLoads : ++stats.numContLoads;
 
     } else {
       // otw
@@ -1778,7 +2172,7 @@ void NatBuilder::vectorizeMemoryInstruction(Instruction *const inst) {
       Value *vecBasePtr = requestScalarValue(accessedPtr);
       vecMem = createContiguousStore(mappedStoredVal, vecBasePtr, Align(alignment), vecMask);
 
-      addrShape.isUniform() ? ++numUniStores : needsMask ? ++numContMaskedStores : ++numContStores;
+      addrShape.isUniform() ? ++stats.numUniStores : needsMask ? ++stats.numContMaskedStores : ++stats.numContStores;
 
     } else {
       // otw
@@ -1815,7 +2209,11 @@ void NatBuilder::vectorizeMemoryInstruction(Instruction *const inst) {
 
 Value *
 NatBuilder::createVaryingToUniformStore(Instruction *scaInst, Type *accessedType, unsigned int alignment, Value *addr, Mask vecMask, Value *values) {
-  assert(!vecMask.getAVL() && "TODO implement AVL");
+  // the last-lane extraction below only looks at the predicate
+  if (vecMask.getAVL()) {
+    VectorMaskBuilder MBuilder(vectorWidth());
+    vecMask = MBuilder.FoldAVL(builder, vecMask, "avl");
+  }
 
   bool needsGuard = true;
   return &createAnyGuard(needsGuard, *scaInst->getParent(), isa<LoadInst>(scaInst),
@@ -1854,7 +2252,7 @@ Value *NatBuilder::createUniformMaskedMemory(Instruction *scaInst,
                                              Type *accessedType,
                                              MaybeAlign AlignOpt,
                                              Value *vecBasePtr, Value *vecValues) {
-  vecValues ? ++numUniMaskedStores : ++numUniMaskedLoads;
+  vecValues ? ++stats.numUniMaskedStores : ++stats.numUniMaskedLoads;
 
   // emit a scalar memory acccess within a any-guarded section
   bool needsGuard = !EnableUnsafeOptimizations; // FIXME
@@ -1876,7 +2274,7 @@ Value *NatBuilder::createUniformMaskedMemory(Instruction *scaInst,
 Value *NatBuilder::createVaryingMemory(Type *vecType, Align alignment, Value *addr, Mask mask, Value *values) {
   bool scatter(values != nullptr);
   bool maskNonConst = !mask.knownAllTrue();
-  maskNonConst ? (scatter ? ++numMaskedScatter : ++numMaskedGather) : (scatter ? ++numScatter : ++numGather);
+  maskNonConst ? (scatter ? ++stats.numMaskedScatter : ++stats.numMaskedGather) : (scatter ? ++stats.numScatter : ++stats.numGather);
 
 #ifdef LLVM_HAVE_VP
   if (config.enableVP) {
@@ -1892,6 +2290,28 @@ Value *NatBuilder::createVaryingMemory(Type *vecType, Align alignment, Value *ad
   }
 #endif
 
+  // pick the cheapest lowering (without gather/scatter support the intrinsics are expanded into branches on every lane)
+  auto * accessedType = cast<VectorType>(vecType)->getElementType();
+  unsigned addrSpace = cast<PointerType>(cast<VectorType>(addr->getType())->getElementType())->getAddressSpace();
+  VaryingLowering lowering = config.useScatterGatherIntrinsics ? VaryingLowering::Intrinsic : VaryingLowering::Cascade;
+  if (costModel) {
+    lowering = costModel->pickVaryingLowering(*accessedType, addrSpace, alignment, vectorWidth(), scatter, maskNonConst);
+  }
+
+  switch (lowering) {
+    case VaryingLowering::Blend:
+      return createBlendedMemory(vecType, alignment, addr, mask, values);
+
+    case VaryingLowering::Cascade: {
+      auto * maskVec = &mask.requestPredAsValue(builder.getContext(), vectorWidth());
+      if (scatter) return requestCascadeStore(values, addr, alignment.value(), maskVec);
+      return requestCascadeLoad(addr, alignment.value(), maskVec);
+    }
+
+    case VaryingLowering::Intrinsic:
+      break;
+  }
+
   auto * vecPtrTy = addr->getType();
 
   std::vector<Value *> args;
@@ -1907,6 +2327,57 @@ Value *NatBuilder::createVaryingMemory(Type *vecType, Align alignment, Value *ad
   return builder.CreateCall(intr, args);
 }
 
+Value *NatBuilder::createBlendedMemory(Type *vecType, Align alignment, Value *addr, Mask mask, Value *values) {
+  bool scatter(values != nullptr);
+  auto * accessedType = cast<VectorType>(vecType)->getElementType();
+
+  // inactive lanes access the dummy slot instead
+  Value * laneMask = nullptr;
+  Value * dummyPtr = nullptr;
+  if (!mask.knownAllTrue()) {
+    laneMask = &mask.requestPredAsValue(builder.getContext(), vectorWidth());
+    auto * lanePtrTy = cast<VectorType>(addr->getType())->getElementType();
+    dummyPtr = builder.CreatePointerCast(&requestDummySlot(*accessedType, alignment), lanePtrTy);
+  }
+
+  Value * result = scatter ? nullptr : UndefValue::get(vecType);
+  for (int i = 0; i < vectorWidth(); ++i) {
+    Value * lanePtr = builder.CreateExtractElement(addr, ConstantInt::get(i32Ty, i), "blend_ptr_" + std::to_string(i));
+    if (laneMask) {
+      auto * laneActive = builder.CreateExtractElement(laneMask, ConstantInt::get(i32Ty, i));
+      lanePtr = builder.CreateSelect(laneActive, lanePtr, dummyPtr);
+    }
+
+    if (scatter) {
+      auto * laneVal = builder.CreateExtractElement(values, ConstantInt::get(i32Ty, i), "val_lane_" + std::to_string(i));
+      auto * laneStore = builder.CreateStore(laneVal, lanePtr);
+      laneStore->setAlignment(alignment);
+      result = laneStore;
+    } else {
+      auto * laneLoad = builder.CreateLoad(accessedType, lanePtr, "load_lane_" + std::to_string(i));
+      laneLoad->setAlignment(alignment);
+      result = builder.CreateInsertElement(result, laneLoad, ConstantInt::get(i32Ty, i), "blend_gather");
+    }
+  }
+  return result;
+}
+
+AllocaInst &NatBuilder::requestDummySlot(Type & elemTy, Align alignment) {
+  auto *& slot = dummySlotMap[&elemTy];
+  if (!slot) {
+    auto & entryBlock = vecInfo.getMapping().vectorFn->getEntryBlock();
+    unsigned allocaAS = layout.getAllocaAddrSpace();
+    auto insertPt = entryBlock.getFirstInsertionPt();
+    if (insertPt == entryBlock.end()) {
+      slot = new AllocaInst(&elemTy, allocaAS, nullptr, alignment, "blend_dummy", &entryBlock);
+    } else {
+      slot = new AllocaInst(&elemTy, allocaAS, nullptr, alignment, "blend_dummy", &*insertPt);
+    }
+  }
+  if (slot->getAlign() < alignment) slot->setAlignment(alignment);
+  return *slot;
+}
+
 Value *NatBuilder::createContiguousStore(Value *vecVal, Value *elemPtr, Align alignment, Mask vecMask) {
 #ifdef LLVM_HAVE_VP
   if (config.enableVP) {
@@ -2234,7 +2705,7 @@ NatBuilder::requestVectorGEP(GetElementPtrInst *const gep) {
   Value *mapped = getVectorValue(*gep);
   if (mapped) return mapped;
 
-  ++numVecGEPs;
+  ++stats.numVecGEPs;
 
   mapped = buildGEP(gep, false, 0);
   mapVectorValue(gep, mapped);
@@ -2246,7 +2717,7 @@ NatBuilder::requestScalarGEP(llvm::GetElementPtrInst *const gep, unsigned laneId
   Value *mapped = getScalarValue(*gep, laneIdx);
   if (mapped) return mapped;
 
-  ++numScalGEPs;
+  ++stats.numScalGEPs;
 
   mapped = buildGEP(gep, true, laneIdx);
   if (!skipMapping)
@@ -2260,7 +2731,7 @@ NatBuilder::requestVectorBitCast(BitCastInst *const bc) {
   if (mapped)
     return mapped;
 
-  ++numVecBCs;
+  ++stats.numVecBCs;
 
   BasicBlockVector mappedBlocks = getMappedBlocks(bc->getParent());
   BasicBlock *insertBlock = builder.GetInsertBlock();
@@ -2285,7 +2756,7 @@ Value *NatBuilder::requestScalarBitCast(llvm::BitCastInst *const bc, unsigned la
   if (mapped)
     return mapped;
 
-  ++numScalBCs;
+  ++stats.numScalBCs;
 
   BasicBlockVector mappedBlocks = getMappedBlocks(bc->getParent());
   BasicBlock *insertBlock = builder.GetInsertBlock();
@@ -2362,7 +2833,7 @@ NatBuilder::requestInterleavedGEP(GetElementPtrInst *const gep, unsigned interle
 
 llvm::Value *
 NatBuilder::requestInterleavedAddress(llvm::Value *const addr, unsigned interleavedIdx, Type *const vecType) {
-  ++numInterGEPs;
+  ++stats.numInterGEPs;
   Value *interAddr = addr;
 
   if (isa<BitCastInst>(interAddr))
@@ -2384,70 +2855,17 @@ NatBuilder::requestInterleavedAddress(llvm::Value *const addr, unsigned interlea
 
 llvm::Value *
 NatBuilder::requestCascadeLoad(Value *vecPtr, unsigned alignment, Value *mask) {
-  Type *elementPtrType = cast<VectorType>(vecPtr->getType())->getElementType();
-  Type *accessedType = cast<PointerType>(elementPtrType)->getElementType();
-  unsigned bitWidth = accessedType->getScalarSizeInBits();
-
-  Function *func = getCascadeFunction(bitWidth, false);
-  if (!func) {
-    func = createCascadeMemory(cast<VectorType>(vecPtr->getType()), alignment, cast<VectorType>(mask->getType()),
-                               false);
-    mapCascadeFunction(bitWidth, func, false);
-  }
-
-  // cast call argument to correct type if needed
-  Argument *ptrArg = &*func->arg_begin();
-  Value *callPtr = vecPtr;
-
-  if (ptrArg->getType() != vecPtr->getType()) {
-    callPtr = builder.CreateBitCast(callPtr, ptrArg->getType(), "bc");
-  }
-
-  std::vector<Value *> args;
-  args.push_back(callPtr);
-  args.push_back(mask);
-  Value *ret = builder.CreateCall(func, args, "cascade_load");
-  // cast call result to correct type if needed
-  Type *vecType = getVectorType(accessedType, vectorWidth());
-  if (ret->getType() != vecType) {
-    ret = builder.CreateBitCast(ret, vecType, "bc");
-  }
-  return ret;
+  Function *func = requestCascadeFunction(cast<VectorType>(vecPtr->getType()), alignment, cast<VectorType>(mask->getType()), false);
+  return builder.CreateCall(func, {vecPtr, mask}, "cascade_load");
 }
 
 Value *NatBuilder::requestCascadeStore(Value *vecVal, Value *vecPtr, unsigned alignment, Value *mask) {
-  unsigned bitWidth = vecVal->getType()->getScalarSizeInBits();
-
-  Function *func = getCascadeFunction(bitWidth, true);
-  if (!func) {
-    func = createCascadeMemory(cast<VectorType>(vecPtr->getType()), alignment, cast<VectorType>(mask->getType()),
-                               true);
-    mapCascadeFunction(bitWidth, func, true);
-  }
-
-  // cast call arguments to correct type if needed
-  auto argIt = func->arg_begin();
-  Argument *valArg = &*argIt++;
-  Argument *ptrArg = &*argIt;
-  Value *callVal = vecVal;
-  Value *callPtr = vecPtr;
-
-  if (valArg->getType() != callVal->getType()) {
-    callVal = builder.CreateBitCast(callVal, valArg->getType());
-  }
-  if (ptrArg->getType() != callPtr->getType()) {
-    callPtr = builder.CreateBitCast(callPtr, ptrArg->getType());
-  }
-
-  std::vector<Value *> args;
-  args.push_back(callVal);
-  args.push_back(callPtr);
-  args.push_back(mask);
-  return builder.CreateCall(func, args);
+  Function *func = requestCascadeFunction(cast<VectorType>(vecPtr->getType()), alignment, cast<VectorType>(mask->getType()), true);
+  return builder.CreateCall(func, {vecVal, vecPtr, mask});
 }
 
-Function *NatBuilder::createCascadeMemory(VectorType *pointerVectorType, unsigned alignment, VectorType *maskType,
-                                          bool store) {
+Function *NatBuilder::requestCascadeFunction(VectorType *pointerVectorType, unsigned alignment, VectorType *maskType,
+                                             bool store) {
   assert(cast<VectorType>(pointerVectorType)->getElementType()->isPointerTy()
          && "pointerVectorType must be of type vector of pointer!");
   assert(cast<VectorType>(maskType)->getElementType()->isIntegerTy(1)
@@ -2468,9 +2886,20 @@ Function *NatBuilder::createCascadeMemory(VectorType *pointerVectorType, unsigne
   argTypes.push_back(pointerVectorType);
   argTypes.push_back(maskType);
 
-  std::string name = store ? "nativeCascadeStoreFn" : "nativeCascadeLoadFn";
+  // one helper per access type, vector width, alignment and address space (shared by all vectorized functions of the module)
+  std::string typeName;
+  raw_string_ostream typeOut(typeName);
+  typeOut << *pointerVectorType;
+  typeOut.flush();
+  for (auto & c : typeName) if (!isalnum(c)) c = '_';
+
+  std::string name = (store ? "rv_cascade_store_" : "rv_cascade_load_") + typeName + "_a" + std::to_string(alignment);
   FunctionType *fnType = FunctionType::get(resType, argTypes, false);
-  Function *func = Function::Create(fnType, GlobalValue::LinkageTypes::ExternalLinkage, name, mod);
+  if (Function *cachedFunc = mod->getFunction(name)) {
+    assert(cachedFunc->getFunctionType() == fnType && "cascade function type mismatch");
+    return cachedFunc;
+  }
+  Function *func = Function::Create(fnType, GlobalValue::LinkageTypes::InternalLinkage, name, mod);
 
   auto argIt = func->arg_begin();
   Argument *valVec = nullptr;
@@ -2555,16 +2984,76 @@ Function *NatBuilder::createCascadeMemory(VectorType *pointerVectorType, unsigne
   return func;
 }
 
-void NatBuilder::mapCascadeFunction(unsigned bitWidth, Function *function, bool store) {
-  if (store) cascadeStoreMap[bitWidth] = function;
-  else cascadeLoadMap[bitWidth] = function;
-}
+void
+NatBuilder::instrumentMaskProfile() {
+  Function *vecFunc = vecInfo.getMapping().vectorFn;
+  Module & mod = *vecFunc->getParent();
+  auto & ctx = mod.getContext();
+  const auto & scaFunc = vecInfo.getScalarFunction();
+  int width = vectorWidth();
+
+  // blocks that were numbered before CIF/BOSCC/linearization (see VectorizationInfo::assignProfileIds)
+  std::vector<std::pair<const BasicBlock*, unsigned>> profBlocks;
+  for (auto & block : scaFunc) {
+    unsigned blockId;
+    if (vecInfo.inRegion(block) && vecInfo.getProfileBlockId(block, blockId)) profBlocks.emplace_back(&block, blockId);
+  }
+  if (profBlocks.empty()) return;
+
+  auto * i32Ty = Type::getInt32Ty(ctx);
+  auto * i64Ty = Type::getInt64Ty(ctx);
+  auto * i8PtrTy = Type::getInt8PtrTy(ctx);
+
+  // one histogram over the number of active lanes (0..width) per block
+  auto * tableTy = ArrayType::get(i64Ty, profBlocks.size() * (width + 1));
+  auto * counters = new GlobalVariable(mod, tableTy, false, GlobalValue::InternalLinkage, ConstantAggregateZero::get(tableTy), "rv.maskprof.counters");
+
+  for (size_t tableIdx = 0; tableIdx < profBlocks.size(); ++tableIdx) {
+    auto & scaBlock = *const_cast<BasicBlock*>(profBlocks[tableIdx].first);
+    auto * vecBlock = getVectorBlock(scaBlock, true);
+    builder.SetInsertPoint(vecBlock->getTerminator());
+
+    Mask vecMask = requestVectorMask(scaBlock);
+    auto * laneMask = &vecMask.requestPredAsValue(ctx, width);
+    auto * flatMask = builder.CreateBitCast(laneMask, builder.getIntNTy(width), "maskprof_bits");
+    auto * numActive = builder.CreateZExt(builder.CreateUnaryIntrinsic(Intrinsic::ctpop, flatMask), i64Ty);
+
+    // the region may run on several threads (eg OpenMP loops)
+    auto * counterIdx = builder.CreateAdd(numActive, ConstantInt::get(i64Ty, tableIdx * (width + 1)));
+    auto * counterPtr = builder.CreateInBoundsGEP(tableTy, counters, {ConstantInt::get(i64Ty, 0), counterIdx});
+    builder.CreateAtomicRMW(AtomicRMWInst::Add, counterPtr, ConstantInt::get(i64Ty, 1), AtomicOrdering::Monotonic);
+  }
 
-Function *NatBuilder::getCascadeFunction(unsigned bitWidth, bool store) {
-  auto mapIt = store ? cascadeStoreMap.find(bitWidth) : cascadeLoadMap.find(bitWidth);
-  auto mapEt = store ? cascadeStoreMap.end() : cascadeLoadMap.end();
-  if (mapIt != mapEt) return mapIt->second;
-  return nullptr;
+  // block ids
+  std::vector<Constant*> blockIds;
+  for (const auto & profBlock : profBlocks) blockIds.push_back(ConstantInt::get(i32Ty, profBlock.second));
+  auto * idsTy = ArrayType::get(i32Ty, blockIds.size());
+  auto * idsVar = new GlobalVariable(mod, idsTy, true, GlobalValue::PrivateLinkage, ConstantArray::get(idsTy, blockIds), "rv.maskprof.blocks");
+
+  // function name
+  auto * nameConst = ConstantDataArray::getString(ctx, scaFunc.getName());
+  auto * nameVar = new GlobalVariable(mod, nameConst->getType(), true, GlobalValue::PrivateLinkage, nameConst, "rv.maskprof.str");
+  nameVar->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+
+  // descriptor (layout of struct rv_mask_profile)
+  auto * descTy = StructType::get(ctx, {i8PtrTy, i32Ty, i32Ty->getPointerTo(), i64Ty->getPointerTo(), i32Ty, i32Ty, i8PtrTy});
+  auto * descConst = ConstantStruct::get(descTy, {
+      ConstantExpr::getPointerCast(nameVar, i8PtrTy),
+      ConstantInt::get(i32Ty, vecInfo.getProfileRegionId()),
+      ConstantExpr::getPointerCast(idsVar, i32Ty->getPointerTo()),
+      ConstantExpr::getPointerCast(counters, i64Ty->getPointerTo()),
+      ConstantInt::get(i32Ty, profBlocks.size()),
+      ConstantInt::get(i32Ty, width),
+      ConstantPointerNull::get(i8PtrTy)});
+  auto * descVar = new GlobalVariable(mod, descTy, false, GlobalValue::InternalLinkage, descConst, "rv.maskprof.desc");
+
+  // register the table at program start (default priority: after the runtime's own constructors)
+  auto registerFunc = mod.getOrInsertFunction("rv_mask_profile_register", Type::getVoidTy(ctx), i8PtrTy);
+  auto * initFunc = Function::Create(FunctionType::get(Type::getVoidTy(ctx), false), GlobalValue::InternalLinkage, "rv.maskprof.init", mod);
+  IRBuilder<> initBuilder(BasicBlock::Create(ctx, "entry", initFunc));
+  initBuilder.CreateCall(registerFunc, {ConstantExpr::getPointerCast(descVar, i8PtrTy)});
+  initBuilder.CreateRetVoid();
+  appendToGlobalCtors(mod, initFunc, 65535);
 }
 
 Value *NatBuilder::createPTest(Value *vector, bool isRv_all) {
@@ -2630,19 +3119,25 @@ NatBuilder::requestLanePredicate(const BasicBlock &ScaBlock, int Lane) {
 }
 
 Mask
-NatBuilder::requestVectorized(Mask ScaMask) {
+NatBuilder::requestVectorized(Mask ScaMask, bool KeepAVL) {
   auto VecPred = ScaMask.getPred() ? requestVectorValue(ScaMask.getPred()) : nullptr;
   auto VecAVL = ScaMask.getAVL() ? requestScalarValue(ScaMask.getAVL()) : nullptr;
-  return Mask(VecPred, VecAVL);
+  if (!VecAVL || KeepAVL) {
+    return Mask(VecPred, VecAVL);
+  }
+
+  // the consumer does not understand the AVL -> lower it into the predicate (lane < AVL)
+  VectorMaskBuilder MBuilder(vectorWidth());
+  return MBuilder.FoldAVL(builder, Mask(VecPred, VecAVL), "avl");
 }
 
 Mask
-NatBuilder::requestVectorMask(const BasicBlock& ScaBlock) {
+NatBuilder::requestVectorMask(const BasicBlock& ScaBlock, bool KeepAVL) {
   if (!vecInfo.hasMask(ScaBlock) || vecInfo.getMask(ScaBlock).knownAllTrue()) {
     return Mask::getAllTrue();
   }
   Mask ScaMask = vecInfo.getMask(ScaBlock);
-  return requestVectorized(ScaMask);
+  return requestVectorized(ScaMask, KeepAVL);
 }
 
 Mask
@@ -2872,7 +3367,7 @@ NatBuilder::materializeOrderedReduction(Reduction & red, PHINode & scaPhi) {
   orderPhi->addIncoming(scaInitValue, vecInitInputBlock);
 // (orderly) reduce vectors into scalars
   IRBuilder<> latchBuilder(&vecLatchBlock, vecLatchBlock.getTerminator()->getIterator());
-  auto & reducedUpdate = CreateVectorReduce(config, latchBuilder, red.kind, *vecLatchInst, orderPhi);
+  auto & reducedUpdate = CreateVectorReduce(config, latchBuilder, red.kind, *vecLatchInst, orderPhi, true);
   orderPhi->addIncoming(&reducedUpdate, &vecLatchBlock);
 
 // reduce reduction phi for outside users
@@ -2905,7 +3400,7 @@ NatBuilder::materializeOrderedReduction(Reduction & red, PHINode & scaPhi) {
                       IRBuilder<> builder(&userBlock, insertPt->getIterator());
                       // reduce all end-of-iteration values and request value of last iteration
                       auto & foldVec = *builder.CreateSelect(selMask, vecLatchInst, &vecElem, ".red");
-                      auto & reducedVector = CreateVectorReduce(config, builder, red.kind, foldVec, orderPhi);
+                      auto & reducedVector = CreateVectorReduce(config, builder, red.kind, foldVec, orderPhi, true);
                       return reducedVector;
                     }
     );
@@ -3430,4 +3925,201 @@ void NatBuilder::visitMemInstructions() {
   }
 }
 
+static bool
+IsInterleavedFactor(int64_t factor) {
+  return factor == 2 || factor == 3 || factor == 4 || factor == 8;
+}
+
+// whether the members between \p first and \p last (both in the same block) may be combined into a single access
+static bool
+CanCombineAccesses(Instruction & first, Instruction & last, bool isStore, const std::set<Instruction *> & members) {
+  for (auto it = first.getIterator(), itEnd = last.getIterator(); it != itEnd; ++it) {
+    auto & inst = *it;
+    if (members.count(&inst)) continue;
+    // loads are hoisted to the first member, stores are sunk to the last one
+    if (isStore ? inst.mayReadOrWriteMemory() : inst.mayWriteToMemory()) return false;
+  }
+  return true;
+}
+
+void NatBuilder::visitInterleavedGroups() {
+  // VE/VP codegen uses AVL predicated accesses instead
+  if (config.enableVP || config.useAVL) return;
+
+  // RV also runs with analysis managers of its own, register the analysis on demand
+  FAM.registerPass([] { return MemoryAccessAnalysisPass(); });
+  auto & memAccesses = FAM.getResult<MemoryAccessAnalysisPass>(vecInfo.getScalarFunction());
+
+  for (auto & block : *vecInfo.getMapping().scalarFn) {
+    if (!vecInfo.inRegion(block)) continue;
+
+    // candidate accesses by kind, element type, stride and address group (in block order)
+    std::map<std::tuple<bool, Type *, int64_t, unsigned>, std::vector<std::pair<int64_t, Instruction *>>> candidates;
+    for (auto & inst : block) {
+      auto * load = dyn_cast<LoadInst>(&inst);
+      auto * store = dyn_cast<StoreInst>(&inst);
+      if (!load && !store) continue;
+      if (keepScalar.count(&inst)) continue;
+      if (load ? !load->isSimple() : !store->isSimple()) continue;
+
+      Type * accessedType = load ? load->getType() : store->getValueOperand()->getType();
+      if (!accessedType->isIntegerTy() && !accessedType->isFloatingPointTy()) continue;
+      int64_t byteSize = layout.getTypeStoreSize(accessedType);
+      if (byteSize == 0 || (int64_t) layout.getTypeAllocSize(accessedType) != byteSize) continue;
+
+      VectorShape addrShape = getVectorShape(*getLoadStorePointerOperand(&inst));
+      if (!addrShape.hasStridedShape() || addrShape.getStride() % byteSize != 0) continue;
+      int64_t factor = addrShape.getStride() / byteSize;
+      if (!IsInterleavedFactor(factor)) continue;
+
+      unsigned groupIdx;
+      int64_t offset;
+      if (!memAccesses.getAccessGroup(inst, groupIdx, offset)) continue;
+
+      candidates[std::make_tuple((bool) store, accessedType, factor, groupIdx)].emplace_back(offset, &inst);
+    }
+
+    for (auto & itCandidates : candidates) {
+      bool isStore = std::get<0>(itCandidates.first);
+      int64_t byteSize = layout.getTypeStoreSize(std::get<1>(itCandidates.first));
+      int64_t factor = std::get<2>(itCandidates.first);
+      int64_t recordSize = factor * byteSize;
+
+      // cut the address group into records (starting at the lowest offset)
+      auto & accesses = itCandidates.second;
+      std::stable_sort(accesses.begin(), accesses.end(),
+          [](const std::pair<int64_t, Instruction *> & a, const std::pair<int64_t, Instruction *> & b) { return a.first < b.first; });
+
+      for (size_t recordBegin = 0, recordEnd = 0; recordBegin < accesses.size(); recordBegin = recordEnd) {
+        int64_t recordOffset = accesses[recordBegin].first;
+        InterleavedGroup group;
+        group.isStore = isStore;
+        group.factor = (unsigned) factor;
+        group.members.resize(factor, nullptr);
+        std::set<Instruction *> members;
+        for (recordEnd = recordBegin; recordEnd < accesses.size() && accesses[recordEnd].first < recordOffset + recordSize; ++recordEnd) {
+          int64_t delta = accesses[recordEnd].first - recordOffset;
+          if (delta % byteSize != 0) continue;
+          auto & slot = group.members[delta / byteSize];
+          if (slot) continue; // keep the first access to every member
+          slot = accesses[recordEnd].second;
+          members.insert(slot);
+        }
+        if (members.size() < 2) continue;
+
+        // block order of the members
+        Instruction * firstInst = nullptr;
+        Instruction * lastInst = nullptr;
+        for (auto & inst : block) {
+          if (!members.count(&inst)) continue;
+          if (!firstInst) firstInst = &inst;
+          lastInst = &inst;
+        }
+        if (!CanCombineAccesses(*firstInst, *lastInst, isStore, members)) continue;
+
+        group.insertInst = isStore ? lastInst : firstInst;
+        group.insertIdx = std::find(group.members.begin(), group.members.end(), group.insertInst) - group.members.begin();
+
+        IF_DEBUG_NAT {
+          errs() << "nat: interleaved " << (isStore ? "store" : "load") << " group, factor " << factor << ":\n";
+          for (auto * member : group.members) {
+            if (member) errs() << "\t" << *member << "\n";
+            else errs() << "\t<gap>\n";
+          }
+        }
+
+        for (auto * member : members) {
+          interleavedGroupIdx[member] = interleavedGroups.size();
+        }
+        interleavedGroups.push_back(group);
+      }
+    }
+  }
+}
+
+bool NatBuilder::vectorizeInterleavedGroup(Instruction & inst) {
+  auto itGroup = interleavedGroupIdx.find(&inst);
+  if (itGroup == interleavedGroupIdx.end()) return false;
+  const InterleavedGroup & group = interleavedGroups[itGroup->second];
+
+  // the whole group is materialized at its insertion member
+  if (&inst != group.insertInst) return true;
+
+  auto * scaBlock = inst.getParent();
+  Mask scaMask = vecInfo.getMask(*scaBlock);
+  bool needsMask = !scaMask.knownAllTrue() && !vecInfo.getVectorShape(scaMask).isUniform();
+  // an AVL makes the mask varying and is folded into the lane predicate (lane < AVL), which is then replicated per member
+  Mask vecMask = needsMask ? requestVectorMask(*scaBlock, false) : Mask::getAllTrue();
+  assert(!vecMask.getAVL());
+
+  bool hasGaps = std::find(group.members.begin(), group.members.end(), nullptr) != group.members.end();
+  unsigned numMembers = group.factor - std::count(group.members.begin(), group.members.end(), nullptr);
+
+  Type * accessedType = group.isStore ? cast<StoreInst>(inst).getValueOperand()->getType() : inst.getType();
+  unsigned byteSize = (unsigned) layout.getTypeStoreSize(accessedType);
+  auto * wideType = FixedVectorType::get(accessedType, vectorWidth() * group.factor);
+
+  // address of the record of lane 0
+  Value * accessedPtr = getLoadStorePointerOperand(&inst);
+  Value * memberPtr = requestScalarValue(accessedPtr);
+  Value * recordPtr = builder.CreateConstGEP1_64(accessedType, memberPtr, -(int64_t) group.insertIdx, "inter_record");
+  unsigned addrSpace = accessedPtr->getType()->getPointerAddressSpace();
+  Value * widePtr = builder.CreatePointerCast(recordPtr, wideType->getPointerTo(addrSpace), "inter_cast");
+  Align alignment = commonAlignment(getLoadStoreAlignment(&inst), group.insertIdx * byteSize);
+
+  // replicate the lane mask for every member (gaps are masked out)
+  Value * wideMask = nullptr;
+  if (needsMask || hasGaps) {
+    auto * boolTy = FixedVectorType::get(i1Ty, vectorWidth());
+    Value * laneMask = needsMask ? vecMask.getPred() : Constant::getAllOnesValue(boolTy);
+    std::vector<Value *> memberMasks;
+    for (auto * member : group.members) {
+      memberMasks.push_back(member ? laneMask : nullptr);
+    }
+    ShuffleBuilder maskBuilder(memberMasks, vectorWidth());
+    wideMask = maskBuilder.interleave(builder);
+  }
+
+  if (group.isStore) {
+    std::vector<Value *> memberValues;
+    for (auto * member : group.members) {
+      memberValues.push_back(member ? requestVectorValue(cast<StoreInst>(member)->getValueOperand()) : nullptr);
+    }
+    ShuffleBuilder interleaver(memberValues, vectorWidth());
+    Value * wideValue = interleaver.interleave(builder);
+
+    Instruction * wideStore;
+    if (wideMask) {
+      wideStore = builder.CreateMaskedStore(wideValue, widePtr, alignment, wideMask);
+    } else {
+      wideStore = builder.CreateAlignedStore(wideValue, widePtr, alignment);
+    }
+    for (auto * member : group.members) {
+      if (member) mapVectorValue(member, wideStore);
+    }
+    needsMask ? stats.numInterMaskedStores += numMembers : stats.numInterStores += numMembers;
+
+  } else {
+    Value * wideLoad;
+    if (wideMask) {
+      wideLoad = builder.CreateMaskedLoad(widePtr, alignment, wideMask, UndefValue::get(wideType), "inter_load");
+    } else {
+      wideLoad = builder.CreateAlignedLoad(wideType, widePtr, alignment, "inter_load");
+    }
+
+    std::vector<Value *> wideVecs(1, wideLoad);
+    ShuffleBuilder deinterleaver(wideVecs, vectorWidth());
+    for (unsigned i = 0; i < group.factor; ++i) {
+      auto * member = group.members[i];
+      if (!member) continue;
+      Value * memberVal = deinterleaver.deinterleave(builder, group.factor, i);
+      memberVal->setName(member->getName() + ".inter");
+      mapVectorValue(member, memberVal);
+    }
+    needsMask ? stats.numInterMaskedLoads += numMembers : stats.numInterLoads += numMembers;
+  }
+
+  return true;
+}
+
 } // namespace rv
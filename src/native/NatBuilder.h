@@ -13,6 +13,7 @@
 #include "MemoryAccessGrouper.h"
 
 #include <vector>
+#include <memory>
 
 #include "rv/vectorizationInfo.h"
 #include "rv/PlatformInfo.h"
@@ -20,10 +21,14 @@
 #include "rv/intrinsics.h"
 #include "rv/analysis/UndeadMaskAnalysis.h"
 #include "rv/analysis/reductions.h"
+#include "rv/analysis/costModel.h"
+#include "rv/vectorizationReport.h"
 #include "llvm/IR/PassManager.h"
 
 #include <llvm/Analysis/MemoryDependenceAnalysis.h>
 #include <llvm/IR/Dominators.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/PostDominators.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/Transforms/Utils/ValueMapper.h>
@@ -49,11 +54,16 @@ namespace rv {
     rv::Config config;
     rv::PlatformInfo & platInfo;
     rv::VectorizationInfo &vecInfo;
-    const llvm::DominatorTree &dominatorTree;
+    llvm::DominatorTree &dominatorTree;
+    llvm::PostDominatorTree *postDomTree; // updated when embedding a loop region (if available)
+    llvm::LoopInfo *loopInfo;             // updated when embedding a loop region (if available)
     llvm::MemoryDependenceResults & memDepRes;
     llvm::ScalarEvolution &SE;
+    llvm::FunctionAnalysisManager & FAM;
     rv::ReductionAnalysis & reda;
     rv::UndeadMaskAnalysis undeadMasks;
+    // picks the lowering of varying accesses (null without TTI)
+    std::unique_ptr<rv::CostModel> costModel;
 
     llvm::DataLayout layout;
 
@@ -63,6 +73,8 @@ namespace rv {
     // the predicate argument in the vector function (WFV mode)
     llvm::Value * vecMaskArg; // TODO use a Mask
 
+    // widening statistics of this region
+    NatStatistics stats;
     void printStatistics();
 
     rv::VectorShape getVectorShape(const llvm::Value &val) const;
@@ -89,7 +101,8 @@ namespace rv {
     // create a mask cascade at the current insertion point, call @genFunc in every cascaded block, if @packResult insert all values provided by @genFunc into
     // an accumulator and return that (result size 1). If !@packResult return dominating definitions of the computed value
     // @genFunc: first argument is an IRBuilder that inserts into a fresh mask-guarded block, second argument is the lane for which the instruction @inst should be scalarized
-    ValVec scalarizeCascaded(llvm::BasicBlock & srcBlock, llvm::Instruction & srcInst, bool packResult, std::function<llvm::Value*(llvm::IRBuilder<>&,size_t)> genFunc);
+    // @laneMask: guard the lanes by this <W x i1> vector instead of the predicate of @srcBlock
+    ValVec scalarizeCascaded(llvm::BasicBlock & srcBlock, llvm::Instruction & srcInst, bool packResult, std::function<llvm::Value*(llvm::IRBuilder<>&,size_t)> genFunc, llvm::Value * laneMask = nullptr);
 
     // scalarize without if-guard
     ValVec scalarize(llvm::BasicBlock & srcBlock, llvm::Instruction & srcInst, bool packResult, std::function<llvm::Value*(llvm::IRBuilder<>&,size_t)> genFunc);
@@ -102,6 +115,12 @@ namespace rv {
     // if vecInstMap is set, store the mapping from scalar source insts/blocks to vector versions
     void vectorize(bool embedRegion, llvm::ValueToValueMapTy * vecInstMap = nullptr);
 
+    // statistics of the last vectorize() call
+    const NatStatistics & getStatistics() const { return stats; }
+
+    // analyses of the vector function that vectorize() keeps up to date
+    llvm::PreservedAnalyses getPreservedAnalyses() const;
+
     void mapVectorValue(const llvm::Value *const value, llvm::Value *vecValue);
     void mapScalarValue(const llvm::Value *const value, llvm::Value *mapValue, unsigned laneIdx = 0);
 
@@ -135,6 +154,40 @@ namespace rv {
     void vectorizePHIInstruction(llvm::PHINode *const scalPhi);
     void vectorizeMemoryInstruction(llvm::Instruction *const inst);
     void vectorizeCallInstruction(llvm::CallInst *const scalCall);
+
+    // calls that are computed by a single multi-result math function (sin(x) & cos(x) -> sincos(x))
+    struct FusedMathCall {
+      std::string fusedName; // resolver name of the fused function
+      llvm::FunctionType * fusedTy; // scalar signature of the fused function
+      unsigned resultIdx; // element of the fused result computed by this call
+      llvm::CallInst * partner; // the other call of the pair
+    };
+    std::map<const llvm::CallInst *, FusedMathCall> fusedMathCalls;
+
+    // pre-widening combine: pair up calls that have a fused vector implementation
+    void combineFusedMathCalls();
+    // widen \p scalCall and its partner with one call to the fused function (false if it does not resolve)
+    bool vectorizeFusedMathCall(llvm::CallInst & scalCall, const FusedMathCall & fused);
+
+    // loads (or stores) of the members of a record that are accessed with the same constant stride (AoS)
+    struct InterleavedGroup {
+      bool isStore;
+      unsigned factor; // stride in elements
+      std::vector<llvm::Instruction *> members; // by element offset in the record (nullptr for gaps)
+      llvm::Instruction * insertInst; // the group is materialized here (first load or last store)
+      unsigned insertIdx; // record offset of insertInst
+    };
+    std::vector<InterleavedGroup> interleavedGroups;
+    std::map<const llvm::Instruction *, unsigned> interleavedGroupIdx;
+
+    // pre-widening: combine strided loads/stores into interleaved access groups
+    void visitInterleavedGroups();
+    // widen the interleaved group of \p inst with a wide contiguous access and shuffles (false if \p inst is not grouped)
+    bool vectorizeInterleavedGroup(llvm::Instruction & inst);
+
+    // post-widening: count the active lanes of every region block in a histogram table (registered with the mask profiling runtime)
+    void instrumentMaskProfile();
+
     void vectorizeMaskReductionCall(llvm::CallInst *rvCall, RVIntrinsic MaskIntrin);
     void vectorizeExtractCall(llvm::CallInst *rvCall);
     void vectorizeInsertCall(llvm::CallInst *rvCall);
@@ -148,9 +201,14 @@ namespace rv {
     void vectorizeCompactCall(llvm::CallInst * rvCall);
 
     void vectorizeAtomicRMW(llvm::AtomicRMWInst *const atomicrmw);
+    // varying pointer atomics: combine the values of lanes with the same address, one atomic per address
+    void vectorizeAtomicHistogram(llvm::AtomicRMWInst & atomicrmw);
 
-    // create a lookup table for an efficient compaction intrinsic
-    llvm::Constant* createCompactLookupTable(unsigned vecWidth);
+    // conflicts[d] is true in lane i if the lanes i and i - d are active and \p vecAddr is the same (d = 1 .. vectorWidth - 1)
+    std::vector<llvm::Value*> createLaneConflicts(llvm::Value & vecAddr, llvm::Value & laneMask);
+
+    // move the lanes of \p vecVal that are set in \p laneMask to the front (in order)
+    llvm::Value* createCompaction(llvm::Value & vecVal, llvm::Value & laneMask);
 
     void vectorizeAlloca(llvm::AllocaInst *const allocaInst);
 
@@ -165,12 +223,16 @@ namespace rv {
 
     void addValuesToPHINodes();
 
+    // the embedded vector loop replaces @oldBlocks: apply @cfgUpdates to the (post) dom tree and
+    // move the loop nest over to the vector blocks (@newBlocks)
+    void updateHostAnalyses(const std::vector<llvm::BasicBlock *> & oldBlocks, const std::vector<llvm::BasicBlock *> & newBlocks,
+                            llvm::ArrayRef<llvm::DominatorTree::UpdateType> cfgUpdates);
+
     void mapOperandsInto(llvm::Instruction *const scalInst, llvm::Instruction *inst, bool vectorizedInst,
                          unsigned laneIdx = 0);
 
     llvm::SmallPtrSet<llvm::Instruction *, 16> keepScalar;
-    llvm::DenseMap<unsigned, llvm::Function *> cascadeLoadMap;
-    llvm::DenseMap<unsigned, llvm::Function *> cascadeStoreMap;
+    llvm::DenseMap<const llvm::Type *, llvm::AllocaInst *> dummySlotMap;
     llvm::DenseMap<const llvm::Value *, llvm::Value *> vectorValueMap;
     std::map<const llvm::Value *, LaneValueVector> scalarValueMap;
     std::map<const llvm::BasicBlock *, BasicBlockVector> basicBlockMap;
@@ -178,13 +240,14 @@ namespace rv {
     std::map<std::pair<Mask, int>, llvm::Value*> MaskLaneMap;
     std::vector<llvm::PHINode *> phiVector;
 
-    // request the vector version of a given mask
-    Mask requestVectorized(Mask ScaMask);
+    // request the vector version of a given mask.
+    // The AVL is folded into the predicate unless \p KeepAVL (only VP lowerings consume it).
+    Mask requestVectorized(Mask ScaMask, bool KeepAVL = false);
 
     // request the mask bit for lane \p Lane in block \p ScaBlock.
     llvm::Value* requestLanePredicate(const llvm::BasicBlock &ScaBlock, int Lane);
     // request a vector bit mask for block \p ScaBlock.
-    Mask requestVectorMask(const llvm::BasicBlock& ScaBlock);
+    Mask requestVectorMask(const llvm::BasicBlock& ScaBlock, bool KeepAVL = false);
     llvm::Value *requestVectorValue(llvm::Value *const value);
     void SetInsertPointAfterMappedInst(llvm::IRBuilder<> & builder, llvm::Instruction * mappedInst);
     llvm::Value *requestScalarValue(llvm::Value *const value, unsigned laneIdx = 0,
@@ -200,12 +263,14 @@ namespace rv {
 
     llvm::Value *requestCascadeLoad(llvm::Value *vecPtr, unsigned alignment, llvm::Value *mask);
     llvm::Value *requestCascadeStore(llvm::Value *vecVal, llvm::Value *vecPtr, unsigned alignment, llvm::Value *mask);
-    llvm::Function *createCascadeMemory(llvm::VectorType *pointerVectorType, unsigned alignment,
-                                        llvm::VectorType *maskType, bool store);
+    // the (internal, per module) cascade function for loads/stores through \p pointerVectorType
+    llvm::Function *requestCascadeFunction(llvm::VectorType *pointerVectorType, unsigned alignment,
+                                           llvm::VectorType *maskType, bool store);
+
+    // stack slot that inactive lanes of blended loads/stores access instead
+    llvm::AllocaInst &requestDummySlot(llvm::Type & elemTy, llvm::Align alignment);
 
     llvm::Value* getSplat(llvm::Constant* Elt);
-    void mapCascadeFunction(unsigned bitWidth, llvm::Function *function, bool store);
-    llvm::Function *getCascadeFunction(unsigned bitWidth, bool store);
 
     llvm::Value& widenScalar(llvm::Value & scaValue, VectorShape vecShape);
     bool hasUniformPredicate(const llvm::BasicBlock & BB) const;
@@ -241,6 +306,9 @@ namespace rv {
 
     llvm::Value *createVaryingMemory(llvm::Type *vecType, llvm::Align alignment, llvm::Value *addr, Mask vecMask,
                                      llvm::Value *values);
+    // branch-free gather/scatter: one scalar access per lane, inactive lanes are redirected to a dummy slot
+    llvm::Value *createBlendedMemory(llvm::Type *vecType, llvm::Align alignment, llvm::Value *addr, Mask vecMask,
+                                     llvm::Value *values);
 
     llvm::Value *createContiguousStore(llvm::Value *val, llvm::Value *ptr, llvm::Align alignment, Mask vecMask);
     llvm::Value *createContiguousLoad(llvm::Value *ptr, llvm::Align alignment, Mask vecMask, llvm::Value *passThru);
@@ -213,4 +213,49 @@ Value *ShuffleBuilder::extractVector(IRBuilder<> &builder, unsigned index, unsig
   return builder.CreateShuffleVector(vec, UndefValue::get(vec->getType()), shuffleMask, "extract_shuffle");
 }
 
+Value *ShuffleBuilder::deinterleave(IRBuilder<> &builder, unsigned stride, unsigned start) {
+  assert(!inputVectors.empty() && "no vector to deinterleave!");
+  Value *wideVec = inputVectors[0];
+  assert(cast<FixedVectorType>(wideVec->getType())->getNumElements() == vectorWidth * stride && "mismatch between wide vector length and stride!");
+
+  SmallVector<int, 32> shuffleMask;
+  for (unsigned i = 0; i < vectorWidth; ++i) {
+    shuffleMask.push_back(static_cast<int>(start + i * stride));
+  }
+  return builder.CreateShuffleVector(wideVec, UndefValue::get(wideVec->getType()), shuffleMask, "inter_member");
+}
+
+Value *ShuffleBuilder::interleave(IRBuilder<> &builder) {
+  unsigned stride = static_cast<unsigned>(inputVectors.size());
+  assert(stride >= 2 && "not enough input vectors to interleave");
+
+  Type *elemTy = nullptr;
+  for (Value *member : inputVectors) {
+    if (member) elemTy = cast<VectorType>(member->getType())->getElementType();
+  }
+  assert(elemTy && "all members are gaps!");
+
+  // insert one member at a time into the wide accumulator (gaps stay zero)
+  unsigned wideWidth = vectorWidth * stride;
+  Value *accu = Constant::getNullValue(FixedVectorType::get(elemTy, wideWidth));
+  for (unsigned member = 0; member < stride; ++member) {
+    Value *memberVec = inputVectors[member];
+    if (!memberVec) continue;
+
+    // widen the member to the accumulator length
+    SmallVector<int, 32> widenMask;
+    for (unsigned i = 0; i < wideWidth; ++i) {
+      widenMask.push_back(i < vectorWidth ? static_cast<int>(i) : -1);
+    }
+    Value *wideMember = builder.CreateShuffleVector(memberVec, UndefValue::get(memberVec->getType()), widenMask, "inter_widen");
+
+    SmallVector<int, 32> shuffleMask;
+    for (unsigned i = 0; i < wideWidth; ++i) {
+      shuffleMask.push_back(i % stride == member ? static_cast<int>(wideWidth + i / stride) : static_cast<int>(i));
+    }
+    accu = builder.CreateShuffleVector(accu, wideMember, shuffleMask, "inter_shuffle");
+  }
+  return accu;
+}
+
 } // namespace rv
@@ -34,6 +34,12 @@ namespace rv {
     llvm::Value *shuffleToInterleaved(llvm::IRBuilder<> &builder, unsigned stride, unsigned start);
     llvm::Value *append(llvm::IRBuilder<> &builder);
     llvm::Value *extractVector(llvm::IRBuilder<> &builder, unsigned index, unsigned offset);
+
+    // interleaved access groups (a single wide vector holds <stride> members per lane)
+    // extract member <start> from the wide vector inputVectors[0]
+    llvm::Value *deinterleave(llvm::IRBuilder<> &builder, unsigned stride, unsigned start);
+    // interleave the input vectors (one per member, nullptr for gaps, which are filled with zeros) into one wide vector
+    llvm::Value *interleave(llvm::IRBuilder<> &builder);
   };
 }
 
@@ -18,10 +18,10 @@
 #include "rv/analysis/reductionAnalysis.h"
 #include "rv/region/LoopRegion.h"
 #include "rv/region/Region.h"
-#include "rv/resolver/resolvers.h"
 #include "rv/rv.h"
 #include "rv/transform/remTransform.h"
 #include "rv/vectorMapping.h"
+#include "rv/vectorizationReport.h"
 
 #include "rv/config.h"
 #include "rv/rvDebug.h"
@@ -39,6 +39,7 @@
 #include "llvm/Passes/PassBuilder.h"
 
 #include "llvm/ADT/GraphTraits.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
 #include "llvm/Analysis/BranchProbabilityInfo.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/MemoryDependenceAnalysis.h"
@@ -49,6 +50,7 @@
 #include "llvm/Analysis/LoopDependenceAnalysis.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
 #include <sstream>
 
 #include "report.h"
@@ -149,6 +151,71 @@ void LoopVectorizer::remarkMiss(const StringRef OREMsg, const StringRef ORETag,
   PassORE.emit(Remark << OREMsg);
 }
 
+// Pin the shapes of the header phis of \p L (induction variables and
+// reductions).
+static void pinHeaderPhiShapes(Loop &L, ReductionAnalysis &MyReda,
+                               VectorizationInfo &vecInfo,
+                               unsigned VectorWidth) {
+  for (auto &phi : L.getHeader()->phis()) {
+    rv::StridePattern *pat = MyReda.getStrideInfo(phi);
+    VectorShape phiShape;
+    if (pat) {
+      IF_DEBUG { pat->dump(); }
+      phiShape = pat->getShape(VectorWidth);
+    } else {
+      rv::Reduction *redInfo = MyReda.getReductionInfo(phi);
+
+      assert(redInfo);
+      assert(IsSupportedReduction(L, *redInfo));
+      // unsupported reduction kind (operator in value SCC unrecognized)
+      assert(redInfo->kind != RedKind::Top);
+
+      // Unsupported recurrence (definition and use in different loop
+      // iterations)
+      assert(redInfo->kind != RedKind::Bot);
+
+      // Otw, this is a privatizable reduction pattern
+      IF_DEBUG { redInfo->dump(); }
+      phiShape = redInfo->getShape(VectorWidth);
+    }
+
+    if (phiShape.isDefined())
+      vecInfo.setPinnedShape(phi, phiShape);
+  }
+}
+
+std::unique_ptr<VectorizationInfo>
+LoopVectorizer::analyzeLoopShapes(Loop &L, Region &LoopRegion,
+                                  unsigned VectorWidth) {
+  ReductionAnalysis MyReda(F, FAM);
+  MyReda.analyze(L);
+
+  std::unique_ptr<VectorizationInfo> vecInfo(
+      new VectorizationInfo(F, VectorWidth, LoopRegion));
+  pinHeaderPhiShapes(L, MyReda, *vecInfo, VectorWidth);
+
+  // The remainder transform will replace the exit conditions with uniform ones
+  SmallVector<BasicBlock *, 4> ExitingBlocks;
+  L.getExitingBlocks(ExitingBlocks);
+  for (auto *ExitingBB : ExitingBlocks) {
+    auto *Br = dyn_cast<BranchInst>(ExitingBB->getTerminator());
+    if (!Br || !Br->isConditional())
+      continue;
+    auto *CondInst = dyn_cast<Instruction>(Br->getCondition());
+    if (CondInst && L.contains(CondInst))
+      vecInfo->setPinnedShape(*CondInst, VectorShape::uni());
+  }
+
+  // the VA only annotates vecInfo (no runtime call lowering at this point)
+  vectorizer->analyze(*vecInfo, FAM);
+
+  IF_DEBUG_LV {
+    errs() << "-- speculative VA result --\n";
+    vecInfo->dump();
+  }
+  return vecInfo;
+}
+
 int LoopVectorizer::getTripAlignment(Loop &L) {
   int tripCount = getTripCount(L);
   if (tripCount > 0)
@@ -258,6 +325,19 @@ static std::string getTag(DebugLoc DL) {
   return ss.str();
 }
 
+void LoopVectorizer::reportRejection(Loop &L, const DebugLoc &DL,
+                                     StringRef Reason, const RegionCost *Cost) {
+  if (!VectorizationReport::isEnabled())
+    return;
+  VectorizationReport LoopReport("loop", F.getName().str(),
+                                 L.getHeader()->getName().str());
+  LoopReport.location = getTag(DL);
+  LoopReport.rejection = Reason.str();
+  if (Cost)
+    LoopReport.setCost(*Cost);
+  LoopReport.emit();
+}
+
 bool LoopVectorizer::scoreLoop(LoopJob &LJ, LoopScore &LS, Loop &L) {
   Value *CodeRegion;
   DebugLoc DL;
@@ -290,6 +370,8 @@ bool LoopVectorizer::scoreLoop(LoopJob &LJ, LoopScore &LS, Loop &L) {
   // (cheap-ish)
   if (!hasVectorizableLoopStructure(L, DoReportFail)) {
     Report() << "x unfit loop structure\n";
+    if (DoReportFail)
+      reportRejection(L, DL, "unfit loop structure");
     return false;
   }
 
@@ -342,9 +424,12 @@ bool LoopVectorizer::scoreLoop(LoopJob &LJ, LoopScore &LS, Loop &L) {
 
   // only trigger on annotated loops
   if (!mdAnnot.vectorizeEnable.safeGet(false)) {
-    if (enableDiagOutput)
+    // unannotated loops are the common case; only record them when diagnosing
+    if (enableDiagOutput) {
       Report() << "x loopVecPass skip " << L.getName()
                << " . not explicitly triggered.\n";
+      reportRejection(L, DL, "not explicitly triggered");
+    }
     return false;
   }
 
@@ -364,6 +449,7 @@ bool LoopVectorizer::scoreLoop(LoopJob &LJ, LoopScore &LS, Loop &L) {
     if (enableDiagOutput)
       Report() << "x loopVecPass skip " << L.getName()
                << " . Min dependence distance was " << LJ.DepDist << "\n";
+    reportRejection(L, DL, "dependence distance " + std::to_string(LJ.DepDist));
     return false;
   }
 
@@ -403,13 +489,32 @@ bool LoopVectorizer::scoreLoop(LoopJob &LJ, LoopScore &LS, Loop &L) {
     CostModel costModel(vectorizer->getPlatformInfo(), RVConfig);
     LoopRegion tmpLoopRegionImpl(L);
     Region tmpLoopRegion(tmpLoopRegionImpl);
-    size_t refinedWidth = costModel.pickWidthForRegion(
-        tmpLoopRegion, initialWidth); // TODO run VA first
+    size_t refinedWidth =
+        costModel.pickWidthForRegion(tmpLoopRegion, initialWidth);
+
+    // Compare the estimated vector cost against the scalar cost
+    RegionCost regionCost;
+    if (RVConfig.enableCostModel && !Force && refinedWidth > 1) {
+      // Shapes only differ in their alignment across widths, a single
+      // speculative VA run at the widest candidate suffices.
+      auto specVecInfo = analyzeLoopShapes(L, tmpLoopRegion, refinedWidth);
+      refinedWidth = costModel.pickProfitableWidth(
+          tmpLoopRegion, refinedWidth, specVecInfo.get(), &regionCost);
+      if (enableDiagOutput) {
+        Report() << "loopVecPass, costModel: ";
+        regionCost.print(ReportContinue());
+        ReportContinue() << "\n";
+      }
+    }
 
     if (refinedWidth <= 1) {
       if (enableDiagOutput) {
         Report() << "loopVecPass, costModel: vectorization not beneficial\n";
       }
+      if (DoReportFail)
+        remarkMiss("Vectorization not beneficial", "RVLoopVecNot", L);
+      reportRejection(L, DL, "not beneficial",
+                      regionCost.vectorWidth > 1 ? &regionCost : nullptr);
       return false;
     } else if (refinedWidth != (size_t)LJ.VectorWidth) {
       if (enableDiagOutput) {
@@ -422,6 +527,8 @@ bool LoopVectorizer::scoreLoop(LoopJob &LJ, LoopScore &LS, Loop &L) {
       }
       LJ.VectorWidth = refinedWidth;
     }
+
+    LJ.Cost = regionCost;
   }
 
   static int GlobalLoopCount = 0;
@@ -434,6 +541,7 @@ bool LoopVectorizer::scoreLoop(LoopJob &LJ, LoopScore &LS, Loop &L) {
     if (SelLoop != GlobalLoopCount) {
       Report() << "loopVecPass, RV_SELECT_LOOP != " << GlobalLoopCount
                << ". not vectorizing!\n";
+      reportRejection(L, DL, "RV_SELECT_LOOP");
       return false;
     }
   }
@@ -447,16 +555,57 @@ bool LoopVectorizer::scoreLoop(LoopJob &LJ, LoopScore &LS, Loop &L) {
     if (!SelectByName) {
       Report() << "loopVecPass, RV_SELECT_NAME != " << NameLoopTxt
                << ". not vectorizing!\n";
+      reportRejection(L, DL, "RV_SELECT_NAME");
       return false;
     }
   }
 
   LJ.TripAlign = getTripAlignment(L);
   LJ.Header = L.getHeader();
-  LS.Score = 0; // TODO compute score
+
+  // remainder treatment (loop annotation or configuration default)
+  int EpilogueMode = mdAnnot.epilogueMode.safeGet(RVConfig.epilogueMode);
+  if (EpilogueMode < Config::EM_Scalar || EpilogueMode > Config::EM_Masked) {
+    Report() << "loopVecPass: ignoring invalid epilogue annotation "
+             << EpilogueMode << "\n";
+    EpilogueMode = RVConfig.epilogueMode;
+  }
+  LJ.Epilogue = (Config::EpilogueMode)EpilogueMode;
+
+  // Expected speedup in percent (the uncosted case keeps a neutral score)
+  if (LJ.Cost.vectorWidth > 1) {
+    LS.Speedup = getExpectedSpeedup(L, LJ);
+    LS.HasEstimate = LS.Speedup > 0.0;
+    LS.Score = (unsigned)(100.0 * LS.Speedup);
+  }
   return true;
 }
 
+double LoopVectorizer::getExpectedSpeedup(Loop &L, const LoopJob &LJ) {
+  double Speedup = LJ.Cost.getSpeedup();
+
+  // without a trip count estimate assume that the remainder is negligible
+  int TripCount = getTripCount(L);
+  if (TripCount <= 0) {
+    auto EstTripCount = getLoopEstimatedTripCount(&L);
+    if (!EstTripCount.hasValue() || EstTripCount.getValue() == 0)
+      return Speedup;
+    TripCount = EstTripCount.getValue();
+  }
+
+  // time in units of a scalar iteration
+  unsigned Width = LJ.Cost.vectorWidth;
+  double VectorIterTime = Width / Speedup;
+  unsigned NumVectorIters = TripCount / Width;
+  unsigned NumRemIters = TripCount % Width;
+  double RemTime = NumRemIters;
+  if (NumRemIters > 0 && LJ.Epilogue == Config::EM_Masked)
+    RemTime = std::min<double>(RemTime, VectorIterTime);
+
+  double VectorTime = NumVectorIters * VectorIterTime + RemTime;
+  return VectorTime > 0.0 ? TripCount / VectorTime : Speedup;
+}
+
 enum ForLoopsControl {
   Descend = 0,     // continue for_loops into child lops
   SkipChildren = 1 // do not descend into child loops
@@ -497,75 +646,114 @@ static void for_loops_post(LoopInfo &LI, std::function<bool(Loop &)> BodyFunc) {
 }
 #endif
 
-bool LoopVectorizer::collectLoopJobs(LoopInfo &LI) {
-#if 0
-  // Outer-loop preference (ignores nested 'pragma omp simd' loops).
-  // TODO consider loops inside legal loops for vectorization on cost grounds.
-  for_loops(LI, [&](Loop &L) {
-    LoopJob LJ;
-    LoopScore LS;
+// frequency-weighted scalar cost of the blocks in \p L
+static double getWeightedScalarCost(Loop &L, BlockFrequencyInfo &BFI,
+                                    const CostModel &CM) {
+  double Cost = 0.0;
+  for (auto *BB : L.blocks()) {
+    double BlockCost = 0.0;
+    for (auto &I : *BB)
+      BlockCost += CM.getScalarCost(I);
+    Cost += BlockCost * BFI.getBlockFreq(BB).getFrequency();
+  }
+  return Cost;
+}
+
+LoopVectorizer::NestChoice
+LoopVectorizer::selectNestLoops(Loop &L, double NestWeight,
+                                std::map<Loop *, ScoredLoop> &Scores) {
+  // the best choice in the child loops (these are disjoint)
+  NestChoice Inner;
+  for (auto *ChildL : L) {
+    NestChoice ChildChoice = selectNestLoops(*ChildL, NestWeight, Scores);
+    if (ChildChoice.Loops.empty())
+      continue;
+    Inner.Saved += ChildChoice.Saved;
+    Inner.Estimated &= ChildChoice.Estimated;
+    Inner.HasSIMDAnnotation |= ChildChoice.HasSIMDAnnotation;
+    Inner.Loops.insert(Inner.Loops.end(), ChildChoice.Loops.begin(),
+                       ChildChoice.Loops.end());
+  }
 
-    // cost & legality
-    bool Legal = scoreLoop(LJ, LS, L);
-    if (!Legal)
-      return Descend;
+  auto &SL = Scores[&L];
+  if (!SL.Legal)
+    return Inner;
+
+  // Vectorizing L saves (1 - 1/speedup) of the time spent in L. The cost
+  // estimate accounts for divergent control (VA) and gathers, the speedup
+  // for the trip count, and the weight for the execution frequency of L.
+  NestChoice Outer;
+  Outer.Estimated = SL.LS.HasEstimate;
+  Outer.HasSIMDAnnotation = SL.LS.HasSIMDAnnotation;
+  Outer.Loops.push_back(&L);
+  if (Outer.Estimated) {
+    double Fraction = NestWeight > 0.0 ? SL.Weight / NestWeight : 1.0;
+    Outer.Saved = Fraction * (1.0 - 1.0 / SL.LS.Speedup);
+  }
 
-    // TODO: Check whether there is any child loop with an explicit SIMD
-    // annotation.
+  if (Inner.Loops.empty())
+    return Outer;
 
-    LoopsToPrepare.emplace_back(LJ);
-    return SkipChildren;
-  });
+  // Without estimates keep the annotation-driven choice (vectorize nested
+  // 'pragma omp simd' loops, otherwise the outer loop).
+  bool PickInner = (Outer.Estimated && Inner.Estimated)
+                       ? Inner.Saved > Outer.Saved
+                       : Inner.HasSIMDAnnotation;
 
-#else
-  // OpenMP mode (vectorize 'parallel for' loops unless there is a nested
-  // 'pragma omp simd' loop). Outer-loop preference (ignores nested 'pragma omp
-  // simd' loops).
-  // TODO consider loops inside legal loops for vectorization on cost grounds.
-  for_loops(LI, [&](Loop &L) {
-    LoopJob LJ;
-    LoopScore LS;
-
-    // cost & legality
-    bool Legal = scoreLoop(LJ, LS, L);
-    if (!Legal)
-      return Descend;
-
-    // Check whether there is a legal inner loop with a vectorization pragma.
-    bool FoundSIMDLoop = false;
-    for_loops(L, [&](Loop &InnerL) {
-      // Skip parent scope.
-      if (&InnerL == &L)
-        return Descend;
-
-      LoopJob InnerLJ;
-      LoopScore InnerLS;
-
-      // cost & legality
-      bool InnerLegal = scoreLoop(InnerLJ, InnerLS, InnerL);
-      if (!InnerLegal)
-        return Descend;
-
-      if (InnerLS.HasSIMDAnnotation) {
-        FoundSIMDLoop = true;
-        LoopsToPrepare.emplace_back(InnerLJ);
-        return SkipChildren;
-      }
-      return Descend;
-    });
+  if (enableDiagOutput)
+    Report() << "loopVecPass: nest choice at " << L.getName() << ": outer "
+             << (int)(100.0 * Outer.Saved) << "% vs. inner "
+             << (int)(100.0 * Inner.Saved) << "% of the nest saved -> "
+             << (PickInner ? "inner" : "outer") << "\n";
+
+  // record why the other loops stay scalar
+  auto &Rejected = PickInner ? Outer : Inner;
+  for (auto *RejectedL : Rejected.Loops) {
+    Value *CodeRegion;
+    DebugLoc DL;
+    getRemarkLoc(*RejectedL, &*RejectedL->getHeader()->phis().begin(),
+                 CodeRegion, DL);
+    auto &RejectedLJ = Scores[RejectedL].LJ;
+    reportRejection(*RejectedL, DL,
+                    PickInner ? "nested loop preferred"
+                              : "enclosing loop preferred",
+                    RejectedLJ.Cost.vectorWidth > 1 ? &RejectedLJ.Cost
+                                                    : nullptr);
+  }
 
-    if (!FoundSIMDLoop)
-      LoopsToPrepare.emplace_back(LJ);
+  return PickInner ? Inner : Outer;
+}
 
-    return SkipChildren;
+bool LoopVectorizer::collectLoopJobs(LoopInfo &LI) {
+  // Score all loops (cost & legality).
+  std::map<Loop *, ScoredLoop> Scores;
+  for_loops(LI, [&](Loop &L) {
+    auto &SL = Scores[&L];
+    SL.Legal = scoreLoop(SL.LJ, SL.LS, L);
+    SL.Weight = 0.0;
+    return Descend;
   });
-#endif
+
+  // Weigh the loops by their execution frequency (BFI uses profile data if
+  // available, otherwise branch heuristics).
+  auto &BFI = FAM.getResult<BlockFrequencyAnalysis>(F);
+  CostModel costModel(vectorizer->getPlatformInfo(), RVConfig);
+  for (auto &It : Scores)
+    It.second.Weight = getWeightedScalarCost(*It.first, BFI, costModel);
+
+  // Pick the level to vectorize in every loop nest.
+  for (auto *NestL : LI) {
+    NestChoice Choice = selectNestLoops(*NestL, Scores[NestL].Weight, Scores);
+    for (auto *L : Choice.Loops)
+      LoopsToPrepare.emplace_back(Scores[L].LJ);
+  }
 
   return !LoopsToPrepare.empty();
 }
 
 PreparedLoop LoopVectorizer::transformToVectorizableLoop(
-    Loop &L, int VectorWidth, int tripAlign, ValueSet &uniformOverrides) {
+    Loop &L, int VectorWidth, int tripAlign, ValueSet &uniformOverrides,
+    bool UseTailPredication) {
   IF_DEBUG {
     errs() << "\tPreparing loop structure of " << L.getName() << "\n";
   }
@@ -575,99 +763,318 @@ PreparedLoop LoopVectorizer::transformToVectorizableLoop(
   MyReda.analyze(L);
   RemainderTransform remTrans(F, FAM, MyReda);
   PreparedLoop LoopPrep = remTrans.createVectorizableLoop(
-      L, uniformOverrides, RVConfig.useAVL, VectorWidth, tripAlign);
+      L, uniformOverrides, UseTailPredication, VectorWidth, tripAlign);
+  if (LoopPrep.TheLoop)
+    FAM.invalidate(F, remTrans.getPreservedAnalyses());
 
   return LoopPrep;
 }
 
-bool LoopVectorizer::prepareLoopVectorization() {
-  auto &LI = *FAM.getCachedResult<LoopAnalysis>(F);
-  for (LoopJob &LJ : LoopsToPrepare) {
-    auto &L = *LI.getLoopFor(LJ.Header);
+// Make sure that there is a preheader in any case
+// \returns false if the edges into the loop can not be split (indirectbr)
+static bool ensurePreheader(Function &F, FunctionAnalysisManager &FAM,
+                            LoopInfo &LI, Loop &L) {
+  if (L.getLoopPreheader())
+    return true;
 
-    Report() << "loopVecPass: Vectorize " << L.getName()
-             << " with VW: " << LJ.VectorWidth
-             << " , Dependence Distance: " << DepDistToString(LJ.DepDist)
-             << " and TripAlignment: " << LJ.TripAlign << "\n";
-
-    // match vector loop structure
-    ValueSet uniOverrides;
-    auto LoopPrep = transformToVectorizableLoop(L, LJ.VectorWidth, LJ.TripAlign,
-                                                uniOverrides);
-    if (!LoopPrep.TheLoop) {
-      Report() << "loopVecPass: Cannot prepare vectorization of the loop\n";
-      return false;
-    }
+  // redirects all (also duplicate) edges from outside the loop
+  auto *DT = FAM.getCachedResult<DominatorTreeAnalysis>(F);
+  return InsertPreheaderForLoop(&L, DT, &LI, nullptr, false) != nullptr;
+}
+
+namespace {
+
+// Holdout copy of the function body taken before a loop is prepared. If the
+// preparation fails half-way, the body of F is restored from the copy and
+// values that outlive the transaction are translated with lookup(). The copy
+// is only taken on take(), the preparation of most loops can not fail after
+// it changed F (see needsSnapshot).
+class PreparationSnapshot {
+  Function &F;
+  Function *Holdout;
+  DenseMap<const Value *, Value *> HoldoutMap; // original -> holdout value
+
+public:
+  PreparationSnapshot(Function &F) : F(F), Holdout(nullptr) {}
+
+  void take() {
+    assert(!Holdout && "snapshot already taken");
+    ValueToValueMapTy VMap;
+    // keep the debug scope, the body may return to F
+    if (auto *SP = F.getSubprogram())
+      VMap.MD()[SP].reset(SP);
+    Holdout = CloneFunction(&F, VMap);
+    for (auto It : VMap)
+      HoldoutMap[It.first] = It.second;
+  }
+
+  bool isTaken() const { return Holdout != nullptr; }
+
+  ~PreparationSnapshot() {
+    if (Holdout)
+      Holdout->eraseFromParent();
+  }
 
+  // The remainder transform runs all its checks before it touches F. After
+  // that, the preparation only fails if a loop preheader can not be created,
+  // which happens for indirectbr/callbr edges into the loop.
+  static bool needsSnapshot(const Function &F) {
 #ifdef RV_ENABLE_LOOPDIST
-    /// BEGIN EXPERIMENTAL SECTION
-    {
-      ReductionAnalysis MyReda(*F, FAM);
-      MyReda.analyze(*LoopPrep.TheLoop);
-
-      LoopComponentAnalysis LCA(*F, *LoopPrep.TheLoop, FAM, MyReda);
-      LCA.run();
-      LoopDistributionTransform loopDistTrans(vectorizer->getPlatformInfo(),
-                                              LJ.VectorWidth, LCA);
-      loopDistTrans.run();
+    return true;
+#endif
+    for (const auto &BB : F) {
+      const auto *Term = BB.getTerminator();
+      if (isa<IndirectBrInst>(Term) || isa<CallBrInst>(Term))
+        return true;
     }
-    /// END EXPERIMENTAL SECTION
+    return false;
+  }
+
+  // blockaddress constants can not be moved between functions
+  static bool canSnapshot(const Function &F) {
+    for (const auto &BB : F)
+      if (BB.hasAddressTaken())
+        return false;
+    return true;
+  }
+
+  // the value that replaces \p V after a rollback
+  template <typename ValT> ValT *lookup(ValT *V) const {
+    if (!V)
+      return nullptr;
+    auto It = HoldoutMap.find(V);
+    assert(It != HoldoutMap.end() && "value created during the transaction");
+    return cast<ValT>(It->second);
+  }
+
+  // discard all changes to F since the snapshot was taken
+  void rollback() {
+    for (auto &BB : F)
+      BB.dropAllReferences();
+    while (!F.empty())
+      F.begin()->eraseFromParent();
+
+    F.getBasicBlockList().splice(F.end(), Holdout->getBasicBlockList());
+    for (auto Args : zip(F.args(), Holdout->args()))
+      std::get<1>(Args).replaceAllUsesWith(&std::get<0>(Args));
+
+    Holdout->eraseFromParent();
+    Holdout = nullptr;
+  }
+};
+
+} // namespace
+
+std::vector<unsigned>
+LoopVectorizer::getVersionWidths(const LoopJob &LJ) const {
+  std::vector<unsigned> Widths;
+
+  // tail-predicated loops do not have a remainder
+  if (RVConfig.useAVL)
+    return Widths;
+
+  // all iterations execute in the widest version
+  if (LJ.TripAlign % LJ.VectorWidth == 0)
+    return Widths;
+
+  // the masked epilogue takes all remaining iterations
+  if (LJ.Epilogue == Config::EM_Masked)
+    return Widths;
+
+  unsigned MinWidth = LJ.VectorWidth;
+  if (RVConfig.minVersionWidth > 0)
+    MinWidth = std::max(2, RVConfig.minVersionWidth);
+  if (LJ.Epilogue == Config::EM_HalfWidth)
+    MinWidth = std::min(MinWidth, LJ.VectorWidth / 2);
+
+  for (unsigned Width = LJ.VectorWidth / 2; Width >= std::max(2u, MinWidth);
+       Width /= 2)
+    Widths.push_back(Width);
+  return Widths;
+}
+
+bool LoopVectorizer::hasMaskedEpilogue(const LoopJob &LJ) const {
+  return LJ.Epilogue == Config::EM_Masked && !RVConfig.useAVL &&
+         (LJ.TripAlign % LJ.VectorWidth != 0);
+}
+
+bool LoopVectorizer::prepareLoop(LoopJob &LJ,
+                                 std::vector<LoopVectorizerJob> &Prepared,
+                                 std::string &FailReason, bool &Modified) {
+  Modified = false;
+  auto &LI = *FAM.getCachedResult<LoopAnalysis>(F);
+  auto &L = *LI.getLoopFor(LJ.Header);
+
+  Report() << "loopVecPass: Vectorize " << L.getName()
+           << " with VW: " << LJ.VectorWidth
+           << " , Dependence Distance: " << DepDistToString(LJ.DepDist)
+           << " and TripAlignment: " << LJ.TripAlign << "\n";
+
+  // match vector loop structure
+  ValueSet uniOverrides;
+  auto LoopPrep = transformToVectorizableLoop(L, LJ.VectorWidth, LJ.TripAlign,
+                                              uniOverrides, RVConfig.useAVL);
+  if (!LoopPrep.TheLoop) {
+    Report() << "loopVecPass: Cannot prepare vectorization of the loop\n";
+    FailReason = "unsupported loop structure";
+    return false;
+  }
+  Modified = true;
+
+#ifdef RV_ENABLE_LOOPDIST
+  /// BEGIN EXPERIMENTAL SECTION
+  {
+    ReductionAnalysis MyReda(*F, FAM);
+    MyReda.analyze(*LoopPrep.TheLoop);
+
+    LoopComponentAnalysis LCA(*F, *LoopPrep.TheLoop, FAM, MyReda);
+    LCA.run();
+    LoopDistributionTransform loopDistTrans(vectorizer->getPlatformInfo(),
+                                            LJ.VectorWidth, LCA);
+    loopDistTrans.run();
+  }
+  /// END EXPERIMENTAL SECTION
 #endif
 
-    // Make sure that there is a preheader in any case
-    BasicBlock *UniquePred = nullptr;
-    if (!LoopPrep.TheLoop->getLoopPreheader()) {
-      auto *Head = LoopPrep.TheLoop->getHeader();
-      for (auto *InB : predecessors(Head)) {
-        if (LoopPrep.TheLoop->contains(InB))
-          continue;
-
-        if (!UniquePred) {
-          UniquePred = InB;
-        } else {
-          abort(); // Multiple edges to the loop header!!!
-        }
-      }
+  // Make sure that there is a preheader in any case
+  if (!ensurePreheader(F, FAM, LI, *LoopPrep.TheLoop)) {
+    Report() << "loopVecPass: Cannot create a preheader for the loop\n";
+    FailReason = "cannot create a loop preheader";
+    return false;
+  }
+  assert(L.getLoopPreheader());
 
-      // break the edge
-      std::string PHName = Head->getName().str() + ".ph";
-      auto *PH = BasicBlock::Create(F.getContext(), PHName, &F, Head);
-      UniquePred->getTerminator()->replaceUsesOfWith(Head, PH);
-      BranchInst::Create(Head, PH);
-      for (auto &phi : Head->phis()) {
-        for (unsigned i = 0; i < phi.getNumIncomingValues(); ++i) {
-          if (phi.getIncomingBlock(i) == UniquePred) {
-            phi.setIncomingBlock(i, PH);
-          }
-        }
-      }
+  // mark the remainder loop as un-vectorizable
+  LoopMD llvmLoopMD;
+  llvmLoopMD.alreadyVectorized = true;
+  SetLLVMLoopAnnotations(L, std::move(llvmLoopMD));
+
+  // clear loop annotations from our copy of the lop
+  ClearLoopVectorizeAnnotations(*LoopPrep.TheLoop);
+
+  // use prepared loop instead
+  LoopJob MainLJ = LJ;
+  MainLJ.Header = LoopPrep.TheLoop->getHeader();
+  Prepared.push_back(
+      LoopVectorizerJob{MainLJ, uniOverrides, LoopPrep.EntryAVL});
+
+  // Insert narrower versions of the loop between the vector loop and the
+  // scalar remainder loop. The guard of each version dispatches on the
+  // remaining trip count, short loops skip the wider versions.
+  for (unsigned VersionWidth : getVersionWidths(LJ)) {
+    ValueSet VersionUniOverrides;
+    auto VersionPrep = transformToVectorizableLoop(
+        L, VersionWidth, LJ.TripAlign, VersionUniOverrides, false);
+    if (!VersionPrep.TheLoop) {
+      Report() << "loopVecPass: Cannot prepare loop version with VW: "
+               << VersionWidth << "\n";
+      break;
+    }
+    if (enableDiagOutput)
+      Report() << "loopVecPass: Added loop version with VW: " << VersionWidth
+               << "\n";
+
+    if (!ensurePreheader(F, FAM, LI, *VersionPrep.TheLoop)) {
+      FailReason = "cannot create a preheader for the loop version";
+      return false;
+    }
+    ClearLoopVectorizeAnnotations(*VersionPrep.TheLoop);
+
+    LoopJob VersionLJ = LJ;
+    VersionLJ.VectorWidth = VersionWidth;
+    VersionLJ.Variant = "version";
+    VersionLJ.Header = VersionPrep.TheLoop->getHeader();
+    Prepared.push_back(LoopVectorizerJob{VersionLJ, VersionUniOverrides,
+                                         VersionPrep.EntryAVL});
+  }
 
-      auto *PHLoop = LI.getLoopFor(UniquePred);
-      if (PHLoop) {
-        PHLoop->addBasicBlockToLoop(PH, LI);
+  // Execute the remaining iterations in a single tail-predicated vector
+  // iteration. The scalar loop becomes unreachable.
+  if (hasMaskedEpilogue(LJ)) {
+    ValueSet EpilogueUniOverrides;
+    auto EpiloguePrep = transformToVectorizableLoop(
+        L, LJ.VectorWidth, LJ.TripAlign, EpilogueUniOverrides, true);
+    if (EpiloguePrep.TheLoop) {
+      Report() << "loopVecPass: Added masked epilogue with VW: "
+               << LJ.VectorWidth << "\n";
+      if (!ensurePreheader(F, FAM, LI, *EpiloguePrep.TheLoop)) {
+        FailReason = "cannot create a preheader for the masked epilogue";
+        return false;
       }
+      ClearLoopVectorizeAnnotations(*EpiloguePrep.TheLoop);
+
+      LoopJob EpilogueLJ = LJ;
+      EpilogueLJ.Header = EpiloguePrep.TheLoop->getHeader();
+      EpilogueLJ.Variant = "epilogue";
+      Prepared.push_back(LoopVectorizerJob{EpilogueLJ, EpilogueUniOverrides,
+                                           EpiloguePrep.EntryAVL});
+    } else {
+      Report() << "loopVecPass: Cannot prepare masked epilogue, keeping "
+                  "the scalar remainder loop\n";
     }
-    assert(L.getLoopPreheader());
+  }
 
-    // mark the remainder loop as un-vectorizable
-    LoopMD llvmLoopMD;
-    llvmLoopMD.alreadyVectorized = true;
-    SetLLVMLoopAnnotations(L, std::move(llvmLoopMD));
+  return true;
+}
+
+bool LoopVectorizer::prepareLoopVectorization(bool &Changed) {
+  // Every loop is prepared in a transaction. If it fails, the function is
+  // restored and the loop stays scalar. Functions with address-taken blocks
+  // can not be snapshotted, their loops are prepared without a rollback.
+  bool NeedsSnapshot = PreparationSnapshot::needsSnapshot(F);
+  bool CanRollback = PreparationSnapshot::canSnapshot(F);
 
-    // clear loop annotations from our copy of the lop
-    ClearLoopVectorizeAnnotations(*LoopPrep.TheLoop);
+  for (size_t i = 0; i < LoopsToPrepare.size(); ++i) {
+    LoopJob &LJ = LoopsToPrepare[i];
+    auto &LI = *FAM.getCachedResult<LoopAnalysis>(F);
+    auto &L = *LI.getLoopFor(LJ.Header);
 
-    // print configuration banner once
-    if (!introduced) {
-      Report() << " rv::RVConfig: ";
-      RVConfig.print(ReportContinue());
-      introduced = true;
+    PreparationSnapshot Snapshot(F);
+    if (NeedsSnapshot && CanRollback)
+      Snapshot.take();
+
+    std::vector<LoopVectorizerJob> Prepared;
+    std::string FailReason;
+    bool Modified;
+    if (prepareLoop(LJ, Prepared, FailReason, Modified)) {
+      // print configuration banner once
+      if (!introduced) {
+        Report() << " rv::RVConfig: ";
+        RVConfig.print(ReportContinue());
+        introduced = true;
+      }
+      for (auto &LVJob : Prepared)
+        LoopsToVectorize.push_back(LVJob);
+      continue;
     }
 
-    // use prepared loop instead
-    LJ.Header = LoopPrep.TheLoop->getHeader();
-    LoopsToVectorize.push_back(
-        LoopVectorizerJob{LJ, uniOverrides, LoopPrep.EntryAVL});
+    Report() << "loopVecPass: Preparation of " << L.getName()
+             << " failed (" << FailReason << "), keeping the scalar loop\n";
+    remarkMiss("Loop not prepared: " + FailReason, "RVLoopVecNot", L);
+    reportRejection(L, L.getStartLoc(), FailReason);
+    if (!Modified)
+      continue;
+
+    // the preparation changed the function -> roll back
+    if (!Snapshot.isTaken())
+      fail("loopVecPass: loop preparation failed after changing the function "
+           "and there is no snapshot to roll back to");
+
+    Snapshot.rollback();
+    Changed = true; // all values of F were replaced
+    FAM.invalidate(F, PreservedAnalyses::none());
+    FAM.getResult<LoopAnalysis>(F);
+
+    for (size_t j = i + 1; j < LoopsToPrepare.size(); ++j)
+      LoopsToPrepare[j].Header = Snapshot.lookup(LoopsToPrepare[j].Header);
+    for (auto &LVJob : LoopsToVectorize) {
+      LVJob.LJ.Header = Snapshot.lookup(LVJob.LJ.Header);
+      LVJob.EntryAVL = Snapshot.lookup(LVJob.EntryAVL);
+      ValueSet UniOverrides;
+      for (auto *V : LVJob.uniOverrides)
+        UniOverrides.insert(Snapshot.lookup(V));
+      LVJob.uniOverrides = std::move(UniOverrides);
+    }
   }
 
   LoopsToPrepare.clear();
@@ -679,6 +1086,19 @@ bool LoopVectorizer::vectorizeLoop(LoopVectorizerJob &LVJob) {
   auto &LI = FAM.getResult<LoopAnalysis>(F);
   auto &L = *LI.getLoopFor(LVJob.LJ.Header);
 
+  // record the phases of this job (RV_REPORT_JSON)
+  std::unique_ptr<VectorizationReport> LoopReport;
+  if (VectorizationReport::isEnabled()) {
+    LoopReport.reset(new VectorizationReport("loop", F.getName().str(),
+                                             L.getHeader()->getName().str()));
+    LoopReport->location = getTag(L.getStartLoc());
+    LoopReport->variant = LVJob.LJ.Variant;
+    LoopReport->vectorWidth = LVJob.LJ.VectorWidth;
+    if (LVJob.LJ.Cost.vectorWidth > 1)
+      LoopReport->setCost(LVJob.LJ.Cost);
+  }
+  vectorizer->setReport(LoopReport.get());
+
   // analyze the recurrence patterns of this loop
   ReductionAnalysis MyReda(F, FAM);
   MyReda.analyze(L);
@@ -704,36 +1124,7 @@ bool LoopVectorizer::vectorizeLoop(LoopVectorizerJob &LVJob) {
 
   // Check reduction patterns of vector loop phis
   // configure initial shape for induction variable
-  for (auto &inst : *LVJob.LJ.Header) {
-    auto *phi = dyn_cast<PHINode>(&inst);
-    if (!phi)
-      continue;
-
-    rv::StridePattern *pat = MyReda.getStrideInfo(*phi);
-    VectorShape phiShape;
-    if (pat) {
-      IF_DEBUG { pat->dump(); }
-      phiShape = pat->getShape(LVJob.LJ.VectorWidth);
-    } else {
-      rv::Reduction *redInfo = MyReda.getReductionInfo(*phi);
-
-      assert(redInfo);
-      assert(IsSupportedReduction(L, *redInfo));
-      // unsupported reduction kind (operator in value SCC unrecognized)
-      assert(redInfo->kind != RedKind::Top);
-
-      // Unsupported recurrence (definition and use in different loop
-      // iterations)
-      assert(redInfo->kind != RedKind::Bot);
-
-      // Otw, this is a privatizable reduction pattern
-      IF_DEBUG { redInfo->dump(); }
-      phiShape = redInfo->getShape(LVJob.LJ.VectorWidth);
-    }
-
-    if (phiShape.isDefined())
-      vecInfo.setPinnedShape(*phi, phiShape);
-  }
+  pinHeaderPhiShapes(L, MyReda, vecInfo, LVJob.LJ.VectorWidth);
 
   // set uniform overrides
   IF_DEBUG { errs() << "-- Setting remTrans uni overrides --\n"; }
@@ -764,9 +1155,7 @@ bool LoopVectorizer::vectorizeLoop(LoopVectorizerJob &LVJob) {
 
   // vectorize the prepared loop embedding it in its context
   ValueToValueMapTy vecMap;
-
-  ScalarEvolutionAnalysis adhocAnalysis;
-  adhocAnalysis.run(F, FAM);
+  std::vector<BasicBlock *> ScalarBlocks(L.block_begin(), L.block_end());
 
   bool vectorizeOk = vectorizer->vectorize(vecInfo, FAM, &vecMap);
   if (!vectorizeOk)
@@ -774,26 +1163,42 @@ bool LoopVectorizer::vectorizeLoop(LoopVectorizerJob &LVJob) {
 
   if (enableDiagOutput) {
     errs() << "-- Vectorized --\n";
-    for (const BasicBlock *BB : L.blocks()) {
+    for (const BasicBlock *BB : ScalarBlocks) {
       const BasicBlock *vecB = cast<const BasicBlock>(vecMap[BB]);
       Dump(*vecB);
     }
     errs() << "-- EOF --\n";
   }
+
+  vectorizer->setReport(nullptr);
+  if (LoopReport)
+    LoopReport->emit();
   return true;
 }
 
+// check the incrementally updated analyses (-verify-dom-info, -verify-loop-info)
+static void verifyLoopAnalyses(Function &F, FunctionAnalysisManager &FAM) {
+  auto *DT = FAM.getCachedResult<DominatorTreeAnalysis>(F);
+  if (VerifyDomInfo) {
+    auto *PDT = FAM.getCachedResult<PostDominatorTreeAnalysis>(F);
+    if (DT && !DT->verify())
+      fail("loopVecPass: dominator tree out of date!");
+    if (PDT && !PDT->verify())
+      fail("loopVecPass: post dominator tree out of date!");
+  }
+  auto *LI = FAM.getCachedResult<LoopAnalysis>(F);
+  if (VerifyLoopInfo && DT && LI)
+    LI->verify(*DT);
+}
+
 bool LoopVectorizer::vectorizeLoopRegions() {
   bool Changed = false;
 
+  // every phase keeps DT, PDT and LI up to date (see getPreservedAnalyses)
+  verifyLoopAnalyses(F, FAM);
   for (auto &LVJob : LoopsToVectorize) {
-    // FIXME repair loop info on the go
-    // Rebuild analysis structured
-    FAM.invalidate<DominatorTreeAnalysis>(F);
-    FAM.invalidate<PostDominatorTreeAnalysis>(F);
-    FAM.invalidate<LoopAnalysis>(F);
-
     Changed |= vectorizeLoop(LVJob);
+    verifyLoopAnalyses(F, FAM);
   }
   LoopsToVectorize.clear();
 
@@ -802,9 +1207,11 @@ bool LoopVectorizer::vectorizeLoopRegions() {
 
 LoopVectorizer::LoopVectorizer(Function &F, TargetTransformInfo &PassTTI,
                                TargetLibraryInfo &PassTLI,
-                               OptimizationRemarkEmitter &PassORE)
+                               OptimizationRemarkEmitter &PassORE,
+                               FunctionAnalysisManager &FAM,
+                               ModuleContext &ModuleCtx)
     : RVConfig(Config::createForFunction(F)), F(F), PassTTI(PassTTI),
-      PassTLI(PassTLI), PassORE(PassORE) {
+      PassTLI(PassTLI), PassORE(PassORE), FAM(FAM), ModuleCtx(ModuleCtx) {
   // have we introduced ourself? (reporting output)
   enableDiagOutput = CheckFlag("LV_DIAG");
   introduced = false;
@@ -813,9 +1220,14 @@ LoopVectorizer::LoopVectorizer(Function &F, TargetTransformInfo &PassTTI,
 bool LoopVectorizer::run() {
   if (getenv("RV_DISABLE"))
     return false;
-  // Only ever use RV for VE.
-  if (!RVConfig.useVE)
+  // only vectorize loops for the configured targets (RV_LOOPVEC_TARGETS)
+  if (!RVConfig.isLoopVecTarget()) {
+    if (enableDiagOutput)
+      Report() << "loopVecPass: skip " << F.getName() << ", target "
+               << RVConfig.getTargetISA() << " not in RV_LOOPVEC_TARGETS ("
+               << RVConfig.loopVecTargets << ")\n";
     return false;
+  }
 
   if (enableDiagOutput)
     Report() << "loopVecPass: run on " << F.getName() << "\n";
@@ -830,25 +1242,11 @@ bool LoopVectorizer::run() {
     Dump(*F.getParent());
   }
 
-  // create private analysis infrastructure
-  PassBuilder PB;
-  PB.registerFunctionAnalyses(FAM);
-
-  // setup PlatformInfo
-  PlatformInfo platInfo(*F.getParent(), &PassTTI, &PassTLI);
+  // the PlatformInfo and resolver chain are shared by the module
+  PlatformInfo &platInfo = ModuleCtx.getPlatformInfo(RVConfig, PassTTI, PassTLI);
+  platInfo.setTargetAttributes(F);
   vectorizer.reset(new VectorizerInterface(platInfo, RVConfig));
 
-  // TODO translate fast-math flag to ULP error bound
-  if (!CheckFlag("RV_NO_SLEEF")) {
-    addSleefResolver(RVConfig, platInfo);
-  }
-
-  // enable inter-procedural vectorization
-  if (RVConfig.enableGreedyIPV) {
-    Report() << "Using greedy inter-procedural vectorization.\n";
-    addRecursiveResolver(RVConfig, platInfo);
-  }
-
   if (enableDiagOutput) {
     platInfo.print(ReportContinue());
   }
@@ -861,13 +1259,10 @@ bool LoopVectorizer::run() {
   if (!FoundAnyLoops)
     return false;
 
-  // Step 2: Refactor loop for vectorization
-  bool PrepOK =
-      prepareLoopVectorization(); // TODO mark this function as un-vectorizable
-                                  // (or prepare a holdout copy)
-  if (!PrepOK) {
-    abort(); // loop nest preparation failed badly
-  }
+  // Step 2: Refactor loop for vectorization (loops that fail stay scalar)
+  bool PrepOK = prepareLoopVectorization(Changed);
+  if (!PrepOK)
+    return Changed;
 
   // Step :3 Vectorize the prepare loops
   Changed |= vectorizeLoopRegions();
@@ -890,13 +1285,31 @@ void LoopVectorizerLegacyPass::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
 }
 
+// Set up the PlatformInfo (and parse the SLEEF modules) once per module
+// rather than once per function.
+bool LoopVectorizerLegacyPass::doInitialization(Module &M) {
+  ModuleCtx.reset(new ModuleContext(M));
+  return false;
+}
+
+bool LoopVectorizerLegacyPass::doFinalization(Module &M) {
+  ModuleCtx.reset();
+  return false;
+}
+
 bool LoopVectorizerLegacyPass::runOnFunction(Function &F) {
   auto &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
   auto &TLI = getAnalysis<TargetLibraryInfoWrapperPass>().getTLI(F);
   auto &ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
 
-  LoopVectorizer LoopVec(F, TTI, TLI, ORE);
-  return LoopVec.run();
+  auto &FAM = ModuleCtx->getPrivateFAM();
+  bool Changed;
+  {
+    LoopVectorizer LoopVec(F, TTI, TLI, ORE, FAM, *ModuleCtx);
+    Changed = LoopVec.run();
+  }
+  FAM.clear(F, F.getName());
+  return Changed;
 }
 
 char LoopVectorizerLegacyPass::ID = 0;
@@ -928,9 +1341,31 @@ LoopVectorizerWrapperPass::run(llvm::Function &F,
   auto &TLI = FAM.getResult<TargetLibraryAnalysis>(F);
   auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
 
-  LoopVectorizer LoopVec(F, TTI, TLI, ORE);
+  LoopVectorizer LoopVec(F, TTI, TLI, ORE, FAM, getModuleContext(F, FAM));
   if (LoopVec.run())
     return llvm::PreservedAnalyses::none();
   else
     return llvm::PreservedAnalyses::all();
 }
+
+ModuleContext &
+LoopVectorizerWrapperPass::getModuleContext(llvm::Function &F,
+                                            llvm::FunctionAnalysisManager &FAM) {
+  Module &M = *F.getParent();
+  auto &MAMProxy = FAM.getResult<ModuleAnalysisManagerFunctionProxy>(F);
+  if (auto *Ctx = MAMProxy.getCachedResult<ModuleContextAnalysis>(M))
+    return *Ctx;
+
+  // Start over when the pass sees a function again: a new sweep may see
+  // functions (and declare simd variants) that module passes added since.
+  // Deleted functions are tracked by the context itself.
+  bool NewSweep = !SweepCtx || &SweepCtx->getModule() != &M ||
+                  !SweepFuncs.insert(&F).second;
+  if (NewSweep) {
+    SweepCtx.reset();
+    SweepCtx.reset(new ModuleContext(M));
+    SweepFuncs.clear();
+    SweepFuncs.insert(&F);
+  }
+  return *SweepCtx;
+}
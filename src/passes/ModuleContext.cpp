@@ -0,0 +1,124 @@
+//===- src/passes/ModuleContext.cpp - per-module state of RV's passes --*- C++ -*-===//
+//
+// Part of the RV Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+
+#include "rv/passes/ModuleContext.h"
+
+#include "rv/resolver/resolvers.h"
+
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "report.h"
+
+using namespace llvm;
+
+namespace rv {
+
+ModuleContext::ModuleContext(Module &M)
+    : M(&M), Ctx(&M.getContext()), Stale(std::make_shared<bool>(false)) {
+  retainSleefModules(*Ctx);
+  watchFunctions();
+}
+
+ModuleContext::ModuleContext(ModuleContext &&Other)
+    : M(Other.M), Ctx(Other.Ctx), PlatInfos(std::move(Other.PlatInfos)),
+      PrivateFAM(std::move(Other.PrivateFAM)), Stale(std::move(Other.Stale)),
+      Watches(std::move(Other.Watches)) {
+  Other.Ctx = nullptr;
+}
+
+void ModuleContext::watchFunctions() {
+  *Stale = false;
+  Watches.clear();
+  Watches.reserve(M->size());
+  for (auto &F : *M)
+    Watches.emplace_back(F, Stale);
+}
+
+ModuleContext::~ModuleContext() {
+  // the resolvers may hold on to SLEEF functions -> drop them first
+  PlatInfos.clear();
+  PrivateFAM.reset();
+  if (Ctx)
+    releaseSleefModules(*Ctx);
+}
+
+bool ModuleContext::invalidate(Module &, const PreservedAnalyses &,
+                               ModuleAnalysisManager::Invalidator &) {
+  // function passes read the context through the outer analysis proxy, which
+  // requires it to survive any invalidation (see reset())
+  return false;
+}
+
+void ModuleContext::reset() {
+  PlatInfos.clear();
+  PrivateFAM.reset();
+  watchFunctions();
+}
+
+PlatformInfo &ModuleContext::getPlatformInfo(const Config &RVConfig,
+                                             TargetTransformInfo &TTI,
+                                             TargetLibraryInfo &TLI) {
+  // the mappings of the PlatformInfos may refer to deleted functions and miss
+  // the declare simd variants of added ones
+  if (*Stale || Watches.size() != M->size()) {
+    PlatInfos.clear();
+    watchFunctions();
+  }
+
+  std::string Key;
+  raw_string_ostream KeyOut(Key);
+  RVConfig.print(KeyOut);
+  KeyOut.flush();
+
+  auto &PlatInfo = PlatInfos[Key];
+  if (!PlatInfo) {
+    PlatInfo.reset(new PlatformInfo(*M, &TTI, &TLI));
+
+    // TODO translate fast-math flag to ULP error bound
+    if (!CheckFlag("RV_NO_SLEEF")) {
+      addSleefResolver(RVConfig, *PlatInfo);
+    }
+
+    // enable inter-procedural vectorization
+    if (RVConfig.enableGreedyIPV) {
+      Report() << "Using greedy inter-procedural vectorization.\n";
+      addRecursiveResolver(RVConfig, *PlatInfo);
+    }
+  }
+
+  PlatInfo->setTTI(&TTI);
+  PlatInfo->setTLI(&TLI);
+  return *PlatInfo;
+}
+
+FunctionAnalysisManager &ModuleContext::getPrivateFAM() {
+  if (!PrivateFAM) {
+    PrivateFAM.reset(new FunctionAnalysisManager());
+    PassBuilder PB;
+    PB.registerFunctionAnalyses(*PrivateFAM);
+  }
+  return *PrivateFAM;
+}
+
+AnalysisKey ModuleContextAnalysis::Key;
+
+ModuleContext ModuleContextAnalysis::run(Module &M, ModuleAnalysisManager &) {
+  return ModuleContext(M);
+}
+
+PreservedAnalyses ModuleContextResetPass::run(Module &M,
+                                              ModuleAnalysisManager &MAM) {
+  if (auto *Ctx = MAM.getCachedResult<ModuleContextAnalysis>(M))
+    Ctx->reset();
+  return PreservedAnalyses::all();
+}
+
+} // namespace rv
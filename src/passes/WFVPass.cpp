@@ -12,6 +12,7 @@
 
 #include "rv/rv.h"
 #include "rv/vectorMapping.h"
+#include "rv/vectorizationReport.h"
 #include "rv/region/LoopRegion.h"
 #include "rv/region/Region.h"
 #include "rv/resolver/resolvers.h"
@@ -20,6 +21,7 @@
 #include "rv/transform/remTransform.h"
 #include "rv/utils.h"
 #include "rv/transform/singleReturnTrans.h"
+#include "rv/transform/crtLowering.h"
 
 #include "rvConfig.h"
 #include "rv/rvDebug.h"
@@ -40,13 +42,21 @@
 #include "llvm/Analysis/MemoryDependenceAnalysis.h"
 #include "llvm/Analysis/BranchProbabilityInfo.h"
 
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Linker/Linker.h"
+
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/ADT/ScopeExit.h"
 #include "llvm/ADT/Sequence.h"
+#include "llvm/ADT/StringSet.h"
 
 #include "report.h"
 #include <map>
 #include <sstream>
 #include <cassert>
+#include <algorithm>
+#include <thread>
 
 using namespace rv;
 using namespace llvm;
@@ -54,7 +64,11 @@ using namespace llvm;
 
 ///// Pass Implementation /////
 
-WFV::WFV() {
+WFV::WFV()
+: enableDiagOutput(false)
+, diagOut(&errs())
+, numThreads(1)
+{
   // Prepare Analyses
   PassBuilder PB;
   PB.registerFunctionAnalyses(FAM);
@@ -63,6 +77,15 @@ WFV::WFV() {
 
 void
 WFV::vectorizeFunction(VectorizerInterface & vectorizer, VectorMapping & wfvJob) {
+  // record the phases of this job (RV_REPORT_JSON)
+  std::unique_ptr<VectorizationReport> funcReport;
+  if (VectorizationReport::isEnabled()) {
+    funcReport.reset(new VectorizationReport("function", wfvJob.scalarFn->getName().str(), wfvJob.vectorFn->getName().str()));
+    funcReport->vectorWidth = wfvJob.vectorWidth;
+    funcReport->variant = wfvJob.maskPos >= 0 ? "masked" : "unmasked";
+  }
+  vectorizer.setReport(funcReport.get());
+
   // clone scalar function
   ValueToValueMapTy cloneMap;
   Function* scalarCopy = CloneFunction(wfvJob.scalarFn, cloneMap, nullptr);
@@ -93,9 +116,9 @@ WFV::vectorizeFunction(VectorizerInterface & vectorizer, VectorMapping & wfvJob)
   vectorizer.analyze(vecInfo, FAM); // TODO can be shared across jobs
 
   if (enableDiagOutput) {
-    errs() << "-- VA result --\n";
-    vecInfo.dump();
-    errs() << "-- EOF --\n";
+    *diagOut << "-- VA result --\n";
+    vecInfo.print(*diagOut);
+    *diagOut << "-- EOF --\n";
   }
 
   IF_DEBUG Dump(*scalarCopy);
@@ -119,6 +142,9 @@ WFV::vectorizeFunction(VectorizerInterface & vectorizer, VectorMapping & wfvJob)
     llvm_unreachable("vector code generation failed");
 
   scalarCopy->eraseFromParent();
+
+  vectorizer.setReport(nullptr);
+  if (funcReport) funcReport->emit();
 }
 
 bool
@@ -163,21 +189,8 @@ WFV::collectJobs(Function & F) {
   }
 }
 
-bool WFV::run(Module &M) {
-  enableDiagOutput = CheckFlag("WFV_DIAG");
-
-  // collect WFV jobs
-  for (auto &func : M) {
-    if (func.isDeclaration())
-      continue;
-
-    collectJobs(func);
-  }
-
-  // no annotated functions found (pragma omp declare simd)
-  if (wfvJobs.empty())
-    return false;
-
+void
+WFV::vectorizeJobs(Module &M, size_t Begin, size_t End) {
   auto &protoFunc = *wfvJobs[0].scalarFn;
 
   Config rvConfig = Config::createForFunction(protoFunc);
@@ -187,6 +200,7 @@ bool WFV::run(Module &M) {
 
   // configure platInfo
   PlatformInfo platInfo(M, &TTI, &TLI);
+  platInfo.setTargetAttributes(protoFunc);
   addSleefResolver(rvConfig, platInfo);
 
   // add mappings for recursive vectorization
@@ -196,10 +210,246 @@ bool WFV::run(Module &M) {
 
   // vectorize jobs
   VectorizerInterface vectorizer(platInfo, rvConfig);
-  for (auto &job : wfvJobs) {
-    vectorizeFunction(vectorizer, job);
+  for (size_t i = Begin; i < End; ++i) {
+    vectorizeFunction(vectorizer, wfvJobs[i]);
+  }
+}
+
+bool
+WFV::canStageJobs(Module &M) const {
+  // Staged code is bound to the globals of M by name when it is linked back.
+  for (auto &GV : M.global_values()) {
+    if (isa<GlobalAlias>(GV) || isa<GlobalIFunc>(GV))
+      return false;
+    if (!GV.hasName())
+      return false;
+  }
+  return true;
+}
+
+bool
+WFV::stageJobs(StringRef ModBuffer, size_t Begin, size_t End, bool DiagOutput,
+               StagedSlice &Slice) {
+  // Report() is shared by all threads -> replay the reports of this worker later.
+  ReportBuffer Reports;
+  VectorizationReportBuffer Records;
+  raw_string_ostream Diags(Slice.diags);
+
+  // LLVM IR is not thread safe within a context -> every worker gets its own.
+  LLVMContext Ctx;
+  // The compiler-rt module of this context has to go with it.
+  auto ReleaseCRT = make_scope_exit([&Ctx] { releaseScalarImplementations(Ctx); });
+  {
+    auto ModOrErr = parseBitcodeFile(MemoryBufferRef(ModBuffer, "rv-wfv-staging"), Ctx);
+    if (!ModOrErr) {
+      consumeError(ModOrErr.takeError());
+      return false;
+    }
+    Module &StagingMod = **ModOrErr;
+
+    // Everything that is defined now is owned by the source module.
+    StringSet<> SourceDefs;
+    for (auto &GV : StagingMod.global_values()) {
+      if (!GV.isDeclaration())
+        SourceDefs.insert(GV.getName());
+    }
+
+    // The job list is re-collected in module order and so matches the source.
+    WFV Worker;
+    Worker.enableDiagOutput = DiagOutput;
+    Worker.diagOut = &Diags;
+    for (auto &func : StagingMod) {
+      if (func.isDeclaration())
+        continue;
+      Worker.collectJobs(func);
+    }
+    if (Worker.wfvJobs.size() < End)
+      return false;
+
+    Worker.vectorizeJobs(StagingMod, Begin, End);
+
+    // Only keep the new SIMD variants and their helpers.
+    for (auto &func : StagingMod) {
+      if (!SourceDefs.count(func.getName()))
+        continue;
+      func.deleteBody();
+      func.setComdat(nullptr);
+    }
+    for (auto &GV : StagingMod.globals()) {
+      if (!SourceDefs.count(GV.getName()))
+        continue;
+      GV.setInitializer(nullptr);
+      GV.setComdat(nullptr);
+      GV.setLinkage(GlobalValue::ExternalLinkage);
+    }
+
+    // Other slices may clone the same helpers (eg SLEEF functions). These are
+    // identical -> let the linker unique them (restored in runStaged).
+    StringSet<> VariantNames;
+    for (size_t i = Begin; i < End; ++i)
+      VariantNames.insert(Worker.wfvJobs[i].vectorFn->getName());
+    for (auto &GV : StagingMod.global_values()) {
+      if (GV.isDeclaration() || !GV.hasExternalLinkage() ||
+          VariantNames.count(GV.getName()))
+        continue;
+      GV.setLinkage(GlobalValue::LinkOnceODRLinkage);
+      Slice.sharedHelpers.push_back(GV.getName().str());
+    }
+
+    // The module flags of the source module are already in place.
+    if (auto *ModFlags = StagingMod.getModuleFlagsMetadata())
+      StagingMod.eraseNamedMetadata(ModFlags);
+
+    raw_svector_ostream Out(Slice.code);
+    WriteBitcodeToFile(StagingMod, Out);
+  }
+
+  Diags.flush();
+  Slice.reports = std::move(Reports.str());
+  Slice.records = std::move(Records.str());
+  return true;
+}
+
+std::unique_ptr<Module>
+WFV::linkStagedSlices(Module &M, std::vector<StagedSlice> &Slices) const {
+  // Nothing is linked into M before all slices have been read back and linked
+  // successfully.
+  auto LinkedMod = std::make_unique<Module>("rv-wfv-staged", M.getContext());
+  LinkedMod->setDataLayout(M.getDataLayout());
+  LinkedMod->setTargetTriple(M.getTargetTriple());
+
+  for (auto &Slice : Slices) {
+    if (Slice.code.empty())
+      continue;
+    StringRef StagedText(Slice.code.data(), Slice.code.size());
+    auto StagedOrErr = parseBitcodeFile(MemoryBufferRef(StagedText, "rv-wfv-staged"), M.getContext());
+    if (!StagedOrErr) {
+      consumeError(StagedOrErr.takeError());
+      return nullptr;
+    }
+    // true indicates an error
+    if (Linker::linkModules(*LinkedMod, std::move(*StagedOrErr)))
+      return nullptr;
+  }
+
+  // The staged code must not redefine anything in M.
+  for (auto &GV : LinkedMod->global_values()) {
+    if (GV.isDeclaration() || GV.isDiscardableIfUnused())
+      continue;
+    auto *DestGV = M.getNamedValue(GV.getName());
+    if (DestGV && !DestGV->isDeclaration())
+      return nullptr;
+  }
+
+  return LinkedMod;
+}
+
+bool
+WFV::runStaged(Module &M) {
+  // Staged code refers to local symbols of M by name. Make them linkable for
+  // the time being.
+  std::vector<std::pair<GlobalValue *, GlobalValue::LinkageTypes>> localSymbols;
+  for (auto &GV : M.global_values()) {
+    if (!GV.hasLocalLinkage())
+      continue;
+    localSymbols.emplace_back(&GV, GV.getLinkage());
+    GV.setLinkage(GlobalValue::ExternalLinkage);
+  }
+
+  SmallVector<char, 0> ModBuffer;
+  raw_svector_ostream ModOut(ModBuffer);
+  WriteBitcodeToFile(M, ModOut);
+  StringRef ModText(ModBuffer.data(), ModBuffer.size());
+
+  // Contiguous job slices -> linking in thread order preserves the job order.
+  const size_t numJobs = wfvJobs.size();
+  const size_t sliceSize = (numJobs + numThreads - 1) / numThreads;
+  std::vector<StagedSlice> stagedSlices(numThreads);
+
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < numThreads; ++t) {
+    size_t Begin = std::min(numJobs, t * sliceSize);
+    size_t End = std::min(numJobs, Begin + sliceSize);
+    workers.emplace_back([=, &stagedSlices] {
+      auto &Slice = stagedSlices[t];
+      Slice.ok = (Begin == End) ||
+          stageJobs(ModText, Begin, End, enableDiagOutput, Slice);
+    });
+  }
+  for (auto &worker : workers)
+    worker.join();
+
+  // replay the worker output in job order
+  for (auto &Slice : stagedSlices) {
+    ReportContinue() << Slice.reports;
+    *diagOut << Slice.diags;
+  }
+
+  std::unique_ptr<Module> LinkedMod;
+  bool allStaged = std::all_of(stagedSlices.begin(), stagedSlices.end(),
+                               [](const StagedSlice &Slice) { return Slice.ok; });
+  if (allStaged)
+    LinkedMod = linkStagedSlices(M, stagedSlices);
+
+  const bool linked = (bool) LinkedMod;
+  if (linked) {
+    // Everything that could fail has been checked above.
+    if (Linker::linkModules(M, std::move(LinkedMod)))
+      fail("WFV: could not link staged module!");
+
+    // the JSON records in job order (the serial fallback emits its own)
+    for (auto &Slice : stagedSlices)
+      VectorizationReport::appendRecords(Slice.records);
+
+    for (auto &Slice : stagedSlices) {
+      for (auto &HelperName : Slice.sharedHelpers) {
+        auto *HelperGV = M.getNamedValue(HelperName);
+        if (HelperGV && !HelperGV->isDeclaration())
+          HelperGV->setLinkage(GlobalValue::ExternalLinkage);
+      }
+    }
+  }
+
+  for (auto &itLocal : localSymbols)
+    itLocal.first->setLinkage(itLocal.second);
+
+  return linked;
+}
+
+bool WFV::run(Module &M) {
+  enableDiagOutput = CheckFlag("WFV_DIAG");
+
+  // parse the SLEEF modules once for all jobs of M
+  retainSleefModules(M.getContext());
+  auto SleefRelease =
+      make_scope_exit([&M] { releaseSleefModules(M.getContext()); });
+
+  const char *threadText = getenv("RV_WFV_THREADS");
+  if (threadText) {
+    int n = atoi(threadText);
+    numThreads = n > 0 ? n : std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // collect WFV jobs
+  for (auto &func : M) {
+    if (func.isDeclaration())
+      continue;
+
+    collectJobs(func);
+  }
+
+  // no annotated functions found (pragma omp declare simd)
+  if (wfvJobs.empty())
+    return false;
+
+  numThreads = std::min<size_t>(numThreads, wfvJobs.size());
+  if (numThreads > 1 && canStageJobs(M)) {
+    if (runStaged(M))
+      return true;
+    Report() << "wfv: staging failed, vectorizing serially.\n";
   }
 
+  vectorizeJobs(M, 0, wfvJobs.size());
   return true;
 }
 
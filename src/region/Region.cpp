@@ -12,6 +12,7 @@
 #include "rv/region/RegionImpl.h"
 #include <llvm/IR/Function.h>
 #include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/IR/CFG.h>
 
 using namespace llvm;
 
@@ -54,11 +55,30 @@ Region::for_blocks(std::function<bool(const BasicBlock& block)> userFunc) const
 
 void
 Region::for_blocks_rpo(std::function<bool(const BasicBlock& block)> userFunc) const {
-  const Function & F = *getRegionEntry().getParent();
-  ReversePostOrderTraversal<const Function*> RPOT(&F);
+  // the region is only entered through its entry: the post order of the blocks that are reachable
+  // inside the region is the function post order restricted to the region (without visiting the whole function)
+  std::vector<const BasicBlock*> postOrder;
+  SmallPtrSet<const BasicBlock*, 32> visited;
+  SmallVector<std::pair<const BasicBlock*, const_succ_iterator>, 16> stack;
 
-  for (auto * BB : RPOT) {
-    if (mImpl.contains(BB) || extraBlocks.count(BB)) userFunc(*BB);
+  const BasicBlock * entry = &getRegionEntry();
+  visited.insert(entry);
+  stack.emplace_back(entry, succ_begin(entry));
+  while (!stack.empty()) {
+    auto & top = stack.back();
+    if (top.second == succ_end(top.first)) {
+      postOrder.push_back(top.first);
+      stack.pop_back();
+      continue;
+    }
+
+    const BasicBlock * succ = *(top.second++);
+    if (!contains(succ) || !visited.insert(succ).second) continue;
+    stack.emplace_back(succ, succ_begin(succ));
+  }
+
+  for (auto it = postOrder.rbegin(); it != postOrder.rend(); ++it) {
+    userFunc(**it);
   }
 }
 
@@ -15,6 +15,8 @@
 
 #include "rv/passes/WFVPass.h"
 #include "rv/passes/LoopVectorizer.h"
+#include "rv/passes/ModuleContext.h"
+#include "rv/analysis/MemoryAccessAnalysis.h"
 #include "rv/passes/irPolisher.h"
 #include "rv/passes/AutoMathPass.h"
 
@@ -123,6 +125,37 @@ static llvm::RegisterStandardPasses
 ///// New PM setup /////
 
 void rv::addConfiguredRVPasses(PassBuilder &PB) {
+  // RV's function passes share one ModuleContext per module when a pipeline
+  // requires it (-passes='require<rv-module-context>,function(...)').
+  PB.registerAnalysisRegistrationCallback([](ModuleAnalysisManager &MAM) {
+    MAM.registerPass([] { return rv::ModuleContextAnalysis(); });
+  });
+  PB.registerAnalysisRegistrationCallback([](FunctionAnalysisManager &FAM) {
+    FAM.registerPass([] { return rv::MemoryAccessAnalysisPass(); });
+  });
+  PB.registerPipelineParsingCallback(
+      [](StringRef Name, ModulePassManager &MPM,
+         ArrayRef<PassBuilder::PipelineElement>) {
+        if (Name == "require<rv-module-context>") {
+          MPM.addPass(RequireAnalysisPass<rv::ModuleContextAnalysis, Module>());
+          return true;
+        }
+        if (Name == "invalidate<rv-module-context>") {
+          MPM.addPass(rv::ModuleContextResetPass());
+          return true;
+        }
+        return false;
+      });
+  PB.registerPipelineParsingCallback(
+      [](StringRef Name, FunctionPassManager &FPM,
+         ArrayRef<PassBuilder::PipelineElement>) {
+        if (Name == "rv-loopvec") {
+          FPM.addPass(rv::LoopVectorizerWrapperPass());
+          return true;
+        }
+        return false;
+      });
+
   PB.registerPipelineStartEPCallback(
       [&](llvm::ModulePassManager &MPM,
           llvm::PassBuilder::OptimizationLevel Level) {
@@ -16,16 +16,20 @@
 // RV_REPORT_FILE stream handle
 static std::unique_ptr<llvm::raw_fd_ostream> outFileStream;
 
+// report stream of this thread (set by ReportBuffer)
+static thread_local llvm::raw_ostream * threadStream = nullptr;
+
 static llvm::raw_ostream &
 reps() {
-  if (outFileStream) return *outFileStream;
-
   // no reporting
   const bool hasReport = rv::CheckFlag("RV_REPORT");
   if (!hasReport) {
     return llvm::nulls();
   }
 
+  if (threadStream) return *threadStream;
+  if (outFileStream) return *outFileStream;
+
   // std out
   const char * repFilePath = getenv("RV_REPORT_FILE");
   if (!repFilePath) {
@@ -69,5 +73,16 @@ fail(const std::string & text) {
   abort();
 }
 
+ReportBuffer::ReportBuffer()
+: stream(text)
+, prevStream(threadStream)
+{
+  threadStream = &stream;
+}
+
+ReportBuffer::~ReportBuffer() {
+  threadStream = prevStream;
+}
+
 
 }
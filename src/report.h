@@ -12,6 +12,8 @@
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/Compiler.h>
 
+#include <string>
+
 namespace rv {
 
 // check if an environment flag is set
@@ -28,6 +30,21 @@ llvm::raw_ostream & Error();
 
 void LLVM_ATTRIBUTE_NORETURN fail(const std::string &text);
 
+// buffers the Report() output of the constructing thread while alive
+// (worker threads must not write to the shared report stream)
+class ReportBuffer {
+  std::string text;
+  llvm::raw_string_ostream stream;
+  llvm::raw_ostream * prevStream;
+
+public:
+  ReportBuffer();
+  ~ReportBuffer();
+
+  // the output buffered so far
+  std::string & str() { return stream.str(); }
+};
+
 }
 
 #endif // RV_REPORT_H_
@@ -16,6 +16,11 @@ namespace rv {
 ResolverService::~ResolverService()
 {}
 
+bool
+ResolverService::isAvailable(llvm::StringRef funcName, llvm::FunctionType & scaFuncTy, const VectorShapeVec & argShapes, int vectorWidth, bool hasPredicate, llvm::Module & destModule) {
+  return (bool) resolve(funcName, scaFuncTy, argShapes, vectorWidth, hasPredicate, destModule);
+}
+
 void
 ResolverService::print(llvm::raw_ostream & out) const {
   out << "{ResolverService}\n";
@@ -10,6 +10,7 @@
 #include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Dominators.h>
 #include <llvm/Analysis/PostDominators.h>
@@ -34,6 +35,17 @@
 #include <llvm/IR/Verifier.h>
 #include <vector>
 #include <sstream>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/xxhash.h>
 
 #if 1
 #define IF_DEBUG_SLEEF IF_DEBUG
@@ -196,19 +208,167 @@ static const unsigned char** extraModuleBuffers[] = {
 
 
 
-static Module *sleefModules[SLEEF_Enum_Entries * 2];
-static Module *extraModules[SLEEF_Enum_Entries * 2];
+// parse ULP error bound from mangled SLEEF name
+static unsigned
+ReadULPBound(StringRef sleefName) {
+  auto itStart = sleefName.find_last_of("_u");
+  if (itStart == StringRef::npos) return 0; // unspecified -> perfect rounding
+  StringRef ulpPart = sleefName.substr(itStart + 1);
+
+  // single digit ULP value
+  unsigned ulpBound;
+  if (ulpPart.size() == 1) {
+    ulpBound = 10 * (ulpPart[0] - '0');
+
+  // lsc is tenth of ULP
+  } else {
+    bool parseError = ulpPart.consumeInteger<unsigned>(10, ulpBound);
+    (void) parseError; assert(!parseError);
+  }
+
+  return ulpBound;
+}
+
+// SLEEF implementations of a function by name prefix ("xlog" -> "xlog_u1", "xlog_u35", ..), in module order.
+struct SleefImpl {
+  unsigned ULPBound;
+  Function * func;
+};
+using SleefImplIndex = StringMap<SmallVector<SleefImpl, 2>>;
+
+static void
+BuildImplIndex(Module & mod, SleefImplIndex & index) {
+  for (auto & func : mod) {
+    if (func.isDeclaration()) continue;
+
+    // register under every prefix that ends in front of a '_' (and the full name)
+    StringRef funcName = func.getName();
+    unsigned ulpBound = ReadULPBound(funcName);
+    for (size_t pos = 1; pos <= funcName.size(); ++pos) {
+      if (pos < funcName.size() && funcName[pos] != '_') continue;
+      index[funcName.substr(0, pos)].push_back(SleefImpl{ulpBound, &func});
+    }
+  }
+}
+
+static Function*
+GetLeastPreciseImpl(const SleefImplIndex & index, StringRef funcPrefix, const unsigned maxULPBound) {
+  Function * currBest = nullptr;
+  unsigned bestBound = 0;
+
+  IF_DEBUG_SLEEF { errs() << "SLEEF: impl: " << funcPrefix << "\n"; }
+  auto itImpls = index.find(funcPrefix);
+  if (itImpls == index.end()) return nullptr;
+
+  for (const auto & impl : itImpls->second) {
+    IF_DEBUG_SLEEF { errs() << "\t candidate: " << impl.func->getName() << "\n"; }
+
+    // dismiss too imprecise functions
+    if (impl.ULPBound > maxULPBound) {
+      IF_DEBUG_SLEEF { errs() << "discard, ulp was: " << impl.ULPBound << "\n"; }
+      continue;
+
+    // accept functions with higher ULP error within maxUPLBound
+    } else if (!currBest || (impl.ULPBound > bestBound)) {
+      IF_DEBUG_SLEEF { errs() << "\tOK! " << impl.func->getName() << " with ulp bound: " << impl.ULPBound << "\n"; }
+      bestBound = impl.ULPBound;
+      currBest = impl.func;
+    }
+  }
+
+  return currBest;
+}
+
+// Parsed SLEEF bitcode modules of one LLVMContext.
+// The modules are shared by all SLEEF resolvers in that context and are
+// released with the last reference (which has to go before the context).
+class SleefModuleCache {
+  LLVMContext &Ctx;
+  std::mutex Lock; // guards lazy module creation
+  std::unique_ptr<Module> SleefModules[SLEEF_Enum_Entries * 2];
+  std::unique_ptr<Module> ExtraModules[SLEEF_Enum_Entries];
+  std::unique_ptr<Module> SharedModule;
+  SleefImplIndex SleefIndices[SLEEF_Enum_Entries * 2]; // built on module load
+  StringMap<std::unique_ptr<Module>> VLAModules; // on-the-fly vectorized VLA functions by cache key
+
+  Module &requestModule(std::unique_ptr<Module> &Slot, const unsigned char **Buffer, size_t BufferLen, SleefImplIndex *Index = nullptr) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    if (!Slot) {
+      // Only the bodies of functions that are actually cloned out get parsed.
+      Slot.reset(createLazyModuleFromBuffer(reinterpret_cast<const char *>(Buffer), BufferLen, Ctx));
+      assert(Slot);
+
+      if (Index)
+        BuildImplIndex(*Slot, *Index);
+    }
+    return *Slot;
+  }
+
+public:
+  unsigned NumRefs;
+
+  SleefModuleCache(LLVMContext &Ctx) : Ctx(Ctx), NumRefs(0) {}
+
+  Module &requestSleefModule(int ModIndex) {
+    return requestModule(SleefModules[ModIndex], sleefModuleBuffers[ModIndex], sleefModuleBufferLens[ModIndex], &SleefIndices[ModIndex]);
+  }
+
+  // least precise implementation of \p FuncPrefix within \p MaxULPBound in SLEEF module \p ModIndex.
+  Function *getLeastPreciseImpl(int ModIndex, StringRef FuncPrefix, unsigned MaxULPBound) {
+    requestSleefModule(ModIndex);
+    return GetLeastPreciseImpl(SleefIndices[ModIndex], FuncPrefix, MaxULPBound);
+  }
+
+  Module &requestExtraModule(int ModIndex) {
+    return requestModule(ExtraModules[ModIndex], extraModuleBuffers[ModIndex], extraModuleBufferLens[ModIndex]);
+  }
+
+  Module &requestSharedModule() {
+    return requestModule(SharedModule, &rempitab_Buffer, rempitab_BufferLen);
+  }
+
+  // an earlier on-the-fly vectorization \p FuncName for \p Key (from any context or RV_SLEEF_CACHE) or nullptr
+  Function *requestVLAFunction(const std::string &Key, StringRef FuncName);
+
+  // make the vectorized VLA function \p VecFunc (and its callees) available under \p Key
+  void storeVLAFunction(const std::string &Key, Function &VecFunc);
+};
+
+static std::mutex ModuleCachesLock; // guards ModuleCaches
+static std::map<const LLVMContext *, std::unique_ptr<SleefModuleCache>> ModuleCaches;
+
+static SleefModuleCache &acquireModuleCache(LLVMContext &Ctx) {
+  std::lock_guard<std::mutex> Guard(ModuleCachesLock);
+  auto &Cache = ModuleCaches[&Ctx];
+  if (!Cache)
+    Cache = std::make_unique<SleefModuleCache>(Ctx);
+  ++Cache->NumRefs;
+  return *Cache;
+}
+
+static void releaseModuleCache(LLVMContext &Ctx) {
+  std::lock_guard<std::mutex> Guard(ModuleCachesLock);
+  auto It = ModuleCaches.find(&Ctx);
+  assert(It != ModuleCaches.end() && "SLEEF modules were not acquired!");
+  if (--It->second->NumRefs == 0)
+    ModuleCaches.erase(It);
+}
 
 static Module &requestSharedModule(LLVMContext &Ctx) {
-  static Module *SharedModule = nullptr;
-  if (!SharedModule)
-    SharedModule =
-        createModuleFromBuffer(reinterpret_cast<const char *>(&rempitab_Buffer),
-                               rempitab_BufferLen, Ctx);
-  assert(SharedModule);
-  return *SharedModule;
+  SleefModuleCache *Cache = nullptr;
+  {
+    std::lock_guard<std::mutex> Guard(ModuleCachesLock);
+    auto It = ModuleCaches.find(&Ctx);
+    assert(It != ModuleCaches.end() && "SLEEF modules were not acquired!");
+    Cache = It->second.get();
+  }
+  return Cache->requestSharedModule();
 }
 
+void retainSleefModules(LLVMContext &Ctx) { acquireModuleCache(Ctx); }
+
+void releaseSleefModules(LLVMContext &Ctx) { releaseModuleCache(Ctx); }
+
 const LinkerCallback SharedModuleLookup = [](GlobalValue& GV, Module& M) -> Value * {
   IF_DEBUG_SLEEF {
     errs() << "SharedModuleLookup: " << GV.getName() << "\n";
@@ -239,6 +399,128 @@ const LinkerCallback SharedModuleLookup = [](GlobalValue& GV, Module& M) -> Valu
   return ClonedGV;
 };
 
+// copy the linkage of all definitions in \p From to their namesakes in \p To
+// (cloneFunctionIntoModule creates external definitions)
+static void
+CopyLinkages(const Module & From, Module & To) {
+  for (const auto & func : From) {
+    if (func.isDeclaration()) continue;
+    auto * toFunc = To.getFunction(func.getName());
+    if (toFunc && !toFunc->isDeclaration()) toFunc->setLinkage(func.getLinkage());
+  }
+  for (const auto & global : From.globals()) {
+    if (global.isDeclaration()) continue;
+    auto * toGlobal = To.getGlobalVariable(global.getName());
+    if (toGlobal && !toGlobal->isDeclaration()) toGlobal->setLinkage(global.getLinkage());
+  }
+}
+
+// Vectorized VLA functions as bitcode by cache key (shared by all contexts in this process).
+// The oldest entries are dropped once the cache exceeds VLABitcodeBudget bytes.
+static const size_t VLABitcodeBudget = 64 << 20;
+static std::mutex VLABitcodeLock; // guards VLABitcodeCache, VLABitcodeOrder, VLABitcodeSize
+static std::map<std::string, std::string> VLABitcodeCache;
+static std::deque<std::string> VLABitcodeOrder; // insertion order of VLABitcodeCache
+static size_t VLABitcodeSize = 0;
+
+static void
+CacheVLABitcode(const std::string & Key, std::string && Bitcode) {
+  std::lock_guard<std::mutex> BitcodeGuard(VLABitcodeLock);
+  size_t NumBytes = Bitcode.size();
+  if (!VLABitcodeCache.emplace(Key, std::move(Bitcode)).second) return;
+  VLABitcodeOrder.push_back(Key);
+  VLABitcodeSize += NumBytes;
+
+  while (VLABitcodeSize > VLABitcodeBudget && VLABitcodeOrder.size() > 1) {
+    auto ItOldest = VLABitcodeCache.find(VLABitcodeOrder.front());
+    VLABitcodeSize -= ItOldest->second.size();
+    VLABitcodeCache.erase(ItOldest);
+    VLABitcodeOrder.pop_front();
+  }
+}
+
+// file for the cache key \p Key in the on-disk cache (RV_SLEEF_CACHE=<dir>), empty if disabled
+static std::string
+GetVLACacheFile(const std::string & Key) {
+  const char * CacheDir = getenv("RV_SLEEF_CACHE");
+  if (!CacheDir || !*CacheDir) return "";
+  SmallString<128> FilePath(CacheDir);
+  sys::path::append(FilePath, "rv-vla-" + utohexstr(xxHash64(Key)) + ".bc");
+  return FilePath.str().str();
+}
+
+Function *
+SleefModuleCache::requestVLAFunction(const std::string &Key, StringRef FuncName) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  auto &Slot = VLAModules[Key];
+  if (!Slot) {
+    std::string Bitcode;
+    {
+      std::lock_guard<std::mutex> BitcodeGuard(VLABitcodeLock);
+      auto ItBitcode = VLABitcodeCache.find(Key);
+      if (ItBitcode != VLABitcodeCache.end())
+        Bitcode = ItBitcode->second;
+    }
+
+    // try the on-disk cache
+    std::string CacheFile = GetVLACacheFile(Key);
+    if (Bitcode.empty() && !CacheFile.empty() && sys::fs::exists(CacheFile)) {
+      auto BufOrErr = MemoryBuffer::getFile(CacheFile);
+      if (BufOrErr)
+        Bitcode = (*BufOrErr)->getBuffer().str();
+    }
+    if (Bitcode.empty())
+      return nullptr;
+
+    auto ModOrErr = parseBitcodeFile(MemoryBufferRef(Bitcode, Key), Ctx);
+    if (!ModOrErr) {
+      consumeError(ModOrErr.takeError());
+      return nullptr;
+    }
+    // hash collision in the on-disk cache
+    if ((*ModOrErr)->getSourceFileName() != Key)
+      return nullptr;
+    Slot = std::move(*ModOrErr);
+    CacheVLABitcode(Key, std::move(Bitcode));
+  }
+  return Slot->getFunction(FuncName);
+}
+
+void
+SleefModuleCache::storeVLAFunction(const std::string &Key, Function &VecFunc) {
+  auto &SrcMod = *VecFunc.getParent();
+  auto CacheMod = std::make_unique<Module>(Key, Ctx);
+  CacheMod->setSourceFileName(Key);
+  CacheMod->setDataLayout(SrcMod.getDataLayout());
+  CacheMod->setTargetTriple(SrcMod.getTargetTriple());
+  cloneFunctionIntoModule(VecFunc, *CacheMod, VecFunc.getName(), SharedModuleLookup);
+  CopyLinkages(SrcMod, *CacheMod);
+
+  std::string Bitcode;
+  raw_string_ostream BitcodeStream(Bitcode);
+  WriteBitcodeToFile(*CacheMod, BitcodeStream);
+  BitcodeStream.flush();
+
+  // persist (write to a temporary file first, concurrent compilers may race for the same entry)
+  std::string CacheFile = GetVLACacheFile(Key);
+  if (!CacheFile.empty() && !sys::fs::exists(CacheFile)) {
+    SmallString<128> TempFile;
+    int TempFD;
+    if (!sys::fs::createUniqueFile(CacheFile + ".%%%%%%.tmp", TempFD, TempFile)) {
+      {
+        raw_fd_ostream TempStream(TempFD, /* shouldClose */ true);
+        TempStream << Bitcode;
+      }
+      if (sys::fs::rename(TempFile, CacheFile))
+        sys::fs::remove(TempFile);
+    }
+  }
+
+  CacheVLABitcode(Key, std::move(Bitcode));
+  std::lock_guard<std::mutex> Guard(Lock);
+  VLAModules[Key] = std::move(CacheMod);
+}
+
 static
 void
 InitSleefMappings(PlainVecDescVector & archMappings, int floatWidth, int doubleWidth) {
@@ -389,6 +671,17 @@ InitSleefMappings(PlainVecDescVector & archMappings, int floatWidth, int doubleW
         archMappings.insert(archMappings.end(), VecFuncs.begin(), VecFuncs.end());
 }
 
+// multi-result functions (struct-of-vectors results) for combined calls, e.g. sin(x) & cos(x) -> sincos(x)
+static
+void
+InitSleefFusedMappings(PlainVecDescVector & archMappings, int floatWidth, int doubleWidth) {
+      PlainVecDescVector VecFuncs = {
+          {"sincosf.fused", "xsincosf", floatWidth},
+          {"sincos.fused", "xsincos", doubleWidth}
+        };
+        archMappings.insert(archMappings.end(), VecFuncs.begin(), VecFuncs.end());
+}
+
 
 class SleefResolverService : public ResolverService {
   PlatformInfo & platInfo;
@@ -399,9 +692,31 @@ class SleefResolverService : public ResolverService {
 
     PlainVecDescVector commonVectorMappings;
 
+    // scalar function name -> positions in commonVectorMappings
+    StringMap<SmallVector<unsigned, 2>> mappingIndex;
+
     void addNamedMappings(const PlainVecDescVector & funcs, bool givePrecedence) {
       auto itInsert = givePrecedence ? commonVectorMappings.begin() : commonVectorMappings.end();
       commonVectorMappings.insert(itInsert, funcs.begin(), funcs.end());
+      buildIndex();
+    }
+
+    void buildIndex() {
+      mappingIndex.clear();
+      for (unsigned i = 0; i < commonVectorMappings.size(); ++i) {
+        mappingIndex[commonVectorMappings[i].scalarFnName].push_back(i);
+      }
+    }
+
+    // first mapping for \p funcName with a matching (or arbitrary) width
+    const PlainVecDesc * lookup(StringRef funcName, int vectorWidth) const {
+      auto itMappings = mappingIndex.find(funcName);
+      if (itMappings == mappingIndex.end()) return nullptr;
+      for (unsigned i : itMappings->second) {
+        const auto & vd = commonVectorMappings[i];
+        if ((vd.vectorWidth <= 0) || (vd.vectorWidth == vectorWidth)) return &vd;
+      }
+      return nullptr;
     }
 
     ArchFunctionList(SleefISA _isaIndex, std::string _archSuffix)
@@ -414,6 +729,20 @@ class SleefResolverService : public ResolverService {
 
   Config config;
 
+  // parsed SLEEF modules of the platform's context
+  SleefModuleCache & moduleCache;
+
+  // SLEEF mapping for \p funcName at \p vectorWidth in the first arch that has one.
+  const PlainVecDesc * lookupMapping(StringRef funcName, int vectorWidth, ArchFunctionList *& oArchList) const {
+    for (auto * candList : archLists) {
+      const auto * vd = candList->lookup(funcName, vectorWidth);
+      if (vd) {
+        oArchList = candList;
+        return vd;
+      }
+    }
+    return nullptr;
+  }
 
 public:
   void
@@ -432,11 +761,13 @@ public:
   SleefResolverService(PlatformInfo & _platInfo, const Config & _config)
   : platInfo(_platInfo)
   , config(_config)
+  , moduleCache(acquireModuleCache(_platInfo.getModule().getContext()))
   {
   // ARM
 #ifdef RV_ENABLE_ADVSIMD
     if (config.useADVSIMD) {
       auto * advSimdArch = new ArchFunctionList(SleefISA::SLEEF_ADVSIMD, "advsimd");
+      // no fused mappings: AdvSIMD xsincos returns a plain struct, not through an sret pointer
       InitSleefMappings(advSimdArch->commonVectorMappings, 4, 2);
       archLists.push_back(advSimdArch);
     }
@@ -447,21 +778,25 @@ public:
     if (config.useAVX512) {
       auto * avx512Arch = new ArchFunctionList(SleefISA::SLEEF_AVX512, "avx512");
       InitSleefMappings(avx512Arch->commonVectorMappings, 16, 8);
+      InitSleefFusedMappings(avx512Arch->commonVectorMappings, 16, 8);
       archLists.push_back(avx512Arch);
     }
     if (config.useAVX2 || config.useAVX512) {
       auto * avx2Arch = new ArchFunctionList(SleefISA::SLEEF_AVX2, "avx2");
       InitSleefMappings(avx2Arch->commonVectorMappings, 8, 4);
+      InitSleefFusedMappings(avx2Arch->commonVectorMappings, 8, 4);
       archLists.push_back(avx2Arch);
     }
     if (config.useAVX) {
       auto * avxArch = new ArchFunctionList(SleefISA::SLEEF_AVX, "avx");
       InitSleefMappings(avxArch->commonVectorMappings, 8, 4);
+      InitSleefFusedMappings(avxArch->commonVectorMappings, 8, 4);
       archLists.push_back(avxArch);
     }
     if (config.useSSE || config.useAVX || config.useAVX2 || config.useAVX512) {
       auto * sseArch = new ArchFunctionList(SleefISA::SLEEF_SSE, "sse");
       InitSleefMappings(sseArch->commonVectorMappings, 4, 2);
+      InitSleefFusedMappings(sseArch->commonVectorMappings, 4, 2);
       archLists.push_back(sseArch);
     }
 #endif
@@ -476,13 +811,17 @@ public:
 
     archLists.push_back(vlaArch);
 
+    for (auto * archList : archLists) archList->buildIndex();
   }
 
   ~SleefResolverService() {
     for (auto * archList : archLists) delete archList;
+    releaseModuleCache(platInfo.getModule().getContext());
   }
 
   std::unique_ptr<FunctionResolver> resolve(llvm::StringRef funcName, llvm::FunctionType & scaFuncTy, const VectorShapeVec & argShapes, int vectorWidth, bool hasPredicate, llvm::Module & destModule) override;
+
+  bool isAvailable(llvm::StringRef funcName, llvm::FunctionType & scaFuncTy, const VectorShapeVec & argShapes, int vectorWidth, bool hasPredicate, llvm::Module & destModule) override;
 };
 
 
@@ -539,6 +878,7 @@ class SleefLookupResolver : public FunctionResolver {
 struct SleefVLAResolver : public FunctionResolver {
   VectorizerInterface vectorizer;
   std::unique_ptr<VectorizationInfo> vecInfo;
+  SleefModuleCache & moduleCache;
 
   Function & scaFunc;
   Function * clonedFunc;
@@ -546,32 +886,61 @@ struct SleefVLAResolver : public FunctionResolver {
   VectorShapeVec argShapes;
   VectorShape resShape;
   int vectorWidth;
+  int maskPos; // trailing mask of the predicated variant (-1 if unpredicated)
 
   std::string vecFuncName;
+  std::string cacheKey; // identifies this vectorization across modules
 
-  SleefVLAResolver(PlatformInfo & platInfo, std::string baseName, Config config, Function & _scaFunc, const VectorShapeVec & _argShapes, int _vectorWidth)
+  SleefVLAResolver(PlatformInfo & platInfo, SleefModuleCache & _moduleCache, std::string baseName, Config config, Function & _scaFunc, const VectorShapeVec & _argShapes, int _vectorWidth, int _maskPos)
   : FunctionResolver(platInfo.getModule())
   , vectorizer(platInfo, config)
   , vecInfo(nullptr)
+  , moduleCache(_moduleCache)
   , scaFunc(_scaFunc)
   , clonedFunc(nullptr)
   , vecFunc(nullptr)
   , argShapes(_argShapes)
   , resShape(VectorShape::undef())
   , vectorWidth(_vectorWidth)
-  , vecFuncName(platInfo.createMangledVectorName(baseName, argShapes, vectorWidth, -1))
+  , maskPos(_maskPos)
+  , vecFuncName(platInfo.createMangledVectorName(baseName, argShapes, vectorWidth, maskPos))
+  , cacheKey(GetVLACacheKey(platInfo, config, vecFuncName))
   {
     IF_DEBUG_SLEEF { errs() << "VLA: " << vecFuncName << "\n"; }
   }
 
+  // RV revision + LLVM version, SLEEF build, target (triple, cpu, features), ISA and codegen flags, ULP bound
+  // and the vector function name (encodes the width and argument shapes)
+  static std::string
+  GetVLACacheKey(PlatformInfo & platInfo, const Config & config, const std::string & vecFuncName) {
+    static const uint64_t sleefBuildHash =
+        xxHash64(StringRef(reinterpret_cast<const char *>(&vla_sp_Buffer), vla_sp_BufferLen)) * 31 +
+        xxHash64(StringRef(reinterpret_cast<const char *>(&vla_dp_Buffer), vla_dp_BufferLen));
+
+    std::string key;
+    raw_string_ostream out(key);
+    // the RV sources and LLVM decide the generated code (not the time of the build)
+    out << "rv-" << RV_REVISION << "/llvm-" << LLVM_VERSION_STRING
+        << "/sleef-" << utohexstr(sleefBuildHash)
+        << "/" << platInfo.getModule().getTargetTriple()
+        << "/" << platInfo.getTargetAttributes()
+        << "/" << config.useSSE << config.useAVX << config.useAVX2 << config.useAVX512
+               << config.useNEON << config.useADVSIMD << config.useVE
+        << "/vp" << config.enableVP << "avl" << config.useAVL << "sd" << config.useSafeDivisors
+        << "/u" << config.maxULPErrorBound
+        << "/" << vecFuncName;
+    return out.str();
+  }
+
   CallPredicateMode getCallSitePredicateMode() override {
+    if (maskPos >= 0) return CallPredicateMode::PredicateArg;
     // FIXME this is not entirely true for vector math
     return CallPredicateMode::SafeWithoutPredicate;
   }
 
   // mask position (if any)
   int getMaskPos() override {
-    return -1; // FIXME vector math is unpredicated
+    return maskPos;
   }
 
   // materialized the vectorized function in the module @insertInto and returns a reference to it
@@ -581,7 +950,7 @@ struct SleefVLAResolver : public FunctionResolver {
     if (vecFunc) return *vecFunc;
 
     // FIXME this is a hacky workaround for sqrt
-    if (scaFunc.getName().startswith("xsqrt")) {
+    if (maskPos < 0 && scaFunc.getName().startswith("xsqrt")) {
       auto funcTy = scaFunc.getFunctionType();
       auto vecTy = FixedVectorType::get(funcTy->getReturnType(), vectorWidth);
       vecFunc = Intrinsic::getDeclaration(&targetModule, Intrinsic::sqrt, {vecTy});
@@ -590,13 +959,26 @@ struct SleefVLAResolver : public FunctionResolver {
 
     requestResultShape();
 
+    // reuse an earlier vectorization of this function (in any module)
+    Function * cachedFunc = moduleCache.requestVLAFunction(cacheKey, vecFuncName);
+    if (cachedFunc) {
+      IF_DEBUG_SLEEF { errs() << "VLA: cached " << vecFuncName << "\n"; }
+      vecFunc = &cloneFunctionIntoModule(*cachedFunc, targetModule, vecFuncName, SharedModuleLookup);
+      CopyLinkages(*cachedFunc->getParent(), targetModule);
+      return *vecFunc;
+    }
+
     // prepare scalar copy for transforming
     clonedFunc = &cloneFunctionIntoModule(
         scaFunc, targetModule, vecFuncName + ".tmp", SharedModuleLookup);
     assert(clonedFunc);
 
+    // the predicated variant only runs the function body for the active lanes
+    if (maskPos >= 0) {
+      MaterializeEntryMask(*clonedFunc, vectorizer.getPlatformInfo());
+    }
+
     // create SIMD declaration
-    const int maskPos = -1; // TODO add support for masking
     vecFunc = createVectorDeclaration(*clonedFunc, resShape, argShapes, vectorWidth, maskPos);
     vecFunc->setName(vecFuncName);
 
@@ -608,7 +990,7 @@ struct SleefVLAResolver : public FunctionResolver {
     vecFunc->setCallingConv(CallingConv::Fast);
     vecFunc->setLinkage(GlobalValue::LinkOnceAnyLinkage);
 
-    VectorMapping mapping(clonedFunc, vecFunc, vectorWidth, maskPos, resShape, argShapes, CallPredicateMode::SafeWithoutPredicate);
+    VectorMapping mapping(clonedFunc, vecFunc, vectorWidth, maskPos, resShape, argShapes, getCallSitePredicateMode());
     vectorizer.getPlatformInfo().addMapping(mapping); // prevent recursive vectorization
 
     // set-up vecInfo
@@ -660,6 +1042,7 @@ struct SleefVLAResolver : public FunctionResolver {
     // can dispose of temporary function now
     clonedFunc->eraseFromParent();
 
+    moduleCache.storeVLAFunction(cacheKey, *vecFunc);
     return *vecFunc;
   }
 
@@ -684,102 +1067,220 @@ struct SleefVLAResolver : public FunctionResolver {
   }
 };
 
-// used for shape-based call mappings
-using VecMappingShortVec = llvm::SmallVector<VectorMapping, 4>;
-using VectorFuncMap = std::map<const llvm::Function *, VecMappingShortVec*>;
+// Wrap the unpredicated SIMD math function \p vecFunc in a function \p wrapperName that takes an additional trailing mask.
+// The call is skipped if no lane is active. Inactive lanes compute on the arguments of the first active lane
+// (an input that is evaluated anyway) and so do not raise spurious floating-point exceptions.
+static Function&
+CreateMaskedWrapper(Function & vecFunc, unsigned vectorWidth, const std::string & wrapperName) {
+  auto & mod = *vecFunc.getParent();
+  auto & ctx = mod.getContext();
+  auto * maskTy = FixedVectorType::get(Type::getInt1Ty(ctx), vectorWidth);
+  auto * maskIntTy = Type::getIntNTy(ctx, vectorWidth);
+
+  SmallVector<Type*, 4> paramTys(vecFunc.getFunctionType()->param_begin(), vecFunc.getFunctionType()->param_end());
+  paramTys.push_back(maskTy);
+  auto * wrapperTy = FunctionType::get(vecFunc.getReturnType(), paramTys, false);
+  auto * wrapper = Function::Create(wrapperTy, GlobalValue::LinkOnceODRLinkage, wrapperName, &mod);
+  wrapper->copyAttributesFrom(&vecFunc);
+  wrapper->setDoesNotRecurse();
+
+  auto * maskArg = wrapper->getArg(paramTys.size() - 1);
+  maskArg->setName("mask");
+
+  auto * entryBlock = BasicBlock::Create(ctx, "entry", wrapper);
+  auto * computeBlock = BasicBlock::Create(ctx, "compute", wrapper);
+  auto * skipBlock = BasicBlock::Create(ctx, "skip", wrapper);
+
+  // skip the call if no lane is active
+  IRBuilder<> builder(entryBlock);
+  auto * maskBits = builder.CreateBitCast(maskArg, maskIntTy, "mask.bits");
+  auto * noneActive = builder.CreateICmpEQ(maskBits, ConstantInt::get(maskIntTy, 0), "none.active");
+  builder.CreateCondBr(noneActive, skipBlock, computeBlock);
+
+  // blend the arguments of the first active lane into the inactive lanes
+  builder.SetInsertPoint(computeBlock);
+  auto * leadLane = builder.CreateIntrinsic(Intrinsic::cttz, {maskIntTy}, {maskBits, builder.getTrue()}, nullptr, "lead.lane");
+  SmallVector<Value*, 4> callArgs;
+  for (unsigned i = 0; i + 1 < wrapper->arg_size(); ++i) {
+    Value * arg = wrapper->getArg(i);
+    auto * argVecTy = dyn_cast<FixedVectorType>(arg->getType());
+    if (!argVecTy || argVecTy->getNumElements() != vectorWidth) {
+      callArgs.push_back(arg);
+      continue;
+    }
+    auto * leadVal = builder.CreateExtractElement(arg, leadLane);
+    auto * leadSplat = builder.CreateVectorSplat(vectorWidth, leadVal);
+    callArgs.push_back(builder.CreateSelect(maskArg, arg, leadSplat));
+  }
+  auto * call = builder.CreateCall(&vecFunc, callArgs);
+  call->setCallingConv(vecFunc.getCallingConv());
+  if (wrapperTy->getReturnType()->isVoidTy()) {
+    builder.CreateRetVoid();
+  } else {
+    builder.CreateRet(call);
+  }
 
-// parse ULP error bound from mangled SLEEF name
-static unsigned
-ReadULPBound(StringRef sleefName) {
-  auto itStart = sleefName.find_last_of("_u");
-  if (itStart == StringRef::npos) return 0; // unspecified -> perfect rounding
-  StringRef ulpPart = sleefName.substr(itStart + 1);
+  builder.SetInsertPoint(skipBlock);
+  if (wrapperTy->getReturnType()->isVoidTy()) {
+    builder.CreateRetVoid();
+  } else {
+    builder.CreateRet(UndefValue::get(wrapperTy->getReturnType()));
+  }
 
-  // single digit ULP value
-  unsigned ulpBound;
-  if (ulpPart.size() == 1) {
-    ulpBound = 10 * (ulpPart[0] - '0');
+  return *wrapper;
+}
 
-  // lsc is tenth of ULP
-  } else {
-    bool parseError = ulpPart.consumeInteger<unsigned>(10, ulpBound);
-    (void) parseError; assert(!parseError);
+// whether \p func returns its results through a leading sret pointer
+static bool
+HasStructRetResult(const Function & func) {
+  return func.arg_size() > 0 && func.hasParamAttribute(0, Attribute::StructRet);
+}
+
+// Wrap the multi-result SIMD math function \p sretFunc (results returned through its leading sret pointer)
+// in a function \p wrapperName that returns the struct-of-vectors by value.
+static Function&
+CreateStructReturnWrapper(Function & sretFunc, const std::string & wrapperName) {
+  auto & ctx = sretFunc.getContext();
+  Type * resTy = sretFunc.getParamStructRetType(0);
+
+  SmallVector<Type*, 2> paramTys(sretFunc.getFunctionType()->param_begin() + 1, sretFunc.getFunctionType()->param_end());
+  auto * wrapperTy = FunctionType::get(resTy, paramTys, false);
+  auto * wrapper = Function::Create(wrapperTy, GlobalValue::LinkOnceODRLinkage, wrapperName, sretFunc.getParent());
+  wrapper->setCallingConv(sretFunc.getCallingConv());
+  wrapper->setDoesNotRecurse();
+  for (const char * attrName : {"target-cpu", "target-features"}) {
+    if (sretFunc.hasFnAttribute(attrName)) wrapper->addFnAttr(sretFunc.getFnAttribute(attrName));
   }
 
-  return ulpBound;
+  IRBuilder<> builder(BasicBlock::Create(ctx, "entry", wrapper));
+  auto * resultBuf = builder.CreateAlloca(resTy, nullptr, "result.buf");
+  resultBuf->setAlignment(std::max(resultBuf->getAlign(), sretFunc.getParamAlign(0).valueOrOne()));
+
+  SmallVector<Value*, 2> callArgs = {resultBuf};
+  for (auto & arg : wrapper->args()) callArgs.push_back(&arg);
+  auto * call = builder.CreateCall(&sretFunc, callArgs);
+  call->setCallingConv(sretFunc.getCallingConv());
+  call->addParamAttr(0, Attribute::getWithStructRetType(ctx, resTy));
+
+  builder.CreateRet(builder.CreateAlignedLoad(resTy, resultBuf, resultBuf->getAlign(), "result"));
+  return *wrapper;
 }
 
-static Function*
-GetLeastPreciseImpl(Module & mod, const std::string & funcPrefix, const unsigned maxULPBound) {
-  Function * currBest = nullptr;
-  unsigned bestBound = 0;
+// multi-result SLEEF math (returns the sret results of the looked-up function by value)
+class SleefStructRetResolver : public FunctionResolver {
+  std::unique_ptr<FunctionResolver> sretResolver;
 
-  IF_DEBUG_SLEEF { errs() << "SLEEF: impl: " << funcPrefix << "\n"; }
-  for (auto & func : mod) {
-    if (func.isDeclaration()) continue;
-    if (!func.getName().startswith(funcPrefix)) continue;
+  public:
+    SleefStructRetResolver(Module & _targetModule, std::unique_ptr<FunctionResolver> _sretResolver)
+    : FunctionResolver(_targetModule)
+    , sretResolver(std::move(_sretResolver))
+  {}
 
-    // not a complete funcname match (ie "xlog" would otw match "xlog1p")
-    if ((func.getName().size() > funcPrefix.size()) &&
-        (func.getName()[funcPrefix.size()] != '_'))
-    {
-        continue;
+  CallPredicateMode getCallSitePredicateMode() override { return sretResolver->getCallSitePredicateMode(); }
+  int getMaskPos() override { return sretResolver->getMaskPos(); }
+
+  llvm::Function&
+  requestVectorized() override {
+    Function & sretFunc = sretResolver->requestVectorized();
+    std::string wrapperName = sretFunc.getName().str() + "_ret";
+    auto * existingFunc = targetModule.getFunction(wrapperName);
+    if (existingFunc) {
+      return *existingFunc;
     }
+    return CreateStructReturnWrapper(sretFunc, wrapperName);
+  }
 
-    IF_DEBUG_SLEEF { errs() << "\t candidate: " << func.getName() << "\n"; }
+  VectorShape requestResultShape() override { return sretResolver->requestResultShape(); }
+};
 
-    unsigned funcBound = ReadULPBound(func.getName());
-    // dismiss too imprecise functions
-    if (funcBound > maxULPBound) {
-      IF_DEBUG_SLEEF { errs() << "discard, ulp was: " << funcBound << "\n"; }
-      continue;
+// predicated SLEEF math (masked wrapper around an unpredicated implementation)
+class SleefMaskedResolver : public FunctionResolver {
+  std::unique_ptr<FunctionResolver> unmaskedResolver;
+  int maskPos;
+  unsigned vectorWidth;
 
-    // accept functions with higher ULP error within maxUPLBound
-    } else if (!currBest || (funcBound > bestBound)) {
-      IF_DEBUG_SLEEF { errs() << "\tOK! " << func.getName() << " with ulp bound: " << funcBound << "\n"; }
-      bestBound = funcBound;
-      currBest = &func;
+  public:
+    SleefMaskedResolver(Module & _targetModule, std::unique_ptr<FunctionResolver> _unmaskedResolver, int _maskPos, unsigned _vectorWidth)
+    : FunctionResolver(_targetModule)
+    , unmaskedResolver(std::move(_unmaskedResolver))
+    , maskPos(_maskPos)
+    , vectorWidth(_vectorWidth)
+  {}
+
+  CallPredicateMode getCallSitePredicateMode() override {
+    return CallPredicateMode::PredicateArg;
+  }
+
+  // the mask is the trailing argument
+  int getMaskPos() override {
+    return maskPos;
+  }
+
+  llvm::Function&
+  requestVectorized() override {
+    Function & unmaskedFunc = unmaskedResolver->requestVectorized();
+    std::string wrapperName = unmaskedFunc.getName().str() + "_masked";
+    auto * existingFunc = targetModule.getFunction(wrapperName);
+    if (existingFunc) {
+      return *existingFunc;
     }
+    return CreateMaskedWrapper(unmaskedFunc, vectorWidth, wrapperName);
   }
 
-  return currBest;
+  VectorShape requestResultShape() override { return unmaskedResolver->requestResultShape(); }
+};
+
+// used for shape-based call mappings
+using VecMappingShortVec = llvm::SmallVector<VectorMapping, 4>;
+using VectorFuncMap = std::map<const llvm::Function *, VecMappingShortVec*>;
+
+static bool
+IsDoublePrecision(const FunctionType & scaFuncTy) {
+  bool doublePrecision = false;
+  for (const auto * argTy : scaFuncTy.params()) {
+    doublePrecision |= argTy->isDoubleTy();
+  }
+  return doublePrecision;
+}
+
+bool
+SleefResolverService::isAvailable(llvm::StringRef funcName, llvm::FunctionType & scaFuncTy, const VectorShapeVec & argShapes, int vectorWidth, bool hasPredicate, llvm::Module & destModule) {
+  ArchFunctionList * archList = nullptr;
+  const PlainVecDesc * funcDesc = lookupMapping(funcName, vectorWidth, archList);
+  if (!funcDesc) return false;
+
+  // extras and builtin sqrt do not need a SLEEF module
+  StringRef sleefName = funcDesc->vectorFnName;
+  if (sleefName.contains("_extra") || sleefName.startswith("xsqrt")) return true;
+
+  auto modIndex = sleefModuleIndex(archList->isaIndex, IsDoublePrecision(scaFuncTy));
+  Function * vecFunc = moduleCache.getLeastPreciseImpl(modIndex, sleefName, config.maxULPErrorBound);
+  if (!vecFunc) return false;
+
+  // resolve() can only wrap fused functions that return their results by sret
+  if (funcName.endswith(".fused")) return HasStructRetResult(*vecFunc);
+  return true;
 }
 
 std::unique_ptr<FunctionResolver>
 SleefResolverService::resolve(llvm::StringRef funcName, llvm::FunctionType & scaFuncTy, const VectorShapeVec & argShapes, int vectorWidth, bool hasPredicate, llvm::Module & destModule) {
   IF_DEBUG_SLEEF { errs() << "SLEEFResolverService: " << funcName << " for width " << vectorWidth << "\n"; }
 
-  (void) hasPredicate; // FIXME use predicated versions
+  // call masked math functions in divergent code (the mask is the trailing argument)
+  bool useMasked = hasPredicate && config.useMaskedMath;
+  const int maskPos = scaFuncTy.getNumParams();
 
   // Otw, start looking for a SIMD-ized implementation
   ArchFunctionList * archList = nullptr;
-  PlainVecDesc funcDesc;
-  for (auto * candList : archLists) {
-    // query custom mappings with precedence
-    std::string funcNameStr = funcName.str();
-    for (const auto & vd : candList->commonVectorMappings) {
-       if (vd.scalarFnName == funcNameStr &&
-          ((vd.vectorWidth <= 0) || (vd.vectorWidth == vectorWidth)))
-       {
-         funcDesc = vd;
-         archList = candList;
-         break;
-       }
-    };
-
-    if (archList) break;
-  }
-  IF_DEBUG_SLEEF { errs() << "\tsleef: n/a\n"; }
-  if (!archList) return nullptr;
-
-  // Make sure the shared module is available
-  auto & Ctx = destModule.getContext();
+  const PlainVecDesc * funcDescPtr = lookupMapping(funcName, vectorWidth, archList);
+  if (!funcDescPtr) {
+    IF_DEBUG_SLEEF { errs() << "\tsleef: n/a\n"; }
+    return nullptr;
+  }
+  const PlainVecDesc & funcDesc = *funcDescPtr;
 
   // decode bitwidth (for module lookup)
-  bool doublePrecision = false;
-  for (const auto * argTy : scaFuncTy.params()) {
-    doublePrecision |= argTy->isDoubleTy();
-  }
+  bool doublePrecision = IsDoublePrecision(scaFuncTy);
 
 
   // remove the trailing isa specifier (_avx2/_avx/_sse/..)
@@ -790,10 +1291,8 @@ SleefResolverService::resolve(llvm::StringRef funcName, llvm::FunctionType & sca
   // TODO factor out
   bool isExtraFunc = funcDesc.vectorFnName.find("_extra") != std::string::npos;
   if (isExtraFunc) {
-    int modIdx = (int) isa;
-    auto *& mod = extraModules[modIdx];
-    if (!mod) mod = createModuleFromBuffer(reinterpret_cast<const char*>(extraModuleBuffers[modIdx]), extraModuleBufferLens[modIdx], Ctx);
-    Function *vecFunc = mod->getFunction(sleefName);
+    auto & mod = moduleCache.requestExtraModule((int) isa);
+    Function *vecFunc = mod.getFunction(sleefName);
     assert(vecFunc && "mapped extra function not found in module!");
     return std::make_unique<SleefLookupResolver>(destModule, /* RNG result */ VectorShape::varying(), *vecFunc, funcDesc.vectorFnName);
   }
@@ -810,25 +1309,17 @@ SleefResolverService::resolve(llvm::StringRef funcName, llvm::FunctionType & sca
 
   // Look in SLEEF module
   auto modIndex = sleefModuleIndex(isa, doublePrecision);
-  llvm::Module*& mod = sleefModules[modIndex]; // TODO const Module
-  if (!mod) {
-    mod = createModuleFromBuffer(reinterpret_cast<const char*>(sleefModuleBuffers[modIndex]), sleefModuleBufferLens[modIndex], Ctx);
-
-    IF_DEBUG {
-      bool brokenMod = verifyModule(*mod, &errs());
-      if (brokenMod) abort();
-    }
-  }
 
   if (isa == SLEEF_VLA) {
     // on-the-fly vectorization module
-    Function *vlaFunc = GetLeastPreciseImpl(*mod, sleefName, config.maxULPErrorBound);
+    Function *vlaFunc = moduleCache.getLeastPreciseImpl(modIndex, sleefName, config.maxULPErrorBound);
     if (!vlaFunc) {
       IF_DEBUG_SLEEF { errs() << "sleef: " << sleefName << " n/a with maxULPError: " << config.maxULPErrorBound << "\n"; }
       return nullptr;
     }
 
-    return std::make_unique<SleefVLAResolver>(platInfo, vlaFunc->getName().str(), config, *vlaFunc, argShapes, vectorWidth);
+    // in divergent code, vectorize a predicated variant (the mask is the trailing argument)
+    return std::make_unique<SleefVLAResolver>(platInfo, moduleCache, vlaFunc->getName().str(), config, *vlaFunc, argShapes, vectorWidth, useMasked ? maskPos : -1);
 
   } else {
     // these are pure functions
@@ -841,14 +1332,31 @@ SleefResolverService::resolve(llvm::StringRef funcName, llvm::FunctionType & sca
     }
 
     // we'll have to link in the function
-    Function *vecFunc = GetLeastPreciseImpl(*mod, sleefName, config.maxULPErrorBound);
+    Function *vecFunc = moduleCache.getLeastPreciseImpl(modIndex, sleefName, config.maxULPErrorBound);
     if (!vecFunc) {
       IF_DEBUG_SLEEF { errs() << "sleef: " << sleefName << " n/a with maxULPError: " << config.maxULPErrorBound << "\n"; }
       return nullptr;
     }
 
     std::string vecFuncName = vecFunc->getName().str() + "_" + archList->archSuffix;
-    return std::make_unique<SleefLookupResolver>(destModule, resShape, *vecFunc, vecFuncName);
+    std::unique_ptr<FunctionResolver> lookupResolver = std::make_unique<SleefLookupResolver>(destModule, resShape, *vecFunc, vecFuncName);
+
+    // fused multi-result functions return their results through an sret pointer
+    bool isFusedFunc = funcName.endswith(".fused");
+    if (isFusedFunc) {
+      if (!HasStructRetResult(*vecFunc)) {
+        IF_DEBUG_SLEEF { errs() << "sleef: " << sleefName << " does not return its results by sret\n"; }
+        return nullptr;
+      }
+      lookupResolver = std::make_unique<SleefStructRetResolver>(destModule, std::move(lookupResolver));
+    }
+
+    if (!useMasked) {
+      return lookupResolver;
+    }
+
+    // the SLEEF modules are unpredicated -> wrap the call
+    return std::make_unique<SleefMaskedResolver>(destModule, std::move(lookupResolver), maskPos, vectorWidth);
   }
 }
 
@@ -29,7 +29,10 @@
 
 #include "rv/PlatformInfo.h"
 #include "rv/vectorizationInfo.h"
+#include "rv/vectorizationReport.h"
 #include "rv/analysis/reductionAnalysis.h"
+#include "rv/analysis/MaskProfile.h"
+#include "rv/analysis/MemoryAccessAnalysis.h"
 
 // RV internal transformations.
 #include "rv/transform/CoherentIFTransform.h"
@@ -62,6 +65,7 @@ namespace rv {
 VectorizerInterface::VectorizerInterface(PlatformInfo & _platInfo, Config _config)
         : config(_config)
         , platInfo(_platInfo)
+        , report(nullptr)
 { }
 
 static void
@@ -157,6 +161,8 @@ VectorizerInterface::analyze(VectorizationInfo& vecInfo,
       vecInfo.dump();
     }
 
+    ReportPhaseTimer phaseTimer(report, "analyze");
+
     // determines value and control shapes
     VectorizationAnalysis vea(config, platInfo, vecInfo, FAM);
     vea.analyze();
@@ -165,7 +171,8 @@ VectorizerInterface::analyze(VectorizationInfo& vecInfo,
 bool
 VectorizerInterface::linearize(VectorizationInfo& vecInfo,
                  FunctionAnalysisManager & FAM) {
-    
+    ReportPhaseTimer phaseTimer(report, "linearize");
+
     // TODO make this part of a new optimization phase
     // Scalar-Replication-Of-Varying-(Aggregates): split up structs of vectorizable elements to promote use of vector registers
     if (config.enableSROV) {
@@ -194,15 +201,20 @@ VectorizerInterface::linearize(VectorizationInfo& vecInfo,
     GuardedDivLoopTrans guardedDLT(platInfo, vecInfo, FAM);
     guardedDLT.transformDivergentLoops();
 
-    // insert CIF branches if desired
+    // key the region blocks of the mask profile before CIF/BOSCC change the CFG
+    if (config.enableMaskProfiling || MaskProfile::get()) {
+      vecInfo.assignProfileIds();
+    }
+
+    // insert CIF branches where the cost model expects them to pay off
     if (config.enableCoherentIF) {
-      CoherentIFTransform CoherentIFTrans(vecInfo, platInfo, maskEx, FAM);
+      CoherentIFTransform CoherentIFTrans(config, vecInfo, platInfo, maskEx, FAM, report);
       CoherentIFTrans.run();
     }
 
-    // insert BOSCC branches if desired
+    // insert BOSCC branches where the cost model expects them to pay off
     if (config.enableHeuristicBOSCC) {
-      BOSCCTransform bosccTrans(vecInfo, platInfo, maskEx, FAM);
+      BOSCCTransform bosccTrans(config, vecInfo, platInfo, maskEx, FAM, report);
       bosccTrans.run();
     }
     // expand masks after BOSCC
@@ -226,6 +238,7 @@ VectorizerInterface::linearize(VectorizationInfo& vecInfo,
     // partially linearize acyclic control in the region
     Linearizer linearizer(config, vecInfo, maskEx, FAM);
     linearizer.run();
+    FAM.invalidate(vecInfo.getScalarFunction(), linearizer.getPreservedAnalyses());
 
     IF_DEBUG {
       errs() << "--- VecInfo after Linearizer ---\n";
@@ -238,6 +251,8 @@ VectorizerInterface::linearize(VectorizationInfo& vecInfo,
 // flag is set if the env var holds a string that starts on a non-'0' char
 bool
 VectorizerInterface::vectorize(VectorizationInfo &vecInfo, FunctionAnalysisManager &FAM, ValueToValueMapTy * vecInstMap) {
+  ReportPhaseTimer phaseTimer(report, "vectorize");
+
   // divergent memcpy lowering
   MemCopyElision mce(platInfo, vecInfo);
   mce.run();
@@ -260,6 +275,11 @@ VectorizerInterface::vectorize(VectorizationInfo &vecInfo, FunctionAnalysisManag
   }
 
 
+  // the transforms above rewrite memory accesses of the scalar function
+  PreservedAnalyses memPA = PreservedAnalyses::all();
+  memPA.abandon<MemoryAccessAnalysisPass>();
+  FAM.invalidate(vecInfo.getScalarFunction(), memPA);
+
   auto &LI = *FAM.getCachedResult<LoopAnalysis>(vecInfo.getScalarFunction());
   auto * hostLoop = LI.getLoopFor(&vecInfo.getEntry());
   ReductionAnalysis reda(vecInfo.getScalarFunction(), FAM);
@@ -268,6 +288,7 @@ VectorizerInterface::vectorize(VectorizationInfo &vecInfo, FunctionAnalysisManag
 // vectorize with native
   NatBuilder natBuilder(config, platInfo, vecInfo, reda, FAM);
   natBuilder.vectorize(true, vecInstMap);
+  if (report) report->setStatistics(natBuilder.getStatistics());
 
   // IR Polish phase: promote i1 vectors and perform early instruction (read: intrinsic) selection
   if (config.enableIRPolish) {
@@ -278,6 +299,7 @@ VectorizerInterface::vectorize(VectorizationInfo &vecInfo, FunctionAnalysisManag
 
   IF_DEBUG verifyFunction(vecInfo.getVectorFunction());
 
+  FAM.invalidate(vecInfo.getVectorFunction(), natBuilder.getPreservedAnalyses());
   return true;
 }
 
@@ -47,6 +47,11 @@
 // only used in assertions.
 #define RV_UNUSED(x) ((void)(x))
 
+// source revision of RV (set by the build system)
+#ifndef RV_REVISION
+#  define RV_REVISION "unknown"
+#endif
+
 
 #endif // _RVCONFIG_H
 
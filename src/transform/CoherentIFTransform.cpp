@@ -35,6 +35,7 @@
 #include "rv/PlatformInfo.h"
 #include "rv/transform/maskExpander.h"
 #include "rv/vectorizationInfo.h"
+#include "rv/vectorizationReport.h"
 
 #include "rv/rvDebug.h"
 #include <rvConfig.h>
@@ -66,9 +67,10 @@ struct CoherentIF{
   LoopInfo & loopInfo;
   Module & mod;
   BranchProbabilityInfo *pbInfo;
+  VectorizationReport * report;
   BranchEstimate BranchEst;
 
-CoherentIF(VectorizationInfo & _vecInfo, PlatformInfo & _platInfo,  MaskExpander & _maskEx, DominatorTree & _domTree, PostDominatorTree & _postDomTree, LoopInfo & _loopInfo, BranchProbabilityInfo * _pbInfo)
+CoherentIF(Config & config, VectorizationInfo & _vecInfo, PlatformInfo & _platInfo,  MaskExpander & _maskEx, DominatorTree & _domTree, PostDominatorTree & _postDomTree, LoopInfo & _loopInfo, BranchProbabilityInfo * _pbInfo, VectorizationReport * _report)
 : vecInfo(_vecInfo)
 , platInfo(_platInfo)
 , maskEx(_maskEx)
@@ -77,7 +79,8 @@ CoherentIF(VectorizationInfo & _vecInfo, PlatformInfo & _platInfo,  MaskExpander
 , loopInfo(_loopInfo)
 , mod(*vecInfo.getScalarFunction().getParent())
 , pbInfo(_pbInfo)
-, BranchEst(vecInfo, platInfo, maskEx, domTree, loopInfo, pbInfo)
+, report(_report)
+, BranchEst(config, vecInfo, platInfo, maskEx, domTree, loopInfo, pbInfo)
 {}
 
 void MaintainCloneLoopwithHeader (Loop * clonedParentLoop, Loop & L, ValueToValueMapTy & valueMap) {
@@ -427,52 +430,48 @@ IsAffine (Instruction* instruction)
 // -1 : TransformBranch onTrue
 // 1 : TransformBranch onFalse
 // currently only cope with BOSCC and CIF
+// the estimate for the most profitable successor is returned in @oGain, @oAllFalseProb
+// @coherent: the branch condition is affine (lanes mostly agree)
 int
-PickSuccessorForCIF(BranchInst & branch, bool onTrueLegal, bool onFalseLegal) {
-  double trueRatio = 0.0;
-  double falseRatio = 0.0;
-  size_t onTrueScore = 0;
-  size_t onFalseScore = 0;
+PickSuccessorForCIF(BranchInst & branch, bool onTrueLegal, bool onFalseLegal, bool coherent, int & oBestIdx, double & oGain, double & oAllFalseProb) {
+  // expected savings of the dynamic variant for either successor region
+  double onTrueAllFalse = 0.0;
+  double onFalseAllFalse = 0.0;
+  double onTrueGain = onTrueLegal ? BranchEst.getSkipGain(branch, 0, onTrueAllFalse, coherent) : 0.0;
+  double onFalseGain = onFalseLegal ? BranchEst.getSkipGain(branch, 1, onFalseAllFalse, coherent) : 0.0;
 
-  BranchEst.analyze(branch, trueRatio, falseRatio, onTrueScore, onFalseScore);
+  IF_DEBUG_CIF { errs() << "CIF: gain onTrue " << onTrueGain << " (all-false " << onTrueAllFalse << "), onFalse " << onFalseGain << " (all-false " << onFalseAllFalse << ")\n"; }
 
-  const char * Ratio_T = "CIF_T";
-  const char * Score_LIMIT = "CIF_LIMIT";
+  bool preferTrue = onTrueLegal && (!onFalseLegal || onTrueGain > onFalseGain);
+  oBestIdx = preferTrue ? 0 : 1;
+  oGain = preferTrue ? onTrueGain : onFalseGain;
+  oAllFalseProb = preferTrue ? onTrueAllFalse : onFalseAllFalse;
 
-  const double maxminRatio = GetValue<double>(Ratio_T, 0.40);
-  const size_t minScore = GetValue<size_t>(Score_LIMIT, 100);
+  if (oGain > 0.0) return preferTrue ? -1 : 1;
 
-  IF_DEBUG_CIF { errs() << *Ratio_T << maxminRatio << *Score_LIMIT << minScore << "\n"; }
-
-  bool onTrueBeneficial = onTrueScore >= minScore && trueRatio < maxminRatio;
-  bool onFalseBeneficial = onFalseScore >= minScore && falseRatio < maxminRatio;
-
-  bool couldTransFalse = onFalseBeneficial && onFalseLegal;
-  bool couldTransTrue = onTrueBeneficial && onTrueLegal;
-
-  // otw try to skip the bigger dominated part
-  // TODO could also give precedence by region size
-  if (couldTransTrue && (!couldTransFalse || onTrueScore > onFalseScore)) {
-    return -1;
-  } else if (couldTransFalse) {
-    return 1;
-  }
-
-  // can not distinguish --> don't TransformBranch
-  // this holds e.g. if the branch does not dominate any of its successors
+  // does not pay off --> don't TransformBranch
   return 0;
 }
 
 bool
 run() {
+  // region blocks with divergent conditional branches (in RPO)
+  std::vector<BasicBlock*> RPOT;
+  vecInfo.getRegion().for_blocks_rpo([&](const BasicBlock & block) {
+    auto * branchInst = dyn_cast<BranchInst>(block.getTerminator());
+    if (branchInst && branchInst->isConditional() && !vecInfo.getVectorShape(*branchInst).isUniform()) {
+      RPOT.push_back(const_cast<BasicBlock*>(&block));
+    }
+    return true;
+  });
+  // nothing to transform -> leave the dom trees alone
+  if (RPOT.empty()) return false;
+
   domTree.recalculate(vecInfo.getScalarFunction());
 
   size_t numCIFBranches = 0;
 
-  ReversePostOrderTraversal<Function*> RPOT(&vecInfo.getScalarFunction());
-
   for (auto * BB : RPOT) {
-    if (!vecInfo.inRegion(*BB)) continue;
     auto * term = BB->getTerminator();
     auto * branchInst = dyn_cast<BranchInst>(term);
 
@@ -499,32 +498,35 @@ run() {
     }
 
 
-    // if affine fails, then use high probability
-    if (IsAffine(dyn_cast<Instruction>(branchCond))) {
-      IF_DEBUG_CIF {errs()<< *branchCond << " is affine condition" << "\n";}
-      ++numCIFBranches;
-      transformCoherentCF(*branchInst, 0);
+    // affine conditions switch at most once across the lanes
+    auto * condInst = dyn_cast<Instruction>(branchCond);
+    bool coherent = condInst && IsAffine(condInst);
+    IF_DEBUG_CIF { if (coherent) errs() << *branchCond << " is affine condition" << "\n"; }
+
+    int bestIdx;
+    double gain, allFalseProb;
+    int score = PickSuccessorForCIF(*branchInst, onTrueLegal, onFalseLegal, coherent, bestIdx, gain, allFalseProb);
+    if (report) {
+      report->addSkipBranch(SkipBranchDecision{"cif", branchInst->getParent()->getName().str(), branchInst->getSuccessor(bestIdx)->getName().str(), allFalseProb, gain, score != 0});
     }
-    else {
-      int score = PickSuccessorForCIF(*branchInst, onTrueLegal, onFalseLegal);
-      if (score == 0) continue;
-      int succIdx = score < 0 ? 0 : 1;
+    if (score == 0) continue;
+    int succIdx = score < 0 ? 0 : 1;
 
-      ++numCIFBranches;
+    ++numCIFBranches;
 
-      Report() << "CIF: dynamic variant succ " << branchInst->getSuccessor(succIdx)->getName() << " of block " << "\n";
+    Report() << "CIF: dynamic variant succ " << branchInst->getSuccessor(succIdx)->getName() << " of block " << branchInst->getParent()->getName() << "\n";
 
-      IF_DEBUG_CIF {errs()<< *branchCond <<  " has high probabilty for CIF " << "\n";}
-      transformCoherentCF(*branchInst, succIdx);
-    }
+    IF_DEBUG_CIF {errs()<< *branchCond <<  " has high probabilty for CIF " << "\n";}
+    transformCoherentCF(*branchInst, succIdx);
   }
 
   if (numCIFBranches > 0) Report() << "CIF: inserted " << numCIFBranches << " CIF branches\n";
 
   // recover
-  postDomTree.recalculate(vecInfo.getScalarFunction());
-
-  domTree.verify();
+  if (numCIFBranches > 0) {
+    postDomTree.recalculate(vecInfo.getScalarFunction());
+    domTree.verify();
+  }
 
   IF_DEBUG_CIF {
     errs() << "--- FUNCTION AFTER CIF ---:\n";
@@ -538,16 +540,18 @@ run() {
 
 bool
 CoherentIFTransform::run() {
-  CoherentIF coherentif(vecInfo, platInfo, maskEx, domTree, postDomTree, loopInfo, pbInfo);
+  CoherentIF coherentif(config, vecInfo, platInfo, maskEx, domTree, postDomTree, loopInfo, pbInfo, report);
   return coherentif.run();
 }
 
-CoherentIFTransform::CoherentIFTransform (VectorizationInfo & _vecInfo, PlatformInfo & _platInfo, MaskExpander & _maskEx, llvm::FunctionAnalysisManager &FAM)
-: vecInfo(_vecInfo)
+CoherentIFTransform::CoherentIFTransform (Config & _config, VectorizationInfo & _vecInfo, PlatformInfo & _platInfo, MaskExpander & _maskEx, llvm::FunctionAnalysisManager &FAM, VectorizationReport * _report)
+: config(_config)
+, vecInfo(_vecInfo)
 , platInfo(_platInfo)
 , maskEx(_maskEx)
 , domTree(FAM.getResult<DominatorTreeAnalysis>(vecInfo.getScalarFunction()))
 , postDomTree(FAM.getResult<PostDominatorTreeAnalysis>(vecInfo.getScalarFunction()))
 , loopInfo(*FAM.getCachedResult<LoopAnalysis>(vecInfo.getScalarFunction()))
 , pbInfo(&FAM.getResult<BranchProbabilityAnalysis>(vecInfo.getScalarFunction()))
+, report(_report)
 {}
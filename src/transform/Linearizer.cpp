@@ -22,6 +22,8 @@
 #include "rv/MaskBuilder.h"
 #include <llvm/ADT/PostOrderIterator.h>
 #include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/Analysis/DomTreeUpdater.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/CFG.h>
 #include <llvm/IR/IRBuilder.h>
@@ -73,6 +75,8 @@ Linearizer::Linearizer(Config _config, VectorizationInfo &_vecInfo,
       config(_config), vecInfo(_vecInfo), maskEx(_maskEx),
       dt(FAM.getResult<DominatorTreeAnalysis>(vecInfo.getScalarFunction())),
       li(*FAM.getCachedResult<LoopAnalysis>(vecInfo.getScalarFunction())),
+      pdt(FAM.getCachedResult<PostDominatorTreeAnalysis>(
+          vecInfo.getScalarFunction())),
       func(vecInfo.getScalarFunction()), context(func.getContext()) {}
 
 void Linearizer::addToBlockIndex(BasicBlock &block) {
@@ -1037,7 +1041,8 @@ void Linearizer::foldPhis(BasicBlock &block) {
   }
 
   // update idom
-  dt.getNode(&block)->setIDom(FindIDom<>(predecessors(&block), dt));
+  dt.changeImmediateDominator(dt.getNode(&block),
+                              FindIDom<>(predecessors(&block), dt));
 }
 
 int Linearizer::processLoop(int headId, Loop &loop) {
@@ -1181,7 +1186,7 @@ Linearizer::RelayNode *Linearizer::emitBlock(int targetId) {
     dt.print(errs());
   }
   assert(nextCommonDom);
-  targetDom->setIDom(nextCommonDom);
+  dt.changeImmediateDominator(targetDom, nextCommonDom);
   IF_DEBUG_DTFIX {
     errs() << "DT after dom change:";
     dt.print(errs());
@@ -1440,7 +1445,7 @@ void Linearizer::processBranch(BasicBlock &head, RelayNode *exitRelay,
       errs() << "DTFIX: " << secondBlock->getName() << " idom is "
              << firstBlock->getName() << " by dominance\n";
     }
-    secondDom->setIDom(firstDom);
+    dt.changeImmediateDominator(secondDom, firstDom);
     IF_DEBUG_DTFIX {
       errs() << "DT after dom change:";
       dt.print(errs());
@@ -1499,6 +1504,11 @@ void Linearizer::run() {
   // verify the integrity of the block index
   verifyBlockIndex();
 
+  // the edges of the region before linearization (post dom tree update)
+  std::vector<DominatorTree::UpdateType> cfgUpdates;
+  if (pdt)
+    recordRegionEdges(cfgUpdates, DominatorTree::Delete);
+
   // fold divergent branches and convert divergent loops to fix point iteration
   // form
   linearizeControl();
@@ -1506,7 +1516,14 @@ void Linearizer::run() {
   // simplify branches
   cleanup();
 
-  dt.recalculate(func);
+  // the dom tree is repaired on the fly (blend blocks included), settle it on
+  // the final region CFG. The post dom tree gets the changed region edges.
+  repairRegionDomTree();
+  if (pdt) {
+    recordRegionEdges(cfgUpdates, DominatorTree::Insert);
+    DomTreeUpdater DTU(nullptr, pdt, DomTreeUpdater::UpdateStrategy::Eager);
+    DTU.applyUpdatesPermissive(cfgUpdates);
+  }
 
   // repair SSA form on the linearized CFG
   resolveRepairPhis();
@@ -1648,12 +1665,86 @@ void Linearizer::cacheMasks() {
   }
 }
 
+void Linearizer::recordRegionEdges(
+    std::vector<DominatorTree::UpdateType> &cfgUpdates,
+    DominatorTree::UpdateKind kind) const {
+  vecInfo.getRegion().for_blocks([&](const BasicBlock &block) {
+    auto *BB = const_cast<BasicBlock *>(&block);
+    for (auto *succBlock : successors(BB))
+      cfgUpdates.push_back({kind, BB, succBlock});
+    return true;
+  });
+}
+
+void Linearizer::repairRegionDomTree() {
+  auto &region = vecInfo.getRegion();
+  auto &entry = region.getRegionEntry();
+
+  // whether @node is dominated by @domNode (walks up the tree, unlike
+  // dt.dominates this does not refresh the DFS numbers of the whole function)
+  auto isDominatedBy = [](DomTreeNode *node, DomTreeNode *domNode) {
+    while (node && node->getLevel() > domNode->getLevel())
+      node = node->getIDom();
+    return node == domNode;
+  };
+
+  // the nearest common dominator of the forward-edge predecessors of @block
+  auto setIDom = [&](BasicBlock &block) {
+    auto *blockNode = dt.getNode(&block);
+    BasicBlock *commonDom = nullptr;
+    for (auto *predBlock : predecessors(&block)) {
+      auto *predNode = dt.getNode(predBlock);
+      if (!predNode || isDominatedBy(predNode, blockNode))
+        continue; // unreachable or back edge
+      commonDom = commonDom ? dt.findNearestCommonDominator(commonDom, predBlock)
+                            : predBlock;
+    }
+    assert(commonDom && "domtree repair: no forward predecessor");
+    auto *idomNode = dt.getNode(commonDom);
+    if (blockNode->getIDom() != idomNode)
+      dt.changeImmediateDominator(blockNode, idomNode);
+  };
+
+  // in RPO all forward-edge predecessors of a block are settled before it
+  SmallVector<BasicBlock *, 16> exitBlocks;
+  SmallPtrSet<BasicBlock *, 4> seenExits;
+  region.for_blocks_rpo([&](const BasicBlock &constBlock) {
+    auto &block = const_cast<BasicBlock &>(constBlock);
+    if (&block != &entry)
+      setIDom(block);
+    for (auto *succBlock : successors(&block)) {
+      if (!region.contains(succBlock) && seenExits.insert(succBlock).second)
+        exitBlocks.push_back(succBlock);
+    }
+    return true;
+  });
+
+  // the region exits are dominated from inside the region
+  for (auto *exitBlock : exitBlocks)
+    setIDom(*exitBlock);
+}
+
+PreservedAnalyses Linearizer::getPreservedAnalyses() const {
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  PA.preserve<PostDominatorTreeAnalysis>();
+  PA.preserve<LoopAnalysis>();
+  return PA;
+}
+
 void Linearizer::cleanup() {
+  // linearization only changes the terminators in the region
+  std::vector<BasicBlock *> regionBlocks;
+  vecInfo.getRegion().for_blocks([&](const BasicBlock &block) {
+    regionBlocks.push_back(const_cast<BasicBlock *>(&block));
+    return true;
+  });
+
   // simplify terminators
   // linearization can lead to terminators of the form "br i1 cond %blockA
   // %blockA"
-  for (auto &block : func) {
-    auto *term = block.getTerminator();
+  for (auto *block : regionBlocks) {
+    auto *term = block->getTerminator();
     if (!term || term->getNumSuccessors() <= 1)
       continue; // already as simple as it gets
 
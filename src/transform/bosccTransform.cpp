@@ -33,6 +33,7 @@
 #include <llvm/Transforms/Utils/ValueMapper.h>
 
 #include "rv/vectorizationInfo.h"
+#include "rv/vectorizationReport.h"
 #include "rv/PlatformInfo.h"
 #include "rv/transform/maskExpander.h"
 
@@ -62,6 +63,7 @@ struct Impl {
   LoopInfo & loopInfo;
   Module & mod;
   BranchProbabilityInfo *pbInfo;
+  VectorizationReport * report;
 
   BranchEstimate BranchEst;
 
@@ -69,7 +71,7 @@ struct Impl {
   BlockSet bosccExitBlocks;
 
 
-Impl(VectorizationInfo & _vecInfo, PlatformInfo & _platInfo,  MaskExpander & _maskEx, DominatorTree & _domTree, PostDominatorTree & _postDomTree, LoopInfo & _loopInfo, BranchProbabilityInfo * _pbInfo)
+Impl(Config & config, VectorizationInfo & _vecInfo, PlatformInfo & _platInfo,  MaskExpander & _maskEx, DominatorTree & _domTree, PostDominatorTree & _postDomTree, LoopInfo & _loopInfo, BranchProbabilityInfo * _pbInfo, VectorizationReport * _report)
 : vecInfo(_vecInfo)
 , platInfo(_platInfo)
 , maskEx(_maskEx)
@@ -78,7 +80,8 @@ Impl(VectorizationInfo & _vecInfo, PlatformInfo & _platInfo,  MaskExpander & _ma
 , loopInfo(_loopInfo)
 , mod(*vecInfo.getScalarFunction().getParent())
 , pbInfo(_pbInfo)
-, BranchEst(vecInfo, platInfo, maskEx, domTree, loopInfo, pbInfo)
+, report(_report)
+, BranchEst(config, vecInfo, platInfo, maskEx, domTree, loopInfo, pbInfo)
 , bosccExitBlocks()
 {}
 
@@ -288,71 +291,57 @@ transformBranch(BranchInst & branch, int succIdx) {
 // -1 : TransformBranch onTrue
 // 1 : TransformBranch onFalse
 // currently only cope with BOSCC and CIF
+// the estimate for the most profitable successor is returned in @oGain, @oAllFalseProb
 int
-PickSuccessorForBoscc(BranchInst & branch) {
-  IF_DEBUG_BOSCC {
-     errs () << "BOSCC: inspecting " << branch << "\n";
-  }
-
-  //run legality checks
-  bool onTrueLegal, onFalseLegal;
-  if (!BranchEst.CheckLegality(branch, onTrueLegal, onFalseLegal)) return 0;
-
+PickSuccessorForBoscc(BranchInst & branch, bool onTrueLegal, bool onFalseLegal, int & oBestIdx, double & oGain, double & oAllFalseProb) {
   IF_DEBUG_BOSCC {
     errs () << "BOSCC: onTrueLegal to " << branch.getSuccessor(0)->getName() << " = " << onTrueLegal << "\n";
     errs () << "BOSCC: onFalseLegal to " << branch.getSuccessor(1)->getName() << " = " << onFalseLegal << "\n";
   }
 
-  double trueRatio = 0.0;
-  double falseRatio = 0.0;
-  size_t onTrueScore = 0;
-  size_t onFalseScore = 0;
-
-  BranchEst.analyze(branch, trueRatio, falseRatio, onTrueScore, onFalseScore);
-
-  const char * Ratio_T = "BOSCC_T";
-  const char * Score_LIMIT = "BOSCC_LIMIT";
-
-  const double maxRatio = GetValue<double>(Ratio_T, 0.40);
-  const size_t minScore = GetValue<size_t>(Score_LIMIT, 100);
-
-  IF_DEBUG_BOSCC { errs() << "BOSCC_T=" << maxRatio << ", BOSCC_LIMIT=" << minScore << "\n"; }
+  // expected savings of skipping either successor region when no lane enters it
+  double onTrueAllFalse = 0.0;
+  double onFalseAllFalse = 0.0;
+  double onTrueGain = onTrueLegal ? BranchEst.getSkipGain(branch, 0, onTrueAllFalse) : 0.0;
+  double onFalseGain = onFalseLegal ? BranchEst.getSkipGain(branch, 1, onFalseAllFalse) : 0.0;
 
   IF_DEBUG_BOSCC {
-    errs () << "BOSCC: onTrue Score/Ratio to " << branch.getSuccessor(0)->getName() << " = " << onTrueScore << " / " << trueRatio << "\n";
-    errs () << "BOSCC: onFalse Legal/Ratio to " << branch.getSuccessor(1)->getName() << " = " << onFalseScore << " / " << falseRatio << "\n";
+    errs () << "BOSCC: onTrue Gain/AllFalse to " << branch.getSuccessor(0)->getName() << " = " << onTrueGain << " / " << onTrueAllFalse << "\n";
+    errs () << "BOSCC: onFalse Gain/AllFalse to " << branch.getSuccessor(1)->getName() << " = " << onFalseGain << " / " << onFalseAllFalse << "\n";
   }
 
-  bool onTrueBeneficial = onTrueScore >= minScore && trueRatio < maxRatio;
-  bool onFalseBeneficial = onFalseScore >= minScore && falseRatio < maxRatio;
+  bool preferTrue = onTrueLegal && (!onFalseLegal || onTrueGain > onFalseGain);
+  oBestIdx = preferTrue ? 0 : 1;
+  oGain = preferTrue ? onTrueGain : onFalseGain;
+  oAllFalseProb = preferTrue ? onTrueAllFalse : onFalseAllFalse;
 
-  bool couldTransFalse = onFalseBeneficial && onFalseLegal;
-  bool couldTransTrue = onTrueBeneficial && onTrueLegal;
-
-  // otw try to skip the bigger dominated part
-  // TODO could also give precedence by region size
-  if (couldTransTrue && (!couldTransFalse || onTrueScore > onFalseScore)) {
-    return -1;
-  } else if (couldTransFalse) {
-    return 1;
-  }
+  // skip the region with the bigger expected savings
+  if (oGain > 0.0) return preferTrue ? -1 : 1;
 
-  // can not distinguish --> don't TransformBranch
-  // this holds e.g. if the branch does not dominate any of its successors
+  // does not pay off --> don't TransformBranch
   return 0;
 }
 
 
 bool
 run() {
+  // region blocks with divergent conditional branches (in RPO)
+  std::vector<BasicBlock*> RPOT;
+  vecInfo.getRegion().for_blocks_rpo([&](const BasicBlock & block) {
+    auto * branchInst = dyn_cast<BranchInst>(block.getTerminator());
+    if (branchInst && branchInst->isConditional() && !vecInfo.getVectorShape(*branchInst).isUniform()) {
+      RPOT.push_back(const_cast<BasicBlock*>(&block));
+    }
+    return true;
+  });
+  // nothing to transform -> leave the dom trees alone
+  if (RPOT.empty()) return false;
+
   domTree.recalculate(vecInfo.getScalarFunction());
 
   size_t numBosccBranches = 0;
 
-  ReversePostOrderTraversal<Function*> RPOT(&vecInfo.getScalarFunction());
-
   for (auto * BB : RPOT) {
-    if (!vecInfo.inRegion(*BB)) continue;
     auto * term = BB->getTerminator();
     auto * branchInst = dyn_cast<BranchInst>(term);
 
@@ -363,7 +352,20 @@ run() {
 
     // do not speculate across BOSCC exits
     if (bosccExitBlocks.count(branchInst->getSuccessor(0)) || bosccExitBlocks.count(branchInst->getSuccessor(1))) return 0;
-    int score = PickSuccessorForBoscc(*branchInst);
+
+    IF_DEBUG_BOSCC { errs () << "BOSCC: inspecting " << *branchInst << "\n"; }
+
+    // run legality checks
+    bool onTrueLegal, onFalseLegal;
+    if (!BranchEst.CheckLegality(*branchInst, onTrueLegal, onFalseLegal)) continue;
+    if (!onTrueLegal && !onFalseLegal) continue;
+
+    int bestIdx;
+    double gain, allFalseProb;
+    int score = PickSuccessorForBoscc(*branchInst, onTrueLegal, onFalseLegal, bestIdx, gain, allFalseProb);
+    if (report) {
+      report->addSkipBranch(SkipBranchDecision{"boscc", branchInst->getParent()->getName().str(), branchInst->getSuccessor(bestIdx)->getName().str(), allFalseProb, gain, score != 0});
+    }
     if (score == 0) continue;
     int succIdx = score < 0 ? 0 : 1;
 
@@ -380,9 +382,10 @@ run() {
   if (numBosccBranches > 0) Report() << "boscc: inserted " << numBosccBranches << " BOSCC branches\n";
 
   // recover
-  postDomTree.recalculate(vecInfo.getScalarFunction());
-
-  domTree.verify();
+  if (numBosccBranches > 0) {
+    postDomTree.recalculate(vecInfo.getScalarFunction());
+    domTree.verify();
+  }
 
   IF_DEBUG_BOSCC {
     errs() << "--- FUNCTION AFTER BOSCC ---:\n";
@@ -397,17 +400,19 @@ run() {
 
 bool
 BOSCCTransform::run() {
-  Impl impl(vecInfo, platInfo, maskEx, domTree, postDomTree, loopInfo, pbInfo);
+  Impl impl(config, vecInfo, platInfo, maskEx, domTree, postDomTree, loopInfo, pbInfo, report);
   return impl.run();
 }
 
 
-BOSCCTransform::BOSCCTransform(VectorizationInfo & _vecInfo, PlatformInfo & _platInfo, MaskExpander & _maskEx, FunctionAnalysisManager &FAM)
-: vecInfo(_vecInfo)
+BOSCCTransform::BOSCCTransform(Config & _config, VectorizationInfo & _vecInfo, PlatformInfo & _platInfo, MaskExpander & _maskEx, FunctionAnalysisManager &FAM, VectorizationReport * _report)
+: config(_config)
+, vecInfo(_vecInfo)
 , platInfo(_platInfo)
 , maskEx(_maskEx)
 , domTree(FAM.getResult<DominatorTreeAnalysis>(vecInfo.getScalarFunction()))
 , postDomTree(FAM.getResult<PostDominatorTreeAnalysis>(vecInfo.getScalarFunction()))
 , loopInfo(*FAM.getCachedResult<LoopAnalysis>(vecInfo.getScalarFunction()))
 , pbInfo(&FAM.getResult<BranchProbabilityAnalysis>(vecInfo.getScalarFunction()))
+, report(_report)
 {}
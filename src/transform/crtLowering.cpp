@@ -14,6 +14,10 @@
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Module.h>
 
+#include <map>
+#include <memory>
+#include <mutex>
+
 using namespace llvm;
 
 #ifdef RV_ENABLE_CRT
@@ -24,15 +28,35 @@ extern const size_t crt_BufferLen;
 
 namespace rv {
 
-// compiler-rt early inlining
-Function *
-requestScalarImplementation(const StringRef & funcName, FunctionType & funcTy, Module &insertInto) {
 #ifdef RV_ENABLE_CRT
-  static Module * scalarModule = nullptr;
+// Parsed compiler-rt modules by context (WFV workers vectorize in their own contexts).
+static std::mutex scalarModulesLock; // guards scalarModules
+static std::map<const LLVMContext *, std::unique_ptr<Module>> scalarModules;
+
+static Module *
+requestScalarModule(LLVMContext & ctx) {
+  std::lock_guard<std::mutex> guard(scalarModulesLock);
+  auto & scalarModule = scalarModules[&ctx];
   if (!scalarModule) {
-    scalarModule = createModuleFromBuffer(reinterpret_cast<const char*>(&crt_Buffer), crt_BufferLen, insertInto.getContext());
+    scalarModule.reset(createModuleFromBuffer(reinterpret_cast<const char*>(&crt_Buffer), crt_BufferLen, ctx));
   }
+  return scalarModule.get();
+}
+#endif
 
+void
+releaseScalarImplementations(LLVMContext & ctx) {
+#ifdef RV_ENABLE_CRT
+  std::lock_guard<std::mutex> guard(scalarModulesLock);
+  scalarModules.erase(&ctx);
+#endif
+}
+
+// compiler-rt early inlining
+Function *
+requestScalarImplementation(const StringRef & funcName, FunctionType & funcTy, Module &insertInto) {
+#ifdef RV_ENABLE_CRT
+  auto * scalarModule = requestScalarModule(insertInto.getContext());
   if (!scalarModule) return nullptr; // could not load module
 
   auto * scalarFn = scalarModule->getFunction(funcName);
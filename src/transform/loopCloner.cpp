@@ -75,7 +75,9 @@ struct LoopCloner {
     if (PDT) {
       auto * loopPostDom = PDT->getNode(loopExiting)->getIDom()->getBlock();
       ClonePostDomTree(*loopPostDom, L, *loopExiting, valueMap);
-      PDT->recalculate(F);
+      // the pre-header branches to both loops
+      auto * preHeadPostDom = PDT->findNearestCommonDominator(&loopHead, &clonedHead);
+      PDT->changeImmediateDominator(loopPreHead, preHeadPostDom);
       clonedExitingPostDom = PDT->getNode(&clonedExiting);
     }
 
@@ -148,7 +150,7 @@ struct LoopCloner {
     auto & currentClone = LookUp(valueMap, currentBlock);
     PDT->addNewBlock(&currentClone, &clonedIDom);
 
-    auto * pDomNode = DT->getNode(&currentBlock);
+    auto * pDomNode = PDT->getNode(&currentBlock);
     for (auto * childPostDom : *pDomNode) {
       ClonePostDomTree(currentClone, L, *childPostDom->getBlock(), valueMap);
     }
@@ -185,7 +185,7 @@ CreateMaskedVectorReduce(Config & config, IRBuilder<> & builder, Mask vecMask, R
 
 // reduce the vector @vectorVal to a scalar value (using redKind)
 Value &
-CreateVectorReduce(Config & config, IRBuilder<> & builder, RedKind redKind, Value & vecVal, Value * initVal) {
+CreateVectorReduce(Config & config, IRBuilder<> & builder, RedKind redKind, Value & vecVal, Value * initVal, bool ordered) {
   auto & vecTy = *cast<FixedVectorType>(vecVal.getType());
   unsigned vecWidth = vecTy.getNumElements();
   auto & elemTy = *vecTy.getElementType();
@@ -226,7 +226,16 @@ CreateVectorReduce(Config & config, IRBuilder<> & builder, RedKind redKind, Valu
 
 // Otw, use fallback code path
   auto * intTy = Type::getInt32Ty(builder.getContext());
-  if (IsPower2(vecWidth)) {
+  if (ordered) {
+    // in-order chain: ((init op v0) op v1) op ..
+    Value * accu = initVal;
+    for (unsigned i = 0; i < vecWidth; ++i) {
+      auto * lane = builder.CreateExtractElement(&vecVal, ConstantInt::get(intTy, i), "reduce_lane");
+      accu = accu ? &CreateReductInst(builder, redKind, *accu, *lane) : lane;
+    }
+    return *accu;
+
+  } else if (IsPower2(vecWidth)) {
     auto * accu = &vecVal;
     for (size_t range = vecWidth / 2; range >= 1; range /= 2) {
       // create a permutation vector
@@ -259,16 +268,51 @@ CreateVectorReduce(Config & config, IRBuilder<> & builder, RedKind redKind, Valu
     }
 
   } else {
-    // create a scalar reduction chain
-    Value * accu = initVal ? initVal : &GetNeutralElement(redKind, GetScalarType(vecVal));
+    // log-depth scan, the last lane holds the reduced value
+    auto & scanVec = CreateVectorScan(builder, redKind, vecVal, false);
+    Value * reducedVec = builder.CreateExtractElement(&scanVec, ConstantInt::get(intTy, vecWidth - 1), "reduce_last");
 
-    for (size_t i = 0; i < vecWidth; ++i) {
-      auto * laneVal = builder.CreateExtractElement(&vecVal, i, "red_ext");
-      accu = &CreateReductInst(builder, redKind, *accu, *laneVal);
+    if (initVal && initVal != &GetNeutralElement(redKind, *reducedVec->getType())) {
+      return CreateReductInst(builder, redKind, *reducedVec, *initVal);
+    } else {
+      return *reducedVec;
     }
+  }
+}
 
-    return *accu;
+Value &
+CreateVectorScan(IRBuilder<> & builder, Value & vecVal, Constant & identity, bool exclusive,
+                 std::function<Value*(IRBuilder<>&, Value*, Value*)> combineFunc) {
+  int vecWidth = cast<FixedVectorType>(vecVal.getType())->getNumElements();
+  Value * identityVec = ConstantVector::getSplat(ElementCount::getFixed(vecWidth), &identity);
+
+  // move lane i to lane i + dist (shifting in the identity)
+  auto shiftUp = [&](Value * vec, int dist, const Twine & name) {
+    SmallVector<int, 32> shuffleMask;
+    for (int i = 0; i < vecWidth; ++i) {
+      shuffleMask.push_back(i < dist ? vecWidth + i : i - dist);
+    }
+    return builder.CreateShuffleVector(vec, identityVec, shuffleMask, name);
+  };
+
+  Value * scan = &vecVal;
+  if (exclusive) scan = shiftUp(scan, 1, "scan_excl");
+
+  // log2(vecWidth) steps: lane i combines with lane i - dist
+  for (int dist = 1; dist < vecWidth; dist *= 2) {
+    Value * shifted = shiftUp(scan, dist, "scan_shift");
+    scan = combineFunc(builder, shifted, scan);
   }
+  return *scan;
+}
+
+Value &
+CreateVectorScan(IRBuilder<> & builder, RedKind redKind, Value & vecVal, bool exclusive) {
+  auto & identity = GetNeutralElement(redKind, GetScalarType(vecVal));
+  return CreateVectorScan(builder, vecVal, identity, exclusive,
+      [redKind](IRBuilder<> & builder, Value * lhs, Value * rhs) -> Value* {
+        return &CreateReductInst(builder, redKind, *lhs, *rhs);
+      });
 }
 
 Value &
@@ -589,20 +589,15 @@ struct LoopTransformer {
     }
 
   // update postDomTree
-    bool loopPostDomsEntry = PDT.dominates(&scalarHead, entryBlock);
     auto * vecLoopExitingPostDom = PDT.getNode(vecLoopExiting);
     PDT.addNewBlock(scalarGuardBlock, &scalarHead); // scalarHead >= scaGuardBlock
     auto * vecToScalarPostDom = PDT.addNewBlock(vecToScalarExit, loopExit); // loopExit >= vecToScalar
     PDT.changeImmediateDominator(vecLoopExitingPostDom, vecToScalarPostDom); // vecToScalar >= vecLoopExiting
 
-    PDT.addNewBlock(vecGuardBlock, loopExit); // loopExit >= vecGuardBlock(?)
+    PDT.addNewBlock(vecGuardBlock, loopExit); // loopExit >= vecGuardBlock
 
-    if (loopPostDomsEntry) {
-      // (if scaHead >= preHeader) vecGuard >= preHeader
-      PDT.changeImmediateDominator(entryBlock, vecGuardBlock);
-    }
-
-    // TODO update PDT
+    // vecGuard is the only successor of the preheader
+    PDT.changeImmediateDominator(entryBlock, vecGuardBlock); // vecGuard >= preHeader
   }
 
   void
@@ -1129,6 +1124,15 @@ RemainderTransform::RemainderTransform(llvm::Function &_F, llvm::FunctionAnalysi
 , reda(_reda)
 {}
 
+PreservedAnalyses RemainderTransform::getPreservedAnalyses() const {
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  PA.preserve<PostDominatorTreeAnalysis>();
+  PA.preserve<LoopAnalysis>();
+  PA.preserve<BranchProbabilityAnalysis>(); // transferred to the cloned loop
+  return PA;
+}
+
 bool RemainderTransform::analyzeLoopStructure(Loop &L) {
   // run capability checks
   // CFG caps
@@ -8,6 +8,7 @@
 #include <llvm/IR/InstIterator.h>
 #include <llvm/Transforms/Utils/ValueMapper.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Support/Error.h>
 #include "rvConfig.h"
 
 #if 0
@@ -116,6 +117,12 @@ Function &cloneFunctionIntoModule(Function &func, Module &cloneInto, StringRef n
   // external decl
   if (func.isDeclaration()) return clonedFn;
 
+  // parse the body of lazily loaded functions (and, transitively, its callees)
+  if (func.isMaterializable()) {
+    if (Error Err = func.materialize())
+      report_fatal_error(std::move(Err));
+  }
+
   ValueToValueMapTy VMap;
   auto CI = clonedFn.arg_begin();
   for (auto I = func.arg_begin(), E = func.arg_end(); I != E; ++I, ++CI) {
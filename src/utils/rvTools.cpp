@@ -27,6 +27,7 @@
 
 #include <llvm/Support/MemoryBuffer.h> // MemoryBuffer
 #include <llvm/IRReader/IRReader.h>
+#include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/Support/SourceMgr.h>
 #include <llvm/Support/FileSystem.h>
 
@@ -145,6 +146,17 @@ createModuleFromBuffer(const char buffer[], size_t length, LLVMContext & context
   return modPtr.release();
 }
 
+Module*
+createLazyModuleFromBuffer(const char buffer[], size_t length, LLVMContext & context) {
+  MemoryBufferRef mbRef(StringRef(buffer, length), "");
+  auto modOrErr = getLazyBitcodeModule(mbRef, context);
+  if (!modOrErr) {
+    logAllUnhandledErrors(modOrErr.takeError(), errs(), "rv::createLazyModuleFromBuffer: ");
+    return nullptr;
+  }
+  return modOrErr->release();
+}
+
 Module*
 createModuleFromFile(const std::string & fileName, LLVMContext & context) {
     SMDiagnostic smDiag;
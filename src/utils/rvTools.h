@@ -75,6 +75,11 @@ createModuleFromFile(const std::string & fileName, LLVMContext & context);
 Module*
 createModuleFromBuffer(const char buffer[], size_t length, LLVMContext & context);
 
+// lazily load the bitcode in \p buffer. Function bodies are only parsed on materialization.
+// \p buffer must outlive the returned module.
+Module*
+createLazyModuleFromBuffer(const char buffer[], size_t length, LLVMContext & context);
+
 void
 writeModuleToFile(const Module& mod, const std::string& fileName);
 
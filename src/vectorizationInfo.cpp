@@ -13,6 +13,7 @@
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Instruction.h>
+#include <llvm/IR/Metadata.h>
 
 #include "rv/region/Region.h"
 #include "utils/rvTools.h"
@@ -152,7 +153,8 @@ VectorizationInfo::VectorizationInfo(llvm::Function &parentFn,
                                      unsigned vectorWidth, Region &_region)
     : DL(parentFn.getParent()->getDataLayout()), EntryAVL(nullptr),
       region(_region), mapping(&parentFn, &parentFn, vectorWidth,
-                               CallPredicateMode::SafeWithoutPredicate) {
+                               CallPredicateMode::SafeWithoutPredicate),
+      ProfileRegionId(0) {
   mapping.resultShape = VectorShape::uni();
   for (auto &arg : parentFn.args()) {
     RV_UNUSED(arg);
@@ -163,7 +165,8 @@ VectorizationInfo::VectorizationInfo(llvm::Function &parentFn,
 // VectorizationInfo
 VectorizationInfo::VectorizationInfo(Region &_region, VectorMapping _mapping)
     : DL(_region.getFunction().getParent()->getDataLayout()),
-      EntryAVL(nullptr), region(_region), mapping(_mapping) {
+      EntryAVL(nullptr), region(_region), mapping(_mapping),
+      ProfileRegionId(0) {
   assert(mapping.argShapes.size() == mapping.scalarFn->arg_size());
   auto it = mapping.scalarFn->arg_begin();
   for (auto argShape : mapping.argShapes) {
@@ -419,6 +422,37 @@ BasicBlock &VectorizationInfo::getEntry() const {
   return region.getRegionEntry();
 }
 
+void VectorizationInfo::assignProfileIds() {
+  auto &scalarFn = getScalarFunction();
+  auto &ctx = scalarFn.getContext();
+
+  // the next free region id of this function
+  ProfileRegionId = 0;
+  if (auto *counterMD = scalarFn.getMetadata("rv.maskprof.regions")) {
+    ProfileRegionId =
+        mdconst::extract<ConstantInt>(counterMD->getOperand(0))->getZExtValue();
+  }
+  auto *nextId = ConstantInt::get(Type::getInt32Ty(ctx), ProfileRegionId + 1);
+  scalarFn.setMetadata("rv.maskprof.regions",
+                       MDNode::get(ctx, ConstantAsMetadata::get(nextId)));
+
+  ProfileBlockIds.clear();
+  unsigned blockId = 0;
+  for (const auto &block : scalarFn) {
+    if (inRegion(block))
+      ProfileBlockIds[&block] = blockId++;
+  }
+}
+
+bool VectorizationInfo::getProfileBlockId(const BasicBlock &block,
+                                          unsigned &oBlockId) const {
+  auto itId = ProfileBlockIds.find(&block);
+  if (itId == ProfileBlockIds.end())
+    return false;
+  oBlockId = itId->second;
+  return true;
+}
+
 bool VectorizationInfo::isTemporalDivergent(const LoopInfo &LI,
                                             const BasicBlock &ObservingBlock,
                                             const Value &Val) const {
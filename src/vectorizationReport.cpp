@@ -0,0 +1,194 @@
+//===- src/vectorizationReport.cpp - machine-readable vectorization report --*- C++ -*-===//
+//
+// Part of the RV Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+
+#include "rv/vectorizationReport.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "report.h"
+
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+
+using namespace llvm;
+
+namespace rv {
+
+// RV_REPORT_JSON stream (shared by all threads)
+static std::mutex jsonReportLock;
+static std::unique_ptr<raw_fd_ostream> jsonReportStream;
+
+// record buffer of this thread (set by VectorizationReportBuffer)
+static thread_local std::string * threadRecords = nullptr;
+
+VectorizationReport::VectorizationReport(std::string _kind, std::string _function, std::string _region)
+: kind(std::move(_kind))
+, function(std::move(_function))
+, region(std::move(_region))
+, location()
+, variant()
+, vectorWidth(0)
+, rejection()
+, hasCost(false)
+, cost()
+, hasStatistics(false)
+, stats()
+, skipBranches()
+, phaseTimes()
+{}
+
+void
+VectorizationReport::addPhaseTime(const std::string & phase, double seconds) {
+  for (auto & phaseTime : phaseTimes) {
+    if (phaseTime.first != phase) continue;
+    phaseTime.second += seconds;
+    return;
+  }
+  phaseTimes.emplace_back(phase, seconds);
+}
+
+bool
+VectorizationReport::isEnabled() {
+  const char * filePath = getenv("RV_REPORT_JSON");
+  return filePath && *filePath;
+}
+
+static json::Object
+StatisticsToJSON(const NatStatistics & s) {
+  unsigned numMasked = s.numMaskedGather + s.numMaskedScatter
+                     + s.numInterMaskedLoads + s.numInterMaskedStores
+                     + s.numContMaskedLoads + s.numContMaskedStores
+                     + s.numUniMaskedLoads + s.numUniMaskedStores;
+  unsigned numUnmasked = s.numGather + s.numScatter
+                       + s.numInterLoads + s.numInterStores
+                       + s.numContLoads + s.numContStores
+                       + s.numUniLoads + s.numUniStores;
+
+  return json::Object{
+    {"gathers", s.numGather + s.numMaskedGather},
+    {"scatters", s.numScatter + s.numMaskedScatter},
+    {"interleaved", s.numInterLoads + s.numInterStores + s.numInterMaskedLoads + s.numInterMaskedStores},
+    {"contiguous", s.numContLoads + s.numContStores + s.numContMaskedLoads + s.numContMaskedStores},
+    {"uniform", s.numUniLoads + s.numUniStores + s.numUniMaskedLoads + s.numUniMaskedStores},
+    {"maskedAccesses", numMasked},
+    {"unmaskedAccesses", numUnmasked},
+    {"vectorCalls", s.numVecCalls},
+    {"semiVectorCalls", s.numSemiCalls},
+    {"replicatedCalls", s.numFallCalls},
+    {"cascadedCalls", s.numCascadeCalls},
+    {"rvIntrinsics", s.numRVIntrinsics},
+    {"uniformAllocas", s.numUniAllocas},
+    {"slowAllocas", s.numSlowAllocas},
+    {"vectorized", s.numVectorized},
+    {"scalarized", s.numScalarized},
+    {"replicated", s.numFallbacked},
+    {"loadMasks", json::Object{{"constant", s.numConstLoadMasks}, {"uniform", s.numUniLoadMasks}, {"varying", s.numVarLoadMasks}}},
+    {"storeMasks", json::Object{{"constant", s.numConstStoreMasks}, {"uniform", s.numUniStoreMasks}, {"varying", s.numVarStoreMasks}}}
+  };
+}
+
+static json::Object
+CostToJSON(const RegionCost & cost) {
+  return json::Object{
+    {"vectorWidth", (int64_t) cost.vectorWidth},
+    {"scalarCost", cost.scalarCost},
+    {"vectorCost", cost.vectorCost},
+    {"speedup", cost.getSpeedup()},
+    {"gathers", (int64_t) cost.numGathers},
+    {"scatters", (int64_t) cost.numScatters},
+    {"interleaved", (int64_t) cost.numInterleaved},
+    {"maskedAccesses", (int64_t) cost.numMaskedAccesses},
+    {"cascadedCalls", (int64_t) cost.numCascadedCalls},
+    {"blends", (int64_t) cost.numBlends}
+  };
+}
+
+void
+VectorizationReport::emit() const {
+  if (!isEnabled()) return;
+
+  json::Object record{
+    {"kind", kind},
+    {"function", function},
+    {"region", region},
+    {"vectorWidth", vectorWidth},
+    {"vectorized", rejection.empty()}
+  };
+  if (!location.empty()) record["location"] = location;
+  if (!variant.empty()) record["variant"] = variant;
+  if (!rejection.empty()) record["rejection"] = rejection;
+  if (hasCost) record["cost"] = CostToJSON(cost);
+  if (hasStatistics) record["statistics"] = StatisticsToJSON(stats);
+
+  if (!skipBranches.empty()) {
+    json::Array branches;
+    for (const auto & decision : skipBranches) {
+      branches.push_back(json::Object{
+        {"transform", decision.transform},
+        {"block", decision.block},
+        {"successor", decision.successor},
+        {"allFalseProb", decision.allFalseProb},
+        {"gain", decision.gain},
+        {"inserted", decision.inserted}
+      });
+    }
+    record["skipBranches"] = std::move(branches);
+  }
+
+  json::Object phases;
+  for (const auto & phaseTime : phaseTimes) {
+    phases[phaseTime.first] = phaseTime.second;
+  }
+  record["phaseTimes"] = std::move(phases);
+
+  std::string line;
+  raw_string_ostream lineOut(line);
+  lineOut << json::Value(std::move(record)) << "\n";
+  lineOut.flush();
+
+  if (threadRecords) {
+    *threadRecords += line;
+    return;
+  }
+  appendRecords(line);
+}
+
+void
+VectorizationReport::appendRecords(const std::string & records) {
+  if (records.empty() || !isEnabled()) return;
+
+  std::lock_guard<std::mutex> guard(jsonReportLock);
+  if (!jsonReportStream) {
+    std::error_code EC;
+    jsonReportStream = std::make_unique<raw_fd_ostream>(getenv("RV_REPORT_JSON"), EC, sys::fs::OF_Append);
+    if (EC) {
+      Error() << "could not open RV_REPORT_JSON file: " << EC.message() << "\n";
+      jsonReportStream.reset();
+      return;
+    }
+  }
+  *jsonReportStream << records;
+  jsonReportStream->flush();
+}
+
+VectorizationReportBuffer::VectorizationReportBuffer()
+: records()
+, prevRecords(threadRecords)
+{
+  threadRecords = &records;
+}
+
+VectorizationReportBuffer::~VectorizationReportBuffer() {
+  threadRecords = prevRecords;
+}
+
+} // namespace rv
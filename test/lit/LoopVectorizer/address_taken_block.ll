@@ -0,0 +1,39 @@
+; RUN: opt %s -O3 -S -o /dev/stdout | FileCheck %s
+
+; The address of a block is taken, so the function can not be snapshotted for
+; a rollback. Without indirect branches the preparation can not fail half-way
+; and the loop is still vectorized.
+
+; CHECK: load <4 x double>
+; CHECK: store <4 x double>
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@resume = global i8* null
+
+define void @copy(double* noalias nocapture %A, double* noalias nocapture readonly %B, i64 %n) #0 {
+entry:
+  store i8* blockaddress(@copy, %exit), i8** @resume, align 8
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body, label %exit
+
+body:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %body ]
+  %pB = getelementptr inbounds double, double* %B, i64 %i
+  %b = load double, double* %pB, align 8
+  %pA = getelementptr inbounds double, double* %A, i64 %i
+  store double %b, double* %pA, align 8
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !0
+
+exit:
+  ret void
+}
+
+attributes #0 = { nounwind "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+
+!0 = distinct !{!0, !1, !2}
+!1 = !{!"llvm.loop.vectorize.width", i32 4}
+!2 = !{!"llvm.loop.vectorize.enable", i1 true}
@@ -0,0 +1,82 @@
+; RUN: opt %s -passes='function(rv-loopvec)' -S -o /dev/stdout | FileCheck %s
+
+; atomicrmw add on a varying address (histogram update): the values of lanes with
+; the same address are pre-combined and only the first lane of every address
+; issues the atomic. Fetch results are rebuilt from the leader's old value.
+; With AVX-512 CD the lane conflicts come from vpconflict, otherwise from
+; shifted address compares.
+
+; CHECK-LABEL: define void @histogram_avx2(
+; CHECK-NOT: llvm.x86.avx512.conflict
+; CHECK: %conflict = icmp eq <8 x i64>
+; CHECK: %atomic_leader = and <8 x i1>
+; CHECK: %atomic_combined = add <8 x i32>
+; CHECK: atomicrmw add i32*
+; CHECK: %old.fetch = add <8 x i32>
+; CHECK: ret void
+
+; CHECK-LABEL: define void @histogram_avx512cd(
+; CHECK: %conflict_bits = call <8 x i64> @llvm.x86.avx512.conflict.q.512(<8 x i64>
+; CHECK: %atomic_leader = and <8 x i1>
+; CHECK: %atomic_combined = add <8 x i32>
+; CHECK: atomicrmw add i32*
+; CHECK: ret void
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @histogram_avx2(i32* noalias %H, i32* noalias %Idx, i32* noalias %Old, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body.preheader, label %exit
+
+body.preheader:
+  br label %body
+
+body:
+  %i = phi i64 [ 0, %body.preheader ], [ %i.next, %body ]
+  %pIdx = getelementptr inbounds i32, i32* %Idx, i64 %i
+  %idx = load i32, i32* %pIdx, align 4
+  %idx.ext = sext i32 %idx to i64
+  %pH = getelementptr inbounds i32, i32* %H, i64 %idx.ext
+  %old = atomicrmw add i32* %pH, i32 1 monotonic
+  %pOld = getelementptr inbounds i32, i32* %Old, i64 %i
+  store i32 %old, i32* %pOld, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !0
+
+exit:
+  ret void
+}
+
+define void @histogram_avx512cd(i32* noalias %H, i32* noalias %Idx, i64 %n) #1 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body.preheader, label %exit
+
+body.preheader:
+  br label %body
+
+body:
+  %i = phi i64 [ 0, %body.preheader ], [ %i.next, %body ]
+  %pIdx = getelementptr inbounds i32, i32* %Idx, i64 %i
+  %idx = load i32, i32* %pIdx, align 4
+  %idx.ext = sext i32 %idx to i64
+  %pH = getelementptr inbounds i32, i32* %H, i64 %idx.ext
+  %old = atomicrmw add i32* %pH, i32 1 monotonic
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !3
+
+exit:
+  ret void
+}
+
+attributes #0 = { nounwind "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+attributes #1 = { nounwind "target-cpu"="skylake-avx512" "target-features"="+avx,+avx2,+avx512cd,+avx512f,+avx512vl,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+
+!0 = distinct !{!0, !1, !2}
+!1 = !{!"llvm.loop.vectorize.width", i32 8}
+!2 = !{!"llvm.loop.vectorize.enable", i1 true}
+!3 = distinct !{!3, !1, !2}
@@ -0,0 +1,226 @@
+; RUN: opt %s -passes='function(rv-loopvec)' -S -o /dev/stdout | FileCheck %s
+; RUN: env RV_DISABLE_INTERLEAVED=1 opt %s -passes='function(rv-loopvec)' -S -o /dev/stdout | FileCheck %s --check-prefix=GATHER
+
+; Strided accesses to the members of an AoS record (stride 2, 3, 4 and 8) are
+; combined into one wide load or store plus (de)interleaving shuffles. Records
+; with gaps and predicated records use a masked wide access.
+
+; CHECK-LABEL: define void @load_stride2(
+; CHECK: %inter_load = load <8 x float>, <8 x float>*
+; CHECK: %x.inter = shufflevector <8 x float> %inter_load
+; CHECK: %y.inter = shufflevector <8 x float> %inter_load
+; CHECK: ret void
+
+; CHECK-LABEL: define void @load_stride3(
+; CHECK: %inter_load = load <12 x float>, <12 x float>*
+; CHECK: %x.inter = shufflevector <12 x float> %inter_load
+; CHECK: %y.inter = shufflevector <12 x float> %inter_load
+; CHECK: ret void
+
+; CHECK-LABEL: define void @load_stride4(
+; CHECK: %inter_load = load <16 x float>, <16 x float>*
+; CHECK: %x.inter = shufflevector <16 x float> %inter_load
+; CHECK: %y.inter = shufflevector <16 x float> %inter_load
+; CHECK: ret void
+
+; CHECK-LABEL: define void @load_stride8(
+; CHECK: %inter_load = load <32 x float>, <32 x float>*
+; CHECK: %x.inter = shufflevector <32 x float> %inter_load
+; CHECK: %y.inter = shufflevector <32 x float> %inter_load
+; CHECK: ret void
+
+; CHECK-LABEL: define void @store_stride2(
+; CHECK: store <8 x float> {{.*}}, <8 x float>*
+; CHECK: ret void
+
+; CHECK-LABEL: define void @load_stride2_masked(
+; CHECK: %inter_load = call <8 x float> @llvm.masked.load.v8f32.p0v8f32(<8 x float>* {{[^,]*}}, i32 4, <8 x i1>
+; CHECK: ret void
+
+; GATHER-LABEL: define void @load_stride2(
+; GATHER-NOT: inter_load
+; GATHER: ret void
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @load_stride2(float* noalias %A, float* noalias %B, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body.preheader, label %exit
+
+body.preheader:
+  br label %body
+
+body:
+  %i = phi i64 [ 0, %body.preheader ], [ %i.next, %body ]
+  %rec = mul nsw i64 %i, 2
+  %pX = getelementptr inbounds float, float* %A, i64 %rec
+  %x = load float, float* %pX, align 4
+  %rec.y = add nsw i64 %rec, 1
+  %pY = getelementptr inbounds float, float* %A, i64 %rec.y
+  %y = load float, float* %pY, align 4
+  %sum = fadd float %x, %y
+  %pB = getelementptr inbounds float, float* %B, i64 %i
+  store float %sum, float* %pB, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !2
+
+exit:
+  ret void
+}
+
+define void @load_stride3(float* noalias %A, float* noalias %B, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body.preheader, label %exit
+
+body.preheader:
+  br label %body
+
+body:
+  %i = phi i64 [ 0, %body.preheader ], [ %i.next, %body ]
+  %rec = mul nsw i64 %i, 3
+  %pX = getelementptr inbounds float, float* %A, i64 %rec
+  %x = load float, float* %pX, align 4
+  %rec.y = add nsw i64 %rec, 1
+  %pY = getelementptr inbounds float, float* %A, i64 %rec.y
+  %y = load float, float* %pY, align 4
+  %sum = fadd float %x, %y
+  %pB = getelementptr inbounds float, float* %B, i64 %i
+  store float %sum, float* %pB, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !3
+
+exit:
+  ret void
+}
+
+define void @load_stride4(float* noalias %A, float* noalias %B, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body.preheader, label %exit
+
+body.preheader:
+  br label %body
+
+body:
+  %i = phi i64 [ 0, %body.preheader ], [ %i.next, %body ]
+  %rec = mul nsw i64 %i, 4
+  %pX = getelementptr inbounds float, float* %A, i64 %rec
+  %x = load float, float* %pX, align 4
+  %rec.y = add nsw i64 %rec, 1
+  %pY = getelementptr inbounds float, float* %A, i64 %rec.y
+  %y = load float, float* %pY, align 4
+  %sum = fadd float %x, %y
+  %pB = getelementptr inbounds float, float* %B, i64 %i
+  store float %sum, float* %pB, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !4
+
+exit:
+  ret void
+}
+
+define void @load_stride8(float* noalias %A, float* noalias %B, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body.preheader, label %exit
+
+body.preheader:
+  br label %body
+
+body:
+  %i = phi i64 [ 0, %body.preheader ], [ %i.next, %body ]
+  %rec = mul nsw i64 %i, 8
+  %pX = getelementptr inbounds float, float* %A, i64 %rec
+  %x = load float, float* %pX, align 4
+  %rec.y = add nsw i64 %rec, 1
+  %pY = getelementptr inbounds float, float* %A, i64 %rec.y
+  %y = load float, float* %pY, align 4
+  %sum = fadd float %x, %y
+  %pB = getelementptr inbounds float, float* %B, i64 %i
+  store float %sum, float* %pB, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !8
+
+exit:
+  ret void
+}
+
+define void @store_stride2(float* noalias %A, float* noalias %B, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body.preheader, label %exit
+
+body.preheader:
+  br label %body
+
+body:
+  %i = phi i64 [ 0, %body.preheader ], [ %i.next, %body ]
+  %pB = getelementptr inbounds float, float* %B, i64 %i
+  %b = load float, float* %pB, align 4
+  %neg = fneg float %b
+  %rec = mul nsw i64 %i, 2
+  %pX = getelementptr inbounds float, float* %A, i64 %rec
+  store float %b, float* %pX, align 4
+  %rec.y = add nsw i64 %rec, 1
+  %pY = getelementptr inbounds float, float* %A, i64 %rec.y
+  store float %neg, float* %pY, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !10
+
+exit:
+  ret void
+}
+
+define void @load_stride2_masked(float* noalias %A, float* noalias %B, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body.preheader, label %exit
+
+body.preheader:
+  br label %body
+
+body:
+  %i = phi i64 [ 0, %body.preheader ], [ %i.next, %latch ]
+  %pB = getelementptr inbounds float, float* %B, i64 %i
+  %b = load float, float* %pB, align 4
+  %pos = fcmp ogt float %b, 0.000000e+00
+  br i1 %pos, label %then, label %latch
+
+then:
+  %rec = mul nsw i64 %i, 2
+  %pX = getelementptr inbounds float, float* %A, i64 %rec
+  %x = load float, float* %pX, align 4
+  %rec.y = add nsw i64 %rec, 1
+  %pY = getelementptr inbounds float, float* %A, i64 %rec.y
+  %y = load float, float* %pY, align 4
+  %sum = fadd float %x, %y
+  store float %sum, float* %pB, align 4
+  br label %latch
+
+latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !11
+
+exit:
+  ret void
+}
+
+attributes #0 = { nounwind "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+
+!0 = !{!"llvm.loop.vectorize.width", i32 4}
+!1 = !{!"llvm.loop.vectorize.enable", i1 true}
+!2 = distinct !{!2, !0, !1}
+!3 = distinct !{!3, !0, !1}
+!4 = distinct !{!4, !0, !1}
+!8 = distinct !{!8, !0, !1}
+!10 = distinct !{!10, !0, !1}
+!11 = distinct !{!11, !0, !1}
@@ -0,0 +1,46 @@
+; RUN: opt %s -passes='function(rv-loopvec)' -S -o /dev/stdout | FileCheck %s
+; RUN: env RV_LOOPVEC_TARGETS=advsimd opt %s -passes='function(rv-loopvec)' -S -o /dev/stdout | FileCheck %s --check-prefix=OFF
+
+; x86 targets are in the default RV_LOOPVEC_TARGETS list and get vectorized
+; unless the list excludes them.
+
+; CHECK-LABEL: define void @scale_x86(
+; CHECK: for.body{{.*}}.rv:
+; CHECK: fmul <4 x float>
+
+; OFF-LABEL: define void @scale_x86(
+; OFF-NOT: .rv:
+; OFF-NOT: <4 x float>
+; OFF: ret void
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @scale_x86(float* noalias %A, float* noalias %B, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %for.body.preheader, label %exit
+
+for.body.preheader:
+  br label %for.body
+
+for.body:
+  %i = phi i64 [ 0, %for.body.preheader ], [ %i.next, %for.body ]
+  %pB = getelementptr inbounds float, float* %B, i64 %i
+  %b = load float, float* %pB, align 4
+  %c = fmul float %b, 2.000000e+00
+  %pA = getelementptr inbounds float, float* %A, i64 %i
+  store float %c, float* %pA, align 4
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %for.body, !llvm.loop !0
+
+exit:
+  ret void
+}
+
+attributes #0 = { nounwind "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+
+!0 = distinct !{!0, !1, !2}
+!1 = !{!"llvm.loop.vectorize.width", i32 4}
+!2 = !{!"llvm.loop.vectorize.enable", i1 true}
@@ -0,0 +1,72 @@
+; RUN: env RV_MASK_PROFILE=1 opt %s -O3 -S -o - | FileCheck %s --check-prefix=PROF
+; RUN: rm -f %t.json
+; RUN: env RV_MASK_PROFILE_USE=%S/Inputs/mask_profile.prof RV_REPORT_JSON=%t.json opt %s -discard-value-names -O3 -S -o /dev/null
+; RUN: FileCheck %s --check-prefix=USE < %t.json
+
+; Mask profile round trip. The instrumented build counts active lanes with
+; atomic adds and registers its table at the default constructor priority.
+; Profile entries are keyed by function, region id and block id, so the
+; profile (Inputs/mask_profile.prof: 100 executions, 25 with active lanes for
+; every block) applies to a compile that discards block names.
+
+; PROF: @llvm.global_ctors = {{.*}} i32 65535, void ()* @rv.maskprof.init
+; PROF: atomicrmw add i64* {{.*}}, i64 1 monotonic
+; PROF: call void @rv_mask_profile_register
+
+; USE: "allFalseProb":0.75,{{[^}]*}}"transform":"cif"
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @skip_branches(double* noalias nocapture %A, double* noalias nocapture readonly %B, i64 %k, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %head, label %exit
+
+head:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %latch ]
+  %pB = getelementptr inbounds double, double* %B, i64 %i
+  %b = load double, double* %pB, align 8
+  %pA = getelementptr inbounds double, double* %A, i64 %i
+  ; affine condition
+  %below = icmp slt i64 %i, %k
+  br i1 %below, label %affine.then, label %mid
+
+affine.then:
+  %s0 = call double @sqrt(double %b)
+  %s1 = call double @exp(double %s0)
+  %s2 = fmul double %s1, %b
+  store double %s2, double* %pA, align 8
+  br label %mid
+
+mid:
+  ; data-dependent condition
+  %pos = fcmp ogt double %b, 0.000000e+00
+  br i1 %pos, label %data.then, label %latch
+
+data.then:
+  %t0 = call double @log(double %b)
+  %t1 = call double @exp(double %t0)
+  %t2 = fadd double %t1, %b
+  store double %t2, double* %pA, align 8
+  br label %latch
+
+latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %head, !llvm.loop !0
+
+exit:
+  ret void
+}
+
+declare double @sqrt(double) #1
+declare double @exp(double) #1
+declare double @log(double) #1
+
+attributes #0 = { nounwind "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+attributes #1 = { nounwind readnone }
+
+!0 = distinct !{!0, !1, !2}
+!1 = !{!"llvm.loop.vectorize.width", i32 4}
+!2 = !{!"llvm.loop.vectorize.enable", i1 true}
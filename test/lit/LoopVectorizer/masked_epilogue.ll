@@ -0,0 +1,39 @@
+; RUN: env RV_EPILOGUE=masked opt %s -O3 -S -o /dev/stdout | FileCheck %s
+
+; The masked epilogue runs the remaining iterations under an active vector
+; length. Lowerings that are not VP intrinsics (masked store, the last-lane
+; extraction of a varying-to-uniform store) must see the AVL folded into the
+; predicate.
+
+; CHECK: avl.avl_pred
+; CHECK-DAG: call void @llvm.masked.store
+; CHECK-DAG: xt.lastlane
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @copy_last(double* nocapture %A, double* nocapture readonly %B, double* nocapture %Last, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body, label %exit
+
+body:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %body ]
+  %pB = getelementptr inbounds double, double* %B, i64 %i
+  %b = load double, double* %pB, align 8
+  %pA = getelementptr inbounds double, double* %A, i64 %i
+  store double %b, double* %pA, align 8
+  store double %b, double* %Last, align 8
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !0
+
+exit:
+  ret void
+}
+
+attributes #0 = { nounwind "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+
+!0 = distinct !{!0, !1, !2}
+!1 = !{!"llvm.loop.vectorize.width", i32 4}
+!2 = !{!"llvm.loop.vectorize.enable", i1 true}
@@ -0,0 +1,55 @@
+; RUN: opt %s -passes='function(rv-loopvec)' -S -o /dev/stdout | FileCheck %s
+; RUN: env RV_DISABLE_MASKEDMATH=1 opt %s -passes='function(rv-loopvec)' -S -o /dev/stdout | FileCheck %s --check-prefix=UNMASKED
+
+; expf under a divergent branch calls the masked wrapper of the SLEEF function
+; (inactive lanes do not compute), unless masked math is disabled.
+
+; CHECK: call {{.*}}<8 x float> @{{[^ ]*}}expf{{[^ ]*}}_masked(<8 x float> {{[^,]*}}, <8 x i1> {{[^)]*}})
+; CHECK: define linkonce_odr {{.*}}<8 x float> @{{[^ ]*}}expf{{[^ ]*}}_masked(<8 x float> {{[^,]*}}, <8 x i1> %mask)
+; CHECK: none.active
+
+; UNMASKED-NOT: _masked(
+; UNMASKED: call {{.*}}<8 x float> @{{[^ ]*}}expf{{[^ ]*}}(<8 x float>
+; UNMASKED-NOT: _masked(
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+declare float @expf(float) #1
+
+define void @exp_positive(float* noalias %A, float* noalias %B, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body.preheader, label %exit
+
+body.preheader:
+  br label %body
+
+body:
+  %i = phi i64 [ 0, %body.preheader ], [ %i.next, %latch ]
+  %pA = getelementptr inbounds float, float* %A, i64 %i
+  %a = load float, float* %pA, align 4
+  %pos = fcmp ogt float %a, 0.000000e+00
+  br i1 %pos, label %then, label %latch
+
+then:
+  %e = call float @expf(float %a) #1
+  %pB = getelementptr inbounds float, float* %B, i64 %i
+  store float %e, float* %pB, align 4
+  br label %latch
+
+latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !0
+
+exit:
+  ret void
+}
+
+attributes #0 = { nounwind "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+attributes #1 = { nounwind readnone }
+
+!0 = distinct !{!0, !1, !2}
+!1 = !{!"llvm.loop.vectorize.width", i32 8}
+!2 = !{!"llvm.loop.vectorize.enable", i1 true}
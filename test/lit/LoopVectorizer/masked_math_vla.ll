@@ -0,0 +1,48 @@
+; RUN: opt %s -passes='function(rv-loopvec)' -S -o /dev/stdout | FileCheck %s
+
+; VLA math (SLEEF vectorized on the fly) under a divergent branch calls a
+; predicated variant that takes the mask as its trailing argument.
+
+; CHECK: call {{.*}} @{{[^ ]*}}expf{{[^ ]*}}_v256_M1_{{[^(]*}}(<256 x float> {{[^,]*}}, <256 x i1> {{[^)]*}})
+
+target datalayout = "e-m:e-i64:64-n32:64-S128-v64:64:64-v128:64:64-v256:64:64-v512:64:64-v1024:64:64-v2048:64:64-v4096:64:64-v8192:64:64-v16384:64:64"
+target triple = "ve-unknown-linux-gnu"
+
+declare float @expf(float) #1
+
+define void @exp_positive(float* noalias %A, float* noalias %B, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body.preheader, label %exit
+
+body.preheader:
+  br label %body
+
+body:
+  %i = phi i64 [ 0, %body.preheader ], [ %i.next, %latch ]
+  %pA = getelementptr inbounds float, float* %A, i64 %i
+  %a = load float, float* %pA, align 4
+  %pos = fcmp ogt float %a, 0.000000e+00
+  br i1 %pos, label %then, label %latch
+
+then:
+  %e = call float @expf(float %a) #1
+  %pB = getelementptr inbounds float, float* %B, i64 %i
+  store float %e, float* %pB, align 4
+  br label %latch
+
+latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !0
+
+exit:
+  ret void
+}
+
+attributes #0 = { nounwind }
+attributes #1 = { nounwind readnone }
+
+!0 = distinct !{!0, !1, !2}
+!1 = !{!"llvm.loop.vectorize.width", i32 256}
+!2 = !{!"llvm.loop.vectorize.enable", i1 true}
@@ -0,0 +1,71 @@
+; RUN: opt %s -passes='require<rv-module-context>,function(rv-loopvec)' -S -o /dev/stdout | FileCheck %s
+; RUN: opt %s -passes='require<rv-module-context>,function(rv-loopvec),invalidate<rv-module-context>,function(rv-loopvec)' -S -o /dev/stdout | FileCheck %s
+
+; Both functions are vectorized with the ModuleContext that the pipeline
+; requires up front (the loop vectorizer reads it through the outer analysis
+; proxy, so it must not be invalidated by the function pass adaptor).
+
+; CHECK-LABEL: define void @add_a(
+; CHECK: for.body{{.*}}.rv:
+; CHECK-LABEL: define void @add_b(
+; CHECK: for.body{{.*}}.rv:
+
+target datalayout = "e-m:e-i64:64-n32:64-S128-v64:64:64-v128:64:64-v256:64:64-v512:64:64-v1024:64:64-v2048:64:64-v4096:64:64-v8192:64:64-v16384:64:64"
+target triple = "ve-unknown-linux-gnu"
+
+define void @add_a(double* noalias %A, double* noalias %B, double* noalias %C, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %for.body.preheader, label %exit
+
+for.body.preheader:
+  br label %for.body
+
+for.body:
+  %i = phi i64 [ 0, %for.body.preheader ], [ %i.next, %for.body ]
+  %pA = getelementptr inbounds double, double* %A, i64 %i
+  %a = load double, double* %pA, align 8
+  %pB = getelementptr inbounds double, double* %B, i64 %i
+  %b = load double, double* %pB, align 8
+  %sum = fadd double %a, %b
+  %pC = getelementptr inbounds double, double* %C, i64 %i
+  store double %sum, double* %pC, align 8
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %for.body, !llvm.loop !0
+
+exit:
+  ret void
+}
+
+define void @add_b(double* noalias %A, double* noalias %B, double* noalias %C, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %for.body.preheader, label %exit
+
+for.body.preheader:
+  br label %for.body
+
+for.body:
+  %i = phi i64 [ 0, %for.body.preheader ], [ %i.next, %for.body ]
+  %pA = getelementptr inbounds double, double* %A, i64 %i
+  %a = load double, double* %pA, align 8
+  %pB = getelementptr inbounds double, double* %B, i64 %i
+  %b = load double, double* %pB, align 8
+  %sum = fmul double %a, %b
+  %pC = getelementptr inbounds double, double* %C, i64 %i
+  store double %sum, double* %pC, align 8
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %for.body, !llvm.loop !3
+
+exit:
+  ret void
+}
+
+attributes #0 = { nounwind }
+
+!0 = distinct !{!0, !1, !2}
+!1 = !{!"llvm.loop.vectorize.width", i32 256}
+!2 = !{!"llvm.loop.vectorize.enable", i1 true}
+!3 = distinct !{!3, !1, !2}
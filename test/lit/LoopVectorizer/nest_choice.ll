@@ -0,0 +1,99 @@
+; RUN: rm -f %t.json
+; RUN: env RV_REPORT_JSON=%t.json opt %s -passes='function(rv-loopvec)' -S -o /dev/null
+; RUN: FileCheck %s < %t.json
+
+; In every loop nest the cost model picks the level that saves the most time.
+; @inner_wins: the inner loop accesses rows contiguously, the outer loop would
+; access them with a stride of %n (gathers/scatters).
+; @outer_wins: the inner loop walks a column (stride %n), the outer loop
+; accesses consecutive elements of each row.
+
+; CHECK-DAG: "function":"inner_wins",{{.*}}"region":"outer",{{.*}}"rejection":"nested loop preferred"
+; CHECK-DAG: "function":"outer_wins",{{.*}}"region":"col",{{.*}}"rejection":"enclosing loop preferred"
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; for i: for j: A[i * n + j] += B[j]
+define void @inner_wins(float* noalias %A, float* noalias %B, i64 %m, i64 %n) #0 {
+entry:
+  %cmp.m = icmp sgt i64 %m, 0
+  %cmp.n = icmp sgt i64 %n, 0
+  %cmp = and i1 %cmp.m, %cmp.n
+  br i1 %cmp, label %outer.preheader, label %exit
+
+outer.preheader:
+  br label %outer
+
+outer:
+  %i = phi i64 [ 0, %outer.preheader ], [ %i.next, %outer.latch ]
+  %row = mul nsw i64 %i, %n
+  br label %inner
+
+inner:
+  %j = phi i64 [ 0, %outer ], [ %j.next, %inner ]
+  %pB = getelementptr inbounds float, float* %B, i64 %j
+  %b = load float, float* %pB, align 4
+  %idx = add nsw i64 %row, %j
+  %pA = getelementptr inbounds float, float* %A, i64 %idx
+  %a = load float, float* %pA, align 4
+  %sum = fadd float %a, %b
+  store float %sum, float* %pA, align 4
+  %j.next = add nuw nsw i64 %j, 1
+  %inner.done = icmp eq i64 %j.next, %n
+  br i1 %inner.done, label %outer.latch, label %inner, !llvm.loop !0
+
+outer.latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %outer.done = icmp eq i64 %i.next, %m
+  br i1 %outer.done, label %exit, label %outer, !llvm.loop !2
+
+exit:
+  ret void
+}
+
+; for i: for j: A[j * n + i] += B[j * n + i]
+define void @outer_wins(float* noalias %A, float* noalias %B, i64 %m, i64 %n) #0 {
+entry:
+  %cmp.m = icmp sgt i64 %m, 0
+  %cmp.n = icmp sgt i64 %n, 0
+  %cmp = and i1 %cmp.m, %cmp.n
+  br i1 %cmp, label %row.preheader, label %exit
+
+row.preheader:
+  br label %row
+
+row:
+  %i = phi i64 [ 0, %row.preheader ], [ %i.next, %row.latch ]
+  br label %col
+
+col:
+  %j = phi i64 [ 0, %row ], [ %j.next, %col ]
+  %colOff = mul nsw i64 %j, %n
+  %idx = add nsw i64 %colOff, %i
+  %pB = getelementptr inbounds float, float* %B, i64 %idx
+  %b = load float, float* %pB, align 4
+  %pA = getelementptr inbounds float, float* %A, i64 %idx
+  %a = load float, float* %pA, align 4
+  %sum = fadd float %a, %b
+  store float %sum, float* %pA, align 4
+  %j.next = add nuw nsw i64 %j, 1
+  %col.done = icmp eq i64 %j.next, %m
+  br i1 %col.done, label %row.latch, label %col, !llvm.loop !3
+
+row.latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %row.done = icmp eq i64 %i.next, %n
+  br i1 %row.done, label %exit, label %row, !llvm.loop !4
+
+exit:
+  ret void
+}
+
+attributes #0 = { nounwind "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+
+!0 = distinct !{!0, !1}
+!1 = !{!"llvm.loop.vectorize.enable", i1 true}
+!2 = distinct !{!2, !1}
+!3 = distinct !{!3, !1}
+!4 = distinct !{!4, !1}
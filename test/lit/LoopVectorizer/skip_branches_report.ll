@@ -0,0 +1,70 @@
+; RUN: rm -f %t.json %t.off.json
+; RUN: env RV_REPORT_JSON=%t.json opt %s -O3 -S -o /dev/null
+; RUN: FileCheck %s < %t.json
+; RUN: env RV_DISABLE_CIF=1 RV_DISABLE_BOSCC=1 RV_REPORT_JSON=%t.off.json opt %s -O3 -S -o /dev/null
+; RUN: FileCheck %s --check-prefix=OFF < %t.off.json
+
+; CIF and BOSCC are on by default and every divergent branch they inspect goes
+; through the cost model and gets a report entry, including affine conditions.
+
+; CHECK-DAG: "block":"head{{[^"]*}}",{{[^}]*}}"transform":"cif"
+; CHECK-DAG: "block":"mid{{[^"]*}}",{{[^}]*}}"transform":"cif"
+; CHECK-DAG: "block":"mid{{[^"]*}}",{{[^}]*}}"transform":"boscc"
+
+; OFF-NOT: skipBranches
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @skip_branches(double* noalias nocapture %A, double* noalias nocapture readonly %B, i64 %k, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %head, label %exit
+
+head:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %latch ]
+  %pB = getelementptr inbounds double, double* %B, i64 %i
+  %b = load double, double* %pB, align 8
+  %pA = getelementptr inbounds double, double* %A, i64 %i
+  ; affine condition
+  %below = icmp slt i64 %i, %k
+  br i1 %below, label %affine.then, label %mid
+
+affine.then:
+  %s0 = call double @sqrt(double %b)
+  %s1 = call double @exp(double %s0)
+  %s2 = fmul double %s1, %b
+  store double %s2, double* %pA, align 8
+  br label %mid
+
+mid:
+  ; data-dependent condition
+  %pos = fcmp ogt double %b, 0.000000e+00
+  br i1 %pos, label %data.then, label %latch
+
+data.then:
+  %t0 = call double @log(double %b)
+  %t1 = call double @exp(double %t0)
+  %t2 = fadd double %t1, %b
+  store double %t2, double* %pA, align 8
+  br label %latch
+
+latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %head, !llvm.loop !0
+
+exit:
+  ret void
+}
+
+declare double @sqrt(double) #1
+declare double @exp(double) #1
+declare double @log(double) #1
+
+attributes #0 = { nounwind "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+attributes #1 = { nounwind readnone }
+
+!0 = distinct !{!0, !1, !2}
+!1 = !{!"llvm.loop.vectorize.width", i32 4}
+!2 = !{!"llvm.loop.vectorize.enable", i1 true}
@@ -0,0 +1,66 @@
+; RUN: opt %s -O3 -verify-dom-info -verify-loop-info -S -o /dev/stdout | FileCheck %s
+
+; Two vectorized loops in one function. DT, PDT and LoopInfo are carried over
+; from the first loop to the second and are verified after every loop. The
+; second loop has a divergent branch nested in another one (linearization).
+
+; CHECK: first.body{{.*}}.rv:
+; CHECK: second.body{{.*}}.rv:
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @two_loops(double* noalias nocapture %A, double* noalias nocapture readonly %B, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %first.body, label %exit
+
+first.body:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %first.body ]
+  %pB = getelementptr inbounds double, double* %B, i64 %i
+  %b = load double, double* %pB, align 8
+  %pA = getelementptr inbounds double, double* %A, i64 %i
+  store double %b, double* %pA, align 8
+  %i.next = add nuw nsw i64 %i, 1
+  %first.done = icmp eq i64 %i.next, %n
+  br i1 %first.done, label %between, label %first.body, !llvm.loop !0
+
+between:
+  br label %second.body
+
+second.body:
+  %j = phi i64 [ 0, %between ], [ %j.next, %second.latch ]
+  %pB2 = getelementptr inbounds double, double* %B, i64 %j
+  %b2 = load double, double* %pB2, align 8
+  %pos = fcmp ogt double %b2, 0.000000e+00
+  br i1 %pos, label %second.outer, label %second.latch
+
+second.outer:
+  %big = fcmp ogt double %b2, 1.000000e+00
+  br i1 %big, label %second.inner, label %second.join
+
+second.inner:
+  %sq = fmul double %b2, %b2
+  br label %second.join
+
+second.join:
+  %v = phi double [ %sq, %second.inner ], [ %b2, %second.outer ]
+  %pA2 = getelementptr inbounds double, double* %A, i64 %j
+  store double %v, double* %pA2, align 8
+  br label %second.latch
+
+second.latch:
+  %j.next = add nuw nsw i64 %j, 1
+  %second.done = icmp eq i64 %j.next, %n
+  br i1 %second.done, label %exit, label %second.body, !llvm.loop !3
+
+exit:
+  ret void
+}
+
+attributes #0 = { nounwind "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+
+!0 = distinct !{!0, !1, !2}
+!1 = !{!"llvm.loop.vectorize.width", i32 4}
+!2 = !{!"llvm.loop.vectorize.enable", i1 true}
+!3 = distinct !{!3, !1, !2}
@@ -0,0 +1,99 @@
+; RUN: opt %s -passes='function(rv-loopvec)' -S -o /dev/stdout | FileCheck %s
+; RUN: env RV_DISABLE_GATHERSCATTER=1 opt %s -passes='function(rv-loopvec)' -S -o /dev/stdout | FileCheck %s --check-prefix=CASCADE
+
+; Masked gathers on a target without native gathers (SSE) are lowered by cost.
+; The branch-free blend redirects inactive lanes to a dummy stack slot. Pointers
+; outside of the alloca address space cannot blend and use the out-of-line
+; cascade helpers when the gather intrinsics are disabled.
+
+; CHECK-LABEL: define void @blend(
+; CHECK: %blend_dummy = alloca float
+; CHECK-NOT: llvm.masked.gather
+; CHECK: %blend_gather{{.*}} = insertelement <4 x float>
+; CHECK: ret void
+
+; CASCADE-LABEL: define void @blend(
+; CASCADE: %blend_dummy = alloca float
+; CASCADE-NOT: rv_cascade_load_
+; CASCADE: ret void
+
+; CASCADE-LABEL: define void @cascade(
+; CASCADE-NOT: blend_dummy
+; CASCADE: call {{.*}}@rv_cascade_load_
+; CASCADE: ret void
+
+; CASCADE: define internal {{.*}}@rv_cascade_load_
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @blend(float* noalias %A, i32* noalias %Idx, float* noalias %B, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body.preheader, label %exit
+
+body.preheader:
+  br label %body
+
+body:
+  %i = phi i64 [ 0, %body.preheader ], [ %i.next, %latch ]
+  %pIdx = getelementptr inbounds i32, i32* %Idx, i64 %i
+  %idx = load i32, i32* %pIdx, align 4
+  %pos = icmp sgt i32 %idx, 0
+  br i1 %pos, label %then, label %latch
+
+then:
+  %idx.ext = sext i32 %idx to i64
+  %pA = getelementptr inbounds float, float* %A, i64 %idx.ext
+  %a = load float, float* %pA, align 4
+  %pB = getelementptr inbounds float, float* %B, i64 %i
+  store float %a, float* %pB, align 4
+  br label %latch
+
+latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !0
+
+exit:
+  ret void
+}
+
+define void @cascade(float addrspace(1)* noalias %A, i32* noalias %Idx, float* noalias %B, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %body.preheader, label %exit
+
+body.preheader:
+  br label %body
+
+body:
+  %i = phi i64 [ 0, %body.preheader ], [ %i.next, %latch ]
+  %pIdx = getelementptr inbounds i32, i32* %Idx, i64 %i
+  %idx = load i32, i32* %pIdx, align 4
+  %pos = icmp sgt i32 %idx, 0
+  br i1 %pos, label %then, label %latch
+
+then:
+  %idx.ext = sext i32 %idx to i64
+  %pA = getelementptr inbounds float, float addrspace(1)* %A, i64 %idx.ext
+  %a = load float, float addrspace(1)* %pA, align 4
+  %pB = getelementptr inbounds float, float* %B, i64 %i
+  store float %a, float* %pB, align 4
+  br label %latch
+
+latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %body, !llvm.loop !3
+
+exit:
+  ret void
+}
+
+attributes #0 = { nounwind "target-cpu"="x86-64" "target-features"="+sse,+sse2" }
+
+!0 = distinct !{!0, !1, !2}
+!1 = !{!"llvm.loop.vectorize.width", i32 4}
+!2 = !{!"llvm.loop.vectorize.enable", i1 true}
+!3 = distinct !{!3, !1, !2}
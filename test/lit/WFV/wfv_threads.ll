@@ -0,0 +1,46 @@
+; RUN: env RV_WFV_THREADS=2 opt %s -O3 -S -o - | FileCheck %s
+; RUN: env RV_WFV_THREADS=2 RV_REPORT=1 opt %s -O3 -S -o /dev/null | FileCheck %s --check-prefix=REPORT
+
+; Two independent SIMD variants are generated in two staging threads and
+; linked back in job order.
+
+; CHECK-DAG: define {{.*}}<8 x float> @_ZGVdN8v_scale(<8 x float>
+; CHECK-DAG: define {{.*}}<8 x float> @_ZGVdN8vv_blend(<8 x float> {{.*}}, <8 x float>
+; CHECK-DAG: define internal float @helper(
+; CHECK-NOT: define {{.*}}@helper.{{[0-9]+}}(
+
+; REPORT-NOT: staging failed
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define internal float @helper(float %x) #1 {
+entry:
+  %m = fmul float %x, 2.000000e+00
+  ret float %m
+}
+
+define float @scale(float %x) #0 {
+entry:
+  %h = call float @helper(float %x)
+  %r = fadd float %h, 1.000000e+00
+  ret float %r
+}
+
+define float @blend(float %a, float %b) #2 {
+entry:
+  %c = fcmp olt float %a, %b
+  br i1 %c, label %less, label %exit
+
+less:
+  %h = call float @helper(float %b)
+  br label %exit
+
+exit:
+  %r = phi float [ %h, %less ], [ %a, %entry ]
+  ret float %r
+}
+
+attributes #0 = { nounwind "_ZGVdN8v_scale" "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+attributes #1 = { noinline nounwind "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
+attributes #2 = { nounwind "_ZGVdN8vv_blend" "target-cpu"="haswell" "target-features"="+avx,+avx2,+fma,+sse,+sse2,+sse3,+sse4.1,+sse4.2,+ssse3" }
@@ -33,8 +33,8 @@ class TestCase:
       return self.baseName
     elif filetype == 'primary':
       return primaryName
-    elif filetype == 'csv':
-      return  primaryName.split("-")[0] + ".csv"
+    elif filetype == 'report':
+      return "logs/" + primaryName + ".report.json"
     elif filetype == 'scalarLL':
       return "build/" + primaryName + ".ll"
     elif filetype == 'wfvLL':
@@ -368,7 +368,11 @@ for pattern in patterns:
     test = TestCase(testCase)
 
     if profileMode:
-      os.environ["NAT_STAT_DUMP"] = test.getFilename('csv')
+      # one JSON vectorization record per loop/SIMD variant (appended by RV)
+      reportFile = test.getFilename('report')
+      if os.path.exists(reportFile):
+        os.remove(reportFile)
+      os.environ["RV_REPORT_JSON"] = reportFile
 
     print("{:60}".format("- {}".format(test.baseName)), end="")
 